@@ -57,6 +57,18 @@ enum {
 	 * IPC_M_DATA_READ requests.
 	 */
 	DATA_XFER_LIMIT = 64 * 1024,
+
+	/**
+	 * Minimum size of IPC_M_DATA_WRITE and IPC_M_DATA_READ transfers
+	 * which are done by loaning pages (see IPC_XF_LOAN).
+	 */
+	DATA_XFER_LOAN_MIN = 64 * 1024,
+
+	/**
+	 * Maximum number of calls made by SYS_IPC_CALL_ASYNC_BATCH or
+	 * received by SYS_IPC_WAIT_BATCH.
+	 */
+	IPC_BATCH_MAX = 16,
 };
 
 /* Flags for calls */
@@ -98,6 +110,18 @@ enum {
 
 	/** Restrict the transfer size if necessary. */
 	IPC_XF_RESTRICT = 1 << 0,
+
+	/**
+	 * Loan the pages of the source buffer to the destination buffer
+	 * copy-on-write instead of copying the data. This is only done if
+	 * the source buffer is page-aligned, has at least DATA_XFER_LOAN_MIN
+	 * bytes and lies in private anonymous memory, and only whole pages
+	 * are mapped into a page-aligned destination buffer, the rest is
+	 * copied. The transfer size is not limited then. Both buffers keep
+	 * their contents and whichever is written to first gets a copy of the
+	 * written page.
+	 */
+	IPC_XF_LOAN = 1 << 1,
 };
 
 /** User-defined IPC methods */
@@ -122,6 +146,18 @@ typedef struct {
 	cap_call_handle_t cap_handle;
 } ipc_data_t;
 
+/** Call made by SYS_IPC_CALL_ASYNC_BATCH */
+typedef struct {
+	/** Phone capability for the call */
+	cap_phone_handle_t phone;
+	/** User-defined label */
+	sysarg_t label;
+	/** Interface, method and arguments */
+	sysarg_t args[IPC_CALL_LEN];
+	/** Error code of the call, set by the kernel */
+	errno_t rc;
+} ipc_batch_call_t;
+
 /* Functions for manipulating calling data */
 
 static inline void ipc_set_retval(ipc_data_t *data, errno_t retval)
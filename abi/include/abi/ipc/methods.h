@@ -162,14 +162,14 @@ enum {
 	 * Sender:
 	 *  - uspace: arg1 .. sender's destination buffer address
 	 *            arg2 .. sender's destination buffer size
-	 *            arg3 .. flags (IPC_XF_RESTRICT)
+	 *            arg3 .. flags (IPC_XF_RESTRICT, IPC_XF_LOAN)
 	 *            arg4 .. <unused>
 	 *            arg5 .. <unused>
 	 *
 	 * Recipient:
 	 *  - uspace: arg1 .. recipient's source buffer address
 	 *            arg2 .. recipient's source buffer size
-	 *            arg3 .. <unused>
+	 *            arg3 .. flags (IPC_XF_LOAN)
 	 *            arg4 .. <unused>
 	 *            arg5 .. <unused>
 	 *
@@ -181,7 +181,7 @@ enum {
 	 * Sender:
 	 *  - uspace: arg1 .. sender's source buffer address
 	 *            arg2 .. sender's source buffer size
-	 *            arg3 .. flags (IPC_XF_RESTRICT)
+	 *            arg3 .. flags (IPC_XF_RESTRICT, IPC_XF_LOAN)
 	 *            arg4 .. <unused>
 	 *            arg5 .. <unused>
 	 *
@@ -107,6 +107,7 @@ typedef struct {
 	size_t threads;               /**< Number of threads */
 	uint64_t ucycles;             /**< Number of CPU cycles in user space */
 	uint64_t kcycles;             /**< Number of CPU cycles in kernel */
+	uint64_t page_faults;         /**< Number of serviced page faults */
 	stats_ipc_t ipc_info;         /**< IPC statistics */
 } stats_task_t;
 
@@ -160,6 +160,18 @@
 #define PTE_EXECUTABLE_ARCH(p) \
 	((p)->no_execute == 0)
 
+/* Level 2 entries can map 2 MiB pages directly. */
+#define LARGE_PAGE_WIDTH  21
+#define LARGE_PAGE_SIZE   (1 << LARGE_PAGE_WIDTH)
+
+/* Large page accessors of level 2 entries. */
+#define GET_PTL3_LARGE_ARCH(ptl2, i) \
+	(((pte_t *) (ptl2))[(i)].page_size != 0)
+#define GET_PTL3_LARGE_FLAGS_ARCH(ptl2, i) \
+	get_pt_flags((pte_t *) (ptl2), (size_t) (i))
+#define SET_PTL3_LARGE_FLAGS_ARCH(ptl2, i, x) \
+	set_pt_large_flags((pte_t *) (ptl2), (size_t) (i), (x))
+
 #ifndef __ASSEMBLER__
 
 #include <arch/interrupt.h>
@@ -197,7 +209,7 @@ typedef struct {
 	unsigned int page_cache_disable : 1;
 	unsigned int accessed : 1;
 	unsigned int dirty : 1;
-	unsigned int unused : 1;
+	unsigned int page_size : 1;  /**< Maps a large page, level 2 only. */
 	unsigned int global : 1;
 	unsigned int soft_valid : 1;  /**< Valid content even if present bit is cleared. */
 	unsigned int avl : 2;
@@ -244,6 +256,12 @@ _NO_TRACE static inline void set_pt_flags(pte_t *pt, size_t i, int flags)
 	p->soft_valid = 1;
 }
 
+_NO_TRACE static inline void set_pt_large_flags(pte_t *pt, size_t i, int flags)
+{
+	set_pt_flags(pt, i, flags);
+	pt[i].page_size = 1;
+}
+
 _NO_TRACE static inline void set_pt_present(pte_t *pt, size_t i)
 {
 	pte_t *p = &pt[i];
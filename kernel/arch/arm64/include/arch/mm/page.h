@@ -158,6 +158,18 @@ extern uintptr_t physmem_base;
 #define PTE_EXECUTABLE_ARCH(pte) \
 	get_pt_executable((pte_t *) (pte))
 
+/* Level 2 block descriptors map 2 MiB pages. */
+#define LARGE_PAGE_WIDTH  21
+#define LARGE_PAGE_SIZE   (1 << LARGE_PAGE_WIDTH)
+
+/* Large page accessors of level 2 entries. */
+#define GET_PTL3_LARGE_ARCH(ptl2, i) \
+	(((pte_t *) (ptl2))[(i)].type == PTE_L012_TYPE_BLOCK)
+#define GET_PTL3_LARGE_FLAGS_ARCH(ptl2, i) \
+	get_pt_level3_flags((pte_t *) (ptl2), (size_t) (i))
+#define SET_PTL3_LARGE_FLAGS_ARCH(ptl2, i, x) \
+	set_pt_level2_block_flags((pte_t *) (ptl2), (size_t) (i), (x))
+
 /* Level 3 access permissions. */
 
 /** Data access permission. User mode: no access, privileged mode: read/write.
@@ -209,8 +221,8 @@ extern uintptr_t physmem_base;
 #define PTE_L3_TYPE_PAGE  1
 
 /** HelenOS descriptor type. Table for level 0, 1, 2 page translation tables,
- * page for level 3 tables. Block descriptors are not used by HelenOS during
- * normal processing.
+ * page for level 3 tables. Block descriptors are only used by HelenOS in level 2
+ * tables to map large pages.
  */
 #define PTE_L0123_TYPE_HELENOS  1
 
@@ -244,8 +256,8 @@ extern uintptr_t physmem_base;
 /** Page Table Entry.
  *
  * HelenOS model:
- * * Level 0, 1, 2 translation tables hold next-level table descriptors. Block
- *   descriptors are not used during normal processing.
+ * * Level 0, 1, 2 translation tables hold next-level table descriptors. Level 2
+ *   tables may also hold block descriptors of 2MB large pages.
  * * Level 3 tables store 4kB page descriptors.
  */
 typedef struct {
@@ -377,6 +389,22 @@ _NO_TRACE static inline void set_pt_level3_flags(pte_t *pt, size_t i,
 	p->not_global = (flags & PAGE_GLOBAL) == 0;
 }
 
+/** Sets flags of level 2 block descriptor.
+ *
+ * The block descriptor shares the attribute layout with the level 3 page
+ * descriptor.
+ *
+ * @param pt    Level 2 page table.
+ * @param i     Index of the entry to be changed.
+ * @param flags New flags.
+ */
+_NO_TRACE static inline void set_pt_level2_block_flags(pte_t *pt, size_t i,
+    int flags)
+{
+	set_pt_level3_flags(pt, i, flags);
+	pt[i].type = PTE_L012_TYPE_BLOCK;
+}
+
 /** Sets the present flag of page table entry.
  *
  * @param pt Level 0, 1, 2, 3 page table.
@@ -41,6 +41,8 @@
 
 static irq_t timer_irq;
 static uint64_t timer_increment;
+/** Counter value of the next regular timer interrupt. */
+static uint64_t timer_next;
 
 /** Disable interrupts.
  *
@@ -116,7 +118,8 @@ static void timer_start(void)
 	timer_increment = cntfrq / HZ;
 
 	/* Program the timer. */
-	CNTV_CVAL_EL0_write(cntvct + timer_increment);
+	timer_next = cntvct + timer_increment;
+	CNTV_CVAL_EL0_write(timer_next);
 	CNTV_CTL_EL0_write(
 	    (cntv_ctl & ~CNTV_CTL_IMASK_FLAG) | CNTV_CTL_ENABLE_FLAG);
 }
@@ -131,14 +134,18 @@ static irq_ownership_t timer_claim(irq_t *irq)
 static void timer_irq_handler(irq_t *irq)
 {
 	uint64_t cntvct = CNTVCT_EL0_read();
-	uint64_t cntv_cval = CNTV_CVAL_EL0_read();
 
-	uint64_t drift = cntvct - cntv_cval;
+	/*
+	 * Count the ticks since the last interrupt relative to when it was
+	 * regularly due, which also covers the ticks skipped while idle.
+	 */
+	uint64_t drift = cntvct - timer_next;
 	while (drift > timer_increment) {
 		drift -= timer_increment;
 		CPU->missed_clock_ticks++;
 	}
-	CNTV_CVAL_EL0_write(cntvct + timer_increment - drift);
+	timer_next = cntvct + timer_increment - drift;
+	CNTV_CVAL_EL0_write(timer_next);
 
 	/*
 	 * We are holding a lock which prevents preemption.
@@ -149,6 +156,31 @@ static void timer_irq_handler(irq_t *irq)
 	irq_spinlock_lock(&irq->lock, false);
 }
 
+/** Let the virtual timer skip the given number of ticks.
+ *
+ * @return Always true, the compare value can be moved at any time.
+ */
+static bool timer_idle_stop(uint64_t ticks)
+{
+	CNTV_CVAL_EL0_write(timer_next + (ticks - 1) * timer_increment);
+	return true;
+}
+
+/** Let the virtual timer tick regularly again.
+ *
+ * If the regular tick is already overdue, the timer fires right away as
+ * the compare condition is met.
+ */
+static void timer_idle_resume(void)
+{
+	CNTV_CVAL_EL0_write(timer_next);
+}
+
+static clock_idle_ops_t timer_idle_ops = {
+	.stop = timer_idle_stop,
+	.resume = timer_idle_resume
+};
+
 /** Initialize basic tables for exception dispatching. */
 void interrupt_init(void)
 {
@@ -166,6 +198,7 @@ void interrupt_init(void)
 	irq_register(&timer_irq);
 
 	timer_start();
+	clock_idle_ops = &timer_idle_ops;
 }
 
 /** @}
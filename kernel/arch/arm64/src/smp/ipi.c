@@ -46,6 +46,16 @@ void ipi_broadcast_arch(int ipi)
 	panic("broadcast IPI not implemented.");
 }
 
+/** Deliver IPI to one processor.
+ *
+ * @param cpu Destination processor.
+ * @param ipi IPI number.
+ */
+void ipi_unicast_arch(struct cpu *cpu, int ipi)
+{
+	panic("unicast IPI not implemented.");
+}
+
 #endif /* CONFIG_SMP */
 
 /** @}
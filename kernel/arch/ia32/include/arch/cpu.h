@@ -81,6 +81,10 @@ typedef struct {
 	tss_t *tss;
 
 	size_t iomapver_copy;  /** Copy of TASK's I/O Permission bitmap generation count. */
+
+	uint32_t l_apic_tick;        /** Local APIC timer count of one clock tick. */
+	uint32_t l_apic_idle_ticks;  /** Clock ticks the stopped local APIC timer is due after. */
+	uint32_t l_apic_alarm_rest;  /** Timer count from a pending alarm to the next tick. */
 } cpu_arch_t;
 
 #endif
@@ -55,6 +55,7 @@
 #include <ddi/irq.h>
 #include <symtab.h>
 #include <stacktrace.h>
+#include <time/clock.h>
 #include <proc/task.h>
 
 /*
@@ -170,6 +171,13 @@ static void tlb_shootdown_ipi(unsigned int n __attribute__((unused)),
 	pic_ops->eoi(0);
 	tlb_shootdown_ipi_recv();
 }
+
+static void wakeup_ipi(unsigned int n __attribute__((unused)),
+    istate_t *istate __attribute__((unused)))
+{
+	pic_ops->eoi(0);
+	clock_idle_exit();
+}
 #endif
 
 /** Handler of IRQ exceptions */
@@ -249,6 +257,8 @@ void interrupt_init(void)
 #ifdef CONFIG_SMP
 	exc_register(VECTOR_TLB_SHOOTDOWN_IPI, "tlb_shootdown", true,
 	    (iroutine_t) tlb_shootdown_ipi);
+	exc_register(VECTOR_WAKEUP_IPI, "wakeup", true,
+	    (iroutine_t) wakeup_ipi);
 #endif
 }
 
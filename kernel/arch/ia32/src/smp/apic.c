@@ -47,6 +47,10 @@
 #include <arch.h>
 #include <ddi/irq.h>
 #include <genarch/pic/pic_ops.h>
+#include <smp/ipi.h>
+#include <time/clock.h>
+#include <time/timeout.h>
+#include <cpu.h>
 
 #ifdef CONFIG_SMP
 
@@ -170,6 +174,39 @@ static irq_ownership_t l_apic_timer_claim(irq_t *irq)
 
 static void l_apic_timer_irq_handler(irq_t *irq)
 {
+	lvt_tm_t tm;
+
+	/*
+	 * The timer is in the one-shot mode if an alarm has been set by
+	 * l_apic_timer_alarm(), if it has been stopped by l_apic_timer_stop()
+	 * or if it is reaching the next tick boundary after
+	 * l_apic_timer_resume(). Except for the alarm, this interrupt comes
+	 * on a tick boundary and the periodic mode can take over again.
+	 */
+	tm.value = l_apic[LVT_Tm];
+	if (tm.mode == TIMER_ONESHOT) {
+		uint32_t rest = CPU->arch.l_apic_alarm_rest;
+		if (rest > 0) {
+			CPU->arch.l_apic_alarm_rest = 0;
+			l_apic[ICRT] = rest;
+
+			irq_spinlock_unlock(&irq->lock, false);
+			timeout_alarm();
+			irq_spinlock_lock(&irq->lock, false);
+			return;
+		}
+
+		if (CPU->arch.l_apic_idle_ticks > 0) {
+			CPU->missed_clock_ticks +=
+			    CPU->arch.l_apic_idle_ticks - 1;
+			CPU->arch.l_apic_idle_ticks = 0;
+		}
+
+		tm.mode = TIMER_PERIODIC;
+		l_apic[LVT_Tm] = tm.value;
+		l_apic[ICRT] = CPU->arch.l_apic_tick;
+	}
+
 	/*
 	 * Holding a spinlock could prevent clock() from preempting
 	 * the current thread. In this case, we don't need to hold the
@@ -180,6 +217,154 @@ static void l_apic_timer_irq_handler(irq_t *irq)
 	irq_spinlock_lock(&irq->lock, false);
 }
 
+/** Check whether the local APIC timer is too close to its periodic reload.
+ *
+ * Around the reload, the tick interrupt is about to come or pending already
+ * and it would be mistaken for the expiration of the one-shot mode.
+ *
+ * @param left Current count of the timer.
+ *
+ * @return True if the timer must not be switched to the one-shot mode.
+ *
+ */
+static bool l_apic_timer_near_reload(uint32_t left)
+{
+	uint32_t tick = CPU->arch.l_apic_tick;
+
+	return (left < tick / 16) || (left > tick - tick / 16);
+}
+
+/** Stop the periodic interrupts of the local APIC timer.
+ *
+ * The timer is switched to the one-shot mode and programmed to expire on
+ * the tick boundary @a ticks ticks from the last one, so that the phase of
+ * the clock ticks is kept.
+ *
+ * @param ticks Number of ticks to defer the next clock interrupt by.
+ *
+ * @return False if the timer has been left ticking because it is about to
+ *         tick anyway or an alarm is pending.
+ *
+ */
+static bool l_apic_timer_stop(uint64_t ticks)
+{
+	uint32_t tick = CPU->arch.l_apic_tick;
+	uint32_t left = l_apic[CCRT];
+
+	if (CPU->arch.l_apic_alarm_rest > 0)
+		return false;
+
+	if (l_apic_timer_near_reload(left))
+		return false;
+
+	if (ticks > UINT32_MAX / tick)
+		ticks = UINT32_MAX / tick;
+	if (ticks < 2)
+		return false;
+
+	lvt_tm_t tm;
+
+	tm.value = l_apic[LVT_Tm];
+	tm.mode = TIMER_ONESHOT;
+	l_apic[LVT_Tm] = tm.value;
+	l_apic[ICRT] = (ticks - 1) * tick + l_apic[CCRT];
+
+	CPU->arch.l_apic_idle_ticks = ticks;
+	return true;
+}
+
+/** Resume the periodic interrupts of the local APIC timer.
+ *
+ * The ticks which have passed since l_apic_timer_stop() are accounted as
+ * missed and the timer is programmed to expire on the next tick boundary,
+ * where l_apic_timer_irq_handler() switches it back to the periodic mode.
+ *
+ */
+static void l_apic_timer_resume(void)
+{
+	uint32_t idle_ticks = CPU->arch.l_apic_idle_ticks;
+	if (idle_ticks == 0)
+		return;
+
+	/* An expired timer has its interrupt pending, let it do the job. */
+	uint32_t left = l_apic[CCRT];
+	if (left == 0)
+		return;
+
+	uint32_t tick = CPU->arch.l_apic_tick;
+	uint32_t next = left % tick;
+	if (next == 0)
+		next = tick;
+
+	CPU->missed_clock_ticks += idle_ticks - 1 - (left - next) / tick;
+	CPU->arch.l_apic_idle_ticks = 0;
+	l_apic[ICRT] = next;
+}
+
+/** Make an idle CPU resume its clock ticks.
+ *
+ * @param cpu CPU to kick.
+ *
+ */
+static void l_apic_timer_kick(cpu_t *cpu)
+{
+	ipi_unicast(cpu, VECTOR_WAKEUP_IPI);
+}
+
+/** Interrupt the current CPU between two ticks of the local APIC timer.
+ *
+ * The timer is switched to the one-shot mode and programmed to expire
+ * after @a usec microseconds. The count left from there to the next tick
+ * boundary is kept for l_apic_timer_irq_handler(), which programs the
+ * timer to expire on the boundary after the alarm.
+ *
+ * @param usec Number of microseconds from now.
+ *
+ */
+static void l_apic_timer_alarm(uint64_t usec)
+{
+	uint32_t tick = CPU->arch.l_apic_tick;
+	uint32_t left = l_apic[CCRT];
+
+	/*
+	 * An expired timer has its interrupt pending, which sets the alarm
+	 * again. This is also the only way for the timer to be still stopped.
+	 */
+	if (left == 0)
+		return;
+
+	assert(CPU->arch.l_apic_idle_ticks == 0);
+
+	lvt_tm_t tm;
+
+	tm.value = l_apic[LVT_Tm];
+	if ((tm.mode == TIMER_PERIODIC) && l_apic_timer_near_reload(left))
+		return;
+
+	/* The next clock interrupt comes first and sets the alarm again. */
+	if (usec >= 1000000 / HZ)
+		return;
+
+	uint32_t count = usec * tick / (1000000 / HZ);
+	if (count >= left)
+		return;
+	if (count == 0)
+		count = 1;
+
+	tm.mode = TIMER_ONESHOT;
+	l_apic[LVT_Tm] = tm.value;
+	l_apic[ICRT] = count;
+
+	CPU->arch.l_apic_alarm_rest += left - count;
+}
+
+static clock_idle_ops_t l_apic_timer_idle_ops = {
+	.stop = l_apic_timer_stop,
+	.resume = l_apic_timer_resume,
+	.kick = l_apic_timer_kick,
+	.alarm = l_apic_timer_alarm
+};
+
 /** Get Local APIC ID.
  *
  * @return Local APIC ID.
@@ -214,6 +399,7 @@ void apic_init(void)
 	l_apic_timer_irq.claim = l_apic_timer_claim;
 	l_apic_timer_irq.handler = l_apic_timer_irq_handler;
 	irq_register(&l_apic_timer_irq);
+	clock_idle_ops = &l_apic_timer_idle_ops;
 
 	uint8_t i;
 	for (i = 0; i < IRQ_COUNT; i++) {
@@ -510,7 +696,10 @@ void l_apic_init(void)
 	delay(1000000 / HZ);
 	uint32_t t2 = l_apic[CCRT];
 
-	l_apic[ICRT] = t1 - t2;
+	CPU->arch.l_apic_tick = t1 - t2;
+	CPU->arch.l_apic_idle_ticks = 0;
+	CPU->arch.l_apic_alarm_rest = 0;
+	l_apic[ICRT] = CPU->arch.l_apic_tick;
 
 	/* Program Logical Destination Register. */
 	assert(CPU->id < 8);
@@ -158,6 +158,22 @@
 #define PTE_WRITABLE_ARCH(pte)    ((pte)->writable != 0)
 #define PTE_EXECUTABLE_ARCH(pte)  ((pte)->executable != 0)
 
+/* Level 2 leaf entries map 2 MiB megapages. */
+#define LARGE_PAGE_WIDTH  21
+#define LARGE_PAGE_SIZE   (1 << LARGE_PAGE_WIDTH)
+
+/* Large page accessors of level 2 entries. */
+#define GET_PTL3_LARGE_ARCH(ptl2, i) \
+	(((((pte_t *) (ptl2))[(i)].readable) | \
+	    (((pte_t *) (ptl2))[(i)].writable) | \
+	    (((pte_t *) (ptl2))[(i)].executable)) != 0)
+
+#define GET_PTL3_LARGE_FLAGS_ARCH(ptl2, i) \
+	get_pt_flags((pte_t *) (ptl2), (size_t) (i))
+
+#define SET_PTL3_LARGE_FLAGS_ARCH(ptl2, i, flags) \
+	set_pt_flags((pte_t *) (ptl2), (size_t) (i), (flags))
+
 #ifndef __ASSEMBLER__
 
 #include <mm/mm.h>
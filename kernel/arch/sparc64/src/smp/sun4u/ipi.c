@@ -172,5 +172,29 @@ void ipi_broadcast_arch(int ipi)
 	}
 }
 
+/*
+ * Deliver IPI to one processor other than the current one.
+ *
+ * We assume that interrupts are disabled.
+ *
+ * @param cpu Destination processor.
+ * @param ipi IPI number.
+ */
+void ipi_unicast_arch(cpu_t *cpu, int ipi)
+{
+	void (*func)(void);
+
+	switch (ipi) {
+	case IPI_TLB_SHOOTDOWN:
+		func = tlb_shootdown_ipi_recv;
+		break;
+	default:
+		panic("Unknown IPI (%d).\n", ipi);
+		break;
+	}
+
+	cross_call(cpu->arch.mid, func);
+}
+
 /** @}
  */
@@ -121,5 +121,29 @@ void ipi_broadcast_arch(int ipi)
 	ipi_brodcast_to(func, ipi_cpu_list[CPU->arch.id], idx);
 }
 
+/*
+ * Deliver IPI to one processor other than the current one.
+ *
+ * We assume that interrupts are disabled.
+ *
+ * @param cpu Destination processor.
+ * @param ipi IPI number.
+ */
+void ipi_unicast_arch(cpu_t *cpu, int ipi)
+{
+	void (*func)(void);
+
+	switch (ipi) {
+	case IPI_TLB_SHOOTDOWN:
+		func = tlb_shootdown_ipi_recv;
+		break;
+	default:
+		panic("Unknown IPI (%d).\n", ipi);
+		break;
+	}
+
+	ipi_unicast_to(func, (uint16_t) cpu->id);
+}
+
 /** @}
  */
@@ -42,6 +42,10 @@
 typedef struct {
 	/** Page table pointer. */
 	pte_t *page_table;
+#ifdef LARGE_PAGE_WIDTH
+	/** Spare PTL3 tables for splitting the large pages of the space. */
+	void *large_tables;
+#endif
 } as_genarch_t;
 
 #endif
@@ -128,6 +128,19 @@
 #define SET_PTL3_PRESENT(ptl2, i)   SET_PTL3_PRESENT_ARCH(ptl2, i)
 #define SET_FRAME_PRESENT(ptl3, i)  SET_FRAME_PRESENT_ARCH(ptl3, i)
 
+#ifdef LARGE_PAGE_WIDTH
+
+/*
+ * These macros are provided to map large pages directly by PTL2 entries.
+ * GET_PTL3_LARGE() is only meaningful for present entries.
+ *
+ */
+#define GET_PTL3_LARGE(ptl2, i)           GET_PTL3_LARGE_ARCH(ptl2, i)
+#define GET_PTL3_LARGE_FLAGS(ptl2, i)     GET_PTL3_LARGE_FLAGS_ARCH(ptl2, i)
+#define SET_PTL3_LARGE_FLAGS(ptl2, i, x)  SET_PTL3_LARGE_FLAGS_ARCH(ptl2, i, x)
+
+#endif /* LARGE_PAGE_WIDTH */
+
 /*
  * Macros for querying the last-level PTEs.
  *
@@ -60,6 +60,7 @@
 #include <mm/asid.h>
 #include <mm/as.h>
 #include <mm/tlb.h>
+#include <cpu/cpu_mask.h>
 #include <arch/mm/asid.h>
 #include <synch/spinlock.h>
 #include <synch/mutex.h>
@@ -123,10 +124,12 @@ asid_t asid_get(void)
 		as_invalidate_translation_cache(as, 0, (size_t) -1);
 
 		/*
-		 * Get the system rid of the stolen ASID.
+		 * Get the system rid of the stolen ASID. Afterwards, no CPU
+		 * caches translations of the address space anymore.
 		 */
-		ipl_t ipl = tlb_shootdown_start(TLB_INVL_ASID, asid, 0, 0);
+		ipl_t ipl = tlb_shootdown_start(TLB_INVL_ASID, as, asid, 0, 0);
 		tlb_invalidate_asid(asid);
+		cpu_mask_none(as->cpu_mask);
 		tlb_shootdown_finalize(ipl);
 	} else {
 
@@ -141,7 +144,7 @@ asid_t asid_get(void)
 		/*
 		 * Purge the allocated ASID from TLBs.
 		 */
-		ipl_t ipl = tlb_shootdown_start(TLB_INVL_ASID, asid, 0, 0);
+		ipl_t ipl = tlb_shootdown_start(TLB_INVL_ASID, NULL, asid, 0, 0);
 		tlb_invalidate_asid(asid);
 		tlb_shootdown_finalize(ipl);
 	}
@@ -41,6 +41,7 @@
 #include <mm/frame.h>
 #include <mm/km.h>
 #include <mm/as.h>
+#include <mm/tlb.h>
 #include <arch/mm/page.h>
 #include <arch/mm/as.h>
 #include <barrier.h>
@@ -52,6 +53,10 @@
 #include <bitops.h>
 
 static void pt_mapping_insert(as_t *, uintptr_t, uintptr_t, unsigned int);
+#ifdef LARGE_PAGE_WIDTH
+static bool pt_mapping_insert_large(as_t *, uintptr_t, uintptr_t,
+    unsigned int);
+#endif
 static void pt_mapping_remove(as_t *, uintptr_t);
 static bool pt_mapping_find(as_t *, uintptr_t, bool, pte_t *pte);
 static void pt_mapping_update(as_t *, uintptr_t, bool, pte_t *pte);
@@ -59,25 +64,24 @@ static void pt_mapping_make_global(uintptr_t, size_t);
 
 page_mapping_operations_t pt_mapping_operations = {
 	.mapping_insert = pt_mapping_insert,
+#ifdef LARGE_PAGE_WIDTH
+	.mapping_insert_large = pt_mapping_insert_large,
+#endif
 	.mapping_remove = pt_mapping_remove,
 	.mapping_find = pt_mapping_find,
 	.mapping_update = pt_mapping_update,
 	.mapping_make_global = pt_mapping_make_global
 };
 
-/** Map page to frame using hierarchical page tables.
+/** Get PTL2 for a page, allocating any missing page tables above it.
  *
- * Map virtual address page to physical address frame
- * using flags.
+ * @param as   Address space to wich page belongs.
+ * @param page Virtual address of the page.
  *
- * @param as    Address space to wich page belongs.
- * @param page  Virtual address of the page to be mapped.
- * @param frame Physical address of memory frame to which the mapping is done.
- * @param flags Flags to be used for mapping.
+ * @return PTL2 which maps the page.
  *
  */
-void pt_mapping_insert(as_t *as, uintptr_t page, uintptr_t frame,
-    unsigned int flags)
+static pte_t *pt_ptl2_get(as_t *as, uintptr_t page)
 {
 	pte_t *ptl0 = (pte_t *) PA2KA((uintptr_t) as->genarch.page_table);
 
@@ -117,7 +121,154 @@ void pt_mapping_insert(as_t *as, uintptr_t page, uintptr_t frame,
 		SET_PTL2_PRESENT(ptl1, PTL1_INDEX(page));
 	}
 
-	pte_t *ptl2 = (pte_t *) PA2KA(GET_PTL2_ADDRESS(ptl1, PTL1_INDEX(page)));
+	return (pte_t *) PA2KA(GET_PTL2_ADDRESS(ptl1, PTL1_INDEX(page)));
+}
+
+#ifdef LARGE_PAGE_WIDTH
+
+/** Deposit a spare PTL3 table for splitting a large page.
+ *
+ * The spare tables are chained through their first word.
+ *
+ * @param as Address space.
+ * @param pt Kernel address of the spare table.
+ *
+ */
+static void pt_large_table_put(as_t *as, pte_t *pt)
+{
+	*((void **) pt) = as->genarch.large_tables;
+	as->genarch.large_tables = pt;
+}
+
+/** Withdraw a spare PTL3 table deposited by pt_large_table_put().
+ *
+ * @param as Address space.
+ *
+ * @return Kernel address of the spare table.
+ *
+ */
+static pte_t *pt_large_table_get(as_t *as)
+{
+	pte_t *pt = as->genarch.large_tables;
+
+	assert(pt != NULL);
+	as->genarch.large_tables = *((void **) pt);
+
+	return pt;
+}
+
+/** Split a large page mapping into mappings of its individual pages.
+ *
+ * The spare PTL3 table deposited when the large page was mapped is used, so
+ * that no memory is allocated and the split can be done within a TLB
+ * shootdown sequence.
+ *
+ * The entry of the large page is cleared and its translation purged from
+ * the TLB of this CPU before the new PTL3 is installed, as some
+ * architectures, such as arm64, require a break-before-make sequence when
+ * changing the size of a mapping. The caller is responsible for the TLB
+ * shootdown which purges the translation from the other CPUs.
+ *
+ * @param as   Address space to wich the large page belongs.
+ * @param ptl2 PTL2 which maps the large page.
+ * @param page Virtual address within the large page.
+ *
+ */
+static void pt_large_split(as_t *as, pte_t *ptl2, uintptr_t page)
+{
+	size_t i = PTL2_INDEX(page);
+	uintptr_t frame = (uintptr_t) GET_PTL3_ADDRESS(ptl2, i);
+	unsigned int flags = GET_PTL3_LARGE_FLAGS(ptl2, i);
+	pte_t *newpt = pt_large_table_get(as);
+
+	memsetb(newpt, PTL3_SIZE, 0);
+	for (unsigned int j = 0; j < PTL3_ENTRIES; j++) {
+		SET_FRAME_ADDRESS(newpt, j, frame + P2SZ(j));
+		SET_FRAME_FLAGS(newpt, j, flags);
+	}
+
+	/*
+	 * The hardware must never see the large page flags together with
+	 * the address of the new PTL3 or vice versa.
+	 */
+	memsetb(&ptl2[i], sizeof(pte_t), 0);
+	write_barrier();
+	tlb_invalidate_pages(as->asid, ALIGN_DOWN(page, LARGE_PAGE_SIZE), 1);
+
+	SET_PTL3_ADDRESS(ptl2, i, KA2PA(newpt));
+	SET_PTL3_FLAGS(ptl2, i,
+	    PAGE_NOT_PRESENT | PAGE_USER | PAGE_EXEC | PAGE_CACHEABLE |
+	    PAGE_WRITE);
+	write_barrier();
+	SET_PTL3_PRESENT(ptl2, i);
+}
+
+/** Map a large page to a block of frames using hierarchical page tables.
+ *
+ * The large page is mapped directly by a PTL2 entry. A spare PTL3 table is
+ * allocated and deposited for splitting the large page later. The table is
+ * allocated without blocking, so that large pages can be mapped from page
+ * fault handlers holding locks.
+ *
+ * @param as    Address space to wich page belongs.
+ * @param page  Virtual address of the large page to be mapped.
+ * @param frame Physical address of the block of frames to which the mapping
+ *              is done.
+ * @param flags Flags to be used for mapping.
+ *
+ * @return False if there is no memory for the spare table, in which case
+ *         nothing is mapped.
+ *
+ */
+bool pt_mapping_insert_large(as_t *as, uintptr_t page, uintptr_t frame,
+    unsigned int flags)
+{
+	pte_t *ptl2 = pt_ptl2_get(as, page);
+
+	/* There must be no mappings within the large page. */
+	assert(GET_PTL3_FLAGS(ptl2, PTL2_INDEX(page)) & PAGE_NOT_PRESENT);
+
+	uintptr_t pt = frame_alloc(PTL3_FRAMES, FRAME_LOWMEM | FRAME_ATOMIC,
+	    PTL3_SIZE - 1);
+	if (pt == 0)
+		return false;
+
+	pt_large_table_put(as, (pte_t *) PA2KA(pt));
+
+	SET_PTL3_ADDRESS(ptl2, PTL2_INDEX(page), frame);
+	SET_PTL3_LARGE_FLAGS(ptl2, PTL2_INDEX(page), flags | PAGE_NOT_PRESENT);
+	/*
+	 * Make the new mapping visible only after it is fully initialized.
+	 */
+	write_barrier();
+	SET_PTL3_PRESENT(ptl2, PTL2_INDEX(page));
+
+	return true;
+}
+
+#endif /* LARGE_PAGE_WIDTH */
+
+/** Map page to frame using hierarchical page tables.
+ *
+ * Map virtual address page to physical address frame
+ * using flags. A large page containing the page is split first.
+ *
+ * @param as    Address space to wich page belongs.
+ * @param page  Virtual address of the page to be mapped.
+ * @param frame Physical address of memory frame to which the mapping is done.
+ * @param flags Flags to be used for mapping.
+ *
+ */
+void pt_mapping_insert(as_t *as, uintptr_t page, uintptr_t frame,
+    unsigned int flags)
+{
+	pte_t *ptl2 = pt_ptl2_get(as, page);
+
+#ifdef LARGE_PAGE_WIDTH
+	if (!(GET_PTL3_FLAGS(ptl2, PTL2_INDEX(page)) & PAGE_NOT_PRESENT) &&
+	    GET_PTL3_LARGE(ptl2, PTL2_INDEX(page)))
+		pt_large_split(as, ptl2, page);
+#endif
 
 	if (GET_PTL3_FLAGS(ptl2, PTL2_INDEX(page)) & PAGE_NOT_PRESENT) {
 		pte_t *newpt = (pte_t *)
@@ -151,7 +302,8 @@ void pt_mapping_insert(as_t *as, uintptr_t page, uintptr_t frame,
  * TLB shootdown should follow in order to make effects of
  * this call visible.
  *
- * Empty page tables except PTL0 are freed.
+ * Empty page tables except PTL0 are freed. A large page containing the page
+ * is split first.
  *
  * @param as   Address space to wich page belongs.
  * @param page Virtual address of the page to be demapped.
@@ -177,6 +329,11 @@ void pt_mapping_remove(as_t *as, uintptr_t page)
 	if (GET_PTL3_FLAGS(ptl2, PTL2_INDEX(page)) & PAGE_NOT_PRESENT)
 		return;
 
+#ifdef LARGE_PAGE_WIDTH
+	if (GET_PTL3_LARGE(ptl2, PTL2_INDEX(page)))
+		pt_large_split(as, ptl2, page);
+#endif
+
 	pte_t *ptl3 = (pte_t *) PA2KA(GET_PTL3_ADDRESS(ptl2, PTL2_INDEX(page)));
 
 	/*
@@ -291,10 +448,23 @@ void pt_mapping_remove(as_t *as, uintptr_t page)
 #endif /* PTL1_ENTRIES != 0 */
 }
 
-static pte_t *pt_mapping_find_internal(as_t *as, uintptr_t page, bool nolock)
+/** Find the PTE mapping a virtual page.
+ *
+ * @param as         Address space to which page belongs.
+ * @param page       Virtual page.
+ * @param nolock     True if the page tables need not be locked.
+ * @param[out] large Set to true if the returned PTE is a PTL2 entry mapping
+ *                   the large page which contains the page.
+ *
+ * @return PTE mapping the page or NULL if there is none.
+ */
+static pte_t *pt_mapping_find_internal(as_t *as, uintptr_t page, bool nolock,
+    bool *large)
 {
 	assert(nolock || page_table_locked(as));
 
+	*large = false;
+
 	pte_t *ptl0 = (pte_t *) PA2KA((uintptr_t) as->genarch.page_table);
 	if (GET_PTL1_FLAGS(ptl0, PTL0_INDEX(page)) & PAGE_NOT_PRESENT)
 		return NULL;
@@ -316,6 +486,13 @@ static pte_t *pt_mapping_find_internal(as_t *as, uintptr_t page, bool nolock)
 	if (GET_PTL3_FLAGS(ptl2, PTL2_INDEX(page)) & PAGE_NOT_PRESENT)
 		return NULL;
 
+#ifdef LARGE_PAGE_WIDTH
+	if (GET_PTL3_LARGE(ptl2, PTL2_INDEX(page))) {
+		*large = true;
+		return &ptl2[PTL2_INDEX(page)];
+	}
+#endif
+
 #if (PTL2_ENTRIES != 0)
 	/*
 	 * Always read ptl3 only after we are sure it is present.
@@ -339,9 +516,19 @@ static pte_t *pt_mapping_find_internal(as_t *as, uintptr_t page, bool nolock)
  */
 bool pt_mapping_find(as_t *as, uintptr_t page, bool nolock, pte_t *pte)
 {
-	pte_t *t = pt_mapping_find_internal(as, page, nolock);
+	bool large;
+	pte_t *t = pt_mapping_find_internal(as, page, nolock, &large);
 	if (t)
 		*pte = *t;
+
+#ifdef LARGE_PAGE_WIDTH
+	/* Make the copy look like a PTE of the individual page. */
+	if (t && large) {
+		SET_FRAME_ADDRESS(pte, 0, PTE_GET_FRAME(t) +
+		    (page - ALIGN_DOWN(page, LARGE_PAGE_SIZE)));
+	}
+#endif
+
 	return t != NULL;
 }
 
@@ -354,10 +541,17 @@ bool pt_mapping_find(as_t *as, uintptr_t page, bool nolock, pte_t *pte)
  */
 void pt_mapping_update(as_t *as, uintptr_t page, bool nolock, pte_t *pte)
 {
-	pte_t *t = pt_mapping_find_internal(as, page, nolock);
+	bool large;
+	pte_t *t = pt_mapping_find_internal(as, page, nolock, &large);
 	if (!t)
 		panic("Updating non-existent PTE");
 
+	/*
+	 * Only architectures which do not update PTEs from their TLB miss
+	 * handlers map large pages.
+	 */
+	assert(!large);
+
 	assert(PTE_VALID(t) == PTE_VALID(pte));
 	assert(PTE_PRESENT(t) == PTE_PRESENT(pte));
 	assert(PTE_GET_FRAME(t) == PTE_GET_FRAME(pte));
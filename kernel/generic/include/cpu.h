@@ -36,6 +36,8 @@
 #define KERN_CPU_H_
 
 #include <mm/tlb.h>
+#include <mm/frame.h>
+#include <mm/zero.h>
 #include <synch/spinlock.h>
 #include <proc/scheduler.h>
 #include <arch/cpu.h>
@@ -45,6 +47,12 @@
 
 #define CPU                  CURRENT->cpu
 
+/** Number of levels of the timing wheel of active timeouts. */
+#define TIMEOUT_WHEEL_LEVELS  4
+/** Each level has 2^TIMEOUT_WHEEL_WIDTH slots. */
+#define TIMEOUT_WHEEL_WIDTH   6
+#define TIMEOUT_WHEEL_SLOTS   (1 << TIMEOUT_WHEEL_WIDTH)
+
 /** CPU structure.
  *
  * There is one structure like this for every processor.
@@ -54,15 +62,48 @@ typedef struct cpu {
 
 	tlb_shootdown_msg_t tlb_messages[TLB_MESSAGE_QUEUE_LEN];
 	size_t tlb_messages_count;
+	/**
+	 * Number of TLB shootdowns which have queued a message for this CPU
+	 * and have not been finalized yet. Only incremented while holding
+	 * the CPU's lock.
+	 */
+	atomic_size_t tlb_pending;
+	/** CPUs targeted by the TLB shootdown this CPU is running. */
+	struct cpu_mask *tlb_targets;
+	/** Address space of the TLB shootdown this CPU is running. */
+	struct as *tlb_as;
 
 	context_t saved_context;
 
 	atomic_size_t nrdy;
 	runq_t rq[RQ_COUNT];
+	/**
+	 * Bitmap of non-empty run queues, see RQ_BIT(). The bit of each
+	 * queue is only changed while holding the queue's lock.
+	 */
+	atomic_uint rq_ready;
 	volatile size_t needs_relink;
 
+	/**
+	 * Thread which is handed this CPU directly by the running thread,
+	 * see thread_handoff_begin(). It is ready, but not in any run queue.
+	 * Only accessed by this CPU with interrupts disabled.
+	 */
+	struct thread *handoff;
+
 	IRQ_SPINLOCK_DECLARE(timeoutlock);
-	list_t timeout_active_list;
+	/** Number of clock() ticks this CPU has processed timeouts for. */
+	uint64_t timeout_ticks;
+	/**
+	 * Timing wheel of active timeouts, see timeout.c. Slots on level l
+	 * cover 2^(l * TIMEOUT_WHEEL_WIDTH) ticks each.
+	 */
+	list_t timeout_wheel[TIMEOUT_WHEEL_LEVELS][TIMEOUT_WHEEL_SLOTS];
+	/**
+	 * Timeouts due between clock ticks, sorted by their cycle count
+	 * deadlines. See timeout_register().
+	 */
+	list_t timeout_alarms;
 
 	/**
 	 * When system clock loses a tick, it is
@@ -73,6 +114,15 @@ typedef struct cpu {
 	 */
 	size_t missed_clock_ticks;
 
+	/** Clock ticks are stopped while the CPU is idle. */
+	bool tickless;
+
+	/** Free frames cached by this CPU, see frame.c. */
+	frame_pcpu_t frame_lists[FRAME_PCPU_LISTS];
+
+	/** Zeroed frames for anonymous memory, see zero.c. */
+	zero_pool_t zero_pool;
+
 	/**
 	 * Processor cycle accounting.
 	 */
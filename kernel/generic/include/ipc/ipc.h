@@ -165,6 +165,11 @@ typedef struct call {
 
 	/** Buffer for IPC_M_DATA_WRITE and IPC_M_DATA_READ. */
 	uint8_t *buffer;
+
+	/** Frames loaned by IPC_M_DATA_WRITE and IPC_M_DATA_READ. */
+	uintptr_t *frames;
+	/** Number of entries in @c frames. */
+	size_t frame_count;
 } call_t;
 
 extern slab_cache_t *phone_cache;
@@ -183,6 +188,8 @@ extern errno_t ipc_wait_for_call(answerbox_t *, uint32_t, unsigned int, call_t *
 extern errno_t ipc_forward(call_t *, phone_t *, answerbox_t *, unsigned int);
 extern void ipc_answer(answerbox_t *, call_t *);
 extern void _ipc_answer_free_call(call_t *, bool);
+extern errno_t ipc_call_pages_loan(call_t *, uspace_addr_t, size_t);
+extern errno_t ipc_call_pages_give(call_t *, uspace_addr_t, size_t);
 
 extern void ipc_phone_init(phone_t *, struct task *);
 extern bool ipc_phone_connect(phone_t *, answerbox_t *);
@@ -45,10 +45,17 @@ extern sys_errno_t sys_ipc_call_async_fast(cap_phone_handle_t, sysarg_t,
     sysarg_t, sysarg_t, sysarg_t, sysarg_t);
 extern sys_errno_t sys_ipc_call_async_slow(cap_phone_handle_t, uspace_ptr_ipc_data_t,
     sysarg_t);
+extern sys_errno_t sys_ipc_call_async_batch(uspace_ptr_ipc_batch_call_t, size_t);
 extern sys_errno_t sys_ipc_answer_fast(cap_call_handle_t, sysarg_t, sysarg_t,
     sysarg_t, sysarg_t, sysarg_t);
 extern sys_errno_t sys_ipc_answer_slow(cap_call_handle_t, uspace_ptr_ipc_data_t);
 extern sys_errno_t sys_ipc_wait_for_call(uspace_ptr_ipc_data_t, uint32_t, unsigned int);
+extern sys_errno_t sys_ipc_call_wait(cap_phone_handle_t, uspace_ptr_ipc_data_t,
+    sysarg_t, uspace_ptr_ipc_data_t, uint32_t, unsigned int);
+extern sys_errno_t sys_ipc_answer_wait(cap_call_handle_t, uspace_ptr_ipc_data_t,
+    uspace_ptr_ipc_data_t, uint32_t, unsigned int);
+extern sys_errno_t sys_ipc_wait_batch(uspace_ptr_ipc_data_t, size_t,
+    uspace_ptr_size_t, uint32_t, unsigned int);
 extern sys_errno_t sys_ipc_poke(void);
 extern sys_errno_t sys_ipc_forward_fast(cap_call_handle_t, cap_phone_handle_t,
     sysarg_t, sysarg_t, sysarg_t, unsigned int);
@@ -88,6 +88,11 @@
 /** The page fault was not resolved by as_page_fault(). Non-verbose version. */
 #define AS_PF_SILENT 3
 
+/** Initial number of pages mapped ahead of a page fault. */
+#define AS_FAULT_AROUND_MIN  8
+/** Maximal number of pages mapped ahead of a page fault. */
+#define AS_FAULT_AROUND_MAX  64
+
 /** Address space structure.
  *
  * as_t contains the list of as_areas of userspace accessible
@@ -115,6 +120,22 @@ typedef struct as {
 	 */
 	asid_t asid;
 
+	/**
+	 * Keeps CPUs from starting to use the address
+	 * space while its TLB shootdown is in progress.
+	 */
+	IRQ_SPINLOCK_DECLARE(tlb_lock);
+
+	/**
+	 * CPUs on which this address space is or has
+	 * been active since it got its ASID, i.e. which
+	 * may have its translations cached. NULL for
+	 * the kernel address space, which is on all
+	 * CPUs. Changed while holding both asidlock
+	 * and tlb_lock.
+	 */
+	struct cpu_mask *cpu_mask;
+
 	/** Number of references (i.e. tasks that reference this as). */
 	atomic_refcount_t refcount;
 
@@ -285,6 +306,11 @@ typedef struct {
 
 	/** Data to be used by the backend. */
 	mem_backend_data_t backend_data;
+
+	/** Page right after the pages mapped by the last page fault. */
+	uintptr_t fault_next;
+	/** Number of pages to map ahead of the next page fault. */
+	size_t fault_window;
 } as_area_t;
 
 /** Address space area backend structure. */
@@ -298,6 +324,7 @@ typedef struct mem_backend {
 	bool (*is_shareable)(as_area_t *);
 
 	int (*page_fault)(as_area_t *, uintptr_t, pf_access_t);
+	size_t (*page_fault_around)(as_area_t *, uintptr_t, size_t, bool);
 	void (*frame_free)(as_area_t *, uintptr_t, uintptr_t);
 
 	bool (*create_shared_data)(as_area_t *);
@@ -324,6 +351,9 @@ extern errno_t as_area_resize(as_t *, uintptr_t, size_t, unsigned int);
 extern errno_t as_area_share(as_t *, uintptr_t, size_t, as_t *, unsigned int,
     uintptr_t *, uintptr_t);
 extern errno_t as_area_change_flags(as_t *, unsigned int, uintptr_t);
+extern errno_t as_pages_loan(as_t *, uintptr_t, size_t, uintptr_t *);
+extern errno_t as_pages_give(as_t *, uintptr_t, size_t, uintptr_t *);
+extern as_area_t *find_area_and_lock(as_t *, uintptr_t);
 extern as_area_t *as_area_first(as_t *);
 extern as_area_t *as_area_next(as_area_t *);
 
@@ -341,6 +371,7 @@ extern size_t as_area_get_size(uintptr_t);
 extern used_space_ival_t *used_space_first(used_space_t *);
 extern used_space_ival_t *used_space_next(used_space_ival_t *);
 extern used_space_ival_t *used_space_find_gteq(used_space_t *, uintptr_t);
+extern size_t used_space_count(used_space_t *, uintptr_t, size_t);
 extern bool used_space_insert(used_space_t *, uintptr_t, size_t);
 
 /* Interface to be implemented by architectures. */
@@ -371,6 +402,11 @@ extern mem_backend_t elf_backend;
 extern mem_backend_t phys_backend;
 extern mem_backend_t user_backend;
 
+#ifdef LARGE_PAGE_WIDTH
+extern void anon_promote_init(void);
+extern void kpromote(void *);
+#endif
+
 /* Address space area related syscalls. */
 extern sysarg_t sys_as_area_create(uintptr_t, size_t, unsigned int, uintptr_t,
     uspace_ptr_as_area_pager_info_t);
@@ -89,11 +89,38 @@ typedef uint8_t zone_flags_t;
 	(((((zf) & ZONE_EF_MASK)) == ((f) & ZONE_EF_MASK)) && \
 	    (((zf) & ~ZONE_EF_MASK) & (f)))
 
+/** Number of orders of free blocks kept by the buddy allocator of a zone. */
+#define ZONE_ORDERS  20
+
+/** Number of frames moved between a per-CPU list and the zones at once. */
+#define FRAME_PCPU_BATCH  16
+/** Capacity of a per-CPU list of free frames. */
+#define FRAME_PCPU_MAX  (4 * FRAME_PCPU_BATCH)
+
+/** Per-CPU list of free frames which can be allocated from low memory. */
+#define FRAME_PCPU_LOWMEM   0
+/** Per-CPU list of free frames which can be allocated from any memory. */
+#define FRAME_PCPU_HIGHMEM  1
+#define FRAME_PCPU_LISTS    2
+
 typedef struct {
 	size_t refcount;  /**< Tracking of shared frames */
 	void *parent;     /**< If allocated by slab, this points there */
+	link_t link;      /**< Link to a free list of the zone */
+	uint8_t order;    /**< Order of the free block headed by this frame */
 } frame_t;
 
+/** List of free frames cached by a CPU.
+ *
+ * The list is used by its CPU with interrupts disabled. Other CPUs only
+ * drain it when they run out of free frames.
+ */
+typedef struct {
+	SPINLOCK_DECLARE(lock);
+	size_t count;
+	pfn_t pfn[FRAME_PCPU_MAX];
+} frame_pcpu_t;
+
 typedef struct {
 	/** Frame_no of the first frame in the frames array */
 	pfn_t base;
@@ -110,8 +137,11 @@ typedef struct {
 	/** Type of the zone */
 	zone_flags_t flags;
 
-	/** Frame bitmap */
-	bitmap_t bitmap;
+	/**
+	 * Free lists of the buddy allocator. Free blocks of order k consist
+	 * of 2^k frames and are aligned to 2^k in physical memory.
+	 */
+	list_t free[ZONE_ORDERS];
 
 	/** Array of frame_t structures in this zone */
 	frame_t *frames;
@@ -138,6 +168,7 @@ extern void frame_free_generic(uintptr_t, size_t, frame_flags_t);
 extern void frame_free(uintptr_t, size_t);
 extern void frame_free_noreserve(uintptr_t, size_t);
 extern void frame_reference_add(pfn_t);
+extern size_t frame_reference_count(pfn_t);
 extern size_t frame_total_free_get(void);
 
 extern size_t find_zone(pfn_t, size_t, size_t);
@@ -53,9 +53,14 @@ extern bool km_is_non_identity(uintptr_t);
 extern uintptr_t km_map(uintptr_t, size_t, size_t, unsigned int);
 extern void km_unmap(uintptr_t, size_t);
 
+extern uintptr_t km_frame_map(uintptr_t);
+extern void km_frame_unmap(uintptr_t);
+
 extern uintptr_t km_temporary_page_get(uintptr_t *, frame_flags_t);
 extern void km_temporary_page_put(uintptr_t);
 
+extern size_t km_shootdowns_avoided(void);
+
 #endif
 
 /** @}
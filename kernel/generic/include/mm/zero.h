@@ -0,0 +1,68 @@
+/*
+ * Copyright (c) 2026 agent
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * - Redistributions of source code must retain the above copyright
+ *   notice, this list of conditions and the following disclaimer.
+ * - Redistributions in binary form must reproduce the above copyright
+ *   notice, this list of conditions and the following disclaimer in the
+ *   documentation and/or other materials provided with the distribution.
+ * - The name of the author may not be used to endorse or promote products
+ *   derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+ * NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/** @addtogroup kernel_generic_mm
+ * @{
+ */
+/** @file
+ */
+
+#ifndef KERN_ZERO_H_
+#define KERN_ZERO_H_
+
+#include <mm/frame.h>
+#include <synch/waitq.h>
+#include <typedefs.h>
+
+/** Number of zeroed frames each CPU can hold. */
+#define ZERO_POOL_SIZE  32
+
+/** Zeroed frames of one CPU.
+ *
+ * Only accessed by its CPU with interrupts disabled, by the kzero thread
+ * wired to the CPU and by page faults running there.
+ */
+typedef struct {
+	/** Number of frames in the pool. */
+	size_t count;
+	/** Number of frames reserved for the pool, at least count. */
+	size_t reserved;
+	/** Physical addresses of the zeroed frames. */
+	uintptr_t frames[ZERO_POOL_SIZE];
+	/** The kzero thread of the CPU sleeps here while the pool is full. */
+	waitq_t wq;
+} zero_pool_t;
+
+extern void zero_pool_init(zero_pool_t *);
+extern void kzero(void *);
+extern uintptr_t zero_frame_alloc(frame_flags_t);
+
+#endif
+
+/** @}
+ */
@@ -44,6 +44,9 @@
 #define RQ_COUNT          16
 #define NEEDS_RELINK_MAX  (HZ)
 
+/** Bit of run queue i in cpu_t.rq_ready, rq[0] gets the most significant. */
+#define RQ_BIT(i)  (1U << (RQ_COUNT - 1 - (i)))
+
 /** Scheduler run queue structure. */
 typedef struct {
 	IRQ_SPINLOCK_DECLARE(lock);
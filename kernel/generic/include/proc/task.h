@@ -129,6 +129,9 @@ typedef struct task {
 	/** Accumulated accounting. */
 	uint64_t ucycles;
 	uint64_t kcycles;
+
+	/** Number of page faults serviced by the address space backends. */
+	uint64_t page_faults;
 } task_t;
 
 /** Synchronize access to @c tasks */
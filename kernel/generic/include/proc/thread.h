@@ -173,6 +173,11 @@ typedef struct thread {
 	bool wired;
 	/** Thread was migrated to another CPU and has not run yet. */
 	bool stolen;
+	/**
+	 * Hand the CPU over to the next thread this thread wakes up from this
+	 * wait queue, see thread_handoff_begin().
+	 */
+	waitq_t *handoff;
 	/** Thread is executed in user space. */
 	bool uspace;
 
@@ -219,6 +224,9 @@ extern thread_t *thread_create(void (*)(void *), void *, task_t *,
 extern void thread_wire(thread_t *, cpu_t *);
 extern void thread_attach(thread_t *, task_t *);
 extern void thread_ready(thread_t *);
+extern void thread_ready_from(thread_t *, waitq_t *);
+extern void thread_handoff_begin(waitq_t *);
+extern void thread_handoff_end(void);
 extern void thread_exit(void) __attribute__((noreturn));
 extern void thread_interrupt(thread_t *);
 extern bool thread_interrupted(thread_t *);
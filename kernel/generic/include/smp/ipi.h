@@ -37,12 +37,17 @@
 
 #ifdef CONFIG_SMP
 
+struct cpu;
+
 extern void ipi_broadcast(int);
 extern void ipi_broadcast_arch(int);
+extern void ipi_unicast(struct cpu *, int);
+extern void ipi_unicast_arch(struct cpu *, int);
 
 #else
 
 #define ipi_broadcast(ipi)
+#define ipi_unicast(cpu, ipi)
 
 #endif /* CONFIG_SMP */
 
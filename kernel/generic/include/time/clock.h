@@ -35,10 +35,16 @@
 #ifndef KERN_CLOCK_H_
 #define KERN_CLOCK_H_
 
+#include <stdbool.h>
 #include <typedefs.h>
 
 #define HZ  100
 
+/** Longest time an idle CPU goes without clock ticks */
+#define CLOCK_IDLE_MAX_TICKS  HZ
+
+struct cpu;
+
 /** Uptime structure */
 typedef struct {
 	sysarg_t seconds1;
@@ -46,10 +52,49 @@ typedef struct {
 	sysarg_t seconds2;
 } uptime_t;
 
+/** Clock interrupt source able to skip ticks of idle CPUs
+ *
+ * The stop, resume and alarm operations act on the clock of the current CPU
+ * and are called with interrupts disabled. The ticks skipped must be
+ * reported to clock() in CPU->missed_clock_ticks, just like ticks lost for
+ * any other reason.
+ */
+typedef struct {
+	/**
+	 * Defer the next clock interrupt by the given number of ticks.
+	 *
+	 * Returns false if the clock keeps ticking, e.g. because it is
+	 * about to tick anyway.
+	 */
+	bool (*stop)(uint64_t);
+	/** Resume regular clock interrupts. */
+	void (*resume)(void);
+	/**
+	 * Make another CPU call clock_idle_exit() as soon as possible.
+	 *
+	 * Without this operation, ticks are skipped only while there is a
+	 * single active CPU.
+	 */
+	void (*kick)(struct cpu *);
+	/**
+	 * Interrupt the current CPU the given number of microseconds from now
+	 * and have it call timeout_alarm(), unless a clock interrupt comes
+	 * sooner. The phase of the clock ticks is kept. Only called while
+	 * the clock ticks.
+	 *
+	 * Without this operation, timeouts expire on clock ticks only.
+	 */
+	void (*alarm)(uint64_t);
+} clock_idle_ops_t;
+
 extern uptime_t *uptime;
+extern clock_idle_ops_t *clock_idle_ops;
 
 extern void clock(void);
 extern void clock_counter_init(void);
+extern void clock_idle_enter(void);
+extern void clock_idle_exit(void);
+extern void clock_idle_kick(struct cpu *);
 
 #endif
 
@@ -44,10 +44,15 @@ typedef void (*timeout_handler_t)(void *arg);
 typedef struct {
 	IRQ_SPINLOCK_DECLARE(lock);
 
-	/** Link to the list of active timeouts on CURRENT->cpu */
+	/** Link to a slot of the timing wheel or to the alarm list of cpu */
 	link_t link;
-	/** Timeout will be activated in this amount of clock() ticks. */
-	uint64_t ticks;
+	/** Timeout will be activated when cpu->timeout_ticks reaches this. */
+	uint64_t deadline;
+	/**
+	 * Cycle count of cpu the timeout expires at, zero if it expires
+	 * right on the tick given by deadline. See timeout_register().
+	 */
+	uint64_t hr_deadline;
 	/** Function that will be called on timeout activation. */
 	timeout_handler_t handler;
 	/** Argument to be passed to handler() function. */
@@ -63,6 +68,9 @@ extern void timeout_initialize(timeout_t *);
 extern void timeout_reinitialize(timeout_t *);
 extern void timeout_register(timeout_t *, uint64_t, timeout_handler_t, void *);
 extern bool timeout_unregister(timeout_t *);
+extern void timeout_tick(void);
+extern void timeout_alarm(void);
+extern uint64_t timeout_idle_ticks(uint64_t);
 
 #endif
 
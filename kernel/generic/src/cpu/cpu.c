@@ -36,6 +36,7 @@
  */
 
 #include <cpu.h>
+#include <cpu/cpu_mask.h>
 #include <arch.h>
 #include <arch/cpu.h>
 #include <stdlib.h>
@@ -85,10 +86,21 @@ void cpu_init(void)
 
 			irq_spinlock_initialize(&cpus[i].lock, "cpus[].lock");
 
+			cpus[i].tlb_targets = malloc(cpu_mask_size());
+			if (!cpus[i].tlb_targets)
+				panic("Cannot allocate CPU TLB shootdown mask.");
+
 			for (unsigned int j = 0; j < RQ_COUNT; j++) {
 				irq_spinlock_initialize(&cpus[i].rq[j].lock, "cpus[].rq[].lock");
 				list_initialize(&cpus[i].rq[j].rq);
 			}
+
+			for (unsigned int j = 0; j < FRAME_PCPU_LISTS; j++) {
+				spinlock_initialize(&cpus[i].frame_lists[j].lock,
+				    "cpus[].frame_lists[].lock");
+			}
+
+			zero_pool_init(&cpus[i].zero_pool);
 		}
 
 #ifdef CONFIG_SMP
@@ -51,6 +51,11 @@
 #include <ipc/sysipc_priv.h>
 #include <errno.h>
 #include <mm/slab.h>
+#include <mm/as.h>
+#include <mm/frame.h>
+#include <mm/km.h>
+#include <mm/page.h>
+#include <mm/reserve.h>
 #include <arch.h>
 #include <proc/task.h>
 #include <mem.h>
@@ -61,6 +66,9 @@
 #include <ipc/irq.h>
 #include <cap/cap.h>
 #include <stdlib.h>
+#include <align.h>
+#include <macros.h>
+#include <syscall/copy.h>
 
 static void ipc_forget_call(call_t *);
 
@@ -86,6 +94,8 @@ static void _ipc_call_init(call_t *call)
 	call->sender = NULL;
 	call->callerbox = NULL;
 	call->buffer = NULL;
+	call->frames = NULL;
+	call->frame_count = 0;
 }
 
 static void call_destroy(void *arg)
@@ -94,6 +104,15 @@ static void call_destroy(void *arg)
 
 	if (call->buffer)
 		free(call->buffer);
+	if (call->frames) {
+		for (size_t i = 0; i < call->frame_count; i++) {
+			if (call->frames[i] != 0) {
+				frame_free_noreserve(call->frames[i], 1);
+				reserve_free(1);
+			}
+		}
+		free(call->frames);
+	}
 	if (call->caller_phone)
 		kobject_put(call->caller_phone->kobject);
 	slab_free(call_cache, call);
@@ -103,6 +122,82 @@ kobject_ops_t call_kobject_ops = {
 	.destroy = call_destroy
 };
 
+/** Loan the pages of a buffer of the current address space to a call.
+ *
+ * The buffer must be page-aligned and have at least DATA_XFER_LOAN_MIN
+ * bytes. The pages it occupies are write-protected and shared with the call
+ * copy-on-write, see as_pages_loan(). The call holds the frames until they
+ * are given away by ipc_call_pages_give() or the call is freed.
+ *
+ * @param call Call which borrows the frames.
+ * @param src  Address of the source buffer.
+ * @param size Size of the source buffer.
+ *
+ * @return EOK on success.
+ * @return ENOTSUP if the pages of the buffer cannot be loaned.
+ * @return ENOMEM if there is not enough memory.
+ *
+ */
+errno_t ipc_call_pages_loan(call_t *call, uspace_addr_t src, size_t size)
+{
+	assert(!call->frames);
+
+	if (!IS_ALIGNED(src, PAGE_SIZE) || (size < DATA_XFER_LOAN_MIN))
+		return ENOTSUP;
+
+	size_t count = ALIGN_UP(size, PAGE_SIZE) / PAGE_SIZE;
+	uintptr_t *frames = malloc(count * sizeof(uintptr_t));
+	if (!frames)
+		return ENOMEM;
+
+	errno_t rc = as_pages_loan(AS, src, count, frames);
+	if (rc != EOK) {
+		free(frames);
+		return rc;
+	}
+
+	call->frames = frames;
+	call->frame_count = count;
+	return EOK;
+}
+
+/** Deliver the pages loaned to a call to a buffer of the current address space.
+ *
+ * Whole pages are mapped copy-on-write into the buffer if it is
+ * page-aligned. Whatever cannot be mapped is copied.
+ *
+ * @param call Call holding the frames.
+ * @param dst  Address of the destination buffer.
+ * @param size Number of bytes to deliver.
+ *
+ * @return EOK on success or an error code from copy_to_uspace().
+ *
+ */
+errno_t ipc_call_pages_give(call_t *call, uspace_addr_t dst, size_t size)
+{
+	assert(size <= P2SZ(call->frame_count));
+
+	size_t pages = 0;
+	if (IS_ALIGNED(dst, PAGE_SIZE)) {
+		pages = size / PAGE_SIZE;
+		if ((pages > 0) &&
+		    (as_pages_give(AS, dst, pages, call->frames) != EOK))
+			pages = 0;
+	}
+
+	for (size_t i = pages; P2SZ(i) < size; i++) {
+		uintptr_t page = km_frame_map(call->frames[i]);
+		errno_t rc = copy_to_uspace(dst + P2SZ(i), (void *) page,
+		    min(PAGE_SIZE, size - P2SZ(i)));
+		km_frame_unmap(page);
+
+		if (rc != EOK)
+			return rc;
+	}
+
+	return EOK;
+}
+
 /** Allocate and initialize a call structure.
  *
  * The call is initialized, so that the reply will be directed to
@@ -47,9 +47,13 @@ static errno_t request_preprocess(call_t *call, phone_t *phone)
 	if (size > DATA_XFER_LIMIT) {
 		int flags = ipc_get_arg3(&call->data);
 
+		/*
+		 * With IPC_XF_LOAN, the limit is only enforced if the
+		 * recipient does not loan the pages of its buffer.
+		 */
 		if (flags & IPC_XF_RESTRICT)
 			ipc_set_arg2(&call->data, DATA_XFER_LIMIT);
-		else
+		else if (!(flags & IPC_XF_LOAN))
 			return ELIMIT;
 	}
 
@@ -59,6 +63,7 @@ static errno_t request_preprocess(call_t *call, phone_t *phone)
 static errno_t answer_preprocess(call_t *answer, ipc_data_t *olddata)
 {
 	assert(!answer->buffer);
+	assert(!answer->frames);
 
 	if (!ipc_get_retval(&answer->data)) {
 		/* The recipient agreed to send data. */
@@ -74,6 +79,17 @@ static errno_t answer_preprocess(call_t *answer, ipc_data_t *olddata)
 			 */
 			ipc_set_arg1(&answer->data, dst);
 
+			/* Large page-aligned buffers can be loaned. */
+			int flags = ipc_get_arg3(&answer->data);
+			if ((flags & IPC_XF_LOAN) &&
+			    (ipc_call_pages_loan(answer, src, size) == EOK))
+				return EOK;
+
+			if (size > DATA_XFER_LIMIT) {
+				ipc_set_retval(&answer->data, ELIMIT);
+				return EOK;
+			}
+
 			answer->buffer = malloc(size);
 			if (!answer->buffer) {
 				ipc_set_retval(&answer->data, ENOMEM);
@@ -101,12 +117,15 @@ static errno_t answer_preprocess(call_t *answer, ipc_data_t *olddata)
 
 static errno_t answer_process(call_t *answer)
 {
-	if (answer->buffer) {
+	if (answer->buffer || answer->frames) {
 		uspace_addr_t dst = ipc_get_arg1(&answer->data);
 		size_t size = ipc_get_arg2(&answer->data);
 		errno_t rc;
 
-		rc = copy_to_uspace(dst, answer->buffer, size);
+		if (answer->frames)
+			rc = ipc_call_pages_give(answer, dst, size);
+		else
+			rc = copy_to_uspace(dst, answer->buffer, size);
 		if (rc)
 			ipc_set_retval(&answer->data, rc);
 	}
@@ -44,10 +44,14 @@ static errno_t request_preprocess(call_t *call, phone_t *phone)
 {
 	uspace_addr_t src = ipc_get_arg1(&call->data);
 	size_t size = ipc_get_arg2(&call->data);
+	int flags = ipc_get_arg3(&call->data);
 
-	if (size > DATA_XFER_LIMIT) {
-		int flags = ipc_get_arg3(&call->data);
+	/* Large page-aligned buffers can be loaned instead of copied. */
+	if ((flags & IPC_XF_LOAN) &&
+	    (ipc_call_pages_loan(call, src, size) == EOK))
+		return EOK;
 
+	if (size > DATA_XFER_LIMIT) {
 		if (flags & IPC_XF_RESTRICT) {
 			size = DATA_XFER_LIMIT;
 			ipc_set_arg2(&call->data, size);
@@ -72,7 +76,7 @@ static errno_t request_preprocess(call_t *call, phone_t *phone)
 
 static errno_t answer_preprocess(call_t *answer, ipc_data_t *olddata)
 {
-	assert(answer->buffer);
+	assert(answer->buffer || answer->frames);
 
 	if (!ipc_get_retval(&answer->data)) {
 		/* The recipient agreed to receive data. */
@@ -81,8 +85,14 @@ static errno_t answer_preprocess(call_t *answer, ipc_data_t *olddata)
 		size_t max_size = ipc_get_arg2(olddata);
 
 		if (size <= max_size) {
-			errno_t rc = copy_to_uspace(dst,
-			    answer->buffer, size);
+			errno_t rc;
+
+			if (answer->frames) {
+				rc = ipc_call_pages_give(answer, dst, size);
+			} else {
+				rc = copy_to_uspace(dst, answer->buffer,
+				    size);
+			}
 			if (rc)
 				ipc_set_retval(&answer->data, rc);
 		} else {
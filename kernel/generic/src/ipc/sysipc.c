@@ -46,12 +46,14 @@
 #include <ipc/event.h>
 #include <ipc/kbox.h>
 #include <synch/waitq.h>
+#include <proc/thread.h>
 #include <arch/interrupt.h>
 #include <syscall/copy.h>
 #include <security/perm.h>
 #include <console/console.h>
 #include <macros.h>
 #include <cap/cap.h>
+#include <time/clock.h>
 
 #define STRUCT_TO_USPACE(dst, src)  copy_to_uspace((dst), (src), sizeof(*(src)))
 
@@ -409,17 +411,17 @@ sys_errno_t sys_ipc_call_async_fast(cap_phone_handle_t handle, sysarg_t imethod,
 	return EOK;
 }
 
-/** Make an asynchronous IPC call allowing to transmit the entire payload.
+/** Make an asynchronous IPC call with the entire payload.
  *
  * @param handle  Phone capability for the call.
- * @param data    Userspace address of call data with the request.
+ * @param args    Interface, method and arguments of the call.
  * @param label   User-defined label.
  *
  * @return See sys_ipc_call_async_fast().
  *
  */
-sys_errno_t sys_ipc_call_async_slow(cap_phone_handle_t handle, uspace_ptr_ipc_data_t data,
-    sysarg_t label)
+static errno_t call_async_slow(cap_phone_handle_t handle,
+    const sysarg_t args[IPC_CALL_LEN], sysarg_t label)
 {
 	kobject_t *kobj = kobject_get(TASK, handle, KOBJECT_TYPE_PHONE);
 	if (!kobj)
@@ -436,13 +438,7 @@ sys_errno_t sys_ipc_call_async_slow(cap_phone_handle_t handle, uspace_ptr_ipc_da
 		return ENOMEM;
 	}
 
-	errno_t rc = copy_from_uspace(&call->data.args, data + offsetof(ipc_data_t, args),
-	    sizeof(call->data.args));
-	if (rc != EOK) {
-		kobject_put(call->kobject);
-		kobject_put(kobj);
-		return (sys_errno_t) rc;
-	}
+	memcpy(call->data.args, args, sizeof(call->data.args));
 
 	/* Set the user-defined label */
 	call->data.answer_label = label;
@@ -458,6 +454,69 @@ sys_errno_t sys_ipc_call_async_slow(cap_phone_handle_t handle, uspace_ptr_ipc_da
 	return EOK;
 }
 
+/** Make an asynchronous IPC call allowing to transmit the entire payload.
+ *
+ * @param handle  Phone capability for the call.
+ * @param data    Userspace address of call data with the request.
+ * @param label   User-defined label.
+ *
+ * @return See sys_ipc_call_async_fast().
+ *
+ */
+sys_errno_t sys_ipc_call_async_slow(cap_phone_handle_t handle, uspace_ptr_ipc_data_t data,
+    sysarg_t label)
+{
+	sysarg_t args[IPC_CALL_LEN];
+
+	errno_t rc = copy_from_uspace(args, data + offsetof(ipc_data_t, args),
+	    sizeof(args));
+	if (rc != EOK)
+		return (sys_errno_t) rc;
+
+	return (sys_errno_t) call_async_slow(handle, args, label);
+}
+
+/** Make a batch of asynchronous IPC calls.
+ *
+ * The calls are made in order, as if by sys_ipc_call_async_slow() each.
+ * The error code of each call is stored in its rc field.
+ *
+ * @param calls Userspace address of the array of calls.
+ * @param count Number of calls, at most IPC_BATCH_MAX.
+ *
+ * @return EOK if all the calls have been processed, EINVAL if @a count is
+ *         too big or an error code if @a calls is not accessible. The calls
+ *         processed before the error have been made.
+ *
+ */
+sys_errno_t sys_ipc_call_async_batch(uspace_ptr_ipc_batch_call_t calls,
+    size_t count)
+{
+	if (count > IPC_BATCH_MAX)
+		return EINVAL;
+
+	for (size_t i = 0; i < count; i++) {
+		uspace_ptr_ipc_batch_call_t ucall =
+		    calls + i * sizeof(ipc_batch_call_t);
+		ipc_batch_call_t batch_call;
+
+		errno_t rc = copy_from_uspace(&batch_call, ucall,
+		    sizeof(batch_call));
+		if (rc != EOK)
+			return (sys_errno_t) rc;
+
+		batch_call.rc = call_async_slow(batch_call.phone,
+		    batch_call.args, batch_call.label);
+
+		rc = copy_to_uspace(ucall + offsetof(ipc_batch_call_t, rc),
+		    &batch_call.rc, sizeof(batch_call.rc));
+		if (rc != EOK)
+			return (sys_errno_t) rc;
+	}
+
+	return EOK;
+}
+
 /** Forward a received call to another destination
  *
  * Common code for both the fast and the slow version.
@@ -691,15 +750,17 @@ sys_errno_t sys_ipc_answer_fast(cap_call_handle_t chandle, sysarg_t retval,
 	return rc;
 }
 
-/** Answer an IPC call.
+/** Answer an IPC call with the data of the answer taken from userspace.
  *
  * @param chandle Call handle to be answered.
  * @param data    Userspace address of call data with the answer.
+ * @param result  Place to store the result of answer_preprocess() to.
  *
- * @return 0 on success, otherwise an error code.
+ * @return EOK if the call was answered, otherwise an error code.
  *
  */
-sys_errno_t sys_ipc_answer_slow(cap_call_handle_t chandle, uspace_ptr_ipc_data_t data)
+static errno_t answer_slow(cap_call_handle_t chandle,
+    uspace_ptr_ipc_data_t data, errno_t *result)
 {
 	kobject_t *kobj = cap_unpublish(TASK, chandle, KOBJECT_TYPE_CALL);
 	if (!kobj)
@@ -727,14 +788,32 @@ sys_errno_t sys_ipc_answer_slow(cap_call_handle_t chandle, uspace_ptr_ipc_data_t
 		return rc;
 	}
 
-	rc = answer_preprocess(call, saved ? &saved_data : NULL);
+	*result = answer_preprocess(call, saved ? &saved_data : NULL);
 
 	ipc_answer(&TASK->answerbox, call);
 
 	kobject_put(kobj);
 	cap_free(TASK, chandle);
 
-	return rc;
+	return EOK;
+}
+
+/** Answer an IPC call.
+ *
+ * @param chandle Call handle to be answered.
+ * @param data    Userspace address of call data with the answer.
+ *
+ * @return 0 on success, otherwise an error code.
+ *
+ */
+sys_errno_t sys_ipc_answer_slow(cap_call_handle_t chandle, uspace_ptr_ipc_data_t data)
+{
+	errno_t result;
+	errno_t rc = answer_slow(chandle, data, &result);
+	if (rc != EOK)
+		return rc;
+
+	return result;
 }
 
 /** Hang up a phone.
@@ -770,6 +849,18 @@ sys_errno_t sys_ipc_wait_for_call(uspace_ptr_ipc_data_t calldata, uint32_t usec,
 {
 	call_t *call = NULL;
 	errno_t rc;
+
+	/*
+	 * User space measures its timeouts against the uptime, which only
+	 * advances on clock ticks. Round the timeout up to whole ticks so
+	 * that the uptime has passed the deadline once the timeout expires,
+	 * rather than the waiter coming back early over and over again.
+	 */
+	if ((usec != SYNCH_NO_TIMEOUT) && (usec < UINT32_MAX - 1000000 / HZ)) {
+		usec = (usec + 1000000 / HZ - 1) / (1000000 / HZ) *
+		    (1000000 / HZ);
+	}
+
 restart:
 
 #ifdef CONFIG_UDEBUG
@@ -865,6 +956,201 @@ error:
 	return rc;
 }
 
+/** Get the wait queue of the answerbox a phone is connected to.
+ *
+ * The result only names the target of a handoff and is never dereferenced,
+ * so it does not matter if the phone gets hung up in the meantime.
+ *
+ * @param handle Phone capability.
+ *
+ * @return Wait queue of the callee or NULL if there is none.
+ *
+ */
+static waitq_t *handoff_phone_target(cap_phone_handle_t handle)
+{
+	kobject_t *kobj = kobject_get(TASK, handle, KOBJECT_TYPE_PHONE);
+	if (!kobj)
+		return NULL;
+
+	phone_t *phone = kobj->phone;
+	waitq_t *wq = NULL;
+
+	mutex_lock(&phone->lock);
+	if ((phone->state == IPC_PHONE_CONNECTED) && (phone->callee != NULL))
+		wq = &phone->callee->wq;
+	mutex_unlock(&phone->lock);
+
+	kobject_put(kobj);
+	return wq;
+}
+
+/** Get the wait queue of the answerbox the answer to a call goes to.
+ *
+ * @param chandle Call capability.
+ *
+ * @return Wait queue of the caller or NULL if there is no such call.
+ *
+ */
+static waitq_t *handoff_call_target(cap_call_handle_t chandle)
+{
+	kobject_t *kobj = kobject_get(TASK, chandle, KOBJECT_TYPE_CALL);
+	if (!kobj)
+		return NULL;
+
+	call_t *call = kobj->call;
+	answerbox_t *callerbox = call->callerbox ? call->callerbox :
+	    &call->sender->answerbox;
+
+	kobject_put(kobj);
+	return &callerbox->wq;
+}
+
+/** Wait for an incoming IPC call or an answer after handing off the CPU.
+ *
+ * Completes the handoff started by the caller. If the wait does not
+ * return a call or an answer, a null call is stored instead. Its return
+ * value is the error code sys_ipc_wait_for_call() failed with.
+ *
+ * @param calldata Pointer to buffer where the call/answer data is stored.
+ * @param usec     Timeout. See waitq_sleep_timeout() for explanation.
+ * @param flags    Select mode of sleep operation. See waitq_sleep_timeout()
+ *                 for explanation.
+ *
+ * @return EOK on success or an error code if @a calldata is not writable.
+ */
+static sys_errno_t wait_for_call_handoff(uspace_ptr_ipc_data_t calldata,
+    uint32_t usec, unsigned int flags)
+{
+	sys_errno_t rc = sys_ipc_wait_for_call(calldata, usec, flags);
+	thread_handoff_end();
+
+	if (rc != EOK) {
+		ipc_data_t null_call;
+
+		memsetb(&null_call, sizeof(null_call), 0);
+		ipc_set_retval(&null_call, rc);
+		null_call.cap_handle = CAP_NIL;
+
+		return STRUCT_TO_USPACE(calldata, &null_call);
+	}
+
+	return EOK;
+}
+
+/** Make an IPC call and wait for an incoming call or an answer.
+ *
+ * This combines sys_ipc_call_async_slow() and sys_ipc_wait_for_call() into
+ * a single system call. Since the calling thread is going to block, the
+ * thread of the recipient, if woken up from its answerbox by the call, is
+ * handed the CPU directly.
+ *
+ * @param handle   Phone capability for the call.
+ * @param data     Userspace address of call data with the request.
+ * @param label    User-defined label.
+ * @param calldata Pointer to buffer where the call/answer data is stored.
+ * @param usec     Timeout. See waitq_sleep_timeout() for explanation.
+ * @param flags    Select mode of sleep operation. See waitq_sleep_timeout()
+ *                 for explanation.
+ *
+ * @return EOK if the call was made. The received call or answer is stored
+ *         in @a calldata, or a null call if the wait did not return any.
+ * @return An error code if the call could not be made. No wait is done
+ *         and @a calldata is left untouched.
+ *
+ */
+sys_errno_t sys_ipc_call_wait(cap_phone_handle_t handle,
+    uspace_ptr_ipc_data_t data, sysarg_t label,
+    uspace_ptr_ipc_data_t calldata, uint32_t usec, unsigned int flags)
+{
+	thread_handoff_begin(handoff_phone_target(handle));
+
+	sys_errno_t rc = sys_ipc_call_async_slow(handle, data, label);
+	if (rc != EOK) {
+		thread_handoff_end();
+		return rc;
+	}
+
+	return wait_for_call_handoff(calldata, usec, flags);
+}
+
+/** Answer an IPC call and wait for an incoming call or an answer.
+ *
+ * This combines sys_ipc_answer_slow() and sys_ipc_wait_for_call() into
+ * a single system call. Since the calling thread is going to block, the
+ * thread of the caller, if woken up from its answerbox by the answer, is
+ * handed the CPU directly.
+ *
+ * Errors detected while processing the answer are not reported, as the
+ * call is answered nevertheless.
+ *
+ * @param chandle  Call handle to be answered.
+ * @param data     Userspace address of call data with the answer.
+ * @param calldata Pointer to buffer where the call/answer data is stored.
+ * @param usec     Timeout. See waitq_sleep_timeout() for explanation.
+ * @param flags    Select mode of sleep operation. See waitq_sleep_timeout()
+ *                 for explanation.
+ *
+ * @return EOK if the call was answered. The received call or answer is
+ *         stored in @a calldata, or a null call if the wait did not
+ *         return any.
+ * @return An error code if the call could not be answered. No wait is
+ *         done and @a calldata is left untouched.
+ *
+ */
+sys_errno_t sys_ipc_answer_wait(cap_call_handle_t chandle,
+    uspace_ptr_ipc_data_t data, uspace_ptr_ipc_data_t calldata,
+    uint32_t usec, unsigned int flags)
+{
+	thread_handoff_begin(handoff_call_target(chandle));
+
+	errno_t result;
+	errno_t rc = answer_slow(chandle, data, &result);
+	if (rc != EOK) {
+		thread_handoff_end();
+		return rc;
+	}
+
+	return wait_for_call_handoff(calldata, usec, flags);
+}
+
+/** Wait for a batch of incoming IPC calls or answers.
+ *
+ * Waits for the first call or answer as sys_ipc_wait_for_call() and then
+ * collects those which are already pending, without blocking.
+ *
+ * @param calldata Pointer to the array where the call/answer data is stored.
+ * @param count    Number of entries of @a calldata, at most IPC_BATCH_MAX.
+ * @param received Pointer to where the number of received calls/answers is
+ *                 stored.
+ * @param usec     Timeout. See waitq_sleep_timeout() for explanation.
+ * @param flags    Select mode of sleep operation. See waitq_sleep_timeout()
+ *                 for explanation.
+ *
+ * @return EOK if at least one call or answer was received, EINVAL if
+ *         @a count is out of range or an error code of the first wait.
+ *
+ */
+sys_errno_t sys_ipc_wait_batch(uspace_ptr_ipc_data_t calldata, size_t count,
+    uspace_ptr_size_t received, uint32_t usec, unsigned int flags)
+{
+	if ((count == 0) || (count > IPC_BATCH_MAX))
+		return EINVAL;
+
+	sys_errno_t rc = sys_ipc_wait_for_call(calldata, usec, flags);
+	if (rc != EOK)
+		return rc;
+
+	size_t i;
+	for (i = 1; i < count; i++) {
+		rc = sys_ipc_wait_for_call(calldata + i * sizeof(ipc_data_t),
+		    SYNCH_NO_TIMEOUT, SYNCH_FLAGS_NON_BLOCKING);
+		if (rc != EOK)
+			break;
+	}
+
+	return (sys_errno_t) copy_to_uspace(received, &i, sizeof(i));
+}
+
 /** Interrupt one thread from sys_ipc_wait_for_call().
  *
  */
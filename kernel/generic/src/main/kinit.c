@@ -58,6 +58,7 @@
 #include <mm/as.h>
 #include <mm/frame.h>
 #include <mm/km.h>
+#include <mm/zero.h>
 #include <stdio.h>
 #include <log.h>
 #include <mem.h>
@@ -159,6 +160,31 @@ void kinit(void *arg)
 	else
 		log(LF_OTHER, LVL_ERROR, "Unable to create kload thread");
 
+	/*
+	 * For each CPU, create its thread zeroing frames for anonymous
+	 * memory.
+	 */
+	for (unsigned int i = 0; i < config.cpu_count; i++) {
+		thread = thread_create(kzero, NULL, TASK, THREAD_FLAG_NONE,
+		    "kzero");
+		if (thread != NULL) {
+			thread_wire(thread, &cpus[i]);
+			thread_ready(thread);
+		} else
+			log(LF_OTHER, LVL_ERROR,
+			    "Unable to create kzero thread for cpu%u", i);
+	}
+
+#ifdef LARGE_PAGE_WIDTH
+	/* Start thread promoting large pages of anonymous memory */
+	thread = thread_create(kpromote, NULL, TASK, THREAD_FLAG_NONE,
+	    "kpromote");
+	if (thread != NULL)
+		thread_ready(thread);
+	else
+		log(LF_OTHER, LVL_ERROR, "Unable to create kpromote thread");
+#endif
+
 #ifdef CONFIG_KCONSOLE
 	if (stdin) {
 		/*
@@ -256,6 +256,9 @@ void main_bsp_separated_stack(void)
 	ddi_init();
 	ARCH_OP(post_mm_init);
 	reserve_init();
+#ifdef LARGE_PAGE_WIDTH
+	anon_promote_init();
+#endif
 	ARCH_OP(pre_smp_init);
 	smp_init();
 
@@ -53,6 +53,8 @@
 #include <mm/frame.h>
 #include <mm/slab.h>
 #include <mm/tlb.h>
+#include <mm/zero.h>
+#include <mm/reserve.h>
 #include <arch/mm/page.h>
 #include <genarch/mm/page_pt.h>
 #include <genarch/mm/page_ht.h>
@@ -64,6 +66,7 @@
 #include <adt/list.h>
 #include <proc/task.h>
 #include <proc/thread.h>
+#include <cpu/cpu_mask.h>
 #include <arch/asm.h>
 #include <panic.h>
 #include <assert.h>
@@ -132,6 +135,7 @@ _NO_TRACE static errno_t as_constructor(void *obj, unsigned int flags)
 
 	link_initialize(&as->inactive_as_with_asid_link);
 	mutex_initialize(&as->lock, MUTEX_PASSIVE);
+	irq_spinlock_initialize(&as->tlb_lock, "as->tlb_lock");
 
 	return as_constructor_arch(as, flags);
 }
@@ -172,6 +176,20 @@ as_t *as_create(unsigned int flags)
 	if (!as)
 		return NULL;
 
+	/*
+	 * The kernel address space is active on all CPUs, which are not
+	 * even known at this point.
+	 */
+	as->cpu_mask = NULL;
+	if (!(flags & FLAG_AS_KERNEL)) {
+		as->cpu_mask = malloc(cpu_mask_size());
+		if (!as->cpu_mask) {
+			slab_free(as_cache, as);
+			return NULL;
+		}
+		cpu_mask_none(as->cpu_mask);
+	}
+
 	(void) as_create_arch(as, 0);
 
 	odict_initialize(&as->as_areas, as_areas_getkey, as_areas_cmp);
@@ -186,6 +204,9 @@ as_t *as_create(unsigned int flags)
 
 #ifdef AS_PAGE_TABLE
 	as->genarch.page_table = page_table_create(flags);
+#ifdef LARGE_PAGE_WIDTH
+	as->genarch.large_tables = NULL;
+#endif
 #else
 	page_table_create(flags);
 #endif
@@ -264,11 +285,16 @@ retry:
 	odict_finalize(&as->as_areas);
 
 #ifdef AS_PAGE_TABLE
+#ifdef LARGE_PAGE_WIDTH
+	/* All large pages have been split when their areas were destroyed. */
+	assert(as->genarch.large_tables == NULL);
+#endif
 	page_table_destroy(as->genarch.page_table);
 #else
 	page_table_destroy(NULL);
 #endif
 
+	free(as->cpu_mask);
 	slab_free(as_cache, as);
 }
 
@@ -761,11 +787,22 @@ as_area_t *as_area_create(as_t *as, unsigned int flags, size_t size,
 	mutex_lock(&as->lock);
 
 	if (*base == (uintptr_t) AS_AREA_ANY) {
-		*base = as_get_unmapped_area(as, bound, size, guarded);
+		size_t align = PAGE_SIZE;
+
+#ifdef LARGE_PAGE_WIDTH
+		/* Align areas which ask for large pages on a large page. */
+		if ((flags & AS_AREA_LARGE_PAGES) && (size >= LARGE_PAGE_SIZE))
+			align = LARGE_PAGE_SIZE;
+#endif
+
+		*base = as_get_unmapped_area(as, bound,
+		    size + align - PAGE_SIZE, guarded);
 		if (*base == (uintptr_t) -1) {
 			mutex_unlock(&as->lock);
 			return NULL;
 		}
+
+		*base = ALIGN_UP(*base, align);
 	}
 
 	if (overflows_into_positive(*base, size)) {
@@ -794,6 +831,8 @@ as_area_t *as_area_create(as_t *as, unsigned int flags, size_t size,
 	area->base = *base;
 	area->backend = backend;
 	area->sh_info = NULL;
+	area->fault_next = 0;
+	area->fault_window = AS_FAULT_AROUND_MIN;
 
 	if (backend_data)
 		area->backend_data = *backend_data;
@@ -860,7 +899,7 @@ as_area_t *as_area_create(as_t *as, unsigned int flags, size_t size,
  *         NULL on failure.
  *
  */
-_NO_TRACE static as_area_t *find_area_and_lock(as_t *as, uintptr_t va)
+_NO_TRACE as_area_t *find_area_and_lock(as_t *as, uintptr_t va)
 {
 	assert(mutex_locked(&as->lock));
 
@@ -954,7 +993,7 @@ errno_t as_area_resize(as_t *as, uintptr_t address, size_t size, unsigned int fl
 		 * Start TLB shootdown sequence.
 		 */
 
-		ipl_t ipl = tlb_shootdown_start(TLB_INVL_PAGES,
+		ipl_t ipl = tlb_shootdown_start(TLB_INVL_PAGES, as,
 		    as->asid, area->base + P2SZ(pages),
 		    area->pages - pages);
 
@@ -1104,8 +1143,8 @@ errno_t as_area_destroy(as_t *as, uintptr_t address)
 	/*
 	 * Start TLB shootdown sequence.
 	 */
-	ipl_t ipl = tlb_shootdown_start(TLB_INVL_PAGES, as->asid, area->base,
-	    area->pages);
+	ipl_t ipl = tlb_shootdown_start(TLB_INVL_PAGES, as, as->asid,
+	    area->base, area->pages);
 
 	/*
 	 * Visit only the pages mapped by used_space.
@@ -1404,8 +1443,8 @@ errno_t as_area_change_flags(as_t *as, unsigned int flags, uintptr_t address)
 	/*
 	 * Start TLB shootdown sequence.
 	 */
-	ipl_t ipl = tlb_shootdown_start(TLB_INVL_PAGES, as->asid, area->base,
-	    area->pages);
+	ipl_t ipl = tlb_shootdown_start(TLB_INVL_PAGES, as, as->asid,
+	    area->base, area->pages);
 
 	/*
 	 * Remove used pages from page tables and remember their frame
@@ -1470,11 +1509,21 @@ errno_t as_area_change_flags(as_t *as, unsigned int flags, uintptr_t address)
 		size_t size;
 
 		for (size = 0; size < ival->count; size++) {
+			uintptr_t frame = old_frame[frame_idx++];
+			unsigned int pflags = page_flags;
+
+			/*
+			 * Frames loaned by as_pages_loan() must stay
+			 * write-protected until they are copied.
+			 */
+			if (frame_reference_count(ADDR2PFN(frame)) > 1)
+				pflags &= ~PAGE_WRITE;
+
 			page_table_lock(as, false);
 
 			/* Insert the new mapping */
-			page_mapping_insert(as, ptr + P2SZ(size),
-			    old_frame[frame_idx++], page_flags);
+			page_mapping_insert(as, ptr + P2SZ(size), frame,
+			    pflags);
 
 			page_table_unlock(as, false);
 		}
@@ -1490,6 +1539,242 @@ errno_t as_area_change_flags(as_t *as, unsigned int flags, uintptr_t address)
 	return 0;
 }
 
+/** Find a private anonymous area suitable for loaning pages and lock it.
+ *
+ * Pages can only be loaned from or to areas which are neither shared nor
+ * late-reserved, so that no pagemap and no per-page reservation refers to
+ * the loaned frames.
+ *
+ * @param as    Locked address space.
+ * @param page  First page of the range.
+ * @param count Number of pages in the range.
+ *
+ * @return Locked address space area containing the whole range or NULL.
+ *
+ */
+static as_area_t *as_pages_area_lock(as_t *as, uintptr_t page, size_t count)
+{
+	as_area_t *area = find_area_and_lock(as, page);
+	if (!area)
+		return NULL;
+
+	if ((area->backend != &anon_backend) ||
+	    (area->flags & AS_AREA_LATE_RESERVE) ||
+	    ((area->flags & (AS_AREA_READ | AS_AREA_WRITE)) !=
+	    (AS_AREA_READ | AS_AREA_WRITE)) ||
+	    (count > area->pages) ||
+	    (page - area->base > P2SZ(area->pages - count))) {
+		mutex_unlock(&area->lock);
+		return NULL;
+	}
+
+	mutex_lock(&area->sh_info->lock);
+	bool shared = area->sh_info->shared;
+	mutex_unlock(&area->sh_info->lock);
+
+	if (shared) {
+		mutex_unlock(&area->lock);
+		return NULL;
+	}
+
+	return area;
+}
+
+/** Loan the frames of a range of pages copy-on-write.
+ *
+ * Each mapped page of the range is write-protected and its frame gets an
+ * additional reference, which is handed over to the caller. Whoever writes
+ * to the page first, be it the owner of the range or a borrower mapping the
+ * frame using as_pages_give(), gets a copy of it in the anonymous backend.
+ * Pages which are not mapped yet read as zeros, so they contribute a fresh
+ * zeroed frame instead.
+ *
+ * The references held by the caller are reserved on top of the memory
+ * reserved for the area, as they may outlive the mapping of the frames in
+ * the area. The caller must drop each of them and its reservation using
+ * frame_free_noreserve() and reserve_free(), or pass it to as_pages_give().
+ *
+ * @param as     Address space.
+ * @param page   First page of the range.
+ * @param count  Number of pages in the range.
+ * @param frames Array which receives @a count frames.
+ *
+ * @return EOK on success.
+ * @return ENOTSUP if the range does not lie within a private
+ *         anonymous area.
+ * @return ENOMEM if the frames cannot be reserved.
+ *
+ */
+errno_t as_pages_loan(as_t *as, uintptr_t page, size_t count,
+    uintptr_t *frames)
+{
+	assert(IS_ALIGNED(page, PAGE_SIZE));
+
+	mutex_lock(&as->lock);
+
+	as_area_t *area = as_pages_area_lock(as, page, count);
+	if (!area) {
+		mutex_unlock(&as->lock);
+		return ENOTSUP;
+	}
+
+	if (!reserve_try_alloc(count)) {
+		mutex_unlock(&area->lock);
+		mutex_unlock(&as->lock);
+		return ENOMEM;
+	}
+
+	unsigned int flags = as_area_get_flags(area) & ~PAGE_WRITE;
+
+	page_table_lock(as, false);
+
+	for (size_t i = 0; i < count; i++) {
+		uintptr_t addr = page + P2SZ(i);
+		pte_t pte;
+
+		if (page_mapping_find(as, addr, false, &pte) &&
+		    PTE_PRESENT(&pte)) {
+			frames[i] = PTE_GET_FRAME(&pte);
+			frame_reference_add(ADDR2PFN(frames[i]));
+			if (PTE_WRITABLE(&pte))
+				page_mapping_insert(as, addr, frames[i], flags);
+		} else {
+			frames[i] = zero_frame_alloc(FRAME_NO_RESERVE);
+		}
+	}
+
+	ipl_t ipl = tlb_shootdown_start(TLB_INVL_PAGES, as, as->asid,
+	    page, count);
+	tlb_invalidate_pages(as->asid, page, count);
+	as_invalidate_translation_cache(as, page, count);
+	tlb_shootdown_finalize(ipl);
+
+	page_table_unlock(as, false);
+
+	mutex_unlock(&area->lock);
+	mutex_unlock(&as->lock);
+
+	return EOK;
+}
+
+/** Map loaned frames copy-on-write to a range of pages of an address space.
+ *
+ * The frames replace whatever the pages were mapped to before and are
+ * mapped read-only, so that the first write to them makes a copy. The
+ * frames previously mapped lose a reference. On success, the address space
+ * holds the references to the frames and the entries of @a frames are
+ * cleared. The reservation made for the references by as_pages_loan() is
+ * released, as the area has its own.
+ *
+ * @param as     Address space.
+ * @param page   First page of the range.
+ * @param count  Number of pages in the range.
+ * @param frames Array of @a count frames obtained from as_pages_loan().
+ *
+ * @return EOK on success.
+ * @return ENOTSUP if the range does not lie within a private
+ *         anonymous area.
+ *
+ */
+errno_t as_pages_give(as_t *as, uintptr_t page, size_t count,
+    uintptr_t *frames)
+{
+	assert(IS_ALIGNED(page, PAGE_SIZE));
+
+	mutex_lock(&as->lock);
+
+	as_area_t *area = as_pages_area_lock(as, page, count);
+	if (!area) {
+		mutex_unlock(&as->lock);
+		return ENOTSUP;
+	}
+
+	unsigned int flags = as_area_get_flags(area) & ~PAGE_WRITE;
+
+	page_table_lock(as, false);
+
+	/*
+	 * Swap the new frames into the page tables and the old ones into the
+	 * array.
+	 */
+	for (size_t i = 0; i < count; i++) {
+		uintptr_t addr = page + P2SZ(i);
+		uintptr_t frame = frames[i];
+		pte_t pte;
+
+		if (page_mapping_find(as, addr, false, &pte) &&
+		    PTE_PRESENT(&pte)) {
+			frames[i] = PTE_GET_FRAME(&pte);
+		} else {
+			frames[i] = 0;
+			if (!used_space_insert(&area->used_space, addr, 1))
+				panic("Cannot insert used space.");
+		}
+
+		page_mapping_insert(as, addr, frame, flags);
+	}
+
+	ipl_t ipl = tlb_shootdown_start(TLB_INVL_PAGES, as, as->asid,
+	    page, count);
+	tlb_invalidate_pages(as->asid, page, count);
+	as_invalidate_translation_cache(as, page, count);
+	tlb_shootdown_finalize(ipl);
+
+	page_table_unlock(as, false);
+
+	mutex_unlock(&area->lock);
+	mutex_unlock(&as->lock);
+
+	/* No stale TLB entry refers to the old frames any more. */
+	for (size_t i = 0; i < count; i++) {
+		if (frames[i] != 0) {
+			frame_free_noreserve(frames[i], 1);
+			frames[i] = 0;
+		}
+	}
+
+	reserve_free(count);
+
+	return EOK;
+}
+
+/** Map pages following a serviced page fault.
+ *
+ * The faults of an area which keep hitting the page right after the pages
+ * mapped by the previous fault are considered sequential and make the
+ * window of pages mapped ahead grow. The backend maps only pages it can
+ * supply without allocating memory, unless the access is sequential.
+ *
+ * The address space area and page tables must be already locked.
+ *
+ * @param area Address space area of the page fault.
+ * @param page Faulting page.
+ *
+ */
+static void as_area_fault_around(as_area_t *area, uintptr_t page)
+{
+	if (!area->backend->page_fault_around)
+		return;
+
+	bool sequential = (page == area->fault_next);
+
+	if (sequential) {
+		area->fault_window = min(2 * area->fault_window,
+		    AS_FAULT_AROUND_MAX);
+	} else
+		area->fault_window = AS_FAULT_AROUND_MIN;
+
+	size_t rest = area->pages - ((page - area->base) >> PAGE_WIDTH) - 1;
+	size_t mapped = 0;
+
+	if (rest > 0) {
+		mapped = area->backend->page_fault_around(area,
+		    page + PAGE_SIZE, min(area->fault_window, rest), sequential);
+	}
+
+	area->fault_next = page + P2SZ(mapped + 1);
+}
+
 /** Handle page fault within the current address space.
  *
  * This is the high-level page fault handler. It decides whether the page fault
@@ -1581,9 +1866,17 @@ int as_page_fault(uintptr_t address, pf_access_t access, istate_t *istate)
 		goto page_fault;
 	}
 
+	as_area_fault_around(area, page);
+
 	page_table_unlock(AS, false);
 	mutex_unlock(&area->lock);
 	mutex_unlock(&AS->lock);
+
+	/* Count serviced page fault */
+	irq_spinlock_lock(&TASK->lock, true);
+	TASK->page_faults++;
+	irq_spinlock_unlock(&TASK->lock, true);
+
 	return AS_PF_OK;
 
 page_fault:
@@ -1675,6 +1968,19 @@ retry:
 			new_as->asid = asid_get();
 	}
 
+	/*
+	 * Make this CPU a target of the address space's TLB shootdowns. If it
+	 * is not one yet, wait for a shootdown in progress to finish first,
+	 * as it will not invalidate the translations this CPU is about to
+	 * cache.
+	 */
+	if ((new_as != AS_KERNEL) &&
+	    (!cpu_mask_is_set(new_as->cpu_mask, CPU->id))) {
+		tlb_as_lock(new_as);
+		cpu_mask_set(new_as->cpu_mask, CPU->id);
+		irq_spinlock_unlock(&new_as->tlb_lock, false);
+	}
+
 #ifdef AS_PAGE_TABLE
 	SET_PTL0_ADDRESS(new_as->genarch.page_table);
 #endif
@@ -1954,6 +2260,31 @@ used_space_ival_t *used_space_find_gteq(used_space_t *used_space, uintptr_t ptr)
 	return NULL;
 }
 
+/** Count used pages within a range of pages.
+ *
+ * @param used_space Used space map
+ * @param page First page of the range
+ * @param count Number of pages in the range
+ *
+ * @return Number of used pages within the range
+ */
+size_t used_space_count(used_space_t *used_space, uintptr_t page, size_t count)
+{
+	uintptr_t end = page + P2SZ(count);
+	size_t used = 0;
+
+	used_space_ival_t *ival = used_space_find_gteq(used_space, page);
+	while ((ival != NULL) && (ival->page < end)) {
+		uintptr_t ival_end = ival->page + P2SZ(ival->count);
+
+		used += (min(ival_end, end) - max(ival->page, page)) >>
+		    PAGE_WIDTH;
+		ival = used_space_next(ival);
+	}
+
+	return used;
+}
+
 /** Get key function for used space ordered dictionary.
  *
  * The key is the virtual address of the first page
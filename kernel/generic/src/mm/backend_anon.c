@@ -45,12 +45,18 @@
 #include <mm/frame.h>
 #include <mm/slab.h>
 #include <mm/km.h>
+#include <mm/tlb.h>
+#include <mm/zero.h>
 #include <synch/mutex.h>
+#include <synch/spinlock.h>
+#include <synch/waitq.h>
+#include <proc/thread.h>
 #include <adt/list.h>
 #include <errno.h>
 #include <typedefs.h>
 #include <align.h>
 #include <mem.h>
+#include <config.h>
 #include <arch.h>
 
 static bool anon_create(as_area_t *);
@@ -62,6 +68,7 @@ static bool anon_is_resizable(as_area_t *);
 static bool anon_is_shareable(as_area_t *);
 
 static int anon_page_fault(as_area_t *, uintptr_t, pf_access_t);
+static size_t anon_page_fault_around(as_area_t *, uintptr_t, size_t, bool);
 static void anon_frame_free(as_area_t *, uintptr_t, uintptr_t);
 
 mem_backend_t anon_backend = {
@@ -74,6 +81,7 @@ mem_backend_t anon_backend = {
 	.is_shareable = anon_is_shareable,
 
 	.page_fault = anon_page_fault,
+	.page_fault_around = anon_page_fault_around,
 	.frame_free = anon_frame_free,
 
 	.create_shared_data = NULL,
@@ -101,6 +109,59 @@ bool anon_resize(as_area_t *area, size_t new_pages)
 	return true;
 }
 
+/** Give a write-protected page of a private area a frame of its own.
+ *
+ * Pages loaned by as_pages_loan() or mapped by as_pages_give() are
+ * write-protected as their frames may be referenced from elsewhere. The
+ * page is copied to a new frame, unless its frame is not referenced from
+ * anywhere else any more, and mapped writable.
+ *
+ * The address space area and page tables must be already locked.
+ *
+ * @param area  Pointer to the address space area.
+ * @param upage Virtual page.
+ * @param frame Frame the page is mapped to.
+ *
+ * @return Frame the page is mapped to now.
+ */
+static uintptr_t anon_page_unshare(as_area_t *area, uintptr_t upage,
+    uintptr_t frame)
+{
+	as_t *as = area->as;
+	uintptr_t copy = frame;
+
+	assert(page_table_locked(as));
+	assert(mutex_locked(&area->lock));
+
+	/*
+	 * Nobody can add a reference to the frame without locking the page
+	 * tables, so if the reference of this area is the only one, it stays
+	 * the only one.
+	 */
+	if (frame_reference_count(ADDR2PFN(frame)) > 1) {
+		copy = frame_alloc(1, FRAME_NO_RESERVE, 0);
+
+		uintptr_t src = km_frame_map(frame);
+		uintptr_t dst = km_frame_map(copy);
+		memcpy((void *) dst, (void *) src, PAGE_SIZE);
+		km_frame_unmap(dst);
+		km_frame_unmap(src);
+	}
+
+	page_mapping_insert(as, upage, copy, as_area_get_flags(area));
+
+	ipl_t ipl = tlb_shootdown_start(TLB_INVL_PAGES, as, as->asid, upage,
+	    1);
+	tlb_invalidate_pages(as->asid, upage, 1);
+	as_invalidate_translation_cache(as, upage, 1);
+	tlb_shootdown_finalize(ipl);
+
+	if (copy != frame)
+		frame_free_noreserve(frame, 1);
+
+	return copy;
+}
+
 /** Share the anonymous address space area.
  *
  * Sharing of anonymous area is done by duplicating its entire mapping
@@ -139,12 +200,23 @@ void anon_share(as_area_t *area)
 			assert(PTE_VALID(&pte));
 			assert(PTE_PRESENT(&pte));
 
+			uintptr_t frame = PTE_GET_FRAME(&pte);
+
+			/*
+			 * Shared areas do not copy on write, so loaned frames
+			 * must be copied now.
+			 */
+			if ((area->flags & AS_AREA_WRITE) &&
+			    !PTE_WRITABLE(&pte)) {
+				frame = anon_page_unshare(area, base + P2SZ(j),
+				    frame);
+			}
+
 			as_pagemap_insert(&area->sh_info->pagemap,
-			    (base + P2SZ(j)) - area->base, PTE_GET_FRAME(&pte));
+			    (base + P2SZ(j)) - area->base, frame);
 			page_table_unlock(area->as, false);
 
-			pfn_t pfn = ADDR2PFN(PTE_GET_FRAME(&pte));
-			frame_reference_add(pfn);
+			frame_reference_add(ADDR2PFN(frame));
 		}
 
 		ival = used_space_next(ival);
@@ -170,6 +242,342 @@ bool anon_is_shareable(as_area_t *area)
 	return !(area->flags & AS_AREA_LATE_RESERVE);
 }
 
+#ifdef LARGE_PAGE_WIDTH
+
+/** Number of large pages which can wait for promotion. */
+#define PROMOTE_QUEUE_SIZE  64
+
+/** Large page waiting for promotion by kpromote. */
+typedef struct {
+	/** Address space of the large page, held by the request. */
+	as_t *as;
+	/** Virtual address of the large page. */
+	uintptr_t page;
+} promote_request_t;
+
+IRQ_SPINLOCK_STATIC_INITIALIZE_NAME(promote_lock, "promote_lock");
+
+/** Circular queue of large pages waiting for promotion. */
+static promote_request_t promote_queue[PROMOTE_QUEUE_SIZE];
+static size_t promote_head = 0;
+static size_t promote_count = 0;
+
+/** The kpromote thread sleeps here while the queue is empty. */
+static waitq_t promote_wq;
+
+/** Frames of the large page being promoted, only used by kpromote. */
+static uintptr_t promote_frames[LARGE_PAGE_PAGES];
+
+/** Check whether a large page lies within an address space area.
+ *
+ * @param area Pointer to the address space area.
+ * @param page Virtual address of the large page.
+ *
+ * @return True if the whole large page belongs to the area.
+ */
+static bool anon_large_page_fits(as_area_t *area, uintptr_t page)
+{
+	return (page >= area->base) &&
+	    (page - area->base + LARGE_PAGE_SIZE <= P2SZ(area->pages));
+}
+
+/** Try to map the whole large page containing a faulting page.
+ *
+ * This is only done in areas created with AS_AREA_LARGE_PAGES, if the large
+ * page lies within the area, none of its pages is mapped yet and a suitably
+ * aligned block of frames is readily available.
+ *
+ * The address space area and page tables must be already locked.
+ *
+ * @param area Pointer to the address space area.
+ * @param upage Faulting virtual page.
+ *
+ * @return True if the large page was mapped.
+ */
+static bool anon_large_page_fault(as_area_t *area, uintptr_t upage)
+{
+	uintptr_t page = ALIGN_DOWN(upage, LARGE_PAGE_SIZE);
+
+	if (!(area->flags & AS_AREA_LARGE_PAGES) ||
+	    (area->flags & AS_AREA_LATE_RESERVE))
+		return false;
+
+	if (!anon_large_page_fits(area, page))
+		return false;
+
+	if (used_space_count(&area->used_space, page, LARGE_PAGE_PAGES) > 0)
+		return false;
+
+	uintptr_t frame = frame_alloc(LARGE_PAGE_PAGES,
+	    FRAME_ATOMIC | FRAME_NO_RESERVE, LARGE_PAGE_SIZE - 1);
+	if (frame == 0)
+		return false;
+
+	for (size_t i = 0; i < LARGE_PAGE_PAGES; i++) {
+		uintptr_t kpage = km_frame_map(frame + P2SZ(i));
+		memsetb((void *) kpage, PAGE_SIZE, 0);
+		km_frame_unmap(kpage);
+	}
+
+	if (!page_mapping_insert_large(AS, page, frame,
+	    as_area_get_flags(area))) {
+		frame_free_noreserve(frame, LARGE_PAGE_PAGES);
+		return false;
+	}
+
+	if (!used_space_insert(&area->used_space, page, LARGE_PAGE_PAGES))
+		panic("Cannot insert used space.");
+
+	return true;
+}
+
+/** Check whether a large page can be promoted.
+ *
+ * Only private areas are promoted as the frames of shared areas are
+ * referenced from the pagemap.
+ *
+ * The address space area must be already locked.
+ *
+ * @param area Pointer to the address space area.
+ * @param page Virtual address of the large page.
+ *
+ * @return True if the large page lies within the area and all of its pages
+ *         are mapped.
+ */
+static bool anon_large_page_promotable(as_area_t *area, uintptr_t page)
+{
+	if (area->backend != &anon_backend)
+		return false;
+
+	if (!anon_large_page_fits(area, page))
+		return false;
+
+	if (used_space_count(&area->used_space, page, LARGE_PAGE_PAGES) <
+	    LARGE_PAGE_PAGES)
+		return false;
+
+	mutex_lock(&area->sh_info->lock);
+	bool shared = area->sh_info->shared;
+	mutex_unlock(&area->sh_info->lock);
+
+	return !shared;
+}
+
+/** Queue a fully populated large page for promotion by kpromote.
+ *
+ * The address space area and page tables must be already locked and
+ * @a upage must have just been mapped to an individual frame.
+ *
+ * @param area Pointer to the address space area.
+ * @param upage Recently mapped virtual page.
+ */
+static void anon_large_page_promote_request(as_area_t *area, uintptr_t upage)
+{
+	uintptr_t page = ALIGN_DOWN(upage, LARGE_PAGE_SIZE);
+
+	if (!anon_large_page_promotable(area, page))
+		return;
+
+	irq_spinlock_lock(&promote_lock, true);
+
+	if (promote_count == PROMOTE_QUEUE_SIZE) {
+		irq_spinlock_unlock(&promote_lock, true);
+		return;
+	}
+
+	as_hold(AS);
+	promote_queue[(promote_head + promote_count) % PROMOTE_QUEUE_SIZE] =
+	    (promote_request_t) { .as = AS, .page = page };
+	promote_count++;
+
+	irq_spinlock_unlock(&promote_lock, true);
+
+	waitq_wakeup(&promote_wq, WAKEUP_FIRST);
+}
+
+/** Promote a fully populated range of pages to a large page.
+ *
+ * The contents of the pages of the large page are copied to a newly
+ * allocated block of frames, which then replaces them. The pages are
+ * write-protected and the frames referenced while being copied, but no
+ * locks are held during the copy. Afterwards, the promotion only goes
+ * ahead if the pages are still mapped read-only to the same frames.
+ * Otherwise, they have been written to, unmapped or remapped meanwhile.
+ *
+ * @param as   Address space of the large page.
+ * @param page Virtual address of the large page.
+ */
+static void anon_large_page_promote(as_t *as, uintptr_t page)
+{
+	ipl_t ipl;
+	pte_t pte;
+	size_t i;
+
+	uintptr_t frame = frame_alloc(LARGE_PAGE_PAGES,
+	    FRAME_ATOMIC | FRAME_NO_RESERVE, LARGE_PAGE_SIZE - 1);
+	if (frame == 0)
+		return;
+
+	mutex_lock(&as->lock);
+	as_area_t *area = find_area_and_lock(as, page);
+	if ((area == NULL) || !anon_large_page_promotable(area, page)) {
+		if (area != NULL)
+			mutex_unlock(&area->lock);
+		mutex_unlock(&as->lock);
+		frame_free_noreserve(frame, LARGE_PAGE_PAGES);
+		return;
+	}
+
+	unsigned int flags = as_area_get_flags(area);
+	bool contiguous = true;
+	size_t count = 0;
+
+	page_table_lock(as, false);
+
+	for (i = 0; i < LARGE_PAGE_PAGES; i++) {
+		if (!page_mapping_find(as, page + P2SZ(i), false, &pte) ||
+		    !PTE_PRESENT(&pte))
+			break;
+
+		promote_frames[i] = PTE_GET_FRAME(&pte);
+		frame_reference_add(ADDR2PFN(promote_frames[i]));
+		count++;
+
+		if (promote_frames[i] != promote_frames[0] + P2SZ(i))
+			contiguous = false;
+	}
+
+	/* Skip large pages which are already promoted. */
+	bool promote = (count == LARGE_PAGE_PAGES) &&
+	    !(contiguous && IS_ALIGNED(promote_frames[0], LARGE_PAGE_SIZE));
+
+	if (promote && (flags & PAGE_WRITE)) {
+		for (i = 0; i < LARGE_PAGE_PAGES; i++) {
+			page_mapping_insert(as, page + P2SZ(i),
+			    promote_frames[i], flags & ~PAGE_WRITE);
+		}
+
+		ipl = tlb_shootdown_start(TLB_INVL_PAGES, as, as->asid, page,
+		    LARGE_PAGE_PAGES);
+		tlb_invalidate_pages(as->asid, page, LARGE_PAGE_PAGES);
+		as_invalidate_translation_cache(as, page, LARGE_PAGE_PAGES);
+		tlb_shootdown_finalize(ipl);
+	}
+
+	page_table_unlock(as, false);
+	mutex_unlock(&area->lock);
+	mutex_unlock(&as->lock);
+
+	if (!promote)
+		goto out;
+
+	for (i = 0; i < LARGE_PAGE_PAGES; i++) {
+		uintptr_t src = km_frame_map(promote_frames[i]);
+		uintptr_t dst = km_frame_map(frame + P2SZ(i));
+		memcpy((void *) dst, (void *) src, PAGE_SIZE);
+		km_frame_unmap(dst);
+		km_frame_unmap(src);
+	}
+
+	mutex_lock(&as->lock);
+	area = find_area_and_lock(as, page);
+	if ((area == NULL) || !anon_large_page_promotable(area, page) ||
+	    (as_area_get_flags(area) != flags)) {
+		if (area != NULL)
+			mutex_unlock(&area->lock);
+		mutex_unlock(&as->lock);
+		goto out;
+	}
+
+	page_table_lock(as, false);
+
+	for (i = 0; i < LARGE_PAGE_PAGES; i++) {
+		if (!page_mapping_find(as, page + P2SZ(i), false, &pte) ||
+		    !PTE_PRESENT(&pte) || PTE_WRITABLE(&pte) ||
+		    (PTE_GET_FRAME(&pte) != promote_frames[i]))
+			break;
+	}
+
+	if (i == LARGE_PAGE_PAGES) {
+		ipl = tlb_shootdown_start(TLB_INVL_PAGES, as, as->asid, page,
+		    LARGE_PAGE_PAGES);
+
+		for (i = 0; i < LARGE_PAGE_PAGES; i++) {
+			frame_free_noreserve(promote_frames[i], 1);
+			page_mapping_remove(as, page + P2SZ(i));
+		}
+
+		tlb_invalidate_pages(as->asid, page, LARGE_PAGE_PAGES);
+		as_invalidate_translation_cache(as, page, LARGE_PAGE_PAGES);
+		tlb_shootdown_finalize(ipl);
+
+		/*
+		 * The large page is mapped only after the shootdown as
+		 * mapping it may need to allocate memory. Without memory for
+		 * that, the copy is mapped page by page.
+		 */
+		if (!page_mapping_insert_large(as, page, frame, flags)) {
+			for (i = 0; i < LARGE_PAGE_PAGES; i++) {
+				page_mapping_insert(as, page + P2SZ(i),
+				    frame + P2SZ(i), flags);
+			}
+		}
+
+		frame = 0;
+	}
+
+	page_table_unlock(as, false);
+	mutex_unlock(&area->lock);
+	mutex_unlock(&as->lock);
+
+out:
+	for (i = 0; i < count; i++)
+		frame_free_noreserve(promote_frames[i], 1);
+
+	if (frame != 0)
+		frame_free_noreserve(frame, LARGE_PAGE_PAGES);
+}
+
+/** Initialize the promotion of large pages. */
+void anon_promote_init(void)
+{
+	waitq_initialize(&promote_wq);
+}
+
+/** Kernel thread promoting fully populated ranges to large pages.
+ *
+ * Promotion copies a whole large page, which is done here rather than in
+ * the page fault handler so as not to stall the faulting thread.
+ *
+ * @param arg Not used.
+ *
+ */
+void kpromote(void *arg)
+{
+	thread_detach(THREAD);
+
+	while (true) {
+		irq_spinlock_lock(&promote_lock, true);
+
+		if (promote_count == 0) {
+			irq_spinlock_unlock(&promote_lock, true);
+			waitq_sleep(&promote_wq);
+			continue;
+		}
+
+		promote_request_t req = promote_queue[promote_head];
+		promote_head = (promote_head + 1) % PROMOTE_QUEUE_SIZE;
+		promote_count--;
+
+		irq_spinlock_unlock(&promote_lock, true);
+
+		anon_large_page_promote(req.as, req.page);
+		as_release(req.as);
+	}
+}
+
+#endif /* LARGE_PAGE_WIDTH */
+
 /** Service a page fault in the anonymous memory address space area.
  *
  * The address space area and page tables must be already locked.
@@ -183,7 +591,6 @@ bool anon_is_shareable(as_area_t *area)
  */
 int anon_page_fault(as_area_t *area, uintptr_t upage, pf_access_t access)
 {
-	uintptr_t kpage;
 	uintptr_t frame;
 
 	assert(page_table_locked(AS));
@@ -206,10 +613,7 @@ int anon_page_fault(as_area_t *area, uintptr_t upage, pf_access_t access)
 		    upage - area->base, &frame);
 		if (rc != EOK) {
 			/* Need to allocate the frame */
-			kpage = km_temporary_page_get(&frame,
-			    FRAME_NO_RESERVE);
-			memsetb((void *) kpage, PAGE_SIZE, 0);
-			km_temporary_page_put(kpage);
+			frame = zero_frame_alloc(FRAME_NO_RESERVE);
 
 			/*
 			 * Insert the address of the newly allocated
@@ -229,6 +633,9 @@ int anon_page_fault(as_area_t *area, uintptr_t upage, pf_access_t access)
 		 *   area (e.g. heap or stack) and so far has not been
 		 *   allocated a frame for the faulting page
 		 *
+		 * - write to a write-protected page: the frame of the
+		 *   page has been loaned copy-on-write
+		 *
 		 * - non-present mapping: another possibility,
 		 *   currently not implemented, would be frame
 		 *   reuse; when this becomes a possibility,
@@ -236,6 +643,22 @@ int anon_page_fault(as_area_t *area, uintptr_t upage, pf_access_t access)
 		 *   the different causes
 		 */
 
+		pte_t pte;
+		if (page_mapping_find(AS, upage, false, &pte) &&
+		    PTE_PRESENT(&pte)) {
+			mutex_unlock(&area->sh_info->lock);
+			(void) anon_page_unshare(area, upage,
+			    PTE_GET_FRAME(&pte));
+			return AS_PF_OK;
+		}
+
+#ifdef LARGE_PAGE_WIDTH
+		if (anon_large_page_fault(area, upage)) {
+			mutex_unlock(&area->sh_info->lock);
+			return AS_PF_OK;
+		}
+#endif
+
 		if (area->flags & AS_AREA_LATE_RESERVE) {
 			/*
 			 * Reserve the memory for this page now.
@@ -246,9 +669,7 @@ int anon_page_fault(as_area_t *area, uintptr_t upage, pf_access_t access)
 			}
 		}
 
-		kpage = km_temporary_page_get(&frame, FRAME_NO_RESERVE);
-		memsetb((void *) kpage, PAGE_SIZE, 0);
-		km_temporary_page_put(kpage);
+		frame = zero_frame_alloc(FRAME_NO_RESERVE);
 	}
 	mutex_unlock(&area->sh_info->lock);
 
@@ -261,9 +682,76 @@ int anon_page_fault(as_area_t *area, uintptr_t upage, pf_access_t access)
 	if (!used_space_insert(&area->used_space, upage, 1))
 		panic("Cannot insert used space.");
 
+#ifdef LARGE_PAGE_WIDTH
+	anon_large_page_promote_request(area, upage);
+#endif
+
 	return AS_PF_OK;
 }
 
+/** Map anonymous pages following a serviced page fault.
+ *
+ * Anonymous pages have no contents before they are touched, so they are
+ * only mapped ahead of sequential accesses. Shared areas and areas with
+ * late reservation are left alone.
+ *
+ * The address space area and page tables must be already locked.
+ *
+ * @param area   Pointer to the address space area.
+ * @param upage  First page to map.
+ * @param count  Maximal number of pages to map.
+ * @param supply True if new frames may be allocated for the pages.
+ *
+ * @return Number of pages mapped starting at upage.
+ */
+size_t anon_page_fault_around(as_area_t *area, uintptr_t upage, size_t count,
+    bool supply)
+{
+	size_t mapped = 0;
+
+	assert(page_table_locked(AS));
+	assert(mutex_locked(&area->lock));
+	assert(IS_ALIGNED(upage, PAGE_SIZE));
+
+	if ((!supply) || (area->flags & AS_AREA_LATE_RESERVE))
+		return 0;
+
+	mutex_lock(&area->sh_info->lock);
+	if (!area->sh_info->shared) {
+		for (; mapped < count; mapped++) {
+			uintptr_t page = upage + P2SZ(mapped);
+			pte_t pte;
+
+			if (page_mapping_find(AS, page, false, &pte) &&
+			    PTE_PRESENT(&pte))
+				break;
+
+			uintptr_t frame = zero_frame_alloc(FRAME_NO_RESERVE);
+			page_mapping_insert(AS, page, frame,
+			    as_area_get_flags(area));
+		}
+	}
+	mutex_unlock(&area->sh_info->lock);
+
+	if ((mapped > 0) &&
+	    (!used_space_insert(&area->used_space, upage, mapped)))
+		panic("Cannot insert used space.");
+
+#ifdef LARGE_PAGE_WIDTH
+	/* The mapped pages may complete up to two large pages. */
+	if (mapped > 0) {
+		uintptr_t last = upage + P2SZ(mapped - 1);
+
+		anon_large_page_promote_request(area, upage);
+		if (ALIGN_DOWN(last, LARGE_PAGE_SIZE) !=
+		    ALIGN_DOWN(upage, LARGE_PAGE_SIZE))
+			anon_large_page_promote_request(area, last);
+	}
+#endif
+
+	return mapped;
+}
+
 /** Free a frame that is backed by the anonymous memory backend.
  *
  * The address space area and page tables must be already locked.
@@ -44,6 +44,7 @@
 #include <mm/page.h>
 #include <mm/reserve.h>
 #include <mm/km.h>
+#include <mm/zero.h>
 #include <genarch/mm/page_pt.h>
 #include <genarch/mm/page_ht.h>
 #include <align.h>
@@ -61,6 +62,7 @@ static bool elf_is_resizable(as_area_t *);
 static bool elf_is_shareable(as_area_t *);
 
 static int elf_page_fault(as_area_t *, uintptr_t, pf_access_t);
+static size_t elf_page_fault_around(as_area_t *, uintptr_t, size_t, bool);
 static void elf_frame_free(as_area_t *, uintptr_t, uintptr_t);
 
 mem_backend_t elf_backend = {
@@ -73,6 +75,7 @@ mem_backend_t elf_backend = {
 	.is_shareable = elf_is_shareable,
 
 	.page_fault = elf_page_fault,
+	.page_fault_around = elf_page_fault_around,
 	.frame_free = elf_frame_free,
 
 	.create_shared_data = NULL,
@@ -351,9 +354,7 @@ int elf_page_fault(as_area_t *area, uintptr_t upage, pf_access_t access)
 		 * To resolve the situation, a frame must be allocated
 		 * and cleared.
 		 */
-		kpage = km_temporary_page_get(&frame, FRAME_NO_RESERVE);
-		memsetb((void *) kpage, PAGE_SIZE, 0);
-		km_temporary_page_put(kpage);
+		frame = zero_frame_alloc(FRAME_NO_RESERVE);
 		dirty = true;
 	} else {
 		size_t pad_lo, pad_hi;
@@ -403,6 +404,86 @@ int elf_page_fault(as_area_t *area, uintptr_t upage, pf_access_t access)
 	return AS_PF_OK;
 }
 
+/** Map ELF pages following a serviced page fault.
+ *
+ * Read-only pages backed directly by the ELF image are always mapped.
+ * Pages of the uninitialized portion of the segment are only mapped
+ * ahead of sequential accesses. Pages which need to be copied and
+ * shared areas are left to the page fault handler.
+ *
+ * The address space area and page tables must be already locked.
+ *
+ * @param area		Pointer to the address space area.
+ * @param upage		First page to map.
+ * @param count		Maximal number of pages to map.
+ * @param supply	True if new frames may be allocated for the pages.
+ *
+ * @return		Number of pages mapped starting at upage.
+ */
+size_t elf_page_fault_around(as_area_t *area, uintptr_t upage, size_t count,
+    bool supply)
+{
+	elf_header_t *elf = area->backend_data.elf;
+	elf_segment_header_t *entry = area->backend_data.segment;
+	uintptr_t base;
+	uintptr_t start_anon;
+	size_t mapped = 0;
+
+	assert(page_table_locked(AS));
+	assert(mutex_locked(&area->lock));
+	assert(IS_ALIGNED(upage, PAGE_SIZE));
+
+	base = (uintptr_t)
+	    (((void *) elf) + ALIGN_DOWN(entry->p_offset, PAGE_SIZE));
+	start_anon = entry->p_vaddr + entry->p_filesz;
+
+	mutex_lock(&area->sh_info->lock);
+	if (!area->sh_info->shared) {
+		for (; mapped < count; mapped++) {
+			uintptr_t page = upage + P2SZ(mapped);
+			uintptr_t elfpage = elf_orig_page(area, page);
+			uintptr_t frame;
+			pte_t pte;
+
+			if (elfpage >= entry->p_vaddr + entry->p_memsz)
+				break;
+
+			if (page_mapping_find(AS, page, false, &pte) &&
+			    PTE_PRESENT(&pte))
+				break;
+
+			if ((elfpage >= entry->p_vaddr) &&
+			    (elfpage + PAGE_SIZE <= start_anon) &&
+			    (!(entry->p_flags & PF_W))) {
+				size_t i = (elfpage -
+				    ALIGN_DOWN(entry->p_vaddr, PAGE_SIZE)) >>
+				    PAGE_WIDTH;
+				bool found = page_mapping_find(AS_KERNEL,
+				    base + i * FRAME_SIZE, true, &pte);
+
+				(void) found;
+				assert(found);
+				assert(PTE_PRESENT(&pte));
+
+				frame = PTE_GET_FRAME(&pte);
+			} else if ((supply) && (elfpage >= start_anon)) {
+				frame = zero_frame_alloc(FRAME_NO_RESERVE);
+			} else
+				break;
+
+			page_mapping_insert(AS, page, frame,
+			    as_area_get_flags(area));
+		}
+	}
+	mutex_unlock(&area->sh_info->lock);
+
+	if ((mapped > 0) &&
+	    (!used_space_insert(&area->used_space, upage, mapped)))
+		panic("Cannot insert used space.");
+
+	return mapped;
+}
+
 /** Free a frame that is backed by the ELF backend.
  *
  * The address space area and page tables must be already locked.
@@ -74,6 +74,7 @@ mem_backend_t phys_backend = {
 	.is_shareable = phys_is_shareable,
 
 	.page_fault = phys_page_fault,
+	.page_fault_around = NULL,
 	.frame_free = NULL,
 
 	.create_shared_data = phys_create_shared_data,
@@ -120,6 +121,51 @@ bool phys_is_shareable(as_area_t *area)
 	return true;
 }
 
+#ifdef LARGE_PAGE_WIDTH
+
+/** Try to map the whole large page containing a faulting page.
+ *
+ * This is only done in areas created with AS_AREA_LARGE_PAGES, if the large
+ * page lies within the area, the physical memory behind it is aligned on a
+ * large page boundary as well and none of its pages is mapped yet.
+ *
+ * @param area Pointer to the address space area.
+ * @param upage Faulting virtual page.
+ *
+ * @return True if the large page was mapped.
+ */
+static bool phys_large_page_fault(as_area_t *area, uintptr_t upage)
+{
+	uintptr_t page = ALIGN_DOWN(upage, LARGE_PAGE_SIZE);
+	uintptr_t frame = area->backend_data.base + (page - area->base);
+
+	if (!(area->flags & AS_AREA_LARGE_PAGES))
+		return false;
+
+	if ((page < area->base) ||
+	    (page - area->base + LARGE_PAGE_SIZE > P2SZ(area->pages)) ||
+	    (page - area->base + LARGE_PAGE_SIZE >
+	    FRAMES2SIZE(area->backend_data.frames)))
+		return false;
+
+	if (!IS_ALIGNED(frame, LARGE_PAGE_SIZE))
+		return false;
+
+	if (used_space_count(&area->used_space, page, LARGE_PAGE_PAGES) > 0)
+		return false;
+
+	if (!page_mapping_insert_large(AS, page, frame,
+	    as_area_get_flags(area)))
+		return false;
+
+	if (!used_space_insert(&area->used_space, page, LARGE_PAGE_PAGES))
+		panic("Cannot insert used space.");
+
+	return true;
+}
+
+#endif /* LARGE_PAGE_WIDTH */
+
 /** Service a page fault in the address space area backed by physical memory.
  *
  * The address space area and page tables must be already locked.
@@ -143,6 +189,12 @@ int phys_page_fault(as_area_t *area, uintptr_t upage, pf_access_t access)
 		return AS_PF_FAULT;
 
 	assert(upage - area->base < area->backend_data.frames * FRAME_SIZE);
+
+#ifdef LARGE_PAGE_WIDTH
+	if (phys_large_page_fault(area, upage))
+		return AS_PF_OK;
+#endif
+
 	page_mapping_insert(AS, upage, base + (upage - area->base),
 	    as_area_get_flags(area));
 
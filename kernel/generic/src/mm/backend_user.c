@@ -39,6 +39,7 @@
 #include <mm/as.h>
 #include <mm/page.h>
 #include <mm/frame.h>
+#include <mm/km.h>
 #include <abi/mm/as.h>
 #include <abi/ipc/methods.h>
 #include <ipc/sysipc.h>
@@ -48,6 +49,7 @@
 #include <assert.h>
 #include <errno.h>
 #include <log.h>
+#include <mem.h>
 #include <str.h>
 
 static bool user_create(as_area_t *);
@@ -69,6 +71,7 @@ mem_backend_t user_backend = {
 	.is_shareable = user_is_shareable,
 
 	.page_fault = user_page_fault,
+	.page_fault_around = NULL,
 	.frame_free = user_frame_free,
 
 	.create_shared_data = NULL,
@@ -145,6 +148,26 @@ int user_page_fault(as_area_t *area, uintptr_t upage, pf_access_t access)
 	 */
 
 	uintptr_t frame = ipc_get_arg1(&data);
+
+	/*
+	 * The pager may hand the same frame out to several areas, e.g. from
+	 * its page cache. Writes to a writable area must not show through
+	 * the other mappings, so such an area gets a private copy.
+	 */
+	if ((area->flags & AS_AREA_WRITE) &&
+	    (find_zone(ADDR2PFN(frame), 1, 0) != (size_t) -1)) {
+		uintptr_t copy = frame_alloc(1, FRAME_NONE, 0);
+
+		uintptr_t src = km_frame_map(frame);
+		uintptr_t dst = km_frame_map(copy);
+		memcpy((void *) dst, (void *) src, PAGE_SIZE);
+		km_frame_unmap(dst);
+		km_frame_unmap(src);
+
+		frame_free(frame, 1);
+		frame = copy;
+	}
+
 	page_mapping_insert(AS, upage, frame, as_area_get_flags(area));
 	if (!used_space_insert(&area->used_space, upage, 1))
 		panic("Cannot insert used space.");
@@ -37,7 +37,18 @@
  * @brief Physical frame allocator.
  *
  * This file contains the physical frame allocator and memory zone management.
- * The frame allocator is built on top of the two-level bitmap structure.
+ * Each zone keeps its free frames in a buddy allocator, so that contiguous
+ * ranges of frames can be found in logarithmic time. Frames are tracked
+ * in the array of frame_t structures of the zone. The first frame of each
+ * free block remembers the order of the block and links it into the free
+ * list of that order. Free frames always have zero reference count.
+ *
+ * Single frames are allocated from per-CPU lists of free frames which are
+ * refilled from the zones and drained back to them in batches. Frames on
+ * these lists keep the reference count of one, so that the zones see them
+ * as busy. Allocating from and freeing to the list of the current CPU does
+ * not take the zones lock. Zones are only created and merged while the
+ * bootstrap CPU runs alone, so their bounds can be looked up without it.
  *
  */
 
@@ -60,6 +71,8 @@
 #include <macros.h>
 #include <config.h>
 #include <str.h>
+#include <atomic.h>
+#include <cpu.h>
 #include <proc/thread.h> /* THREAD */
 
 zones_t zones;
@@ -72,6 +85,11 @@ static mutex_t mem_avail_mtx;
 static condvar_t mem_avail_cv;
 static size_t mem_avail_req = 0;  /**< Number of frames requested. */
 static size_t mem_avail_gen = 0;  /**< Generation counter. */
+/** Number of threads waiting for free frames. */
+static atomic_size_t mem_avail_waiters = 0;
+
+/** Order of frames which do not head a free block. */
+#define ORDER_NONE  UINT8_MAX
 
 /** Initialize frame structure.
  *
@@ -82,12 +100,36 @@ _NO_TRACE static void frame_initialize(frame_t *frame)
 {
 	frame->refcount = 0;
 	frame->parent = NULL;
+	link_initialize(&frame->link);
+	frame->order = ORDER_NONE;
 }
 
 /*
  * Zones functions
  */
 
+/** Move zone structure to a different place.
+ *
+ * The free lists of the zone are relinked to their new heads.
+ *
+ * @param dst Destination of the zone structure.
+ * @param src Zone structure to be moved.
+ *
+ */
+_NO_TRACE static void zone_move(zone_t *dst, zone_t *src)
+{
+	*dst = *src;
+
+	for (unsigned int order = 0; order < ZONE_ORDERS; order++) {
+		if (list_empty(&src->free[order])) {
+			list_initialize(&dst->free[order]);
+		} else {
+			dst->free[order].head.next->prev = &dst->free[order].head;
+			dst->free[order].head.prev->next = &dst->free[order].head;
+		}
+	}
+}
+
 /** Insert-sort zone into zones list.
  *
  * Assume interrupts are disabled and zones lock is
@@ -140,7 +182,7 @@ _NO_TRACE static size_t zones_insert_zone(pfn_t base, size_t count,
 
 	/* Move other zones up */
 	for (size_t j = zones.count; j > i; j--)
-		zones.info[j] = zones.info[j - 1];
+		zone_move(&zones.info[j], &zones.info[j - 1]);
 
 	zones.count++;
 
@@ -209,18 +251,248 @@ _NO_TRACE size_t find_zone(pfn_t frame, size_t count, size_t hint)
 	return (size_t) -1;
 }
 
+/** Check if frame range  priority memory
+ *
+ * @param pfn   Starting frame.
+ * @param count Number of frames.
+ *
+ * @return True if the range contains only priority memory.
+ *
+ */
+_NO_TRACE static bool is_high_priority(pfn_t base, size_t count)
+{
+	return (base + count <= FRAME_LOWPRIO);
+}
+
+/** Return frame from zone. */
+_NO_TRACE static frame_t *zone_get_frame(zone_t *zone, size_t index)
+{
+	assert(index < zone->count);
+
+	return &zone->frames[index];
+}
+
+/** Get the smallest order of a block which holds given number of frames. */
+_NO_TRACE static unsigned int count_order(size_t count)
+{
+	return (ispwr2(count) ? fnzb(count) : fnzb(count) + 1);
+}
+
+/** Insert free block into the free list of its order.
+ *
+ * Blocks outside of high-priority memory are kept at the front of
+ * the list, so that they are preferred by allocations.
+ *
+ * @param zone  Zone of the block.
+ * @param index Index of the first frame of the block.
+ * @param order Order of the block.
+ *
+ */
+_NO_TRACE static void zone_block_insert(zone_t *zone, size_t index,
+    unsigned int order)
+{
+	frame_t *frame = zone_get_frame(zone, index);
+
+	assert(frame->order == ORDER_NONE);
+	frame->order = order;
+
+	if (is_high_priority(zone->base + index, 1))
+		list_append(&frame->link, &zone->free[order]);
+	else
+		list_prepend(&frame->link, &zone->free[order]);
+}
+
+/** Remove free block from its free list. */
+_NO_TRACE static void zone_block_remove(zone_t *zone, size_t index)
+{
+	frame_t *frame = zone_get_frame(zone, index);
+
+	assert(frame->order != ORDER_NONE);
+	list_remove(&frame->link);
+	frame->order = ORDER_NONE;
+}
+
+/** Find buddy of a block.
+ *
+ * @param zone  Zone of the block.
+ * @param index Index of the first frame of the block.
+ * @param order Order of the block.
+ *
+ * @return Index of the first frame of the buddy.
+ * @return -1 if the buddy does not lie within the zone.
+ *
+ */
+_NO_TRACE static size_t zone_block_buddy(zone_t *zone, size_t index,
+    unsigned int order)
+{
+	pfn_t pfn = (zone->base + index) ^ ((pfn_t) 1 << order);
+
+	if ((pfn < zone->base) ||
+	    (pfn - zone->base + ((size_t) 1 << order) > zone->count))
+		return (size_t) -1;
+
+	return pfn - zone->base;
+}
+
+/** Free block of frames, coalescing it with its free buddies.
+ *
+ * @param zone  Zone of the block.
+ * @param index Index of the first frame of the block.
+ * @param order Order of the block.
+ *
+ */
+_NO_TRACE static void zone_block_free(zone_t *zone, size_t index,
+    unsigned int order)
+{
+	while (order + 1 < ZONE_ORDERS) {
+		size_t buddy = zone_block_buddy(zone, index, order);
+		if ((buddy == (size_t) -1) ||
+		    (zone_get_frame(zone, buddy)->order != order))
+			break;
+
+		zone_block_remove(zone, buddy);
+		index = min(index, buddy);
+		order++;
+	}
+
+	zone_block_insert(zone, index, order);
+}
+
+/** Find free block containing a frame.
+ *
+ * @param zone  Zone of the frame.
+ * @param index Index of the frame.
+ *
+ * @return Index of the first frame of the block.
+ * @return -1 if the frame is not free.
+ *
+ */
+_NO_TRACE static size_t zone_block_find(zone_t *zone, size_t index)
+{
+	pfn_t pfn = zone->base + index;
+
+	for (unsigned int order = 0; order < ZONE_ORDERS; order++) {
+		pfn_t head = pfn & ~(((pfn_t) 1 << order) - 1);
+		if (head < zone->base)
+			break;
+
+		if (zone_get_frame(zone, head - zone->base)->order == order)
+			return head - zone->base;
+	}
+
+	return (size_t) -1;
+}
+
+/** Take single frame out of a free block.
+ *
+ * The rest of the block is returned to the free lists.
+ *
+ * @param zone  Zone of the frame.
+ * @param head  Index of the first frame of the free block.
+ * @param index Index of the frame.
+ *
+ */
+_NO_TRACE static void zone_block_take(zone_t *zone, size_t head, size_t index)
+{
+	unsigned int order = zone_get_frame(zone, head)->order;
+
+	zone_block_remove(zone, head);
+
+	while (order > 0) {
+		order--;
+		size_t half = (size_t) 1 << order;
+
+		if (index < head + half) {
+			zone_block_insert(zone, head + half, order);
+		} else {
+			zone_block_insert(zone, head, order);
+			head += half;
+		}
+	}
+}
+
+/** Find free block to allocate frames from.
+ *
+ * @param zone       Zone to search.
+ * @param order      Minimal order of the block.
+ * @param constraint Indication of bits that cannot be set in the
+ *                   physical frame number of the block.
+ * @param lowprio    Only consider blocks outside of high-priority memory.
+ * @param porder     Place to store the order of the block found.
+ *
+ * @return Index of the first frame of the block.
+ * @return -1 if there is no such block.
+ *
+ */
+_NO_TRACE static size_t zone_block_search(zone_t *zone, unsigned int order,
+    pfn_t constraint, bool lowprio, unsigned int *porder)
+{
+	for (unsigned int k = order; k < ZONE_ORDERS; k++) {
+		list_foreach(zone->free[k], link, frame_t, frame) {
+			size_t index = frame - zone->frames;
+			pfn_t pfn = zone->base + index;
+
+			/* High-priority blocks are at the end of the list. */
+			if ((lowprio) && (is_high_priority(pfn, 1)))
+				break;
+
+			if ((pfn & constraint) == 0) {
+				*porder = k;
+				return index;
+			}
+		}
+	}
+
+	return (size_t) -1;
+}
+
+/** Find run of free frames which need not form a single block.
+ *
+ * @param zone       Zone to search.
+ * @param count      Number of free frames to find.
+ * @param constraint Indication of bits that cannot be set in the
+ *                   physical frame number of the first frame.
+ * @param start      Index of the frame to start searching at.
+ *
+ * @return Index of the first frame of the run.
+ * @return -1 if there is no such run.
+ *
+ */
+_NO_TRACE static size_t zone_run_search(zone_t *zone, size_t count,
+    pfn_t constraint, size_t start)
+{
+	size_t run = 0;
+
+	for (size_t i = start; i < zone->count; i++) {
+		if (zone->frames[i].refcount > 0) {
+			run = 0;
+			continue;
+		}
+
+		if ((run == 0) && (((zone->base + i) & constraint) != 0))
+			continue;
+
+		if (++run == count)
+			return i + 1 - count;
+	}
+
+	return (size_t) -1;
+}
+
 /** @return True if zone can allocate specified number of frames */
 _NO_TRACE static bool zone_can_alloc(zone_t *zone, size_t count,
     pfn_t constraint)
 {
-	/*
-	 * The function bitmap_allocate_range() does not modify
-	 * the bitmap if the last argument is NULL.
-	 */
+	if ((!(zone->flags & ZONE_AVAILABLE)) || (zone->free_count < count))
+		return false;
+
+	unsigned int order;
+	if (zone_block_search(zone, count_order(count), constraint, false,
+	    &order) != (size_t) -1)
+		return true;
 
-	return ((zone->flags & ZONE_AVAILABLE) &&
-	    bitmap_allocate_range(&zone->bitmap, count, zone->base,
-	    FRAME_LOWPRIO, constraint, NULL));
+	return ((count > 1) &&
+	    (zone_run_search(zone, count, constraint, 0) != (size_t) -1));
 }
 
 /** Find a zone that can allocate specified number of frames
@@ -256,19 +528,6 @@ _NO_TRACE static size_t find_free_zone_all(size_t count, zone_flags_t flags,
 	return (size_t) -1;
 }
 
-/** Check if frame range  priority memory
- *
- * @param pfn   Starting frame.
- * @param count Number of frames.
- *
- * @return True if the range contains only priority memory.
- *
- */
-_NO_TRACE static bool is_high_priority(pfn_t base, size_t count)
-{
-	return (base + count <= FRAME_LOWPRIO);
-}
-
 /** Find a zone that can allocate specified number of frames
  *
  * This function ignores zones that contain only high-priority
@@ -344,14 +603,6 @@ _NO_TRACE static size_t find_free_zone(size_t count, zone_flags_t flags,
  * Zone functions
  */
 
-/** Return frame from zone. */
-_NO_TRACE static frame_t *zone_get_frame(zone_t *zone, size_t index)
-{
-	assert(index < zone->count);
-
-	return &zone->frames[index];
-}
-
 /** Allocate frame in particular zone.
  *
  * Assume zone is locked and is available for allocation.
@@ -371,14 +622,49 @@ _NO_TRACE static size_t zone_frame_alloc(zone_t *zone, size_t count,
 	assert(zone->flags & ZONE_AVAILABLE);
 	assert(zone->free_count >= count);
 
-	/* Allocate frames from zone */
-	size_t index = (size_t) -1;
-	int avail = bitmap_allocate_range(&zone->bitmap, count, zone->base,
-	    FRAME_LOWPRIO, constraint, &index);
+	/* Allocate frames from zone, preferably outside high-priority memory */
+	unsigned int order;
+	size_t index = zone_block_search(zone, count_order(count), constraint,
+	    true, &order);
+	if (index == (size_t) -1)
+		index = zone_block_search(zone, count_order(count), constraint,
+		    false, &order);
+
+	if (index != (size_t) -1) {
+		zone_block_remove(zone, index);
+
+		/* Return the frames beyond count to the free lists */
+		size_t pos = index;
+		size_t rest = count;
+
+		while (rest < ((size_t) 1 << order)) {
+			order--;
+			size_t half = (size_t) 1 << order;
+
+			if (rest <= half) {
+				zone_block_insert(zone, pos + half, order);
+			} else {
+				pos += half;
+				rest -= half;
+			}
+		}
+	} else {
+		/*
+		 * No single block is large enough, so take the frames
+		 * out of adjacent free blocks one by one.
+		 */
+		if (is_high_priority(zone->base, 1))
+			index = zone_run_search(zone, count, constraint,
+			    min(FRAME_LOWPRIO - zone->base, zone->count));
+
+		if (index == (size_t) -1)
+			index = zone_run_search(zone, count, constraint, 0);
+
+		assert(index != (size_t) -1);
 
-	(void) avail;
-	assert(avail);
-	assert(index != (size_t) -1);
+		for (size_t i = index; i < index + count; i++)
+			zone_block_take(zone, zone_block_find(zone, i), i);
+	}
 
 	/* Update frame reference count */
 	for (size_t i = 0; i < count; i++) {
@@ -415,7 +701,7 @@ _NO_TRACE static size_t zone_frame_free(zone_t *zone, size_t index)
 	if (!--frame->refcount) {
 		assert(zone->busy_count > 0);
 
-		bitmap_set(&zone->bitmap, index, 0);
+		zone_block_free(zone, index, 0);
 
 		/* Update zone information. */
 		zone->free_count++;
@@ -440,8 +726,12 @@ _NO_TRACE static void zone_mark_unavailable(zone_t *zone, size_t index)
 
 	assert(zone->free_count > 0);
 
+	/* Frames which are not free yet are not in any block. */
+	size_t head = zone_block_find(zone, index);
+	if (head != (size_t) -1)
+		zone_block_take(zone, head, index);
+
 	frame->refcount = 1;
-	bitmap_set_range(&zone->bitmap, index, 1);
 
 	zone->free_count--;
 	reserve_force_alloc(1);
@@ -456,7 +746,7 @@ _NO_TRACE static void zone_mark_available(zone_t *zone, size_t index)
 	assert(frame->refcount == 1);
 
 	frame->refcount = 0;
-	bitmap_set_range(&zone->bitmap, index, 0);
+	zone_block_free(zone, index, 0);
 
 	zone->free_count++;
 }
@@ -490,37 +780,46 @@ _NO_TRACE static void zone_merge_internal(size_t z1, size_t z2, zone_t *old_z1,
 	zones.info[z1].free_count += zones.info[z2].free_count;
 	zones.info[z1].busy_count += zones.info[z2].busy_count;
 
-	bitmap_initialize(&zones.info[z1].bitmap, zones.info[z1].count,
-	    confdata + (sizeof(frame_t) * zones.info[z1].count));
-	bitmap_clear_range(&zones.info[z1].bitmap, 0, zones.info[z1].count);
-
 	zones.info[z1].frames = (frame_t *) confdata;
 
 	/*
-	 * Copy frames and bits from both zones to preserve parents, etc.
+	 * Copy frames from both zones to preserve parents, etc.
 	 */
 
-	for (size_t i = 0; i < old_z1->count; i++) {
-		bitmap_set(&zones.info[z1].bitmap, i,
-		    bitmap_get(&old_z1->bitmap, i));
+	for (size_t i = 0; i < old_z1->count; i++)
 		zones.info[z1].frames[i] = old_z1->frames[i];
-	}
 
 	for (size_t i = 0; i < zones.info[z2].count; i++) {
-		bitmap_set(&zones.info[z1].bitmap, base_diff + i,
-		    bitmap_get(&zones.info[z2].bitmap, i));
 		zones.info[z1].frames[base_diff + i] =
 		    zones.info[z2].frames[i];
 	}
 
+	for (size_t i = 0; i < gap; i++)
+		frame_initialize(&zones.info[z1].frames[old_z1->count + i]);
+
+	/*
+	 * The free blocks of both zones stay aligned within the merged
+	 * zone, so just link them into its free lists.
+	 */
+
+	for (unsigned int order = 0; order < ZONE_ORDERS; order++)
+		list_initialize(&zones.info[z1].free[order]);
+
+	for (size_t i = 0; i < zones.info[z1].count; i++) {
+		unsigned int order = zones.info[z1].frames[i].order;
+
+		if (order != ORDER_NONE) {
+			zones.info[z1].frames[i].order = ORDER_NONE;
+			zone_block_insert(&zones.info[z1], i, order);
+		}
+	}
+
 	/*
 	 * Mark the gap between the original zones as unavailable.
 	 */
 
-	for (size_t i = 0; i < gap; i++) {
-		frame_initialize(&zones.info[z1].frames[old_z1->count + i]);
+	for (size_t i = 0; i < gap; i++)
 		zone_mark_unavailable(&zones.info[z1], old_z1->count + i);
-	}
 }
 
 /** Return old configuration frames into the zone.
@@ -614,7 +913,7 @@ bool zone_merge(size_t z1, size_t z2)
 
 	/* Move zones down */
 	for (size_t i = z2 + 1; i < zones.count; i++)
-		zones.info[i - 1] = zones.info[i];
+		zone_move(&zones.info[i - 1], &zones.info[i]);
 
 	zones.count--;
 
@@ -661,16 +960,10 @@ _NO_TRACE static void zone_construct(zone_t *zone, pfn_t start, size_t count,
 	zone->free_count = count;
 	zone->busy_count = 0;
 
-	if (flags & ZONE_AVAILABLE) {
-		/*
-		 * Initialize frame bitmap (located after the array of
-		 * frame_t structures in the configuration space).
-		 */
-
-		bitmap_initialize(&zone->bitmap, count, confdata +
-		    (sizeof(frame_t) * count));
-		bitmap_clear_range(&zone->bitmap, 0, count);
+	for (unsigned int order = 0; order < ZONE_ORDERS; order++)
+		list_initialize(&zone->free[order]);
 
+	if (flags & ZONE_AVAILABLE) {
 		/*
 		 * Initialize the array of frame_t structures.
 		 */
@@ -679,8 +972,25 @@ _NO_TRACE static void zone_construct(zone_t *zone, pfn_t start, size_t count,
 
 		for (size_t i = 0; i < count; i++)
 			frame_initialize(&zone->frames[i]);
+
+		/*
+		 * Split the zone into the largest aligned free blocks.
+		 */
+
+		size_t index = 0;
+		while (index < count) {
+			pfn_t pfn = start + index;
+			unsigned int order = 0;
+
+			while ((order + 1 < ZONE_ORDERS) &&
+			    ((pfn & (((pfn_t) 2 << order) - 1)) == 0) &&
+			    (index + ((size_t) 2 << order) <= count))
+				order++;
+
+			zone_block_insert(zone, index, order);
+			index += (size_t) 1 << order;
+		}
 	} else {
-		bitmap_initialize(&zone->bitmap, 0, NULL);
 		zone->frames = NULL;
 	}
 }
@@ -694,7 +1004,7 @@ _NO_TRACE static void zone_construct(zone_t *zone, pfn_t start, size_t count,
  */
 size_t zone_conf_size(size_t count)
 {
-	return (count * sizeof(frame_t) + bitmap_size(count));
+	return (count * sizeof(frame_t));
 }
 
 /** Allocate external configuration frames from low memory. */
@@ -859,6 +1169,196 @@ static size_t try_find_zone(size_t count, bool lowmem,
 	    frame_constraint, hint);
 }
 
+/*
+ * Per-CPU lists of free frames
+ */
+
+/** Get the free list of the current CPU.
+ *
+ * Assume interrupts are disabled.
+ *
+ * @param lowmem True for the list of frames which can be identity-mapped.
+ *
+ * @return Free list or NULL if the CPU has not been initialized yet.
+ *
+ */
+_NO_TRACE static frame_pcpu_t *frame_pcpu_list(bool lowmem)
+{
+	if (CPU == NULL)
+		return NULL;
+
+	return &CPU->frame_lists[lowmem ? FRAME_PCPU_LOWMEM : FRAME_PCPU_HIGHMEM];
+}
+
+/** Move a batch of frames from the zones to a per-CPU list.
+ *
+ * Assume interrupts are disabled and the list and
+ * zones lock are locked.
+ *
+ */
+_NO_TRACE static void frame_pcpu_refill(frame_pcpu_t *list, bool lowmem)
+{
+	while (list->count < FRAME_PCPU_BATCH) {
+		size_t znum = try_find_zone(1, lowmem, 0, 0);
+		if (znum == (size_t) -1)
+			break;
+
+		list->pfn[list->count++] = zones.info[znum].base +
+		    zone_frame_alloc(&zones.info[znum], 1, 0);
+	}
+}
+
+/** Move the least recently freed frames from a per-CPU list to the zones.
+ *
+ * Assume interrupts are disabled and the list and
+ * zones lock are locked.
+ *
+ * @param list  Per-CPU list.
+ * @param count Maximal number of frames to move.
+ *
+ * @return Number of frames moved.
+ *
+ */
+_NO_TRACE static size_t frame_pcpu_drain(frame_pcpu_t *list, size_t count)
+{
+	size_t drained = min(count, list->count);
+
+	for (size_t i = 0; i < drained; i++) {
+		size_t znum = find_zone(list->pfn[i], 1, 0);
+
+		assert(znum != (size_t) -1);
+
+		(void) zone_frame_free(&zones.info[znum],
+		    list->pfn[i] - zones.info[znum].base);
+	}
+
+	list->count -= drained;
+	for (size_t i = 0; i < list->count; i++)
+		list->pfn[i] = list->pfn[drained + i];
+
+	return drained;
+}
+
+/** Allocate a frame from the free list of the current CPU.
+ *
+ * The list is refilled from the zones when it runs empty.
+ *
+ * @param lowmem True if the frame must be identity-mappable.
+ * @param pfn    Place to store the frame number.
+ *
+ * @return True if a frame has been allocated.
+ *
+ */
+_NO_TRACE static bool frame_pcpu_alloc(bool lowmem, pfn_t *pfn)
+{
+	bool allocated = false;
+	ipl_t ipl = interrupts_disable();
+
+	frame_pcpu_t *list = frame_pcpu_list(lowmem);
+	if (list != NULL) {
+		spinlock_lock(&list->lock);
+
+		if (list->count == 0) {
+			irq_spinlock_lock(&zones.lock, false);
+			frame_pcpu_refill(list, lowmem);
+			irq_spinlock_unlock(&zones.lock, false);
+		}
+
+		if (list->count > 0) {
+			*pfn = list->pfn[--list->count];
+			allocated = true;
+		}
+
+		spinlock_unlock(&list->lock);
+	}
+
+	interrupts_restore(ipl);
+	return allocated;
+}
+
+/** Put a frame losing its last reference on the free list of the current CPU.
+ *
+ * The zones lock is not taken unless the list is full. The reference count
+ * of the frame is read without it, as nobody else can add a reference to
+ * a frame whose only reference is being dropped.
+ *
+ * @param pfn Frame number of the frame.
+ *
+ * @return True if the frame has been put on the list.
+ *
+ */
+_NO_TRACE static bool frame_pcpu_free(pfn_t pfn)
+{
+	/* Frames some thread is waiting for go straight back to the zone. */
+	if (atomic_load(&mem_avail_waiters) > 0)
+		return false;
+
+	size_t znum = find_zone(pfn, 1, 0);
+
+	assert(znum != (size_t) -1);
+
+	zone_t *zone = &zones.info[znum];
+
+	/* Shared frames only lose a reference. */
+	if (zone_get_frame(zone, pfn - zone->base)->refcount != 1)
+		return false;
+
+	bool cached = false;
+	ipl_t ipl = interrupts_disable();
+
+	frame_pcpu_t *list = frame_pcpu_list(!(zone->flags & ZONE_HIGHMEM));
+	if (list != NULL) {
+		spinlock_lock(&list->lock);
+
+		if (list->count == FRAME_PCPU_MAX) {
+			irq_spinlock_lock(&zones.lock, false);
+			(void) frame_pcpu_drain(list, FRAME_PCPU_BATCH);
+			irq_spinlock_unlock(&zones.lock, false);
+		}
+
+		/* The list holds the reference of the frame. */
+		list->pfn[list->count++] = pfn;
+		cached = true;
+
+		spinlock_unlock(&list->lock);
+	}
+
+	interrupts_restore(ipl);
+	return cached;
+}
+
+/** Move all frames from the free lists of all CPUs to the zones.
+ *
+ * Assume zones lock is not locked.
+ *
+ * @return Number of frames moved.
+ *
+ */
+_NO_TRACE static size_t frame_pcpu_drain_all(void)
+{
+	size_t drained = 0;
+
+	if (cpus == NULL)
+		return 0;
+
+	ipl_t ipl = interrupts_disable();
+
+	for (size_t i = 0; i < config.cpu_count; i++) {
+		for (unsigned int j = 0; j < FRAME_PCPU_LISTS; j++) {
+			frame_pcpu_t *list = &cpus[i].frame_lists[j];
+
+			spinlock_lock(&list->lock);
+			irq_spinlock_lock(&zones.lock, false);
+			drained += frame_pcpu_drain(list, FRAME_PCPU_MAX);
+			irq_spinlock_unlock(&zones.lock, false);
+			spinlock_unlock(&list->lock);
+		}
+	}
+
+	interrupts_restore(ipl);
+	return drained;
+}
+
 /** Allocate frames of physical memory.
  *
  * @param count      Number of continuous frames to allocate.
@@ -884,17 +1384,40 @@ uintptr_t frame_alloc_generic(size_t count, frame_flags_t flags,
 	if (!(flags & FRAME_NO_RESERVE))
 		reserve_force_alloc(count);
 
-loop:
-	irq_spinlock_lock(&zones.lock, true);
-
 	// TODO: Print diagnostic if neither is explicitly specified.
 	bool lowmem = (flags & FRAME_LOWMEM) || !(flags & FRAME_HIGHMEM);
 
+	/*
+	 * Single frames come from the free list of the current CPU,
+	 * unless the caller is interested in the zone.
+	 */
+	if ((count == 1) && (frame_constraint == 0) && (pzone == NULL)) {
+		pfn_t pfn;
+		if (frame_pcpu_alloc(lowmem, &pfn))
+			return PFN2ADDR(pfn);
+	}
+
+loop:
+	irq_spinlock_lock(&zones.lock, true);
+
 	/*
 	 * First, find suitable frame zone.
 	 */
 	size_t znum = try_find_zone(count, lowmem, frame_constraint, hint);
 
+	/*
+	 * The frames may be cached on the free lists of the CPUs.
+	 */
+	if (znum == (size_t) -1) {
+		irq_spinlock_unlock(&zones.lock, true);
+		size_t drained = frame_pcpu_drain_all();
+		irq_spinlock_lock(&zones.lock, true);
+
+		if (drained > 0)
+			znum = try_find_zone(count, lowmem,
+			    frame_constraint, hint);
+	}
+
 	/*
 	 * If no memory, reclaim some slab memory,
 	 * if it does not help, reclaim all.
@@ -961,9 +1484,14 @@ loop:
 
 		size_t gen = mem_avail_gen;
 
+		/* Make the freed frames bypass the per-CPU lists. */
+		atomic_inc(&mem_avail_waiters);
+
 		while (gen == mem_avail_gen)
 			condvar_wait(&mem_avail_cv, &mem_avail_mtx);
 
+		atomic_dec(&mem_avail_waiters);
+
 		mutex_unlock(&mem_avail_mtx);
 		interrupts_restore(ipl);
 
@@ -1006,6 +1534,17 @@ void frame_free_generic(uintptr_t start, size_t count, frame_flags_t flags)
 {
 	size_t freed = 0;
 
+	/*
+	 * Single frames are cached on the free list of this CPU. Nobody
+	 * needs to be woken up then, as waiting threads make the freed
+	 * frames bypass the lists.
+	 */
+	if ((count == 1) && (frame_pcpu_free(ADDR2PFN(start)))) {
+		if (!(flags & FRAME_NO_RESERVE))
+			reserve_free(1);
+		return;
+	}
+
 	irq_spinlock_lock(&zones.lock, true);
 
 	for (size_t i = 0; i < count; i++) {
@@ -1082,6 +1621,32 @@ _NO_TRACE void frame_reference_add(pfn_t pfn)
 	irq_spinlock_unlock(&zones.lock, true);
 }
 
+/** Get the number of references to a frame.
+ *
+ * The result is only stable if the caller holds the only reference or
+ * prevents any other holder from adding or dropping references.
+ *
+ * @param pfn Frame number of the frame.
+ *
+ * @return Reference count of the frame.
+ *
+ */
+_NO_TRACE size_t frame_reference_count(pfn_t pfn)
+{
+	irq_spinlock_lock(&zones.lock, true);
+
+	size_t znum = find_zone(pfn, 1, 0);
+
+	assert(znum != (size_t) -1);
+
+	size_t refcount =
+	    zones.info[znum].frames[pfn - zones.info[znum].base].refcount;
+
+	irq_spinlock_unlock(&zones.lock, true);
+
+	return refcount;
+}
+
 /** Mark given range unavailable in frame zones.
  *
  */
@@ -1289,7 +1854,7 @@ void zones_print_list(void)
 
 				for (size_t index = 0; index < count; index++) {
 					if (is_high_priority(fbase + index, 0)) {
-						if (!bitmap_get(&zones.info[i].bitmap, index))
+						if (zones.info[i].frames[index].refcount == 0)
 							free_highprio++;
 					} else
 						break;
@@ -1401,7 +1966,7 @@ void zone_print_one(size_t num)
 
 			for (size_t index = 0; index < count; index++) {
 				if (is_high_priority(fbase + index, 0)) {
-					if (!bitmap_get(&zones.info[znum].bitmap, index))
+					if (zones.info[znum].frames[index].refcount == 0)
 						free_highprio++;
 				} else
 					break;
@@ -33,6 +33,13 @@
 /**
  * @file
  * @brief Kernel virtual memory setup.
+ *
+ * Non-identity kernel mappings are unmapped lazily. Their page table entries
+ * are removed right away, so that no new translation of an unmapped range
+ * can be established, but the TLB is flushed only once a whole batch of
+ * unmapped ranges has accumulated, with a single shootdown of the kernel
+ * address space. Only then is their virtual address space returned to the
+ * allocator, so that no stale TLB entry can ever alias a new mapping.
  */
 
 #include <mm/km.h>
@@ -52,34 +59,61 @@
 
 static ra_arena_t *km_ni_arena;
 
-#define DEFERRED_PAGES_MAX	(PAGE_SIZE / sizeof(uintptr_t))
+/** Range of kernel virtual address space waiting to be purged. */
+typedef struct {
+	uintptr_t base;
+	size_t size;
+} km_deferred_range_t;
 
-/** Number of freed pages in the deferred buffer. */
-static volatile unsigned deferred_pages;
-/** Buffer of deferred freed pages. */
-static uintptr_t deferred_page[DEFERRED_PAGES_MAX];
+#define DEFERRED_RANGES_MAX	(PAGE_SIZE / sizeof(km_deferred_range_t))
+/** Number of deferred pages which triggers a purge. */
+#define DEFERRED_PAGES_MAX	1024
 
-/** Flush the buffer of deferred freed pages.
+/*
+ * The deferred ranges and the counters below are protected by the page
+ * table lock of AS_KERNEL.
+ */
+
+/** Number of ranges in the deferred buffer. */
+static size_t deferred_ranges;
+/** Number of pages in the deferred buffer. */
+static size_t deferred_pages;
+/** Buffer of unmapped ranges waiting to be purged. */
+static km_deferred_range_t deferred_range[DEFERRED_RANGES_MAX];
+/** Number of TLB shootdowns saved by purging ranges in batches. */
+static size_t shootdowns_avoided;
+
+/** Purge the buffer of deferred unmapped ranges.
+ *
+ * The page table entries of the ranges are already removed, only the TLB
+ * is flushed and the virtual address space released.
  *
- * @return		Number of freed pages.
+ * Must be called with the page table lock of AS_KERNEL held.
+ *
+ * @return		Number of purged ranges.
  */
-static unsigned km_flush_deferred(void)
+static size_t km_flush_deferred(void)
 {
-	unsigned i = 0;
+	size_t i;
 	ipl_t ipl;
 
-	ipl = tlb_shootdown_start(TLB_INVL_ASID, ASID_KERNEL, 0, 0);
-
-	for (i = 0; i < deferred_pages; i++) {
-		page_mapping_remove(AS_KERNEL, deferred_page[i]);
-		km_page_free(deferred_page[i], PAGE_SIZE);
-	}
+	if (deferred_ranges == 0)
+		return 0;
 
+	ipl = tlb_shootdown_start(TLB_INVL_ASID, AS_KERNEL, ASID_KERNEL, 0, 0);
 	tlb_invalidate_asid(ASID_KERNEL);
 
 	as_invalidate_translation_cache(AS_KERNEL, 0, -1);
 	tlb_shootdown_finalize(ipl);
 
+	/* The virtual addresses can be handed out again. */
+	for (i = 0; i < deferred_ranges; i++)
+		km_page_free(deferred_range[i].base, deferred_range[i].size);
+
+	shootdowns_avoided += deferred_ranges - 1;
+	deferred_ranges = 0;
+	deferred_pages = 0;
+
 	return i;
 }
 
@@ -120,8 +154,16 @@ uintptr_t km_page_alloc(size_t size, size_t align)
 	uintptr_t base;
 	if (ra_alloc(km_ni_arena, size, align, &base))
 		return base;
-	else
-		panic("Kernel ran out of virtual address space.");
+
+	/* Reclaim the address space held by deferred ranges and retry. */
+	page_table_lock(AS_KERNEL, true);
+	size_t purged = km_flush_deferred();
+	page_table_unlock(AS_KERNEL, true);
+
+	if ((purged > 0) && ra_alloc(km_ni_arena, size, align, &base))
+		return base;
+
+	panic("Kernel ran out of virtual address space.");
 }
 
 void km_page_free(uintptr_t page, size_t size)
@@ -155,28 +197,35 @@ km_map_aligned(uintptr_t paddr, size_t size, size_t align, unsigned int flags)
 	return vaddr;
 }
 
+/** Unmap a range of kernel pages lazily.
+ *
+ * The page table entries are removed immediately. The range is then put
+ * into the deferred buffer, which is purged once it fills up or the virtual
+ * address space runs out.
+ *
+ * @param vaddr		Page-aligned virtual address of the range.
+ * @param size		Page-aligned size of the range.
+ */
 static void km_unmap_aligned(uintptr_t vaddr, size_t size)
 {
-	uintptr_t offs;
-	ipl_t ipl;
-
 	assert(ALIGN_DOWN(vaddr, PAGE_SIZE) == vaddr);
 	assert(ALIGN_UP(size, PAGE_SIZE) == size);
 
 	page_table_lock(AS_KERNEL, true);
 
-	ipl = tlb_shootdown_start(TLB_INVL_ASID, ASID_KERNEL, 0, 0);
-
-	for (offs = 0; offs < size; offs += PAGE_SIZE)
+	for (size_t offs = 0; offs < size; offs += PAGE_SIZE)
 		page_mapping_remove(AS_KERNEL, vaddr + offs);
 
-	tlb_invalidate_asid(ASID_KERNEL);
+	deferred_range[deferred_ranges].base = vaddr;
+	deferred_range[deferred_ranges].size = size;
+	deferred_ranges++;
+	deferred_pages += size / PAGE_SIZE;
 
-	as_invalidate_translation_cache(AS_KERNEL, 0, -1);
-	tlb_shootdown_finalize(ipl);
-	page_table_unlock(AS_KERNEL, true);
+	if ((deferred_ranges == DEFERRED_RANGES_MAX) ||
+	    (deferred_pages >= DEFERRED_PAGES_MAX))
+		(void) km_flush_deferred();
 
-	km_page_free(vaddr, size);
+	page_table_unlock(AS_KERNEL, true);
 }
 
 /** Map a piece of physical address space into the virtual address space.
@@ -214,22 +263,31 @@ void km_unmap(uintptr_t vaddr, size_t size)
 	    ALIGN_UP(size + offs, PAGE_SIZE));
 }
 
-/** Unmap kernel non-identity page.
+/** Map a single frame into the kernel address space.
+ *
+ * Frames within the identity mapping are not mapped again.
+ *
+ * @param frame		Physical address of the frame.
  *
- * @param[in] page	Non-identity page to be unmapped.
+ * @return		Kernel virtual address of the frame.
  */
-static void km_unmap_deferred(uintptr_t page)
+uintptr_t km_frame_map(uintptr_t frame)
 {
-	page_table_lock(AS_KERNEL, true);
-
-	if (deferred_pages == DEFERRED_PAGES_MAX) {
-		(void) km_flush_deferred();
-		deferred_pages = 0;
-	}
+	if (frame < config.identity_size)
+		return PA2KA(frame);
 
-	deferred_page[deferred_pages++] = page;
+	return km_map(frame, PAGE_SIZE, PAGE_SIZE,
+	    PAGE_READ | PAGE_WRITE | PAGE_CACHEABLE);
+}
 
-	page_table_unlock(AS_KERNEL, true);
+/** Unmap a frame mapped by km_frame_map().
+ *
+ * @param page		Kernel virtual address of the frame.
+ */
+void km_frame_unmap(uintptr_t page)
+{
+	if (km_is_non_identity(page))
+		km_unmap(page, PAGE_SIZE);
 }
 
 /** Create a temporary page.
@@ -240,15 +298,16 @@ static void km_unmap_deferred(uintptr_t page)
  *
  * @param[inout] framep	Pointer to a variable which will receive the physical
  *			address of the allocated frame.
- * @param[in] flags	Frame allocation flags. FRAME_NONE, FRAME_NO_RESERVE
- *			and FRAME_ATOMIC bits are allowed.
- * @return		Virtual address of the allocated frame.
+ * @param[in] flags	Frame allocation flags. FRAME_NONE, FRAME_NO_RESERVE,
+ *			FRAME_NO_RECLAIM and FRAME_ATOMIC bits are allowed.
+ * @return		Virtual address of the allocated frame or 0 if
+ *			FRAME_ATOMIC was given and there is no free frame.
  */
 uintptr_t km_temporary_page_get(uintptr_t *framep, frame_flags_t flags)
 {
 	assert(THREAD);
 	assert(framep);
-	assert(!(flags & ~(FRAME_NO_RESERVE | FRAME_ATOMIC)));
+	assert(!(flags & ~(FRAME_NO_RESERVE | FRAME_NO_RECLAIM | FRAME_ATOMIC)));
 
 	/*
 	 * Allocate a frame, preferably from high memory.
@@ -257,6 +316,9 @@ uintptr_t km_temporary_page_get(uintptr_t *framep, frame_flags_t flags)
 	uintptr_t frame;
 
 	frame = frame_alloc(1, FRAME_HIGHMEM | flags, 0);
+	if (frame == 0)
+		return 0;
+
 	if (frame >= config.identity_size) {
 		page = km_map(frame, PAGE_SIZE, PAGE_SIZE,
 		    PAGE_READ | PAGE_WRITE | PAGE_CACHEABLE);
@@ -281,7 +343,22 @@ void km_temporary_page_put(uintptr_t page)
 	assert(THREAD);
 
 	if (km_is_non_identity(page))
-		km_unmap_deferred(page);
+		km_unmap_aligned(page, PAGE_SIZE);
+}
+
+/** Get the number of TLB shootdowns saved by unmapping lazily.
+ *
+ * @return		Number of kernel address space shootdowns that
+ *			unmapping each range on its own would have taken on
+ *			top of the ones actually done.
+ */
+size_t km_shootdowns_avoided(void)
+{
+	page_table_lock(AS_KERNEL, true);
+	size_t avoided = shootdowns_avoided;
+	page_table_unlock(AS_KERNEL, true);
+
+	return avoided;
 }
 
 /** @}
@@ -109,6 +109,44 @@ _NO_TRACE void page_mapping_insert(as_t *as, uintptr_t page, uintptr_t frame,
 	memory_barrier();
 }
 
+#ifdef LARGE_PAGE_WIDTH
+
+/** Insert mapping of a large page to a block of frames.
+ *
+ * There must be no mapping within the large page yet. Removing any page of
+ * the large page splits it into mappings of individual pages again.
+ *
+ * @param as    Address space to which page belongs.
+ * @param page  Virtual address of the large page, aligned to LARGE_PAGE_SIZE.
+ * @param frame Physical address of the block of frames, aligned to
+ *              LARGE_PAGE_SIZE.
+ * @param flags Flags to be used for mapping.
+ *
+ * @return False if the mapping could not be inserted without blocking. The
+ *         caller can map the individual pages instead.
+ *
+ */
+_NO_TRACE bool page_mapping_insert_large(as_t *as, uintptr_t page,
+    uintptr_t frame, unsigned int flags)
+{
+	assert(page_table_locked(as));
+	assert(IS_ALIGNED(page, LARGE_PAGE_SIZE));
+	assert(IS_ALIGNED(frame, LARGE_PAGE_SIZE));
+
+	assert(page_mapping_operations);
+	assert(page_mapping_operations->mapping_insert_large);
+
+	if (!page_mapping_operations->mapping_insert_large(as, page, frame,
+	    flags))
+		return false;
+
+	/* Repel prefetched accesses to the old mapping. */
+	memory_barrier();
+	return true;
+}
+
+#endif /* LARGE_PAGE_WIDTH */
+
 /** Remove mapping of page.
  *
  * Remove any mapping of page within address space as.
@@ -105,6 +105,30 @@ bool reserve_try_alloc(size_t size)
 	return reserved;
 }
 
+/** Try to reserve memory without reclaiming any.
+ *
+ * Unlike reserve_try_alloc(), fail right away if there is not enough
+ * reservable memory, so that caches do not take memory from their users.
+ *
+ * @param size		Number of frames to reserve.
+ * @return		True on success or false otherwise.
+ */
+bool reserve_try_alloc_noreclaim(size_t size)
+{
+	bool reserved = false;
+
+	assert(reserve_initialized);
+
+	irq_spinlock_lock(&reserve_lock, true);
+	if (reserve >= 0 && (size_t) reserve >= size) {
+		reserve -= size;
+		reserved = true;
+	}
+	irq_spinlock_unlock(&reserve_lock, true);
+
+	return reserved;
+}
+
 /** Reserve memory.
  *
  * This function simply marks the respective amount of memory frames reserved.
@@ -35,12 +35,13 @@
  * @brief Generic TLB shootdown algorithm.
  *
  * The algorithm implemented here is based on the CMU TLB shootdown
- * algorithm and is further simplified (e.g. all CPUs receive all TLB
- * shootdown messages).
+ * algorithm. Each address space keeps track of the CPUs it has been active
+ * on and only those receive its TLB shootdown messages.
  */
 
 #include <mm/tlb.h>
 #include <mm/asid.h>
+#include <mm/as.h>
 #include <arch/mm/tlb.h>
 #include <assert.h>
 #include <smp/ipi.h>
@@ -51,6 +52,8 @@
 #include <arch.h>
 #include <panic.h>
 #include <cpu.h>
+#include <cpu/cpu_mask.h>
+#include <mem.h>
 
 void tlb_init(void)
 {
@@ -59,20 +62,17 @@ void tlb_init(void)
 
 #ifdef CONFIG_SMP
 
-/**
- * This lock is used for synchronisation between sender and
- * recipients of TLB shootdown message. It must be acquired
- * before CPU structure lock.
- *
- */
-IRQ_SPINLOCK_STATIC_INITIALIZE(tlblock);
-
 /** Send TLB shootdown message.
  *
- * This function attempts to deliver TLB shootdown message
- * to all other processors.
+ * This function attempts to deliver TLB shootdown message to all other
+ * processors which may cache translations of the address space and waits
+ * until they have stopped. Shootdowns of different address spaces may
+ * proceed concurrently, each of them only stalls the processors it
+ * targets.
  *
  * @param type  Type describing scope of shootdown.
+ * @param as    Address space whose translations are invalidated or NULL
+ *              if the shootdown concerns all processors.
  * @param asid  Address space, if required by type.
  * @param page  Virtual page address, if required by type.
  * @param count Number of pages, if required by type.
@@ -80,18 +80,27 @@ IRQ_SPINLOCK_STATIC_INITIALIZE(tlblock);
  * @return The interrupt priority level as it existed prior to this call.
  *
  */
-ipl_t tlb_shootdown_start(tlb_invalidate_type_t type, asid_t asid,
+ipl_t tlb_shootdown_start(tlb_invalidate_type_t type, as_t *as, asid_t asid,
     uintptr_t page, size_t count)
 {
 	ipl_t ipl = interrupts_disable();
 	CPU->tlb_active = false;
-	irq_spinlock_lock(&tlblock, false);
 
-	size_t i;
-	for (i = 0; i < config.cpu_count; i++) {
-		if (i == CPU->id)
-			continue;
+	cpu_mask_t *targets = CPU->tlb_targets;
+	if ((as != NULL) && (as != AS_KERNEL)) {
+		/*
+		 * Holding the lock prevents other processors from joining
+		 * the address space until the shootdown is finalized.
+		 */
+		irq_spinlock_lock(&as->tlb_lock, false);
+		memcpy(targets, as->cpu_mask, cpu_mask_size());
+	} else {
+		cpu_mask_all(targets);
+	}
+	cpu_mask_reset(targets, CPU->id);
+	CPU->tlb_as = as;
 
+	cpu_mask_for_each(*targets, i) {
 		cpu_t *cpu = &cpus[i];
 
 		irq_spinlock_lock(&cpu->lock, false);
@@ -115,13 +124,14 @@ ipl_t tlb_shootdown_start(tlb_invalidate_type_t type, asid_t asid,
 			cpu->tlb_messages[idx].page = page;
 			cpu->tlb_messages[idx].count = count;
 		}
+		atomic_inc(&cpu->tlb_pending);
 		irq_spinlock_unlock(&cpu->lock, false);
 	}
 
 	tlb_shootdown_ipi_send();
 
 busy_wait:
-	for (i = 0; i < config.cpu_count; i++) {
+	cpu_mask_for_each(*targets, i) {
 		if (cpus[i].tlb_active)
 			goto busy_wait;
 	}
@@ -130,20 +140,73 @@ busy_wait:
 }
 
 /** Finish TLB shootdown sequence.
+ *
+ * Lets the processors stopped by tlb_shootdown_start() process the
+ * message.
  *
  * @param ipl Previous interrupt priority level.
  *
  */
 void tlb_shootdown_finalize(ipl_t ipl)
 {
-	irq_spinlock_unlock(&tlblock, false);
+	cpu_mask_for_each(*CPU->tlb_targets, i)
+		atomic_dec(&cpus[i].tlb_pending);
+
+	as_t *as = CPU->tlb_as;
+	if ((as != NULL) && (as != AS_KERNEL))
+		irq_spinlock_unlock(&as->tlb_lock, false);
+	CPU->tlb_as = NULL;
+
 	CPU->tlb_active = true;
 	interrupts_restore(ipl);
 }
 
+/** Lock the TLB shootdown lock of an address space.
+ *
+ * The lock is held by a shootdown of the address space while it waits for
+ * its target processors to stop. Waiting for the lock with interrupts
+ * disabled could therefore close a cycle with another shootdown which
+ * targets this processor. While waiting, this processor counts as stopped
+ * and the messages it was sent meanwhile are processed once the lock is
+ * acquired.
+ *
+ * Interrupts must be disabled.
+ *
+ * @param as Address space whose lock is to be acquired.
+ *
+ */
+void tlb_as_lock(as_t *as)
+{
+	assert(interrupts_disabled());
+
+	if (irq_spinlock_trylock(&as->tlb_lock))
+		return;
+
+	CPU->tlb_active = false;
+
+	while (!irq_spinlock_trylock(&as->tlb_lock))
+		;
+
+	tlb_shootdown_ipi_recv();
+}
+
+/** Interrupt the processors targeted by the current TLB shootdown. */
 void tlb_shootdown_ipi_send(void)
 {
-	ipi_broadcast(VECTOR_TLB_SHOOTDOWN_IPI);
+	cpu_mask_t *targets = CPU->tlb_targets;
+	size_t others = 0;
+
+	cpu_mask_for_each(*targets, i)
+		others++;
+
+	/* Prefer a single broadcast if all other processors are targeted. */
+	if (others + 1 == config.cpu_count) {
+		ipi_broadcast(VECTOR_TLB_SHOOTDOWN_IPI);
+		return;
+	}
+
+	cpu_mask_for_each(*targets, i)
+		ipi_unicast(&cpus[i], VECTOR_TLB_SHOOTDOWN_IPI);
 }
 
 /** Receive TLB shootdown message.
@@ -154,10 +217,22 @@ void tlb_shootdown_ipi_recv(void)
 	assert(CPU);
 
 	CPU->tlb_active = false;
-	irq_spinlock_lock(&tlblock, false);
-	irq_spinlock_unlock(&tlblock, false);
 
-	irq_spinlock_lock(&CPU->lock, false);
+	/*
+	 * Wait until all shootdowns which have queued a message for this
+	 * processor are done changing the page tables. No new message can
+	 * be queued while the processor's lock is held.
+	 */
+	while (true) {
+		while (atomic_load(&CPU->tlb_pending) != 0)
+			;
+
+		irq_spinlock_lock(&CPU->lock, false);
+		if (atomic_load(&CPU->tlb_pending) == 0)
+			break;
+		irq_spinlock_unlock(&CPU->lock, false);
+	}
+
 	assert(CPU->tlb_messages_count <= TLB_MESSAGE_QUEUE_LEN);
 
 	size_t i;
@@ -0,0 +1,208 @@
+/*
+ * Copyright (c) 2026 agent
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * - Redistributions of source code must retain the above copyright
+ *   notice, this list of conditions and the following disclaimer.
+ * - Redistributions in binary form must reproduce the above copyright
+ *   notice, this list of conditions and the following disclaimer in the
+ *   documentation and/or other materials provided with the distribution.
+ * - The name of the author may not be used to endorse or promote products
+ *   derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+ * NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/** @addtogroup kernel_generic_mm
+ * @{
+ */
+
+/**
+ * @file
+ * @brief Pools of zeroed frames.
+ *
+ * Anonymous memory must be cleared before it is handed out to userspace.
+ * Each CPU has a kzero thread which clears free frames ahead of time
+ * whenever the CPU has nothing else to run and keeps them in the small
+ * pool of the CPU, from which page faults running there take them. When
+ * the pool is empty, the frame is cleared synchronously.
+ *
+ * A pool is only accessed by its own CPU with interrupts disabled, so it
+ * needs no lock.
+ *
+ * Frames in a pool are reserved by the pool. A frame handed out to a
+ * caller who has already reserved it leaves its reservation behind in the
+ * pool, which is then used for the next frame the pool is refilled with.
+ * Thus a pool holds at most ZERO_POOL_SIZE reservations, and page faults
+ * do not touch the reservation accounting at all.
+ */
+
+#include <mm/zero.h>
+#include <mm/frame.h>
+#include <mm/km.h>
+#include <mm/reserve.h>
+#include <synch/waitq.h>
+#include <proc/thread.h>
+#include <assert.h>
+#include <atomic.h>
+#include <cpu.h>
+#include <mem.h>
+#include <arch.h>
+
+/** The kzero thread is woken up when its pool drops below this. */
+#define ZERO_POOL_LOW   (ZERO_POOL_SIZE / 2)
+
+/** Back-off while the CPU of kzero has other threads to run. */
+#define ZERO_BUSY_USEC  10000
+/** Back-off while there is no free memory to spare. */
+#define ZERO_NOMEM_SEC  1
+
+/** Initialize the pool of zeroed frames of a CPU. */
+void zero_pool_init(zero_pool_t *pool)
+{
+	pool->count = 0;
+	pool->reserved = 0;
+	waitq_initialize(&pool->wq);
+}
+
+/** Reserve a frame for the pool of the current CPU.
+ *
+ * Only called by the kzero thread of the CPU.
+ *
+ * @return True if the pool holds a reservation for one more frame.
+ *
+ */
+static bool zero_pool_reserve(zero_pool_t *pool)
+{
+	ipl_t ipl = interrupts_disable();
+	bool reserved = (pool->reserved > pool->count);
+	interrupts_restore(ipl);
+
+	if (reserved)
+		return true;
+
+	/* Do not compete for memory with those who need it. */
+	if (!reserve_try_alloc_noreclaim(1))
+		return false;
+
+	ipl = interrupts_disable();
+	pool->reserved++;
+	interrupts_restore(ipl);
+
+	return true;
+}
+
+/** Kernel thread filling the pool of zeroed frames of its CPU.
+ *
+ * The thread is wired to the CPU and only clears frames while there is
+ * no other ready thread there, so that it effectively runs with idle
+ * priority.
+ *
+ * @param arg Not used.
+ *
+ */
+void kzero(void *arg)
+{
+	thread_detach(THREAD);
+
+	zero_pool_t *pool = &CPU->zero_pool;
+
+	while (true) {
+		ipl_t ipl = interrupts_disable();
+		bool full = (pool->count == ZERO_POOL_SIZE);
+		interrupts_restore(ipl);
+
+		if (full) {
+			waitq_sleep(&pool->wq);
+			continue;
+		}
+
+		if (atomic_load(&CPU->nrdy) > 0) {
+			thread_usleep(ZERO_BUSY_USEC);
+			continue;
+		}
+
+		if (!zero_pool_reserve(pool)) {
+			thread_sleep(ZERO_NOMEM_SEC);
+			continue;
+		}
+
+		uintptr_t frame;
+		uintptr_t kpage = km_temporary_page_get(&frame,
+		    FRAME_ATOMIC | FRAME_NO_RECLAIM | FRAME_NO_RESERVE);
+		if (kpage == 0) {
+			/* The reservation stays in the pool. */
+			thread_sleep(ZERO_NOMEM_SEC);
+			continue;
+		}
+
+		memsetb((void *) kpage, PAGE_SIZE, 0);
+		km_temporary_page_put(kpage);
+
+		/* Only this thread adds frames to the pool. */
+		ipl = interrupts_disable();
+		assert(pool->count < pool->reserved);
+		assert(pool->count < ZERO_POOL_SIZE);
+		pool->frames[pool->count++] = frame;
+		interrupts_restore(ipl);
+	}
+}
+
+/** Allocate a zeroed frame.
+ *
+ * @param flags Frame allocation flags. FRAME_NONE and FRAME_NO_RESERVE
+ *              are allowed.
+ *
+ * @return Physical address of the allocated frame.
+ *
+ */
+uintptr_t zero_frame_alloc(frame_flags_t flags)
+{
+	assert(!(flags & ~FRAME_NO_RESERVE));
+
+	uintptr_t frame = 0;
+	bool wakeup = false;
+
+	ipl_t ipl = interrupts_disable();
+
+	zero_pool_t *pool = &CPU->zero_pool;
+	if (pool->count > 0) {
+		frame = pool->frames[--pool->count];
+		wakeup = (pool->count == ZERO_POOL_LOW - 1);
+
+		/* The reservation of the frame passes to the caller. */
+		if (!(flags & FRAME_NO_RESERVE))
+			pool->reserved--;
+	}
+
+	interrupts_restore(ipl);
+
+	if (wakeup)
+		waitq_wakeup(&pool->wq, WAKEUP_FIRST);
+
+	if (frame != 0)
+		return frame;
+
+	/* The pool is empty, clear the frame synchronously. */
+	uintptr_t kpage = km_temporary_page_get(&frame, flags);
+	memsetb((void *) kpage, PAGE_SIZE, 0);
+	km_temporary_page_put(kpage);
+
+	return frame;
+}
+
+/** @}
+ */
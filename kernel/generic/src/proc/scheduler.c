@@ -36,16 +36,22 @@
  *
  * This file contains the scheduler and kcpulb kernel thread which
  * performs load-balancing of per-CPU run queues.
+ *
+ * A CPU which runs out of ready threads immediately tries to steal one
+ * from a busy CPU before it goes idle. The kcpulb threads merely even out
+ * the run queue lengths of CPUs which are all busy.
  */
 
 #include <assert.h>
 #include <atomic.h>
+#include <bitops.h>
 #include <proc/scheduler.h>
 #include <proc/thread.h>
 #include <proc/task.h>
 #include <mm/frame.h>
 #include <mm/page.h>
 #include <mm/as.h>
+#include <time/clock.h>
 #include <time/timeout.h>
 #include <time/delay.h>
 #include <arch/asm.h>
@@ -69,6 +75,20 @@ static void scheduler_separated_stack(void);
 
 atomic_size_t nrdy;  /**< Number of ready threads in the system. */
 
+/** Get the highest priority run queue set in a rq_ready bitmap. */
+static inline int rq_first(unsigned int mask)
+{
+	assert(mask != 0);
+	return RQ_COUNT - 1 - fnzb32(mask);
+}
+
+/** Account for a thread removed from a run queue whose lock is held. */
+static inline void rq_dec(cpu_t *cpu, int i)
+{
+	if (--cpu->rq[i].n == 0)
+		atomic_fetch_and(&cpu->rq_ready, ~RQ_BIT(i));
+}
+
 /** Carry out actions before new task runs. */
 static void before_task_runs(void)
 {
@@ -172,6 +192,129 @@ void scheduler_init(void)
 {
 }
 
+#ifdef CONFIG_SMP
+/** Take a ready thread which may migrate off a CPU's run queue
+ *
+ * The run queue is searched from the back, so that threads which have
+ * been waiting for the shortest time and are thus the least likely to
+ * still have their working set in the other CPU's cache are taken first.
+ *
+ * @param cpu CPU whose run queue is to be searched.
+ * @param i   Index of the run queue.
+ *
+ * @return Thread removed from the run queue with its lock held or NULL.
+ *
+ */
+static thread_t *steal_thread_from(cpu_t *cpu, int i)
+{
+	if (!(atomic_load(&cpu->rq_ready) & RQ_BIT(i)))
+		return NULL;
+
+	irq_spinlock_lock(&(cpu->rq[i].lock), false);
+	if (cpu->rq[i].n == 0) {
+		irq_spinlock_unlock(&(cpu->rq[i].lock), false);
+		return NULL;
+	}
+
+	link_t *link = list_last(&cpu->rq[i].rq);
+
+	while (link != NULL) {
+		thread_t *thread = (thread_t *) list_get_instance(link,
+		    thread_t, rq_link);
+
+		/*
+		 * Do not steal CPU-wired threads, threads
+		 * already stolen, threads for which migration
+		 * was temporarily disabled or threads whose
+		 * FPU context is still in the CPU.
+		 */
+		irq_spinlock_lock(&thread->lock, false);
+
+		if ((!thread->wired) && (!thread->stolen) &&
+		    (!thread->nomigrate) &&
+		    (!thread->fpu_context_engaged)) {
+			/*
+			 * Remove thread from ready queue.
+			 */
+			atomic_dec(&cpu->nrdy);
+			atomic_dec(&nrdy);
+
+			rq_dec(cpu, i);
+			list_remove(&thread->rq_link);
+
+			irq_spinlock_unlock(&(cpu->rq[i].lock), false);
+			return thread;
+		}
+
+		irq_spinlock_unlock(&thread->lock, false);
+
+		link = list_prev(link, &cpu->rq[i].rq);
+	}
+
+	irq_spinlock_unlock(&(cpu->rq[i].lock), false);
+	return NULL;
+}
+
+/** Steal a ready thread for an idle CPU
+ *
+ * Other CPUs are searched starting with the ones with the nearest
+ * IDs on either side, which tend to share caches with this CPU. Idle CPUs are left alone
+ * as they will shortly run their threads themselves.
+ *
+ * @param rq Place to store the index of the run queue the thread was in.
+ *
+ * @return Stolen thread with its lock held or NULL.
+ *
+ */
+static thread_t *steal_thread(int *rq)
+{
+	size_t ncpus = config.cpu_active;
+
+	for (size_t acpu = 1; acpu < ncpus; acpu++) {
+		/* Alternate the direction: +1, -1, +2, -2, ... */
+		size_t dist = (acpu + 1) / 2;
+		size_t offset = (acpu % 2) ? dist : ncpus - dist;
+		cpu_t *cpu = &cpus[(CPU->id + offset) % ncpus];
+
+		if ((atomic_load(&cpu->nrdy) == 0) || (cpu->idle))
+			continue;
+
+		unsigned int mask = atomic_load(&cpu->rq_ready);
+		while (mask != 0) {
+			int i = rq_first(mask);
+			thread_t *thread = steal_thread_from(cpu, i);
+			if (thread != NULL) {
+				*rq = i;
+				return thread;
+			}
+			mask &= ~RQ_BIT(i);
+		}
+	}
+
+	return NULL;
+}
+#endif /* CONFIG_SMP */
+
+/** Prepare a thread taken from a run queue for running on this CPU
+ *
+ * @param thread Thread with its lock held, the lock is released.
+ * @param i      Index of the run queue the thread was in.
+ *
+ */
+static void take_thread(thread_t *thread, int i)
+{
+	thread->cpu = CPU;
+	thread->ticks = us2ticks((i + 1) * 10000);
+	thread->priority = i;  /* Correct rq index */
+
+	/*
+	 * Clear the stolen flag so that it can be migrated
+	 * when load balancing needs emerge.
+	 */
+	thread->stolen = false;
+	irq_spinlock_unlock(&thread->lock, false);
+}
+
 /** Get thread to be scheduled
  *
  * Get the optimal thread to be scheduled
@@ -185,9 +328,32 @@ static thread_t *find_best_thread(void)
 {
 	assert(CPU != NULL);
 
+	if (CPU->handoff != NULL) {
+		/* The thread which has just blocked handed us its CPU. */
+		thread_t *thread = CPU->handoff;
+		CPU->handoff = NULL;
+
+		irq_spinlock_lock(&thread->lock, false);
+		take_thread(thread, thread->priority);
+		return thread;
+	}
+
 loop:
 
 	if (atomic_load(&CPU->nrdy) == 0) {
+#ifdef CONFIG_SMP
+		/*
+		 * Rather than waiting for kcpulb, help out a busy CPU right
+		 * away.
+		 */
+		int rq;
+		thread_t *stolen = steal_thread(&rq);
+		if (stolen != NULL) {
+			take_thread(stolen, rq);
+			return stolen;
+		}
+#endif
+
 		/*
 		 * For there was nothing to run, the CPU goes to sleep
 		 * until a hardware interrupt or an IPI comes.
@@ -196,6 +362,7 @@ loop:
 		irq_spinlock_lock(&CPU->lock, false);
 		CPU->idle = true;
 		irq_spinlock_unlock(&CPU->lock, false);
+		clock_idle_enter();
 		interrupts_enable();
 
 		/*
@@ -205,17 +372,21 @@ loop:
 		 */
 		cpu_sleep();
 		interrupts_disable();
+		clock_idle_exit();
 		goto loop;
 	}
 
 	assert(!CPU->idle);
 
-	unsigned int i;
-	for (i = 0; i < RQ_COUNT; i++) {
+	unsigned int mask;
+	while ((mask = atomic_load(&CPU->rq_ready)) != 0) {
+		int i = rq_first(mask);
+
 		irq_spinlock_lock(&(CPU->rq[i].lock), false);
 		if (CPU->rq[i].n == 0) {
 			/*
-			 * If this queue is empty, try a lower-priority queue.
+			 * The queue has been emptied by a stealing CPU in the
+			 * meantime, its bit is clear by now.
 			 */
 			irq_spinlock_unlock(&(CPU->rq[i].lock), false);
 			continue;
@@ -223,7 +394,7 @@ loop:
 
 		atomic_dec(&CPU->nrdy);
 		atomic_dec(&nrdy);
-		CPU->rq[i].n--;
+		rq_dec(CPU, i);
 
 		/*
 		 * Take the first thread from the queue.
@@ -233,17 +404,7 @@ loop:
 		list_remove(&thread->rq_link);
 
 		irq_spinlock_pass(&(CPU->rq[i].lock), &thread->lock);
-
-		thread->cpu = CPU;
-		thread->ticks = us2ticks((i + 1) * 10000);
-		thread->priority = i;  /* Correct rq index */
-
-		/*
-		 * Clear the stolen flag so that it can be migrated
-		 * when load balancing needs emerge.
-		 */
-		thread->stolen = false;
-		irq_spinlock_unlock(&thread->lock, false);
+		take_thread(thread, i);
 
 		return thread;
 	}
@@ -272,18 +433,28 @@ static void relink_rq(int start)
 	if (CPU->needs_relink > NEEDS_RELINK_MAX) {
 		int i;
 		for (i = start; i < RQ_COUNT - 1; i++) {
+			/* Leave empty queues alone */
+			if (!(atomic_load(&CPU->rq_ready) & RQ_BIT(i + 1)))
+				continue;
+
 			/* Remember and empty rq[i + 1] */
 
 			irq_spinlock_lock(&CPU->rq[i + 1].lock, false);
 			list_concat(&list, &CPU->rq[i + 1].rq);
 			size_t n = CPU->rq[i + 1].n;
 			CPU->rq[i + 1].n = 0;
+			atomic_fetch_and(&CPU->rq_ready, ~RQ_BIT(i + 1));
 			irq_spinlock_unlock(&CPU->rq[i + 1].lock, false);
 
+			if (n == 0)
+				continue;
+
 			/* Append rq[i + 1] to rq[i] */
 
 			irq_spinlock_lock(&CPU->rq[i].lock, false);
 			list_concat(&CPU->rq[i].rq, &list);
+			if (CPU->rq[i].n == 0)
+				atomic_fetch_or(&CPU->rq_ready, RQ_BIT(i));
 			CPU->rq[i].n += n;
 			irq_spinlock_unlock(&CPU->rq[i].lock, false);
 		}
@@ -600,61 +771,14 @@ not_satisfied:
 			if (atomic_load(&cpu->nrdy) <= average)
 				continue;
 
-			irq_spinlock_lock(&(cpu->rq[rq].lock), true);
-			if (cpu->rq[rq].n == 0) {
-				irq_spinlock_unlock(&(cpu->rq[rq].lock), true);
-				continue;
-			}
-
-			thread_t *thread = NULL;
-
-			/* Search rq from the back */
-			link_t *link = list_last(&cpu->rq[rq].rq);
-
-			while (link != NULL) {
-				thread = (thread_t *) list_get_instance(link,
-				    thread_t, rq_link);
-
-				/*
-				 * Do not steal CPU-wired threads, threads
-				 * already stolen, threads for which migration
-				 * was temporarily disabled or threads whose
-				 * FPU context is still in the CPU.
-				 */
-				irq_spinlock_lock(&thread->lock, false);
-
-				if ((!thread->wired) && (!thread->stolen) &&
-				    (!thread->nomigrate) &&
-				    (!thread->fpu_context_engaged)) {
-					/*
-					 * Remove thread from ready queue.
-					 */
-					irq_spinlock_unlock(&thread->lock,
-					    false);
-
-					atomic_dec(&cpu->nrdy);
-					atomic_dec(&nrdy);
-
-					cpu->rq[rq].n--;
-					list_remove(&thread->rq_link);
-
-					break;
-				}
-
-				irq_spinlock_unlock(&thread->lock, false);
-
-				link = list_prev(link, &cpu->rq[rq].rq);
-				thread = NULL;
-			}
+			ipl_t ipl = interrupts_disable();
+			thread_t *thread = steal_thread_from(cpu, rq);
 
 			if (thread) {
 				/*
 				 * Ready thread on local CPU
 				 */
 
-				irq_spinlock_pass(&(cpu->rq[rq].lock),
-				    &thread->lock);
-
 #ifdef KCPULB_VERBOSE
 				log(LF_OTHER, LVL_DEBUG,
 				    "kcpulb%u: TID %" PRIu64 " -> cpu%u, "
@@ -666,7 +790,8 @@ not_satisfied:
 				thread->stolen = true;
 				thread->state = Entering;
 
-				irq_spinlock_unlock(&thread->lock, true);
+				irq_spinlock_unlock(&thread->lock, false);
+				interrupts_restore(ipl);
 				thread_ready(thread);
 
 				if (--count == 0)
@@ -678,11 +803,8 @@ not_satisfied:
 				 *
 				 */
 				acpu_bias++;
-
-				continue;
 			} else
-				irq_spinlock_unlock(&(cpu->rq[rq].lock), true);
-
+				interrupts_restore(ipl);
 		}
 	}
 
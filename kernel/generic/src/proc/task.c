@@ -210,6 +210,7 @@ task_t *task_create(as_t *as, const char *name)
 	task->perms = 0;
 	task->ucycles = 0;
 	task->kcycles = 0;
+	task->page_faults = 0;
 
 	caps_task_init(task);
 
@@ -272,14 +272,42 @@ static void before_thread_is_ready(thread_t *thread)
 	assert(irq_spinlock_locked(&thread->lock));
 }
 
-/** Make thread ready
+/** Append a ready thread to a run queue
  *
- * Switch thread to the ready state.
+ * @param thread Thread with its lock held, the lock is released.
+ * @param cpu    CPU whose run queue the thread is appended to.
+ * @param i      Index of the run queue.
+ * @param irq    Whether the lock of the thread was taken with interrupts
+ *               disabled by irq_spinlock_lock().
+ *
+ */
+static void thread_rq_append(thread_t *thread, cpu_t *cpu, int i, bool irq)
+{
+	irq_spinlock_pass(&thread->lock, &(cpu->rq[i].lock));
+
+	/*
+	 * Append thread to respective ready queue
+	 * on respective processor.
+	 */
+
+	list_append(&thread->rq_link, &cpu->rq[i].rq);
+	if (cpu->rq[i].n++ == 0)
+		atomic_fetch_or(&cpu->rq_ready, RQ_BIT(i));
+	irq_spinlock_unlock(&(cpu->rq[i].lock), irq);
+
+	atomic_inc(&nrdy);
+	atomic_inc(&cpu->nrdy);
+
+	clock_idle_kick(cpu);
+}
+
+/** Make thread ready, possibly handing it the CPU
  *
  * @param thread Thread to make ready.
+ * @param wq     Wait queue the thread has been woken up from or NULL.
  *
  */
-void thread_ready(thread_t *thread)
+static void thread_ready_internal(thread_t *thread, waitq_t *wq)
 {
 	irq_spinlock_lock(&thread->lock, true);
 
@@ -290,8 +318,21 @@ void thread_ready(thread_t *thread)
 	int i = (thread->priority < RQ_COUNT - 1) ?
 	    ++thread->priority : thread->priority;
 
+	bool pinned = thread->wired || thread->nomigrate ||
+	    thread->fpu_context_engaged;
+
+	if ((wq != NULL) && (THREAD != NULL) && (THREAD != thread) &&
+	    (THREAD->handoff == wq) && (CPU->handoff == NULL) &&
+	    ((!pinned) || (thread->cpu == CPU))) {
+		THREAD->handoff = NULL;
+		thread->state = Ready;
+		CPU->handoff = thread;
+		irq_spinlock_unlock(&thread->lock, true);
+		return;
+	}
+
 	cpu_t *cpu;
-	if (thread->wired || thread->nomigrate || thread->fpu_context_engaged) {
+	if (pinned) {
 		/* Cannot ready to another CPU */
 		assert(thread->cpu != NULL);
 		cpu = thread->cpu;
@@ -308,19 +349,78 @@ void thread_ready(thread_t *thread)
 
 	thread->state = Ready;
 
-	irq_spinlock_pass(&thread->lock, &(cpu->rq[i].lock));
+	thread_rq_append(thread, cpu, i, true);
+}
 
-	/*
-	 * Append thread to respective ready queue
-	 * on respective processor.
-	 */
+/** Make thread ready
+ *
+ * Switch thread to the ready state.
+ *
+ * @param thread Thread to make ready.
+ *
+ */
+void thread_ready(thread_t *thread)
+{
+	thread_ready_internal(thread, NULL);
+}
 
-	list_append(&thread->rq_link, &cpu->rq[i].rq);
-	cpu->rq[i].n++;
-	irq_spinlock_unlock(&(cpu->rq[i].lock), true);
+/** Make thread woken up from a wait queue ready
+ *
+ * If the current thread has announced that it is about to block using
+ * thread_handoff_begin() with @a wq, the first thread it wakes up from
+ * @a wq is handed the CPU directly instead of being appended to a run
+ * queue. Threads made ready otherwise, e.g. by timeouts, never are.
+ *
+ * @param thread Thread to make ready.
+ * @param wq     Wait queue the thread has been woken up from.
+ *
+ */
+void thread_ready_from(thread_t *thread, waitq_t *wq)
+{
+	thread_ready_internal(thread, wq);
+}
 
-	atomic_inc(&nrdy);
-	atomic_inc(&cpu->nrdy);
+/** Hand the CPU over to the next thread woken up from a wait queue.
+ *
+ * The current thread is expected to block soon after waking the other thread
+ * up, e.g. when it sends an IPC request and waits for the answer. The woken
+ * up thread then runs on this CPU right away, bypassing the run queues.
+ * The handoff must be completed with thread_handoff_end().
+ *
+ * @param wq Wait queue of the intended recipient, e.g. of its answerbox.
+ *           Wakeups from other wait queues are not affected.
+ *
+ */
+void thread_handoff_begin(waitq_t *wq)
+{
+	assert(THREAD);
+
+	THREAD->handoff = wq;
+}
+
+/** Complete a handoff started by thread_handoff_begin().
+ *
+ * If the current thread has not blocked since it woke up the other thread,
+ * the other thread is appended to the run queue of this CPU.
+ *
+ */
+void thread_handoff_end(void)
+{
+	assert(THREAD);
+
+	ipl_t ipl = interrupts_disable();
+
+	THREAD->handoff = NULL;
+
+	thread_t *thread = CPU->handoff;
+	CPU->handoff = NULL;
+
+	if (thread != NULL) {
+		irq_spinlock_lock(&thread->lock, false);
+		thread_rq_append(thread, CPU, thread->priority, false);
+	}
+
+	interrupts_restore(ipl);
 }
 
 /** Create new thread
@@ -380,6 +480,7 @@ thread_t *thread_create(void (*func)(void *), void *arg, task_t *task,
 	thread->cpu = NULL;
 	thread->wired = false;
 	thread->stolen = false;
+	thread->handoff = NULL;
 	thread->uspace =
 	    ((flags & THREAD_FLAG_USPACE) == THREAD_FLAG_USPACE);
 
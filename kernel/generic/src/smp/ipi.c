@@ -39,6 +39,8 @@
 
 #include <smp/ipi.h>
 #include <config.h>
+#include <cpu.h>
+#include <assert.h>
 
 /** Broadcast IPI message
  *
@@ -59,6 +61,19 @@ void ipi_broadcast(int ipi)
 		ipi_broadcast_arch(ipi);
 }
 
+/** Send IPI message to one CPU
+ *
+ * @param cpu Destination CPU other than the current one.
+ * @param ipi Message to send.
+ *
+ */
+void ipi_unicast(cpu_t *cpu, int ipi)
+{
+	assert(cpu != CPU);
+
+	ipi_unicast_arch(cpu, ipi);
+}
+
 #endif /* CONFIG_SMP */
 
 /** @}
@@ -555,7 +555,7 @@ loop:
 	thread->sleep_queue = NULL;
 	irq_spinlock_unlock(&thread->lock, false);
 
-	thread_ready(thread);
+	thread_ready_from(thread, wq);
 
 	if (mode == WAKEUP_ALL)
 		goto loop;
@@ -43,6 +43,7 @@
 #include <synch/mutex.h>
 #include <time/clock.h>
 #include <mm/frame.h>
+#include <mm/km.h>
 #include <proc/task.h>
 #include <proc/thread.h>
 #include <interrupt.h>
@@ -226,6 +227,7 @@ static void produce_stats_task(task_t *task, stats_task_t *stats_task)
 	stats_task->threads = atomic_load(&task->refcount);
 	task_get_accounting(task, &(stats_task->ucycles),
 	    &(stats_task->kcycles));
+	stats_task->page_faults = task->page_faults;
 	stats_task->ipc_info = task->ipc_info;
 }
 
@@ -864,6 +866,20 @@ void kload(void *arg)
 	}
 }
 
+/** Get the number of TLB shootdowns saved by lazy kernel unmapping
+ *
+ * @param item Sysinfo item (unused).
+ * @param data Unused.
+ *
+ * @return Number of saved shootdowns.
+ *
+ */
+static sysarg_t get_stats_km_shootdowns_avoided(struct sysinfo_item *item,
+    void *data)
+{
+	return (sysarg_t) km_shootdowns_avoided();
+}
+
 /** Register sysinfo statistical items
  *
  */
@@ -878,6 +894,8 @@ void stats_init(void)
 	sysinfo_set_item_gen_data("system.threads", NULL, get_stats_threads, NULL);
 	sysinfo_set_item_gen_data("system.ipccs", NULL, get_stats_ipccs, NULL);
 	sysinfo_set_item_gen_data("system.exceptions", NULL, get_stats_exceptions, NULL);
+	sysinfo_set_item_gen_val("system.km_shootdowns_avoided", NULL,
+	    get_stats_km_shootdowns_avoided, NULL);
 	sysinfo_set_subtree_fn("system.tasks", NULL, get_stats_task, NULL);
 	sysinfo_set_subtree_fn("system.threads", NULL, get_stats_thread, NULL);
 	sysinfo_set_subtree_fn("system.exceptions", NULL, get_stats_exception, NULL);
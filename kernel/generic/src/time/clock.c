@@ -61,6 +61,9 @@
 /* Pointer to variable with uptime */
 uptime_t *uptime;
 
+/** Clock source operations for idle CPUs, NULL if ticks cannot be skipped */
+clock_idle_ops_t *clock_idle_ops = NULL;
+
 /** Physical memory area of the real time clock */
 static parea_t clock_parea;
 
@@ -136,6 +139,88 @@ static void cpu_update_accounting(void)
 	irq_spinlock_unlock(&CPU->lock, false);
 }
 
+/** Stop clock ticks of an idle CPU
+ *
+ * Called with interrupts disabled right before the CPU goes to sleep. The
+ * next clock interrupt is deferred to the first tick which has timeouts
+ * to process, so that an idle CPU is not woken up just to find nothing to
+ * do.
+ *
+ */
+void clock_idle_enter(void)
+{
+	if (clock_idle_ops == NULL)
+		return;
+
+#ifdef CONFIG_SMP
+	/*
+	 * Threads readied by other CPUs would have to wait for the next
+	 * tick of this CPU if there is no way to kick it sooner.
+	 */
+	if ((config.cpu_active > 1) && (clock_idle_ops->kick == NULL))
+		return;
+#endif
+
+	uint64_t ticks = timeout_idle_ticks(CLOCK_IDLE_MAX_TICKS);
+	if ((ticks > 1) && clock_idle_ops->stop(ticks)) {
+		CPU->tickless = true;
+
+#ifdef CONFIG_SMP
+		/*
+		 * Pairs with the barrier in clock_idle_kick(). Either the
+		 * other CPU sees this CPU tickless and kicks it, or this
+		 * CPU sees the thread it has readied.
+		 */
+		memory_barrier();
+		if (atomic_load(&CPU->nrdy) > 0)
+			clock_idle_exit();
+#endif
+	}
+}
+
+/** Restart clock ticks of a CPU which has stopped being idle
+ *
+ * Called with interrupts disabled after the CPU woke up. Ticks which have
+ * passed in the meantime are accounted by the next clock interrupt.
+ *
+ */
+void clock_idle_exit(void)
+{
+	if (CPU->tickless) {
+		CPU->tickless = false;
+		clock_idle_ops->resume();
+	}
+}
+
+/** Restart clock ticks of a CPU a thread has been readied on
+ *
+ * Called after the thread has been appended to one of the run queues of
+ * @a cpu. If the CPU has stopped its ticks, it would not notice the thread
+ * before its next timeout, so it is kicked.
+ *
+ * @param cpu CPU the thread has been readied on.
+ *
+ */
+void clock_idle_kick(cpu_t *cpu)
+{
+#ifdef CONFIG_SMP
+	if ((clock_idle_ops == NULL) || (clock_idle_ops->kick == NULL))
+		return;
+
+	ipl_t ipl = interrupts_disable();
+
+	/* An idle CPU which readies a thread for itself resumes on its own. */
+	if (cpu != CPU) {
+		/* Pairs with the barrier in clock_idle_enter(). */
+		memory_barrier();
+		if (cpu->tickless)
+			clock_idle_ops->kick(cpu);
+	}
+
+	interrupts_restore(ipl);
+#endif
+}
+
 /** Clock routine
  *
  * Clock routine executed from clock interrupt handler
@@ -150,44 +235,14 @@ void clock(void)
 	/* Account CPU usage */
 	cpu_update_accounting();
 
-	/*
-	 * To avoid lock ordering problems,
-	 * run all expired timeouts as you visit them.
-	 *
-	 */
 	size_t i;
 	for (i = 0; i <= missed_clock_ticks; i++) {
 		/* Update counters and accounting */
 		clock_update_counters();
 		cpu_update_accounting();
 
-		irq_spinlock_lock(&CPU->timeoutlock, false);
-
-		link_t *cur;
-		while ((cur = list_first(&CPU->timeout_active_list)) != NULL) {
-			timeout_t *timeout = list_get_instance(cur, timeout_t,
-			    link);
-
-			irq_spinlock_lock(&timeout->lock, false);
-			if (timeout->ticks-- != 0) {
-				irq_spinlock_unlock(&timeout->lock, false);
-				break;
-			}
-
-			list_remove(cur);
-			timeout_handler_t handler = timeout->handler;
-			void *arg = timeout->arg;
-			timeout_reinitialize(timeout);
-
-			irq_spinlock_unlock(&timeout->lock, false);
-			irq_spinlock_unlock(&CPU->timeoutlock, false);
-
-			handler(arg);
-
-			irq_spinlock_lock(&CPU->timeoutlock, false);
-		}
-
-		irq_spinlock_unlock(&CPU->timeoutlock, false);
+		/* Run expired timeouts */
+		timeout_tick();
 	}
 	CPU->missed_clock_ticks = 0;
 
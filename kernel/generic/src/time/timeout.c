@@ -33,9 +33,25 @@
 /**
  * @file
  * @brief Timeout management functions.
+ *
+ * Active timeouts of each CPU are kept in a hierarchical timing wheel.
+ * Level 0 has a slot for each of the next TIMEOUT_WHEEL_SLOTS ticks, each
+ * slot of level l covers TIMEOUT_WHEEL_SLOTS times as many ticks as a slot
+ * of level l - 1. A timeout is put on the lowest level whose range
+ * reaches its deadline. Whenever the lower levels have gone full circle,
+ * the timeouts in the next slot of the level above are cascaded, i.e.
+ * spread to the lower levels according to their deadlines. Registering and
+ * unregistering a timeout therefore takes constant time and clock() only
+ * ever looks at the timeouts which are about to expire.
+ *
+ * If the clock of the CPU can interrupt it between ticks, a timeout only
+ * waits on the wheel for the last tick before its deadline. From there, it
+ * moves to a short list of alarms sorted by their deadlines in CPU cycles
+ * and expires on the alarm interrupt, with a resolution finer than a tick.
  */
 
 #include <time/timeout.h>
+#include <time/clock.h>
 #include <typedefs.h>
 #include <config.h>
 #include <panic.h>
@@ -43,8 +59,13 @@
 #include <halt.h>
 #include <cpu.h>
 #include <arch/asm.h>
+#include <arch/cycle.h>
 #include <arch.h>
 
+/** Number of ticks the whole timing wheel spans. */
+#define TIMEOUT_WHEEL_SPAN \
+	((uint64_t) 1 << (TIMEOUT_WHEEL_LEVELS * TIMEOUT_WHEEL_WIDTH))
+
 /** Initialize timeouts
  *
  * Initialize kernel timeouts.
@@ -53,7 +74,14 @@
 void timeout_init(void)
 {
 	irq_spinlock_initialize(&CPU->timeoutlock, "cpu.timeoutlock");
-	list_initialize(&CPU->timeout_active_list);
+	CPU->timeout_ticks = 0;
+
+	for (unsigned int l = 0; l < TIMEOUT_WHEEL_LEVELS; l++) {
+		for (unsigned int i = 0; i < TIMEOUT_WHEEL_SLOTS; i++)
+			list_initialize(&CPU->timeout_wheel[l][i]);
+	}
+
+	list_initialize(&CPU->timeout_alarms);
 }
 
 /** Reinitialize timeout
@@ -66,7 +94,8 @@ void timeout_init(void)
 void timeout_reinitialize(timeout_t *timeout)
 {
 	timeout->cpu = NULL;
-	timeout->ticks = 0;
+	timeout->deadline = 0;
+	timeout->hr_deadline = 0;
 	timeout->handler = NULL;
 	timeout->arg = NULL;
 	link_initialize(&timeout->link);
@@ -85,6 +114,90 @@ void timeout_initialize(timeout_t *timeout)
 	timeout_reinitialize(timeout);
 }
 
+/** Put timeout into the timing wheel slot its deadline belongs to
+ *
+ * Timeouts further away than the wheel spans are put into the farthest
+ * slot and get placed again once it is cascaded.
+ *
+ * @param cpu     CPU whose timeoutlock is held.
+ * @param timeout Timeout with its deadline set.
+ *
+ */
+static void timeout_insert(cpu_t *cpu, timeout_t *timeout)
+{
+	uint64_t now = cpu->timeout_ticks;
+	uint64_t deadline = timeout->deadline;
+
+	if (deadline < now)
+		deadline = now;
+	else if (deadline - now >= TIMEOUT_WHEEL_SPAN)
+		deadline = now + TIMEOUT_WHEEL_SPAN - 1;
+
+	unsigned int l = 0;
+	while ((deadline - now) >> ((l + 1) * TIMEOUT_WHEEL_WIDTH) != 0)
+		l++;
+
+	size_t i = (deadline >> (l * TIMEOUT_WHEEL_WIDTH)) &
+	    (TIMEOUT_WHEEL_SLOTS - 1);
+	list_append(&timeout->link, &cpu->timeout_wheel[l][i]);
+}
+
+/** Check whether the clock can interrupt the current CPU between ticks */
+static bool timeout_alarms_available(void)
+{
+	return (clock_idle_ops != NULL) && (clock_idle_ops->alarm != NULL) &&
+	    (CPU->frequency_mhz != 0);
+}
+
+/** Program the clock to interrupt the current CPU when an alarm is due
+ *
+ * @param timeout Timeout with its hr_deadline set.
+ *
+ */
+static void timeout_alarm_program(timeout_t *timeout)
+{
+	uint64_t now = get_cycle();
+	uint64_t usec = 0;
+
+	if ((int64_t) (timeout->hr_deadline - now) > 0) {
+		usec = (timeout->hr_deadline - now + CPU->frequency_mhz - 1) /
+		    CPU->frequency_mhz;
+	}
+
+	clock_idle_ops->alarm(usec);
+}
+
+/** Put timeout into the alarm list of the current CPU
+ *
+ * The clock is programmed to interrupt the CPU when the timeout becomes
+ * the first one to expire.
+ *
+ * @param timeout Timeout with its hr_deadline set.
+ *
+ */
+static void timeout_alarm_insert(timeout_t *timeout)
+{
+	link_t *next = NULL;
+
+	list_foreach(CPU->timeout_alarms, link, timeout_t, cur) {
+		if ((int64_t) (timeout->hr_deadline - cur->hr_deadline) < 0) {
+			next = &cur->link;
+			break;
+		}
+	}
+
+	if (next != NULL)
+		list_insert_before(&timeout->link, next);
+	else
+		list_append(&timeout->link, &CPU->timeout_alarms);
+
+	if (list_first(&CPU->timeout_alarms) == &timeout->link) {
+		/* The alarm of a CPU with its ticks stopped would be late. */
+		clock_idle_exit();
+		timeout_alarm_program(timeout);
+	}
+}
+
 /** Register timeout
  *
  * Insert timeout handler f (with argument arg)
@@ -107,51 +220,25 @@ void timeout_register(timeout_t *timeout, uint64_t time,
 		panic("Unexpected: timeout->cpu != 0.");
 
 	timeout->cpu = CPU;
-	timeout->ticks = us2ticks(time);
-
 	timeout->handler = handler;
 	timeout->arg = arg;
 
-	/*
-	 * Insert timeout into the active timeouts list according to timeout->ticks.
-	 */
-	uint64_t sum = 0;
-	timeout_t *target = NULL;
-	link_t *cur, *prev;
-	prev = NULL;
-	for (cur = list_first(&CPU->timeout_active_list);
-	    cur != NULL; cur = list_next(cur, &CPU->timeout_active_list)) {
-		target = list_get_instance(cur, timeout_t, link);
-		irq_spinlock_lock(&target->lock, false);
-
-		if (timeout->ticks < sum + target->ticks) {
-			irq_spinlock_unlock(&target->lock, false);
-			break;
-		}
-
-		sum += target->ticks;
-		irq_spinlock_unlock(&target->lock, false);
-		prev = cur;
-	}
-
-	if (prev == NULL)
-		list_prepend(&timeout->link, &CPU->timeout_active_list);
-	else
-		list_insert_after(&timeout->link, prev);
+	if (timeout_alarms_available()) {
+		/*
+		 * The us2ticks(time)-th tick comes before the deadline, no
+		 * matter how much of the current tick has passed already.
+		 */
+		timeout->hr_deadline = get_cycle() + time * CPU->frequency_mhz;
+		timeout->deadline = CPU->timeout_ticks + us2ticks(time);
 
-	/*
-	 * Adjust timeout->ticks according to ticks
-	 * accumulated in target's predecessors.
-	 */
-	timeout->ticks -= sum;
-
-	/*
-	 * Decrease ticks of timeout's immediate succesor by timeout->ticks.
-	 */
-	if (cur != NULL) {
-		irq_spinlock_lock(&target->lock, false);
-		target->ticks -= timeout->ticks;
-		irq_spinlock_unlock(&target->lock, false);
+		if (timeout->deadline == CPU->timeout_ticks)
+			timeout_alarm_insert(timeout);
+		else
+			timeout_insert(CPU, timeout);
+	} else {
+		/* The handler runs on the (us2ticks(time) + 1)-th tick. */
+		timeout->deadline = CPU->timeout_ticks + us2ticks(time) + 1;
+		timeout_insert(CPU, timeout);
 	}
 
 	irq_spinlock_unlock(&timeout->lock, false);
@@ -186,18 +273,10 @@ grab_locks:
 
 	/*
 	 * Now we know for sure that timeout hasn't been activated yet
-	 * and is lurking in timeout->cpu->timeout_active_list.
+	 * and is lurking in the timing wheel or the alarm list of
+	 * timeout->cpu.
 	 */
 
-	link_t *cur = list_next(&timeout->link,
-	    &timeout->cpu->timeout_active_list);
-	if (cur != NULL) {
-		timeout_t *tmp = list_get_instance(cur, timeout_t, link);
-		irq_spinlock_lock(&tmp->lock, false);
-		tmp->ticks += timeout->ticks;
-		irq_spinlock_unlock(&tmp->lock, false);
-	}
-
 	list_remove(&timeout->link);
 	irq_spinlock_unlock(&timeout->cpu->timeoutlock, false);
 
@@ -207,5 +286,176 @@ grab_locks:
 	return true;
 }
 
+/** Spread the timeouts of a timing wheel slot to the lower levels
+ *
+ * @param l Level of the slot.
+ * @param i Index of the slot.
+ *
+ */
+static void timeout_cascade(unsigned int l, size_t i)
+{
+	list_t *slot = &CPU->timeout_wheel[l][i];
+	link_t *cur;
+
+	while ((cur = list_first(slot)) != NULL) {
+		timeout_t *timeout = list_get_instance(cur, timeout_t, link);
+
+		list_remove(cur);
+		timeout_insert(CPU, timeout);
+	}
+}
+
+/** Run the handler of an expired timeout
+ *
+ * The timeoutlock of the current CPU is held on entry and on exit, but
+ * not while the handler runs, to avoid lock ordering problems.
+ *
+ * @param timeout Expired timeout.
+ *
+ */
+static void timeout_expire(timeout_t *timeout)
+{
+	irq_spinlock_lock(&timeout->lock, false);
+
+	list_remove(&timeout->link);
+	timeout_handler_t handler = timeout->handler;
+	void *arg = timeout->arg;
+	timeout_reinitialize(timeout);
+
+	irq_spinlock_unlock(&timeout->lock, false);
+	irq_spinlock_unlock(&CPU->timeoutlock, false);
+
+	handler(arg);
+
+	irq_spinlock_lock(&CPU->timeoutlock, false);
+}
+
+/** Run the handlers of the alarms of this CPU which are due
+ *
+ * The clock is programmed to interrupt the CPU when the next alarm is due.
+ * Called with the timeoutlock of the current CPU held.
+ *
+ */
+static void timeout_alarms_expire(void)
+{
+	link_t *cur;
+
+	while ((cur = list_first(&CPU->timeout_alarms)) != NULL) {
+		timeout_t *timeout = list_get_instance(cur, timeout_t, link);
+
+		if ((int64_t) (timeout->hr_deadline - get_cycle()) > 0) {
+			timeout_alarm_program(timeout);
+			break;
+		}
+
+		timeout_expire(timeout);
+	}
+}
+
+/** Advance timeouts of this CPU by one tick
+ *
+ * Executed from clock() with interrupts disabled. Runs the handlers of all
+ * timeouts which expire on this tick.
+ *
+ */
+void timeout_tick(void)
+{
+	irq_spinlock_lock(&CPU->timeoutlock, false);
+
+	uint64_t now = ++CPU->timeout_ticks;
+
+	/*
+	 * Cascade the levels whose lower neighbour has just wrapped around,
+	 * farthest first, so that their timeouts can trickle all the way
+	 * down to level 0.
+	 */
+	unsigned int top = 0;
+	while ((top < TIMEOUT_WHEEL_LEVELS - 1) &&
+	    ((now & (((uint64_t) 1 << ((top + 1) * TIMEOUT_WHEEL_WIDTH)) - 1)) == 0))
+		top++;
+
+	for (unsigned int l = top; l > 0; l--) {
+		timeout_cascade(l, (now >> (l * TIMEOUT_WHEEL_WIDTH)) &
+		    (TIMEOUT_WHEEL_SLOTS - 1));
+	}
+
+	/*
+	 * To avoid lock ordering problems,
+	 * run all expired timeouts as you visit them.
+	 *
+	 */
+	list_t *slot = &CPU->timeout_wheel[0][now & (TIMEOUT_WHEEL_SLOTS - 1)];
+	link_t *cur;
+	while ((cur = list_first(slot)) != NULL) {
+		timeout_t *timeout = list_get_instance(cur, timeout_t, link);
+
+		/* Wait for the rest of the time on the alarm list. */
+		if ((timeout->hr_deadline != 0) &&
+		    ((int64_t) (timeout->hr_deadline - get_cycle()) > 0)) {
+			list_remove(cur);
+			timeout_alarm_insert(timeout);
+			continue;
+		}
+
+		timeout_expire(timeout);
+	}
+
+	timeout_alarms_expire();
+
+	irq_spinlock_unlock(&CPU->timeoutlock, false);
+}
+
+/** Run the alarms of this CPU which are due
+ *
+ * Executed from the clock interrupt handler with interrupts disabled when
+ * the interrupt has been requested by clock_idle_ops->alarm() rather than
+ * being a clock tick.
+ *
+ */
+void timeout_alarm(void)
+{
+	irq_spinlock_lock(&CPU->timeoutlock, false);
+	timeout_alarms_expire();
+	irq_spinlock_unlock(&CPU->timeoutlock, false);
+}
+
+/** Find out how long this CPU can do without clock ticks
+ *
+ * @param max Maximum number of ticks to report.
+ *
+ * @return Number of ticks until the first tick which expires or cascades
+ *         timeouts of this CPU, or @a max if there is no such tick sooner.
+ *         Zero if there are alarms pending.
+ *
+ */
+uint64_t timeout_idle_ticks(uint64_t max)
+{
+	irq_spinlock_lock(&CPU->timeoutlock, false);
+
+	uint64_t now = CPU->timeout_ticks;
+	uint64_t ticks = list_empty(&CPU->timeout_alarms) ? max : 0;
+
+	for (unsigned int l = 0; l < TIMEOUT_WHEEL_LEVELS; l++) {
+		unsigned int shift = l * TIMEOUT_WHEEL_WIDTH;
+		uint64_t base = now >> shift;
+
+		/* Slot k positions ahead is visited on tick (base + k) << shift */
+		for (uint64_t k = 1; k <= TIMEOUT_WHEEL_SLOTS; k++) {
+			uint64_t when = ((base + k) << shift) - now;
+			if (when >= ticks)
+				break;
+
+			if (!list_empty(&CPU->timeout_wheel[l][(base + k) &
+			    (TIMEOUT_WHEEL_SLOTS - 1)])) {
+				ticks = when;
+				break;
+			}
+		}
+	}
+
+	irq_spinlock_unlock(&CPU->timeoutlock, false);
+	return ticks;
+}
+
 /** @}
  */
@@ -33,11 +33,98 @@
 #include <typedefs.h>
 #include <align.h>
 #include <stdlib.h>
+#include <preemption.h>
 
 #define MAX_FRAMES  1024
 #define MAX_ORDER   8
 #define TEST_RUNS   2
 
+/** Allocate aligned blocks of all orders up to MAX_ORDER. */
+static const char *falloc_orders(uintptr_t *frames)
+{
+	for (unsigned int run = 0; run < TEST_RUNS; run++) {
+		for (unsigned int order = 0; order <= MAX_ORDER; order++) {
+			size_t count = 1 << order;
+			size_t bytes = FRAMES2SIZE(count);
+
+			TPRINTF("Allocating %zu frames block aligned to "
+			    "%zu bytes ... ", count, bytes);
+
+			frames[order] = frame_alloc(count, FRAME_ATOMIC,
+			    bytes - 1);
+			if (!frames[order]) {
+				TPRINTF("failed.\n");
+				while (order-- > 0)
+					frame_free(frames[order], 1 << order);
+				return "Unable to allocate aligned block";
+			}
+
+			TPRINTF("%p.\n", (void *) frames[order]);
+
+			if (!IS_ALIGNED(frames[order], bytes))
+				return "Block not aligned to its size";
+		}
+
+		for (unsigned int i = 0; i <= MAX_ORDER; i++) {
+			for (unsigned int j = i + 1; j <= MAX_ORDER; j++) {
+				if ((frames[i] < frames[j] + FRAMES2SIZE(1 << j)) &&
+				    (frames[j] < frames[i] + FRAMES2SIZE(1 << i)))
+					return "Overlapping blocks";
+			}
+		}
+
+		TPRINTF("Deallocating ... ");
+
+		for (unsigned int order = 0; order <= MAX_ORDER; order++)
+			frame_free(frames[order], 1 << order);
+
+		TPRINTF("done.\n");
+	}
+
+	return NULL;
+}
+
+/** Free single frames through the list of this CPU and get them back. */
+static const char *falloc_pcpu(uintptr_t *frames)
+{
+	/* Free more frames than the list holds to make it drain. */
+	size_t count = 2 * FRAME_PCPU_MAX;
+
+	preemption_disable();
+
+	TPRINTF("Allocating %zu single frames ... ", count);
+
+	for (size_t i = 0; i < count; i++) {
+		frames[i] = frame_alloc(1, FRAME_ATOMIC, 0);
+		if (!frames[i]) {
+			TPRINTF("failed.\n");
+			while (i-- > 0)
+				frame_free(frames[i], 1);
+			preemption_enable();
+			return "Unable to allocate single frames";
+		}
+	}
+
+	TPRINTF("done.\nDeallocating ... ");
+
+	for (size_t i = 0; i < count; i++)
+		frame_free(frames[i], 1);
+
+	TPRINTF("done.\n");
+
+	/* The most recently freed frame is at the top of the list. */
+	uintptr_t frame = frame_alloc(1, FRAME_ATOMIC, 0);
+	if (frame)
+		frame_free(frame, 1);
+
+	preemption_enable();
+
+	if (frame != frames[count - 1])
+		return "Freed frame not reused from the per-CPU list";
+
+	return NULL;
+}
+
 const char *test_falloc1(void)
 {
 	if (TEST_RUNS < 2)
@@ -85,7 +172,11 @@ const char *test_falloc1(void)
 		}
 	}
 
+	const char *err = falloc_orders(frames);
+	if (err == NULL)
+		err = falloc_pcpu(frames);
+
 	free(frames);
 
-	return NULL;
+	return err;
 }
@@ -0,0 +1,132 @@
+/*
+ * Copyright (c) 2026 agent
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * - Redistributions of source code must retain the above copyright
+ *   notice, this list of conditions and the following disclaimer.
+ * - Redistributions in binary form must reproduce the above copyright
+ *   notice, this list of conditions and the following disclaimer in the
+ *   documentation and/or other materials provided with the distribution.
+ * - The name of the author may not be used to endorse or promote products
+ *   derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+ * NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <test.h>
+#include <arch.h>
+#include <atomic.h>
+#include <cpu.h>
+#include <proc/thread.h>
+#include <time/timeout.h>
+#include <typedefs.h>
+
+/** Ticks until the timeouts expire, around the slots of two wheel levels */
+static const uint64_t delays[] = {
+	0, 1, 2, 5, 62, 63, 64, 65, 100, 127, 128, 129, 200
+};
+
+#define TIMEOUTS  (sizeof(delays) / sizeof(delays[0]))
+
+/** Timeout which gets unregistered before it expires */
+#define CANCELED  6
+
+typedef struct {
+	timeout_t timeout;
+	/** Tick the timeout is expected to expire on */
+	uint64_t deadline;
+	/** Tick the timeout has expired on */
+	uint64_t expired;
+} test_timeout_t;
+
+static test_timeout_t timeouts[TIMEOUTS];
+static atomic_size_t expired_cnt;
+
+static void handler(void *arg)
+{
+	test_timeout_t *t = (test_timeout_t *) arg;
+
+	t->expired = CPU->timeout_ticks;
+	atomic_inc(&expired_cnt);
+}
+
+static const char *check_timeouts(void)
+{
+	/* Give the timeouts plenty of time on a busy system. */
+	unsigned int wait = 4 * delays[TIMEOUTS - 1] + 2 * HZ;
+
+	while ((atomic_load(&expired_cnt) < TIMEOUTS - 1) && (wait-- > 0))
+		thread_usleep(1000000 / HZ);
+
+	if (atomic_load(&expired_cnt) != TIMEOUTS - 1)
+		return "Timeouts did not expire";
+
+	if (timeouts[CANCELED].expired != 0)
+		return "Unregistered timeout expired";
+
+	for (size_t i = 0; i < TIMEOUTS; i++) {
+		if (i == CANCELED)
+			continue;
+
+		TPRINTF("Timeout %zu: deadline %" PRIu64 ", expired %" PRIu64
+		    "\n", i, timeouts[i].deadline, timeouts[i].expired);
+
+		if (timeouts[i].expired != timeouts[i].deadline)
+			return "Timeout expired on a wrong tick";
+
+		if (timeout_unregister(&timeouts[i].timeout))
+			return "Expired timeout still registered";
+	}
+
+	return NULL;
+}
+
+const char *test_timeout1(void)
+{
+	atomic_store(&expired_cnt, 0);
+
+	/*
+	 * Register all timeouts on the same tick, in a scrambled order.
+	 * The deadlines are checked against the ticks of the CPU the
+	 * timeouts are registered on.
+	 */
+	ipl_t ipl = interrupts_disable();
+	uint64_t now = CPU->timeout_ticks;
+
+	for (size_t k = 0; k < TIMEOUTS; k++) {
+		size_t i = (k * 5) % TIMEOUTS;
+
+		timeout_initialize(&timeouts[i].timeout);
+		timeouts[i].deadline = now + delays[i] + 1;
+		timeouts[i].expired = 0;
+		timeout_register(&timeouts[i].timeout,
+		    delays[i] * (1000000 / HZ), handler, &timeouts[i]);
+	}
+
+	interrupts_restore(ipl);
+
+	const char *err = NULL;
+	if (!timeout_unregister(&timeouts[CANCELED].timeout))
+		err = "Cannot unregister pending timeout";
+
+	if (err == NULL)
+		err = check_timeouts();
+
+	for (size_t i = 0; i < TIMEOUTS; i++)
+		(void) timeout_unregister(&timeouts[i].timeout);
+
+	return err;
+}
@@ -49,12 +49,14 @@
 #include <inttypes.h>
 #include <errno.h>
 #include <str.h>
+#include <str_error.h>
 
 #define NAME	"blkdump"
 
 static void syntax_print(void);
 static int print_blocks(aoff64_t block_offset, aoff64_t block_count, size_t block_size);
 static int print_toc(void);
+static int print_stats(void);
 static void print_hex_row(uint8_t *data, size_t length, size_t bytes_per_row);
 
 static bool relative = false;
@@ -71,6 +73,7 @@ int main(int argc, char **argv)
 	aoff64_t block_count = 1;
 	aoff64_t dev_nblocks;
 	bool toc = false;
+	bool stats = false;
 
 	if (argc < 2) {
 		printf(NAME ": Error, argument missing.\n");
@@ -88,6 +91,13 @@ int main(int argc, char **argv)
 		goto devname;
 	}
 
+	if (str_cmp(*argv, "--stats") == 0) {
+		--argc;
+		++argv;
+		stats = true;
+		goto devname;
+	}
+
 	if (str_cmp(*argv, "--relative") == 0) {
 		--argc;
 		++argv;
@@ -171,6 +181,8 @@ devname:
 	int ret;
 	if (toc)
 		ret = print_toc();
+	else if (stats)
+		ret = print_stats();
 	else
 		ret = print_blocks(block_offset, block_count, block_size);
 
@@ -282,10 +294,26 @@ static void print_hex_row(uint8_t *data, size_t length, size_t bytes_per_row)
 	}
 }
 
+static int print_stats(void)
+{
+	errno_t rc;
+
+	rc = block_print_stats(service_id);
+	if (rc != EOK) {
+		printf(NAME ": Error requesting device statistics: %s.\n",
+		    str_error(rc));
+		return 1;
+	}
+
+	printf("Statistics printed by the device server.\n");
+	return 0;
+}
+
 static void syntax_print(void)
 {
 	printf("syntax: blkdump [--toc] [--relative] [--offset <num_blocks>] "
 	    "[--count <num_blocks>] <device_name>\n");
+	printf("        blkdump --stats <device_name>\n");
 }
 
 /**
@@ -0,0 +1,96 @@
+/*
+ * Copyright (c) 2026 agent
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * - Redistributions of source code must retain the above copyright
+ *   notice, this list of conditions and the following disclaimer.
+ * - Redistributions in binary form must reproduce the above copyright
+ *   notice, this list of conditions and the following disclaimer in the
+ *   documentation and/or other materials provided with the distribution.
+ * - The name of the author may not be used to endorse or promote products
+ *   derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+ * NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <inttypes.h>
+#include <stats.h>
+#include <task.h>
+#include <as.h>
+#include "../tester.h"
+
+#define AREA_PAGES  256
+
+static bool get_page_faults(uint64_t *faults)
+{
+	stats_task_t *stats = stats_get_task(task_get_id());
+	if (stats == NULL)
+		return false;
+
+	*faults = stats->page_faults;
+	free(stats);
+	return true;
+}
+
+const char *test_around1(void)
+{
+	uint64_t before;
+	uint64_t after;
+
+	TPRINTF("Creating AS area...\n");
+	char *area = as_area_create(AS_AREA_ANY, AREA_PAGES * PAGE_SIZE,
+	    AS_AREA_READ | AS_AREA_WRITE | AS_AREA_CACHEABLE, AS_AREA_UNPAGED);
+	if (area == AS_MAP_FAILED)
+		return "Cannot create AS area";
+
+	if (!get_page_faults(&before)) {
+		as_area_destroy(area);
+		return "Cannot read task statistics";
+	}
+
+	TPRINTF("Touching %d pages sequentially...\n", AREA_PAGES);
+	for (size_t i = 0; i < AREA_PAGES; i++)
+		area[i * PAGE_SIZE] = (char) i;
+
+	if (!get_page_faults(&after)) {
+		as_area_destroy(area);
+		return "Cannot read task statistics";
+	}
+
+	for (size_t i = 0; i < AREA_PAGES; i++) {
+		if (area[i * PAGE_SIZE] != (char) i) {
+			as_area_destroy(area);
+			return "Page contents corrupted";
+		}
+	}
+
+	as_area_destroy(area);
+
+	/*
+	 * Reading the statistics may fault in a few pages of the heap, so
+	 * only require that most of the area was mapped ahead of the faults.
+	 */
+	uint64_t faults = after - before;
+	TPRINTF("Serviced %" PRIu64 " page faults for %d pages.\n",
+	    faults, AREA_PAGES);
+
+	if (faults >= AREA_PAGES / 4)
+		return "Sequential touch was not mapped ahead";
+
+	return NULL;
+}
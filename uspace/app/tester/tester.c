@@ -74,6 +74,7 @@ test_t tests[] = {
 #include "mm/malloc2.def"
 #include "mm/malloc3.def"
 #include "mm/mapping1.def"
+#include "mm/around1.def"
 #include "mm/pager1.def"
 #include "hw/serial/serial1.def"
 #include "chardev/chardev1.def"
@@ -907,6 +907,21 @@ errno_t block_read_toc(service_id_t service_id, uint8_t session, void *buf,
 	return bd_read_toc(devcon->bd, session, buf, bufsize);
 }
 
+/** Have the device server print its usage statistics.
+ *
+ * @param service_id Service ID of the block device.
+ *
+ * @return EOK on success or an error code.
+ *
+ */
+errno_t block_print_stats(service_id_t service_id)
+{
+	devcon_t *devcon = devcon_search(service_id);
+
+	assert(devcon);
+	return bd_print_stats(devcon->bd);
+}
+
 /** Read blocks from block device.
  *
  * @param devcon	Device connection.
@@ -116,6 +116,7 @@ extern errno_t block_seqread(service_id_t, void *, size_t *, size_t *, aoff64_t
 extern errno_t block_get_bsize(service_id_t, size_t *);
 extern errno_t block_get_nblocks(service_id_t, aoff64_t *);
 extern errno_t block_read_toc(service_id_t, uint8_t, void *, size_t);
+extern errno_t block_print_stats(service_id_t);
 extern errno_t block_read_direct(service_id_t, aoff64_t, size_t, void *);
 extern errno_t block_read_bytes_direct(service_id_t, aoff64_t, size_t, void *);
 extern errno_t block_write_direct(service_id_t, aoff64_t, size_t, const void *);
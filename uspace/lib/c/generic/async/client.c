@@ -237,6 +237,10 @@ void async_reply_received(ipc_call_t *data)
  * The return value can be used as input for async_wait() to wait for
  * completion.
  *
+ * The message is deferred until the current thread waits for IPC, see
+ * fibril_ipc_call_defer(). Messages sent in a row are thus made by a
+ * single system call.
+ *
  * @param exch    Exchange for sending the message.
  * @param imethod Service-defined interface and method.
  * @param arg1    Service-defined payload argument.
@@ -260,8 +264,15 @@ static aid_t async_send_fast(async_exch_t *exch, sysarg_t imethod, sysarg_t arg1
 
 	msg->dataptr = dataptr;
 
-	errno_t rc = ipc_call_async_4(exch->phone, imethod, arg1, arg2, arg3,
-	    arg4, msg);
+	ipc_call_t data;
+	ipc_set_imethod(&data, imethod);
+	ipc_set_arg1(&data, arg1);
+	ipc_set_arg2(&data, arg2);
+	ipc_set_arg3(&data, arg3);
+	ipc_set_arg4(&data, arg4);
+	ipc_set_arg5(&data, 0);
+
+	errno_t rc = fibril_ipc_call_defer(exch->phone, &data, msg);
 	if (rc != EOK) {
 		msg->retval = rc;
 		msg->done = true;
@@ -301,8 +312,15 @@ static aid_t async_send_slow(async_exch_t *exch, sysarg_t imethod, sysarg_t arg1
 
 	msg->dataptr = dataptr;
 
-	errno_t rc = ipc_call_async_5(exch->phone, imethod, arg1, arg2, arg3,
-	    arg4, arg5, msg);
+	ipc_call_t data;
+	ipc_set_imethod(&data, imethod);
+	ipc_set_arg1(&data, arg1);
+	ipc_set_arg2(&data, arg2);
+	ipc_set_arg3(&data, arg3);
+	ipc_set_arg4(&data, arg4);
+	ipc_set_arg5(&data, arg5);
+
+	errno_t rc = fibril_ipc_call_defer(exch->phone, &data, msg);
 	if (rc != EOK) {
 		msg->retval = rc;
 		msg->done = true;
@@ -1207,6 +1225,13 @@ void async_exchange_end(async_exch_t *exch)
 	if (sess->iface != 0)
 		mgmt = sess->iface & IFACE_EXCHANGE_MASK;
 
+	/*
+	 * The phone of the exchange is going to be used by other exchanges,
+	 * possibly by other threads. Make the deferred calls before that.
+	 */
+	if (mgmt != EXCHANGE_PARALLEL)
+		fibril_ipc_flush();
+
 	if (mgmt == EXCHANGE_SERIALIZE)
 		fibril_mutex_unlock(&sess->mutex);
 
@@ -1328,6 +1353,29 @@ errno_t async_data_read_start(async_exch_t *exch, void *dst, size_t size)
 	    (sysarg_t) size);
 }
 
+/** Wrapper for IPC_M_DATA_READ calls which accept loaned pages.
+ *
+ * The transfer size is not limited by DATA_XFER_LIMIT if the recipient
+ * loans the pages of its source buffer using
+ * async_data_read_finalize_loan(). Whole pages are then mapped
+ * copy-on-write into the destination buffer if it is page-aligned.
+ *
+ * @param exch Exchange for sending the message.
+ * @param dst  Address of the beginning of the destination buffer.
+ * @param size Size of the destination buffer.
+ *
+ * @return Zero on success or an error code from errno.h.
+ *
+ */
+errno_t async_data_read_start_loan(async_exch_t *exch, void *dst, size_t size)
+{
+	if (exch == NULL)
+		return ENOENT;
+
+	return async_req_3_0(exch, IPC_M_DATA_READ, (sysarg_t) dst,
+	    (sysarg_t) size, IPC_XF_LOAN);
+}
+
 /** Wrapper for IPC_M_DATA_WRITE calls using the async framework.
  *
  * @param exch Exchange for sending the message.
@@ -1346,6 +1394,32 @@ errno_t async_data_write_start(async_exch_t *exch, const void *src, size_t size)
 	    (sysarg_t) size);
 }
 
+/** Wrapper for IPC_M_DATA_WRITE calls which loan the source pages.
+ *
+ * If the source buffer is page-aligned, has at least DATA_XFER_LOAN_MIN
+ * bytes and lies in private anonymous memory, its pages are loaned to the
+ * recipient copy-on-write instead of being copied, and the transfer size is
+ * not limited. The buffer keeps its contents, but the first write to each of
+ * its pages afterwards makes a copy of the page if the recipient still maps
+ * it. Otherwise this behaves like async_data_write_start().
+ *
+ * @param exch Exchange for sending the message.
+ * @param src  Address of the beginning of the source buffer.
+ * @param size Size of the source buffer.
+ *
+ * @return Zero on success or an error code from errno.h.
+ *
+ */
+errno_t async_data_write_start_loan(async_exch_t *exch, const void *src,
+    size_t size)
+{
+	if (exch == NULL)
+		return ENOENT;
+
+	return async_req_3_0(exch, IPC_M_DATA_WRITE, (sysarg_t) src,
+	    (sysarg_t) size, IPC_XF_LOAN);
+}
+
 errno_t async_state_change_start(async_exch_t *exch, sysarg_t arg1, sysarg_t arg2,
     sysarg_t arg3, async_exch_t *other_exch)
 {
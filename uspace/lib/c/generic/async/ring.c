@@ -0,0 +1,722 @@
+/*
+ * Copyright (c) 2026 agent
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * - Redistributions of source code must retain the above copyright
+ *   notice, this list of conditions and the following disclaimer.
+ * - Redistributions in binary form must reproduce the above copyright
+ *   notice, this list of conditions and the following disclaimer in the
+ *   documentation and/or other materials provided with the distribution.
+ * - The name of the author may not be used to endorse or promote products
+ *   derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+ * NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/** @addtogroup libc
+ * @{
+ */
+
+/** @file Shared-memory ring channels.
+ *
+ * A ring channel carries requests from a client to a server and answers
+ * back through an address space area shared by both tasks. The area holds
+ * a submission ring of requests and a completion ring of answers. Each
+ * ring has a single producer and a single consumer, which synchronize
+ * solely through the head and tail indices of the ring.
+ *
+ * IPC is only used for doorbells, when a ring transitions from empty to
+ * non-empty:
+ *
+ * - The client sends an ASYNC_RING_SUBMIT message after putting a request
+ *   to the empty submission ring, unless the server is still polling it.
+ *   The server then consumes requests until the submission ring is empty
+ *   again.
+ *
+ * - The client keeps an ASYNC_RING_WAIT call pending while the completion
+ *   ring is empty. The server answers it when it puts the first answer to
+ *   the completion ring.
+ *
+ * All control calls are made over an existing session using a method
+ * chosen by the protocol, with the operation in the first argument.
+ * The ring channel is thus negotiated by the protocol like this:
+ *
+ * @code
+ * // Client
+ * rc = async_ring_create(sess, FOO_RING, 64, &ring);
+ * ...
+ * rc = async_ring_req(ring, &request, &answer);
+ *
+ * // Server connection fibril
+ * case FOO_RING:
+ *	if (ipc_get_arg1(&call) == ASYNC_RING_CREATE)
+ *		async_ring_accept(&call, foo_ring_handler, foo, &ring);
+ *	else
+ *		async_ring_dispatch(ring, &call);
+ *	break;
+ * @endcode
+ *
+ * The server handler is called for each request in the connection fibril
+ * and answers it using async_ring_answer(), possibly later and from
+ * another fibril.
+ *
+ * A request made while the server is idle still costs a doorbell and the
+ * answer of the pending ASYNC_RING_WAIT call, which is more than a plain
+ * call. Ring channels pay off for clients which keep several requests in
+ * flight, so that the server finds them while it is consuming the ring.
+ */
+
+#include <async.h>
+#include <fibril.h>
+#include <fibril_synch.h>
+#include <as.h>
+#include <align.h>
+#include <assert.h>
+#include <errno.h>
+#include <mem.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdlib.h>
+
+/** Maximum number of entries of a ring. */
+#define ASYNC_RING_ENTRIES_MAX  4096
+
+/** Request or answer in a ring. */
+typedef struct {
+	/** Identifies the request, copied to its answer. */
+	sysarg_t tag;
+	/** Method and arguments or return value and arguments. */
+	sysarg_t args[IPC_CALL_LEN];
+} async_ring_entry_t;
+
+/** Head and tail of a ring. */
+typedef struct {
+	/** Number of entries consumed, written by the consumer. */
+	atomic_size_t head;
+	/** Number of entries produced, written by the producer. */
+	atomic_size_t tail;
+} async_ring_index_t;
+
+/** Layout of the shared area. */
+typedef struct {
+	async_ring_index_t sq;
+	async_ring_index_t cq;
+	/** Server is consuming the submission ring, no doorbell is needed. */
+	atomic_bool sq_polling;
+	/** Submission ring followed by the completion ring. */
+	async_ring_entry_t entries[];
+} async_ring_area_t;
+
+/** Request of a client waiting for its answer. */
+typedef struct {
+	/** Storage for the answer, NULL if the entry is free. */
+	ipc_call_t *answer;
+	bool done;
+	errno_t retval;
+	fibril_condvar_t cv;
+} async_ring_waiter_t;
+
+struct async_ring {
+	async_ring_area_t *area;
+	size_t size;
+	/** Number of entries of each ring, a power of two. */
+	size_t entries;
+	bool server;
+
+	fibril_mutex_t lock;
+	/** No more requests or answers can pass. */
+	bool closed;
+
+	/** Client: session and method of the control calls. */
+	async_sess_t *sess;
+	sysarg_t imethod;
+	/** Client: local copies of the indices it produces or consumes. */
+	size_t sq_tail;
+	size_t cq_head;
+	/** Client: one waiter per possible request in flight. */
+	async_ring_waiter_t *waiters;
+	size_t waiters_free;
+	fibril_condvar_t waiters_cv;
+	/** Client: completion fibril has finished. */
+	bool done;
+	fibril_condvar_t done_cv;
+
+	/** Server: handler of requests. */
+	async_ring_handler_t handler;
+	void *arg;
+	/** Server: local copies of the indices it produces or consumes. */
+	size_t sq_head;
+	size_t cq_tail;
+	/** Server: pending ASYNC_RING_WAIT call. */
+	ipc_call_t wait_call;
+	bool waiting;
+};
+
+static size_t async_ring_area_size(size_t entries)
+{
+	return ALIGN_UP(sizeof(async_ring_area_t) +
+	    2 * entries * sizeof(async_ring_entry_t), PAGE_SIZE);
+}
+
+static async_ring_entry_t *async_ring_sq_entry(async_ring_t *ring, size_t i)
+{
+	return &ring->area->entries[i & (ring->entries - 1)];
+}
+
+static async_ring_entry_t *async_ring_cq_entry(async_ring_t *ring, size_t i)
+{
+	return &ring->area->entries[ring->entries + (i & (ring->entries - 1))];
+}
+
+static async_ring_t *async_ring_alloc(size_t entries, bool server)
+{
+	async_ring_t *ring = calloc(1, sizeof(async_ring_t));
+	if (ring == NULL)
+		return NULL;
+
+	ring->entries = entries;
+	ring->size = async_ring_area_size(entries);
+	ring->server = server;
+	fibril_mutex_initialize(&ring->lock);
+	fibril_condvar_initialize(&ring->waiters_cv);
+	fibril_condvar_initialize(&ring->done_cv);
+	return ring;
+}
+
+/** Consume the completion ring and wake up the waiting requests.
+ *
+ * @param ring Client side of a ring channel, locked.
+ */
+static void async_ring_complete(async_ring_t *ring)
+{
+	size_t tail = atomic_load(&ring->area->cq.tail);
+
+	/* The server is not trusted to keep the indices sane. */
+	if (tail - ring->cq_head > ring->entries)
+		return;
+
+	while (ring->cq_head != tail) {
+		async_ring_entry_t entry = *async_ring_cq_entry(ring,
+		    ring->cq_head);
+		ring->cq_head++;
+
+		if (entry.tag >= ring->entries)
+			continue;
+
+		async_ring_waiter_t *w = &ring->waiters[entry.tag];
+		if ((w->answer == NULL) || (w->done))
+			continue;
+
+		memset(w->answer, 0, sizeof(ipc_call_t));
+		memcpy(w->answer->args, entry.args, sizeof(entry.args));
+		w->retval = ipc_get_retval(w->answer);
+		w->done = true;
+		fibril_condvar_signal(&w->cv);
+	}
+
+	atomic_store(&ring->area->cq.head, ring->cq_head);
+}
+
+/** Client fibril waiting for the server to fill the completion ring. */
+static errno_t async_ring_completion_fibril(void *arg)
+{
+	async_ring_t *ring = (async_ring_t *) arg;
+	errno_t rc;
+
+	while (true) {
+		fibril_mutex_lock(&ring->lock);
+		async_ring_complete(ring);
+		fibril_mutex_unlock(&ring->lock);
+
+		async_exch_t *exch = async_exchange_begin(ring->sess);
+		if (exch == NULL) {
+			rc = ENOMEM;
+			break;
+		}
+
+		aid_t req = async_send_1(exch, ring->imethod, ASYNC_RING_WAIT,
+		    NULL);
+		async_exchange_end(exch);
+
+		async_wait_for(req, &rc);
+		if (rc != EOK)
+			break;
+	}
+
+	/* Fail the requests which are not going to be answered. */
+	fibril_mutex_lock(&ring->lock);
+
+	ring->closed = true;
+	for (size_t i = 0; i < ring->entries; i++) {
+		async_ring_waiter_t *w = &ring->waiters[i];
+		if ((w->answer != NULL) && (!w->done)) {
+			w->retval = rc;
+			w->done = true;
+			fibril_condvar_signal(&w->cv);
+		}
+	}
+
+	fibril_condvar_broadcast(&ring->waiters_cv);
+	ring->done = true;
+	fibril_condvar_broadcast(&ring->done_cv);
+
+	fibril_mutex_unlock(&ring->lock);
+	return EOK;
+}
+
+/** Create a ring channel over a session.
+ *
+ * @param sess    Session to the server.
+ * @param imethod Method of the control calls, as chosen by the protocol.
+ * @param entries Maximum number of requests in flight, a power of two.
+ * @param rring   Place to store the new ring channel.
+ *
+ * @return EOK on success, EINVAL if @a entries is not acceptable, ENOMEM
+ *         if out of memory or an error code returned by the server.
+ *
+ */
+errno_t async_ring_create(async_sess_t *sess, sysarg_t imethod,
+    size_t entries, async_ring_t **rring)
+{
+	if ((entries == 0) || (entries > ASYNC_RING_ENTRIES_MAX) ||
+	    ((entries & (entries - 1)) != 0))
+		return EINVAL;
+
+	async_ring_t *ring = async_ring_alloc(entries, false);
+	if (ring == NULL)
+		return ENOMEM;
+
+	ring->sess = sess;
+	ring->imethod = imethod;
+	ring->waiters_free = entries;
+	ring->waiters = calloc(entries, sizeof(async_ring_waiter_t));
+	if (ring->waiters == NULL) {
+		free(ring);
+		return ENOMEM;
+	}
+
+	for (size_t i = 0; i < entries; i++)
+		fibril_condvar_initialize(&ring->waiters[i].cv);
+
+	ring->area = as_area_create(AS_AREA_ANY, ring->size,
+	    AS_AREA_READ | AS_AREA_WRITE | AS_AREA_CACHEABLE,
+	    AS_AREA_UNPAGED);
+	if (ring->area == AS_MAP_FAILED) {
+		free(ring->waiters);
+		free(ring);
+		return ENOMEM;
+	}
+
+	async_exch_t *exch = async_exchange_begin(sess);
+	if (exch == NULL) {
+		as_area_destroy(ring->area);
+		free(ring->waiters);
+		free(ring);
+		return ENOMEM;
+	}
+
+	aid_t req = async_send_2(exch, imethod, ASYNC_RING_CREATE, entries,
+	    NULL);
+	errno_t rc = async_share_out_start(exch, ring->area,
+	    AS_AREA_READ | AS_AREA_WRITE | AS_AREA_CACHEABLE);
+	async_exchange_end(exch);
+
+	if (rc != EOK) {
+		async_forget(req);
+	} else {
+		async_wait_for(req, &rc);
+	}
+
+	if (rc != EOK) {
+		as_area_destroy(ring->area);
+		free(ring->waiters);
+		free(ring);
+		return rc;
+	}
+
+	fid_t fid = fibril_create(async_ring_completion_fibril, ring);
+	if (fid == 0) {
+		/* The server cleans up once the session is hung up. */
+		as_area_destroy(ring->area);
+		free(ring->waiters);
+		free(ring);
+		return ENOMEM;
+	}
+
+	fibril_add_ready(fid);
+
+	*rring = ring;
+	return EOK;
+}
+
+/** Make a request through a ring channel and wait for its answer.
+ *
+ * The session of the ring channel must not be used in an exchange held
+ * by the caller, as the caller may need to ring the doorbell.
+ *
+ * @param ring    Client side of a ring channel.
+ * @param request Method and arguments of the request.
+ * @param answer  Storage for the answer or NULL.
+ *
+ * @return Return value of the answer or EHANGUP if the ring channel has
+ *         been closed.
+ *
+ */
+errno_t async_ring_req(async_ring_t *ring, ipc_call_t *request,
+    ipc_call_t *answer)
+{
+	assert(!ring->server);
+
+	ipc_call_t local_answer;
+	if (answer == NULL)
+		answer = &local_answer;
+
+	fibril_mutex_lock(&ring->lock);
+
+	while ((ring->waiters_free == 0) && (!ring->closed))
+		fibril_condvar_wait(&ring->waiters_cv, &ring->lock);
+
+	if (ring->closed) {
+		fibril_mutex_unlock(&ring->lock);
+		return EHANGUP;
+	}
+
+	size_t tag;
+	for (tag = 0; ring->waiters[tag].answer != NULL; tag++)
+		;
+
+	async_ring_waiter_t *w = &ring->waiters[tag];
+	w->answer = answer;
+	w->done = false;
+	ring->waiters_free--;
+
+	/*
+	 * Each request in flight has its waiter, so the submission ring
+	 * cannot be full.
+	 */
+	async_ring_entry_t *entry = async_ring_sq_entry(ring, ring->sq_tail);
+	entry->tag = tag;
+	memcpy(entry->args, request->args, sizeof(entry->args));
+
+	size_t tail = ring->sq_tail++;
+	atomic_store(&ring->area->sq.tail, ring->sq_tail);
+
+	/*
+	 * A server which is still polling rechecks the tail before it stops,
+	 * see async_ring_consume().
+	 */
+	bool doorbell = (!atomic_load(&ring->area->sq_polling)) &&
+	    (atomic_load(&ring->area->sq.head) == tail);
+
+	fibril_mutex_unlock(&ring->lock);
+
+	if (doorbell) {
+		async_exch_t *exch = async_exchange_begin(ring->sess);
+		if (exch != NULL) {
+			async_msg_1(exch, ring->imethod, ASYNC_RING_SUBMIT);
+			async_exchange_end(exch);
+		}
+	}
+
+	fibril_mutex_lock(&ring->lock);
+
+	while (!w->done)
+		fibril_condvar_wait(&w->cv, &ring->lock);
+
+	errno_t rc = w->retval;
+	w->answer = NULL;
+	ring->waiters_free++;
+	fibril_condvar_signal(&ring->waiters_cv);
+
+	fibril_mutex_unlock(&ring->lock);
+	return rc;
+}
+
+/** Accept a ring channel.
+ *
+ * To be called from the connection fibril upon receiving a call with
+ * ASYNC_RING_CREATE. The call is answered.
+ *
+ * @param call    The ASYNC_RING_CREATE call.
+ * @param handler Handler of the requests.
+ * @param arg     Argument passed to @a handler.
+ * @param rring   Place to store the new ring channel.
+ *
+ * @return EOK on success or an error code.
+ *
+ */
+errno_t async_ring_accept(ipc_call_t *call, async_ring_handler_t handler,
+    void *arg, async_ring_t **rring)
+{
+	size_t entries = ipc_get_arg2(call);
+
+	if ((entries == 0) || (entries > ASYNC_RING_ENTRIES_MAX) ||
+	    ((entries & (entries - 1)) != 0)) {
+		async_answer_0(call, EINVAL);
+		return EINVAL;
+	}
+
+	async_ring_t *ring = async_ring_alloc(entries, true);
+	if (ring == NULL) {
+		async_answer_0(call, ENOMEM);
+		return ENOMEM;
+	}
+
+	ring->handler = handler;
+	ring->arg = arg;
+
+	ipc_call_t share;
+	size_t size;
+	unsigned int flags;
+
+	if (!async_share_out_receive(&share, &size, &flags)) {
+		free(ring);
+		async_answer_0(call, EINVAL);
+		return EINVAL;
+	}
+
+	if ((size != ring->size) ||
+	    ((flags & (AS_AREA_READ | AS_AREA_WRITE)) !=
+	    (AS_AREA_READ | AS_AREA_WRITE))) {
+		free(ring);
+		async_answer_0(&share, EINVAL);
+		async_answer_0(call, EINVAL);
+		return EINVAL;
+	}
+
+	void *area;
+	errno_t rc = async_share_out_finalize(&share, &area);
+	if ((rc != EOK) || (area == AS_MAP_FAILED)) {
+		free(ring);
+		async_answer_0(call, ENOMEM);
+		return ENOMEM;
+	}
+
+	ring->area = area;
+
+	async_answer_0(call, EOK);
+
+	*rring = ring;
+	return EOK;
+}
+
+/** Consume the submission ring, passing the requests to the handler.
+ *
+ * The client does not ring the doorbell while the server is polling the
+ * submission ring. Upon finding it empty, the server stops polling and
+ * looks once more, so that a request put there meanwhile is not missed.
+ *
+ * @param ring Server side of a ring channel.
+ */
+static void async_ring_consume(async_ring_t *ring)
+{
+	atomic_store(&ring->area->sq_polling, true);
+
+	while (!ring->closed) {
+		size_t tail = atomic_load(&ring->area->sq.tail);
+		if (tail == ring->sq_head) {
+			atomic_store(&ring->area->sq_polling, false);
+			if (atomic_load(&ring->area->sq.tail) == ring->sq_head)
+				return;
+
+			atomic_store(&ring->area->sq_polling, true);
+			continue;
+		}
+
+		/* The client is not trusted to keep the indices sane. */
+		if (tail - ring->sq_head > ring->entries)
+			break;
+
+		while (ring->sq_head != tail) {
+			async_ring_entry_t entry = *async_ring_sq_entry(ring,
+			    ring->sq_head);
+			ring->sq_head++;
+			atomic_store(&ring->area->sq.head, ring->sq_head);
+
+			ipc_call_t call;
+			memset(&call, 0, sizeof(call));
+			memcpy(call.args, entry.args, sizeof(entry.args));
+			call.request_label = entry.tag;
+			call.cap_handle = CAP_NIL;
+
+			ring->handler(ring, &call, ring->arg);
+		}
+	}
+
+	atomic_store(&ring->area->sq_polling, false);
+}
+
+/** Handle a control call of a ring channel.
+ *
+ * To be called from the connection fibril upon receiving a call with
+ * ASYNC_RING_SUBMIT, ASYNC_RING_WAIT or ASYNC_RING_DESTROY. The call is
+ * answered, possibly later.
+ *
+ * @param ring Server side of a ring channel or NULL if none was accepted.
+ * @param call The control call.
+ */
+void async_ring_dispatch(async_ring_t *ring, ipc_call_t *call)
+{
+	if (ring == NULL) {
+		async_answer_0(call, ENOENT);
+		return;
+	}
+
+	assert(ring->server);
+
+	switch (ipc_get_arg1(call)) {
+	case ASYNC_RING_SUBMIT:
+		async_answer_0(call, EOK);
+		if (!ring->closed)
+			async_ring_consume(ring);
+		break;
+	case ASYNC_RING_WAIT:
+		fibril_mutex_lock(&ring->lock);
+		if (ring->closed) {
+			async_answer_0(call, EHANGUP);
+		} else if (ring->waiting) {
+			async_answer_0(call, EBUSY);
+		} else if (atomic_load(&ring->area->cq.head) != ring->cq_tail) {
+			async_answer_0(call, EOK);
+		} else {
+			ring->wait_call = *call;
+			ring->waiting = true;
+		}
+		fibril_mutex_unlock(&ring->lock);
+		break;
+	case ASYNC_RING_DESTROY:
+		fibril_mutex_lock(&ring->lock);
+		ring->closed = true;
+		if (ring->waiting) {
+			ring->waiting = false;
+			async_answer_0(&ring->wait_call, EHANGUP);
+		}
+		fibril_mutex_unlock(&ring->lock);
+		async_answer_0(call, EOK);
+		break;
+	default:
+		async_answer_0(call, EINVAL);
+		break;
+	}
+}
+
+/** Answer a request received through a ring channel.
+ *
+ * @param ring   Server side of a ring channel.
+ * @param call   The request as passed to the handler.
+ * @param retval Return value of the answer.
+ * @param arg1   Service-defined return value.
+ * @param arg2   Service-defined return value.
+ * @param arg3   Service-defined return value.
+ * @param arg4   Service-defined return value.
+ * @param arg5   Service-defined return value.
+ *
+ * @return EOK on success, EHANGUP if the ring channel has been closed or
+ *         ENOSPC if the client does not consume the answers.
+ *
+ */
+errno_t async_ring_answer(async_ring_t *ring, ipc_call_t *call,
+    errno_t retval, sysarg_t arg1, sysarg_t arg2, sysarg_t arg3,
+    sysarg_t arg4, sysarg_t arg5)
+{
+	assert(ring->server);
+
+	fibril_mutex_lock(&ring->lock);
+
+	if (ring->closed) {
+		fibril_mutex_unlock(&ring->lock);
+		return EHANGUP;
+	}
+
+	if (ring->cq_tail - atomic_load(&ring->area->cq.head) >=
+	    ring->entries) {
+		fibril_mutex_unlock(&ring->lock);
+		return ENOSPC;
+	}
+
+	async_ring_entry_t *entry = async_ring_cq_entry(ring, ring->cq_tail);
+	entry->tag = call->request_label;
+	entry->args[0] = (sysarg_t) retval;
+	entry->args[1] = arg1;
+	entry->args[2] = arg2;
+	entry->args[3] = arg3;
+	entry->args[4] = arg4;
+	entry->args[5] = arg5;
+
+	ring->cq_tail++;
+	atomic_store(&ring->area->cq.tail, ring->cq_tail);
+
+	/* The client only waits when the completion ring is empty. */
+	if (ring->waiting) {
+		ring->waiting = false;
+		async_answer_0(&ring->wait_call, EOK);
+	}
+
+	fibril_mutex_unlock(&ring->lock);
+	return EOK;
+}
+
+/** Destroy a ring channel.
+ *
+ * The client waits for its requests in flight to be answered and tells
+ * the server to close the ring channel. The server should destroy its side
+ * once the requests it has received are answered and the client has
+ * closed the ring channel or hung up.
+ *
+ * @param ring Either side of a ring channel.
+ */
+void async_ring_destroy(async_ring_t *ring)
+{
+	if (ring->server) {
+		fibril_mutex_lock(&ring->lock);
+		ring->closed = true;
+		if (ring->waiting) {
+			ring->waiting = false;
+			async_answer_0(&ring->wait_call, EHANGUP);
+		}
+		fibril_mutex_unlock(&ring->lock);
+
+		as_area_destroy(ring->area);
+		free(ring);
+		return;
+	}
+
+	fibril_mutex_lock(&ring->lock);
+	while ((ring->waiters_free != ring->entries) && (!ring->closed))
+		fibril_condvar_wait(&ring->waiters_cv, &ring->lock);
+	fibril_mutex_unlock(&ring->lock);
+
+	async_exch_t *exch = async_exchange_begin(ring->sess);
+	if (exch != NULL) {
+		(void) async_req_1_0(exch, ring->imethod, ASYNC_RING_DESTROY);
+		async_exchange_end(exch);
+	}
+
+	/* Wait for the failed requests to let go of their waiters, too. */
+	fibril_mutex_lock(&ring->lock);
+	while (!ring->done)
+		fibril_condvar_wait(&ring->done_cv, &ring->lock);
+	while (ring->waiters_free != ring->entries)
+		fibril_condvar_wait(&ring->waiters_cv, &ring->lock);
+	fibril_mutex_unlock(&ring->lock);
+
+	as_area_destroy(ring->area);
+	free(ring->waiters);
+	free(ring);
+}
+
+/** @}
+ */
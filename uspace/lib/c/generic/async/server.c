@@ -112,6 +112,7 @@
 #include <time.h>
 #include <stdbool.h>
 #include <stdlib.h>
+#include <malloc.h>
 #include <mem.h>
 #include <macros.h>
 #include <str_error.h>
@@ -1047,56 +1048,97 @@ errno_t async_accept_0(ipc_call_t *call)
 	return ipc_answer_5(chandle, EOK, 0, 0, 0, 0, async_get_label());
 }
 
-errno_t async_answer_0(ipc_call_t *call, errno_t retval)
+/** Answer a call, possibly deferring the answer.
+ *
+ * Answers to calls of user methods only carry the return value and
+ * arguments, they may be deferred until the current thread waits for IPC,
+ * see fibril_ipc_answer_defer(). Errors of deferred answers are not
+ * reported, EOK is returned instead. Callers which need to know whether
+ * the answer was delivered must use async_answer_sync().
+ *
+ * Answers to system methods are sent right away, because the kernel does
+ * its part of the method, such as copying data or connecting phones, only
+ * when the answer is sent, and the result is returned.
+ *
+ */
+static errno_t async_answer_deferred(ipc_call_t *call, errno_t retval,
+    sysarg_t arg1, sysarg_t arg2, sysarg_t arg3, sysarg_t arg4, sysarg_t arg5)
 {
+	if (ipc_get_imethod(call) <= IPC_M_LAST_SYSTEM)
+		return async_answer_sync(call, retval, arg1, arg2, arg3, arg4,
+		    arg5);
+
 	cap_call_handle_t chandle = call->cap_handle;
 	assert(chandle != CAP_NIL);
 	call->cap_handle = CAP_NIL;
-	return ipc_answer_0(chandle, retval);
+
+	ipc_call_t data;
+	ipc_set_retval(&data, retval);
+	ipc_set_arg1(&data, arg1);
+	ipc_set_arg2(&data, arg2);
+	ipc_set_arg3(&data, arg3);
+	ipc_set_arg4(&data, arg4);
+	ipc_set_arg5(&data, arg5);
+
+	fibril_ipc_answer_defer(chandle, &data);
+	return EOK;
 }
 
-errno_t async_answer_1(ipc_call_t *call, errno_t retval, sysarg_t arg1)
+/** Answer a call right away.
+ *
+ * Unlike the async_answer_N() family, the answer is never deferred, so
+ * the error code of sending it is returned.
+ *
+ * @param call   Call to answer.
+ * @param retval Return value of the answer.
+ *
+ * @return EOK on success or an error code if the call could not be answered.
+ *
+ */
+errno_t async_answer_sync(ipc_call_t *call, errno_t retval, sysarg_t arg1,
+    sysarg_t arg2, sysarg_t arg3, sysarg_t arg4, sysarg_t arg5)
 {
 	cap_call_handle_t chandle = call->cap_handle;
 	assert(chandle != CAP_NIL);
 	call->cap_handle = CAP_NIL;
-	return ipc_answer_1(chandle, retval, arg1);
+
+	return ipc_answer_5(chandle, retval, arg1, arg2, arg3, arg4, arg5);
+}
+
+errno_t async_answer_0(ipc_call_t *call, errno_t retval)
+{
+	return async_answer_deferred(call, retval, 0, 0, 0, 0, 0);
+}
+
+errno_t async_answer_1(ipc_call_t *call, errno_t retval, sysarg_t arg1)
+{
+	return async_answer_deferred(call, retval, arg1, 0, 0, 0, 0);
 }
 
 errno_t async_answer_2(ipc_call_t *call, errno_t retval, sysarg_t arg1,
     sysarg_t arg2)
 {
-	cap_call_handle_t chandle = call->cap_handle;
-	assert(chandle != CAP_NIL);
-	call->cap_handle = CAP_NIL;
-	return ipc_answer_2(chandle, retval, arg1, arg2);
+	return async_answer_deferred(call, retval, arg1, arg2, 0, 0, 0);
 }
 
 errno_t async_answer_3(ipc_call_t *call, errno_t retval, sysarg_t arg1,
     sysarg_t arg2, sysarg_t arg3)
 {
-	cap_call_handle_t chandle = call->cap_handle;
-	assert(chandle != CAP_NIL);
-	call->cap_handle = CAP_NIL;
-	return ipc_answer_3(chandle, retval, arg1, arg2, arg3);
+	return async_answer_deferred(call, retval, arg1, arg2, arg3, 0, 0);
 }
 
 errno_t async_answer_4(ipc_call_t *call, errno_t retval, sysarg_t arg1,
     sysarg_t arg2, sysarg_t arg3, sysarg_t arg4)
 {
-	cap_call_handle_t chandle = call->cap_handle;
-	assert(chandle != CAP_NIL);
-	call->cap_handle = CAP_NIL;
-	return ipc_answer_4(chandle, retval, arg1, arg2, arg3, arg4);
+	return async_answer_deferred(call, retval, arg1, arg2, arg3, arg4,
+	    0);
 }
 
 errno_t async_answer_5(ipc_call_t *call, errno_t retval, sysarg_t arg1,
     sysarg_t arg2, sysarg_t arg3, sysarg_t arg4, sysarg_t arg5)
 {
-	cap_call_handle_t chandle = call->cap_handle;
-	assert(chandle != CAP_NIL);
-	call->cap_handle = CAP_NIL;
-	return ipc_answer_5(chandle, retval, arg1, arg2, arg3, arg4, arg5);
+	return async_answer_deferred(call, retval, arg1, arg2, arg3, arg4,
+	    arg5);
 }
 
 static errno_t async_forward_fast(ipc_call_t *call, async_exch_t *exch,
@@ -1361,6 +1403,33 @@ errno_t async_data_read_finalize(ipc_call_t *call, const void *src, size_t size)
 	return ipc_answer_2(chandle, EOK, (sysarg_t) src, (sysarg_t) size);
 }
 
+/** Answer an IPC_M_DATA_READ call by loaning the pages of the source buffer.
+ *
+ * The pages are only loaned if the source buffer qualifies for IPC_XF_LOAN,
+ * in which case they are shared copy-on-write with the destination buffer.
+ * Otherwise the data is copied as with async_data_read_finalize().
+ *
+ * @param call IPC_M_DATA_READ call to answer.
+ * @param src  Source address for the IPC_M_DATA_READ call.
+ * @param size Size for the IPC_M_DATA_READ call. Can be smaller than
+ *             the maximum size announced by the sender.
+ *
+ * @return  Zero on success or a value from @ref errno.h on failure.
+ *
+ */
+errno_t async_data_read_finalize_loan(ipc_call_t *call, const void *src,
+    size_t size)
+{
+	assert(call);
+
+	cap_call_handle_t chandle = call->cap_handle;
+	assert(chandle != CAP_NIL);
+	call->cap_handle = CAP_NIL;
+
+	return ipc_answer_3(chandle, EOK, (sysarg_t) src, (sysarg_t) size,
+	    IPC_XF_LOAN);
+}
+
 /** Wrapper for forwarding any read request
  *
  */
@@ -1565,11 +1634,16 @@ errno_t async_data_write_accept(void **data, const bool nullterm,
 	}
 
 	void *arg_data;
+	size_t asize = nullterm ? size + 1 : size;
 
-	if (nullterm)
-		arg_data = malloc(size + 1);
+	/*
+	 * Large buffers are page-aligned, so that the pages loaned by
+	 * async_data_write_start_loan() can be mapped into them.
+	 */
+	if (size >= DATA_XFER_LOAN_MIN)
+		arg_data = memalign(PAGE_SIZE, asize);
 	else
-		arg_data = malloc(size);
+		arg_data = malloc(asize);
 
 	if (arg_data == NULL) {
 		async_answer_0(&call, ENOMEM);
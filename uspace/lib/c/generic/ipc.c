@@ -47,6 +47,7 @@
 #include <adt/list.h>
 #include <fibril.h>
 #include <macros.h>
+#include "private/fibril.h"
 
 /** Fast asynchronous call.
  *
@@ -69,6 +70,8 @@
 errno_t ipc_call_async_fast(cap_phone_handle_t phandle, sysarg_t imethod,
     sysarg_t arg1, sysarg_t arg2, sysarg_t arg3, void *label)
 {
+	fibril_ipc_flush();
+
 	return __SYSCALL6(SYS_IPC_CALL_ASYNC_FAST,
 	    cap_handle_raw(phandle), imethod, arg1, arg2, arg3,
 	    (sysarg_t) label);
@@ -95,6 +98,8 @@ errno_t ipc_call_async_slow(cap_phone_handle_t phandle, sysarg_t imethod,
     sysarg_t arg1, sysarg_t arg2, sysarg_t arg3, sysarg_t arg4, sysarg_t arg5,
     void *label)
 {
+	fibril_ipc_flush();
+
 	ipc_call_t data;
 
 	ipc_set_imethod(&data, imethod);
@@ -109,6 +114,28 @@ errno_t ipc_call_async_slow(cap_phone_handle_t phandle, sysarg_t imethod,
 	    (sysarg_t) label);
 }
 
+/** Make a batch of asynchronous calls.
+ *
+ * The calls are made in order by a single system call. The error code of
+ * each call, with the meaning of the return value of ipc_call_async_slow(),
+ * is stored in its rc field.
+ *
+ * @param calls Array of the calls.
+ * @param count Number of calls, at most IPC_BATCH_MAX.
+ *
+ * @return EOK if all the calls have been processed or an error code.
+ *         The rc field of the calls which have not been processed is
+ *         left untouched.
+ *
+ */
+errno_t ipc_call_async_batch(ipc_batch_call_t *calls, size_t count)
+{
+	fibril_ipc_flush();
+
+	return (errno_t) __SYSCALL2(SYS_IPC_CALL_ASYNC_BATCH,
+	    (sysarg_t) calls, (sysarg_t) count);
+}
+
 /** Answer received call (fast version).
  *
  * The fast answer makes use of passing retval and first four arguments in
@@ -128,6 +155,8 @@ errno_t ipc_call_async_slow(cap_phone_handle_t phandle, sysarg_t imethod,
 errno_t ipc_answer_fast(cap_call_handle_t chandle, errno_t retval,
     sysarg_t arg1, sysarg_t arg2, sysarg_t arg3, sysarg_t arg4)
 {
+	fibril_ipc_flush();
+
 	return (errno_t) __SYSCALL6(SYS_IPC_ANSWER_FAST,
 	    cap_handle_raw(chandle), (sysarg_t) retval, arg1, arg2, arg3, arg4);
 }
@@ -149,6 +178,8 @@ errno_t ipc_answer_fast(cap_call_handle_t chandle, errno_t retval,
 errno_t ipc_answer_slow(cap_call_handle_t chandle, errno_t retval,
     sysarg_t arg1, sysarg_t arg2, sysarg_t arg3, sysarg_t arg4, sysarg_t arg5)
 {
+	fibril_ipc_flush();
+
 	ipc_call_t data;
 
 	ipc_set_retval(&data, retval);
@@ -176,6 +207,73 @@ errno_t ipc_wait(ipc_call_t *call, sysarg_t usec, unsigned int flags)
 	return __SYSCALL3(SYS_IPC_WAIT, (sysarg_t) call, usec, flags);
 }
 
+/** Wait for a batch of incoming calls or answers.
+ *
+ * Waits for the first call or answer as ipc_wait() and then collects those
+ * which are already pending, all in a single system call.
+ *
+ * @param calls    Storage for the received calls or answers.
+ * @param count    Number of entries of @a calls, at most IPC_BATCH_MAX.
+ * @param received Storage for the number of received calls or answers.
+ * @param usec     Timeout of the wait for the first one in microseconds.
+ * @param flags    Flags of the wait for the first one.
+ *
+ * @return Zero on success or a value from @ref errno.h on failure.
+ *
+ */
+errno_t ipc_wait_batch(ipc_call_t *calls, size_t count, size_t *received,
+    sysarg_t usec, unsigned int flags)
+{
+	return (errno_t) __SYSCALL5(SYS_IPC_WAIT_BATCH, (sysarg_t) calls,
+	    (sysarg_t) count, (sysarg_t) received, usec, flags);
+}
+
+/** Make a call and wait for an incoming call or an answer.
+ *
+ * The kernel may switch to the recipient of the call directly.
+ *
+ * @param phandle Phone handle for the call.
+ * @param data    Payload of the call.
+ * @param label   A value to set to the label field of the answer.
+ * @param call    Storage for the received call or answer.
+ * @param usec    Timeout of the wait in microseconds.
+ * @param flags   Flags of the wait.
+ *
+ * @return EOK if the call was made, in which case @a call is filled in.
+ *         If the wait failed, @a call is a null call with the error code
+ *         as its return value. Otherwise an error code of the call, which
+ *         was not made and nothing was waited for.
+ *
+ */
+errno_t ipc_call_wait(cap_phone_handle_t phandle, const ipc_call_t *data,
+    void *label, ipc_call_t *call, sysarg_t usec, unsigned int flags)
+{
+	return __SYSCALL6(SYS_IPC_CALL_WAIT, cap_handle_raw(phandle),
+	    (sysarg_t) data, (sysarg_t) label, (sysarg_t) call, usec, flags);
+}
+
+/** Answer a call and wait for an incoming call or an answer.
+ *
+ * The kernel may switch to the caller directly.
+ *
+ * @param chandle Handle of the call being answered.
+ * @param data    Payload of the answer.
+ * @param call    Storage for the received call or answer.
+ * @param usec    Timeout of the wait in microseconds.
+ * @param flags   Flags of the wait.
+ *
+ * @return EOK if the call was answered, in which case @a call is filled
+ *         in as by ipc_call_wait(). Otherwise an error code of the answer
+ *         and nothing was waited for.
+ *
+ */
+errno_t ipc_answer_wait(cap_call_handle_t chandle, const ipc_call_t *data,
+    ipc_call_t *call, sysarg_t usec, unsigned int flags)
+{
+	return __SYSCALL5(SYS_IPC_ANSWER_WAIT, cap_handle_raw(chandle),
+	    (sysarg_t) data, (sysarg_t) call, usec, flags);
+}
+
 /** Hang up a phone.
  *
  * @param phandle  Handle of the phone to be hung up.
@@ -185,6 +283,8 @@ errno_t ipc_wait(ipc_call_t *call, sysarg_t usec, unsigned int flags)
  */
 errno_t ipc_hangup(cap_phone_handle_t phandle)
 {
+	fibril_ipc_flush();
+
 	return (errno_t) __SYSCALL1(SYS_IPC_HANGUP, cap_handle_raw(phandle));
 }
 
@@ -208,6 +308,8 @@ errno_t ipc_hangup(cap_phone_handle_t phandle)
 errno_t ipc_forward_fast(cap_call_handle_t chandle, cap_phone_handle_t phandle,
     sysarg_t imethod, sysarg_t arg1, sysarg_t arg2, unsigned int mode)
 {
+	fibril_ipc_flush();
+
 	return (errno_t) __SYSCALL6(SYS_IPC_FORWARD_FAST,
 	    cap_handle_raw(chandle), cap_handle_raw(phandle), imethod, arg1,
 	    arg2, mode);
@@ -217,6 +319,8 @@ errno_t ipc_forward_slow(cap_call_handle_t chandle, cap_phone_handle_t phandle,
     sysarg_t imethod, sysarg_t arg1, sysarg_t arg2, sysarg_t arg3,
     sysarg_t arg4, sysarg_t arg5, unsigned int mode)
 {
+	fibril_ipc_flush();
+
 	ipc_call_t data;
 
 	ipc_set_imethod(&data, imethod);
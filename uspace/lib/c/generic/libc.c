@@ -182,6 +182,7 @@ void __libc_exit(int status)
 		task_retval(status);
 	}
 
+	fibril_ipc_flush();
 	__SYSCALL1(SYS_TASK_EXIT, false);
 	__builtin_unreachable();
 }
@@ -44,6 +44,40 @@ typedef struct {
 
 #define FIBRIL_EVENT_INIT ((fibril_event_t) {0})
 
+/** Size of the queue of calls received ahead by a thread. */
+#define _IPC_RECEIVED_MAX  (2 * IPC_BATCH_MAX)
+
+/** IPC operations deferred until their thread waits for IPC. */
+typedef struct {
+	/** Calls to be made, in order. */
+	ipc_batch_call_t calls[IPC_BATCH_MAX];
+	size_t ncalls;
+	/** An answer to be sent, never pending together with calls. */
+	bool answer;
+	cap_call_handle_t chandle;
+	ipc_call_t answer_data;
+	/**
+	 * Calls and answers received ahead by a batched wait, and error
+	 * answers to deferred calls which could not be made.
+	 */
+	ipc_call_t received[_IPC_RECEIVED_MAX];
+	size_t received_first;
+	size_t received_count;
+} _ipc_deferred_t;
+
+/** Fibrils ready to run, queued by one thread and stolen by the others. */
+typedef struct {
+	futex_t futex;
+	/** Fibril made ready last by the owning thread, run first. */
+	fibril_t *next;
+	/** Number of fibrils run from next in a row. */
+	unsigned int next_runs;
+	list_t list;
+	size_t count;
+	/** Position among the queues of all threads. */
+	size_t index;
+} _ready_queue_t;
+
 struct fibril {
 	// XXX: The first two fields must not move (for taskdump).
 	link_t all_link;
@@ -57,15 +91,22 @@ struct fibril {
 	errno_t (*func)(void *);
 	tcb_t *tcb;
 
+	/* Set on the fibril switched to, see _fibril_switch_done(). */
 	fibril_t *clean_after_me;
+	fibril_t *ready_after_me;
 	errno_t retval;
 
 	fibril_t *thread_ctx;
+	/** Only allocated for helper fibrils, see fibril_ipc_call_defer(). */
+	_ipc_deferred_t *deferred;
+	/** Only allocated for helper fibrils, see _ready_list_push(). */
+	_ready_queue_t *ready;
 
 	bool is_running : 1;
 	bool is_writer : 1;
 	/* In some places, we use fibril structs that can't be freed. */
 	bool is_freeable : 1;
+	bool unlock_after_me : 1;
 
 	/* Debugging stuff. */
 	int rmutex_locks;
@@ -87,6 +128,9 @@ extern void fibril_notify(fibril_event_t *);
 
 extern errno_t fibril_ipc_wait(ipc_call_t *, const struct timespec *);
 extern void fibril_ipc_poke(void);
+extern errno_t fibril_ipc_call_defer(cap_phone_handle_t, ipc_call_t *,
+    void *);
+extern void fibril_ipc_answer_defer(cap_call_handle_t, ipc_call_t *);
 
 /**
  * "Restricted" fibril mutex.
@@ -55,6 +55,9 @@ typedef struct futex {
 
 extern errno_t futex_initialize(futex_t *futex, int value);
 
+/* Defined in fibril.c. */
+extern void fibril_ipc_flush(void);
+
 static inline errno_t futex_destroy(futex_t *futex)
 {
 	if (futex->whandle) {
@@ -147,6 +150,13 @@ static inline errno_t futex_down_composable(futex_t *futex,
 		assert(timeout > 0);
 	}
 
+	/*
+	 * IPC deferred by this thread would not be carried out until it
+	 * wakes up. Only a nonblocking attempt may keep it deferred.
+	 */
+	if (timeout != 1)
+		fibril_ipc_flush();
+
 	return __SYSCALL3(SYS_WAITQ_SLEEP, (sysarg_t) futex->whandle,
 	    (sysarg_t) timeout, (sysarg_t) SYNCH_FLAGS_FUTEX);
 }
@@ -44,6 +44,7 @@
 #include <assert.h>
 
 #include <mem.h>
+#include <macros.h>
 #include <str.h>
 #include <ipc/ipc.h>
 #include <libarch/faddr.h>
@@ -56,6 +57,12 @@
 #define DPRINTF(...) ((void)0)
 #undef READY_DEBUG
 
+/** Maximum number of threads with a ready queue of their own. */
+#define READY_QUEUES_MAX  64
+
+/** Number of fibrils run in a row from the next slot of a ready queue. */
+#define READY_NEXT_MAX  8
+
 /** Member of timeout_list. */
 typedef struct {
 	link_t link;
@@ -88,9 +95,16 @@ static bool multithreaded = false;
 /* This futex serializes access to global data. */
 static futex_t fibril_futex;
 static futex_t ready_semaphore;
-static long ready_st_count;
+static atomic_long ready_st_count;
+
+/*
+ * Ready fibrils are queued by the thread which made them ready, or in the
+ * shared queue if the thread has no queue of its own.
+ */
+static _ready_queue_t ready_shared;
+static _Atomic(_ready_queue_t *) ready_queues[READY_QUEUES_MAX];
+static atomic_size_t ready_queues_count;
 
-static LIST_INITIALIZE(ready_list);
 static LIST_INITIALIZE(fibril_list);
 static LIST_INITIALIZE(timeout_list);
 
@@ -110,9 +124,20 @@ static inline void _ready_debug_check(void)
 {
 #ifdef READY_DEBUG
 	assert(!multithreaded);
-	long count = (long) list_count(&ready_list) +
+	long count = (long) ready_shared.count +
 	    (long) list_count(&ipc_buffer_free_list);
-	assert(ready_st_count == count);
+
+	size_t n = atomic_load_explicit(&ready_queues_count,
+	    memory_order_acquire);
+	for (size_t i = 0; i < min(n, READY_QUEUES_MAX); i++) {
+		_ready_queue_t *q = atomic_load_explicit(&ready_queues[i],
+		    memory_order_acquire);
+		if (q)
+			count += (long) q->count + (q->next ? 1 : 0);
+	}
+
+	assert(atomic_load_explicit(&ready_st_count,
+	    memory_order_relaxed) == count);
 #endif
 }
 
@@ -121,7 +146,8 @@ static inline void _ready_up(void)
 	if (multithreaded) {
 		futex_up(&ready_semaphore);
 	} else {
-		ready_st_count++;
+		atomic_fetch_add_explicit(&ready_st_count, 1,
+		    memory_order_relaxed);
 		_ready_debug_check();
 	}
 }
@@ -132,12 +158,149 @@ static inline errno_t _ready_down(const struct timespec *expires)
 		return futex_down_timeout(&ready_semaphore, expires);
 
 	_ready_debug_check();
-	ready_st_count--;
+	atomic_fetch_sub_explicit(&ready_st_count, 1, memory_order_relaxed);
 	return EOK;
 }
 
+/** Allocate a ready queue for the current thread, NULL if there is none. */
+static _ready_queue_t *_ready_queue_create(void)
+{
+	size_t index = atomic_fetch_add_explicit(&ready_queues_count, 1,
+	    memory_order_relaxed);
+	if (index >= READY_QUEUES_MAX)
+		return NULL;
+
+	_ready_queue_t *q = calloc(1, sizeof(_ready_queue_t));
+	if (!q)
+		return NULL;
+
+	if (futex_initialize(&q->futex, 1) != EOK) {
+		free(q);
+		return NULL;
+	}
+
+	list_initialize(&q->list);
+	q->index = index;
+
+	/* The queue is never freed, other threads may steal from it. */
+	atomic_store_explicit(&ready_queues[index], q, memory_order_release);
+	return q;
+}
+
+/** @return the ready queue of the current thread, or NULL. */
+static _ready_queue_t *_ready_queue(void)
+{
+	fibril_t *helper = fibril_self()->thread_ctx;
+	return helper ? helper->ready : NULL;
+}
+
+/** Take a fibril from the queue, preferring its next slot. */
+static fibril_t *_ready_queue_take(_ready_queue_t *q)
+{
+	fibril_t *f;
+
+	futex_lock(&q->futex);
+
+	if (q->next && (q->next_runs < READY_NEXT_MAX || q->count == 0)) {
+		f = q->next;
+		q->next = NULL;
+		q->next_runs++;
+	} else {
+		f = list_pop(&q->list, fibril_t, link);
+		if (f)
+			q->count--;
+		q->next_runs = 0;
+	}
+
+	futex_unlock(&q->futex);
+	return f;
+}
+
+/**
+ * Steal a fibril from another thread's queue, along with half of the rest
+ * of the queue which goes to @a q, if not NULL.
+ */
+static fibril_t *_ready_queue_steal(_ready_queue_t *victim,
+    _ready_queue_t *q)
+{
+	list_t stolen;
+	list_initialize(&stolen);
+	size_t n = 0;
+
+	futex_lock(&victim->futex);
+
+	fibril_t *f = list_pop(&victim->list, fibril_t, link);
+	if (f) {
+		victim->count--;
+
+		if (q) {
+			n = victim->count / 2;
+			for (size_t i = 0; i < n; i++) {
+				fibril_t *g = list_pop(&victim->list, fibril_t,
+				    link);
+				list_append(&g->link, &stolen);
+			}
+			victim->count -= n;
+		}
+	} else {
+		/* The owner is busy, do not let its next fibril wait. */
+		f = victim->next;
+		victim->next = NULL;
+	}
+
+	futex_unlock(&victim->futex);
+
+	if (n > 0) {
+		futex_lock(&q->futex);
+		list_concat(&q->list, &stolen);
+		q->count += n;
+		futex_unlock(&q->futex);
+	}
+
+	return f;
+}
+
+/**
+ * Take a ready fibril from the current thread's queue, the shared queue or
+ * the queue of another thread, in this order.
+ */
+static fibril_t *_ready_take(void)
+{
+	_ready_queue_t *q = _ready_queue();
+	fibril_t *f;
+
+	if (q) {
+		f = _ready_queue_take(q);
+		if (f)
+			return f;
+	}
+
+	f = _ready_queue_take(&ready_shared);
+	if (f)
+		return f;
+
+	size_t n = min(atomic_load_explicit(&ready_queues_count,
+	    memory_order_relaxed), READY_QUEUES_MAX);
+	size_t start = q ? q->index + 1 : 0;
+
+	for (size_t i = 0; i < n; i++) {
+		_ready_queue_t *victim = atomic_load_explicit(
+		    &ready_queues[(start + i) % n], memory_order_acquire);
+		if (!victim || victim == q)
+			continue;
+
+		f = _ready_queue_steal(victim, q);
+		if (f)
+			return f;
+	}
+
+	return NULL;
+}
+
 static atomic_int threads_in_ipc_wait;
 
+static void _fibril_switch_done(void);
+
 /** Function that spans the whole life-cycle of a fibril.
  *
  * Each fibril begins execution in this function. Then the function implementing
@@ -147,8 +310,8 @@ static atomic_int threads_in_ipc_wait;
  */
 static void _fibril_main(void)
 {
-	/* fibril_futex is locked when a fibril is started. */
-	futex_unlock(&fibril_futex);
+	/* A fibril is started by a switch, just like it is resumed. */
+	_fibril_switch_done();
 
 	fibril_t *fibril = fibril_self();
 
@@ -180,12 +343,13 @@ fibril_t *fibril_alloc(void)
 }
 
 /**
- * Put the fibril into fibril_list.
+ * Put the fibril into fibril_list, unless it is there already.
  */
 void fibril_setup(fibril_t *f)
 {
 	futex_lock(&fibril_futex);
-	list_append(&f->all_link, &fibril_list);
+	if (!link_in_use(&f->all_link))
+		list_append(&f->all_link, &fibril_list);
 	futex_unlock(&fibril_futex);
 }
 
@@ -197,6 +361,7 @@ void fibril_teardown(fibril_t *fibril)
 
 	if (fibril->is_freeable) {
 		tls_free(fibril->tcb);
+		free(fibril->deferred);
 		free(fibril);
 	}
 }
@@ -237,21 +402,251 @@ static fibril_t *_fibril_trigger_internal(fibril_event_t *event, fibril_t *reaso
 	return f;
 }
 
+/** @return IPC operations deferred by the current thread or NULL. */
+static _ipc_deferred_t *_ipc_deferred(void)
+{
+	/* Futexes can be slept on before the thread is set up. */
+	if (!__tcb_is_set())
+		return NULL;
+
+	fibril_t *helper = fibril_self()->thread_ctx;
+	return helper ? helper->deferred : NULL;
+}
+
+/** @return True if the current thread has deferred calls or an answer. */
+static bool _ipc_deferred_pending(void)
+{
+	_ipc_deferred_t *d = _ipc_deferred();
+	return d && (d->ncalls > 0 || d->answer);
+}
+
+/** Queue a call or an answer received ahead. */
+static void _ipc_received_push(_ipc_deferred_t *d, const ipc_call_t *call)
+{
+	assert(d->received_count < _IPC_RECEIVED_MAX);
+
+	size_t i = (d->received_first + d->received_count) % _IPC_RECEIVED_MAX;
+	d->received[i] = *call;
+	d->received_count++;
+}
+
+/** Dequeue a call or an answer received ahead, if there is any. */
+static bool _ipc_received_pop(_ipc_deferred_t *d, ipc_call_t *call)
+{
+	if (d->received_count == 0)
+		return false;
+
+	*call = d->received[d->received_first];
+	d->received_first = (d->received_first + 1) % _IPC_RECEIVED_MAX;
+	d->received_count--;
+	return true;
+}
+
+/** Queue the error answer to a deferred call which could not be made. */
+static void _ipc_deferred_fail(_ipc_deferred_t *d, const ipc_batch_call_t *c)
+{
+	ipc_call_t answer;
+
+	memset(&answer, 0, sizeof(answer));
+	ipc_set_retval(&answer, c->rc);
+	answer.flags = IPC_CALL_ANSWERED;
+	answer.answer_label = c->label;
+	answer.cap_handle = CAP_NIL;
+	_ipc_received_push(d, &answer);
+}
+
+/**
+ * Defer a call until the current thread waits for IPC.
+ *
+ * A single deferred call is then made by the same system call which waits,
+ * so that the kernel can switch to the recipient directly. More deferred
+ * calls are made by a single system call. If a call cannot be made at that
+ * time, its answer with the error code is received instead.
+ *
+ * The calls are made right away if the thread switches to another fibril,
+ * makes another IPC operation or blocks in the kernel otherwise, e.g. on a
+ * futex or in thread_usleep(), first.
+ *
+ * @param phandle  Phone handle for the call.
+ * @param data     Payload of the call.
+ * @param label    A value to set to the label field of the answer.
+ *
+ * @return EOK if the call was deferred or made, an error code if it was
+ *         made right away and failed.
+ */
+errno_t fibril_ipc_call_defer(cap_phone_handle_t phandle, ipc_call_t *data,
+    void *label)
+{
+	_ipc_deferred_t *d = _ipc_deferred();
+
+	/* A deferred answer must not be overtaken. */
+	if (d && (d->answer || d->ncalls == IPC_BATCH_MAX))
+		fibril_ipc_flush();
+
+	/* There must be room for the error answers of the deferred calls. */
+	if (!d || d->received_count + d->ncalls >= _IPC_RECEIVED_MAX) {
+		return ipc_call_async_slow(phandle, ipc_get_imethod(data),
+		    ipc_get_arg1(data), ipc_get_arg2(data), ipc_get_arg3(data),
+		    ipc_get_arg4(data), ipc_get_arg5(data), label);
+	}
+
+	ipc_batch_call_t *c = &d->calls[d->ncalls++];
+	c->phone = phandle;
+	c->label = (sysarg_t) label;
+	memcpy(c->args, data->args, sizeof(c->args));
+	/* Overwritten once the call is processed by the kernel. */
+	c->rc = EINVAL;
+	return EOK;
+}
+
+/**
+ * Defer an answer until the current thread waits for IPC.
+ *
+ * Same as fibril_ipc_call_defer(), but for answers. Errors of the answer
+ * are not reported.
+ *
+ * @param chandle  Handle of the call being answered.
+ * @param data     Payload of the answer.
+ */
+void fibril_ipc_answer_defer(cap_call_handle_t chandle, ipc_call_t *data)
+{
+	fibril_ipc_flush();
+
+	_ipc_deferred_t *d = _ipc_deferred();
+	if (!d) {
+		(void) ipc_answer_slow(chandle, ipc_get_retval(data),
+		    ipc_get_arg1(data), ipc_get_arg2(data), ipc_get_arg3(data),
+		    ipc_get_arg4(data), ipc_get_arg5(data));
+		return;
+	}
+
+	d->chandle = chandle;
+	d->answer_data = *data;
+	d->answer = true;
+}
+
+/** Make the calls or send the answer deferred by the current thread now. */
+void fibril_ipc_flush(void)
+{
+	_ipc_deferred_t *d = _ipc_deferred();
+	if (!d)
+		return;
+
+	if (d->answer) {
+		d->answer = false;
+		(void) ipc_answer_slow(d->chandle,
+		    ipc_get_retval(&d->answer_data),
+		    ipc_get_arg1(&d->answer_data),
+		    ipc_get_arg2(&d->answer_data),
+		    ipc_get_arg3(&d->answer_data),
+		    ipc_get_arg4(&d->answer_data),
+		    ipc_get_arg5(&d->answer_data));
+	}
+
+	size_t ncalls = d->ncalls;
+	if (ncalls == 0)
+		return;
+
+	d->ncalls = 0;
+
+	if (ncalls == 1) {
+		ipc_batch_call_t *c = &d->calls[0];
+		c->rc = ipc_call_async_slow(c->phone, c->args[0], c->args[1],
+		    c->args[2], c->args[3], c->args[4], c->args[5],
+		    (void *) c->label);
+	} else {
+		(void) ipc_call_async_batch(d->calls, ncalls);
+	}
+
+	for (size_t i = 0; i < ncalls; i++) {
+		if (d->calls[i].rc != EOK)
+			_ipc_deferred_fail(d, &d->calls[i]);
+	}
+}
+
+/** @return Error code of a wait which returned @a call. */
+static errno_t _ipc_wait_rc(ipc_call_t *call)
+{
+	/* A null call means that the wait itself has failed. */
+	if (call->cap_handle == CAP_NIL && call->flags == 0)
+		return ipc_get_retval(call);
+
+	return EOK;
+}
+
+/** Wait for IPC, carrying out the operations deferred by the current thread. */
+static errno_t _ipc_wait_deferred(ipc_call_t *call, sysarg_t usec,
+    unsigned int flags)
+{
+	_ipc_deferred_t *d = _ipc_deferred();
+	if (!d)
+		return ipc_wait(call, usec, flags);
+
+	errno_t rc;
+
+	if (d->received_count == 0 && d->ncalls == 1) {
+		ipc_batch_call_t *c = &d->calls[0];
+		ipc_call_t data;
+
+		d->ncalls = 0;
+		memcpy(data.args, c->args, sizeof(data.args));
+		c->rc = ipc_call_wait(c->phone, &data, (void *) c->label, call,
+		    usec, flags);
+		if (c->rc == EOK)
+			return _ipc_wait_rc(call);
+
+		/* The call was not made, receive its error answer. */
+		_ipc_deferred_fail(d, c);
+	} else if (d->received_count == 0 && d->answer) {
+		d->answer = false;
+		rc = ipc_answer_wait(d->chandle, &d->answer_data, call, usec,
+		    flags);
+		if (rc == EOK)
+			return _ipc_wait_rc(call);
+	} else {
+		fibril_ipc_flush();
+	}
+
+	if (_ipc_received_pop(d, call))
+		return EOK;
+
+	/*
+	 * Calls received ahead are only returned by the same thread, which
+	 * is fine as long as there is no other thread to pick them up.
+	 */
+	if (multithreaded)
+		return ipc_wait(call, usec, flags);
+
+	size_t received;
+	rc = ipc_wait_batch(d->received, IPC_BATCH_MAX, &received, usec,
+	    flags);
+	if (rc != EOK)
+		return rc;
+
+	d->received_first = 0;
+	d->received_count = received;
+	(void) _ipc_received_pop(d, call);
+	return EOK;
+}
+
 static errno_t _ipc_wait(ipc_call_t *call, const struct timespec *expires)
 {
 	if (!expires)
-		return ipc_wait(call, SYNCH_NO_TIMEOUT, SYNCH_FLAGS_NONE);
+		return _ipc_wait_deferred(call, SYNCH_NO_TIMEOUT,
+		    SYNCH_FLAGS_NONE);
 
 	if (expires->tv_sec == 0)
-		return ipc_wait(call, SYNCH_NO_TIMEOUT, SYNCH_FLAGS_NON_BLOCKING);
+		return _ipc_wait_deferred(call, SYNCH_NO_TIMEOUT,
+		    SYNCH_FLAGS_NON_BLOCKING);
 
 	struct timespec now;
 	getuptime(&now);
 
 	if (ts_gteq(&now, expires))
-		return ipc_wait(call, SYNCH_NO_TIMEOUT, SYNCH_FLAGS_NON_BLOCKING);
+		return _ipc_wait_deferred(call, SYNCH_NO_TIMEOUT,
+		    SYNCH_FLAGS_NON_BLOCKING);
 
-	return ipc_wait(call, NSEC2USEC(ts_sub_diff(expires, &now)),
+	return _ipc_wait_deferred(call, NSEC2USEC(ts_sub_diff(expires, &now)),
 	    SYNCH_FLAGS_NONE);
 }
 
@@ -271,29 +666,62 @@ static fibril_t *_ready_list_pop(const struct timespec *expires, bool locked)
 		futex_assert_is_not_locked(&fibril_futex);
 	}
 
-	errno_t rc = _ready_down(expires);
+	bool nonblocking = expires && expires->tv_sec == 0;
+	bool deferred = _ipc_deferred_pending();
+	errno_t rc;
+
+	if (deferred && !nonblocking) {
+		/* Do not block with a deferred IPC operation still pending. */
+		struct timespec tv = { .tv_sec = 0, .tv_nsec = 0 };
+		rc = _ready_down(&tv);
+		if (rc != EOK) {
+			fibril_ipc_flush();
+			deferred = false;
+			rc = _ready_down(expires);
+		}
+	} else {
+		rc = _ready_down(expires);
+	}
+
 	if (rc != EOK)
 		return NULL;
 
 	/*
 	 * Once we acquire a token from ready_semaphore, there are two options.
-	 * Either there is a ready fibril in the list, or it's our turn to
-	 * call `ipc_wait_cycle()`. There is one extra token on the semaphore
-	 * for each entry of the call buffer.
+	 * Either there is a ready fibril in one of the queues, or it's our
+	 * turn to call `ipc_wait_cycle()`. There is one extra token on the
+	 * semaphore for each entry of the call buffer.
 	 */
 
-	if (!locked)
-		futex_lock(&fibril_futex);
-	fibril_t *f = list_pop(&ready_list, fibril_t, link);
-	if (!f)
-		atomic_fetch_add_explicit(&threads_in_ipc_wait, 1,
-		    memory_order_relaxed);
-	if (!locked)
-		futex_unlock(&fibril_futex);
-
+	fibril_t *f = _ready_take();
 	if (f)
 		return f;
 
+	/*
+	 * A nonblocking check for IPC would carry out the deferred operation
+	 * without waiting. Leave it to the blocking wait instead.
+	 */
+	if (deferred && nonblocking) {
+		/* Return token. */
+		_ready_up();
+		return NULL;
+	}
+
+	/*
+	 * The queues are not searched atomically. Look once more after
+	 * announcing the wait, a fibril made ready later pokes us out of it.
+	 */
+	atomic_fetch_add_explicit(&threads_in_ipc_wait, 1,
+	    memory_order_relaxed);
+	atomic_thread_fence(memory_order_seq_cst);
+
+	f = _ready_take();
+	if (f) {
+		atomic_fetch_sub_explicit(&threads_in_ipc_wait, 1,
+		    memory_order_relaxed);
+		return f;
+	}
+
 	if (!multithreaded)
 		assert(list_empty(&ipc_buffer_list));
 
@@ -359,17 +787,43 @@ static fibril_t *_ready_list_pop_nonblocking(bool locked)
 	return _ready_list_pop(&tv, locked);
 }
 
-static void _ready_list_push(fibril_t *f)
+/**
+ * Make a fibril ready to run, queueing it for the current thread.
+ *
+ * @param f     Fibril to queue, nothing is done if NULL.
+ * @param next  Run the fibril next, it has just been woken up.
+ */
+static void _ready_list_push(fibril_t *f, bool next)
 {
 	if (!f)
 		return;
 
-	futex_assert_is_locked(&fibril_futex);
+	_ready_queue_t *q = _ready_queue();
+	if (!q) {
+		q = &ready_shared;
+		next = false;
+	}
+
+	futex_lock(&q->futex);
+
+	if (next) {
+		if (q->next) {
+			list_append(&q->next->link, &q->list);
+			q->count++;
+		}
+		q->next = f;
+	} else {
+		list_append(&f->link, &q->list);
+		q->count++;
+	}
+
+	futex_unlock(&q->futex);
 
-	/* Enqueue in ready_list. */
-	list_append(&f->link, &ready_list);
 	_ready_up();
 
+	/* Pairs with the fence in _ready_list_pop(). */
+	atomic_thread_fence(memory_order_seq_cst);
+
 	if (atomic_load_explicit(&threads_in_ipc_wait, memory_order_relaxed)) {
 		DPRINTF("Poking.\n");
 		/* Wakeup one thread sleeping in SYS_IPC_WAIT. */
@@ -435,7 +889,7 @@ static struct timespec *_handle_expired_timeouts(struct timespec *next_timeout)
 		list_remove(&to->link);
 
 		_ready_list_push(_fibril_trigger_internal(
-		    to->event, _EVENT_TIMED_OUT));
+		    to->event, _EVENT_TIMED_OUT), false);
 	}
 
 	futex_unlock(&fibril_futex);
@@ -459,15 +913,44 @@ static void _fibril_cleanup_dead(void)
 	srcf->clean_after_me = NULL;
 }
 
-/** Switch to a fibril. */
+/**
+ * Finish a switch on behalf of the fibril switched from, once its context
+ * is saved. Called by the fibril switched to, right after the switch.
+ */
+static void _fibril_switch_done(void)
+{
+	fibril_t *f = fibril_self();
+
+	if (f->unlock_after_me) {
+		f->unlock_after_me = false;
+		futex_unlock(&fibril_futex);
+	}
+
+	if (f->ready_after_me) {
+		fibril_t *yielded = f->ready_after_me;
+		f->ready_after_me = NULL;
+		_ready_list_push(yielded, false);
+	}
+
+	_fibril_cleanup_dead();
+}
+
+/**
+ * Switch to a fibril.
+ *
+ * If @a locked, fibril_futex is held by the caller, which keeps the source
+ * fibril from being woken up, and it is unlocked by the destination fibril.
+ * Otherwise, the source fibril is not reachable by other threads until the
+ * switch is done.
+ */
 static void _fibril_switch_to(_switch_type_t type, fibril_t *dstf, bool locked)
 {
 	assert(fibril_self()->rmutex_locks == 0);
 
-	if (!locked)
-		futex_lock(&fibril_futex);
-	else
+	if (locked)
 		futex_assert_is_locked(&fibril_futex);
+	else
+		futex_assert_is_not_locked(&fibril_futex);
 
 	fibril_t *srcf = fibril_self();
 	assert(srcf);
@@ -475,7 +958,7 @@ static void _fibril_switch_to(_switch_type_t type, fibril_t *dstf, bool locked)
 
 	switch (type) {
 	case SWITCH_FROM_YIELD:
-		_ready_list_push(srcf);
+		dstf->ready_after_me = srcf;
 		break;
 	case SWITCH_FROM_DEAD:
 		dstf->clean_after_me = srcf;
@@ -485,11 +968,22 @@ static void _fibril_switch_to(_switch_type_t type, fibril_t *dstf, bool locked)
 		break;
 	}
 
+	/*
+	 * Only the helper fibril is going to wait for IPC right away, other
+	 * fibrils must not hold back the deferred IPC operation.
+	 */
+	if (dstf != srcf->thread_ctx)
+		fibril_ipc_flush();
+
 	dstf->thread_ctx = srcf->thread_ctx;
 	srcf->thread_ctx = NULL;
 
-	/* Just some bookkeeping to allow better debugging of futex locks. */
-	futex_give_to(&fibril_futex, dstf);
+	if (locked) {
+		dstf->unlock_after_me = true;
+
+		/* Bookkeeping to allow better debugging of futex locks. */
+		futex_give_to(&fibril_futex, dstf);
+	}
 
 	/* Swap to the next fibril. */
 	context_swap(&srcf->ctx, &dstf->ctx);
@@ -497,11 +991,8 @@ static void _fibril_switch_to(_switch_type_t type, fibril_t *dstf, bool locked)
 	assert(srcf == fibril_self());
 	assert(srcf->thread_ctx);
 
-	if (!locked) {
-		/* Must be after context_swap()! */
-		futex_unlock(&fibril_futex);
-		_fibril_cleanup_dead();
-	}
+	/* Must be after context_swap()! */
+	_fibril_switch_done();
 }
 
 /**
@@ -518,6 +1009,12 @@ static errno_t _helper_fibril_fn(void *arg)
 	/* Set itself as the thread's own context. */
 	fibril_self()->thread_ctx = fibril_self();
 
+	/* Without it, IPC operations are not deferred by this thread. */
+	fibril_self()->deferred = calloc(1, sizeof(_ipc_deferred_t));
+
+	/* Without it, fibrils made ready by this thread go to ready_shared. */
+	fibril_self()->ready = _ready_queue_create();
+
 	(void) arg;
 
 	struct timespec next_timeout;
@@ -693,6 +1190,8 @@ errno_t fibril_wait_timeout(fibril_event_t *event,
 
 	_fibril_switch_to(SWITCH_FROM_BLOCKED, dstf, true);
 
+	futex_lock(&fibril_futex);
+
 	assert(event->fibril != srcf);
 	assert(event->fibril != _EVENT_INITIAL);
 	assert(event->fibril == _EVENT_TIMED_OUT || event->fibril == _EVENT_TRIGGERED);
@@ -702,7 +1201,6 @@ errno_t fibril_wait_timeout(fibril_event_t *event,
 	event->fibril = _EVENT_INITIAL;
 
 	futex_unlock(&fibril_futex);
-	_fibril_cleanup_dead();
 	return rc;
 }
 
@@ -722,23 +1220,22 @@ void fibril_wait_for(fibril_event_t *event)
 void fibril_notify(fibril_event_t *event)
 {
 	futex_lock(&fibril_futex);
-	_ready_list_push(_fibril_trigger_internal(event, _EVENT_TRIGGERED));
+	fibril_t *f = _fibril_trigger_internal(event, _EVENT_TRIGGERED);
 	futex_unlock(&fibril_futex);
+
+	/* The fibril is no longer reachable through the event. */
+	_ready_list_push(f, true);
 }
 
 /** Start a fibril that has not been running yet. */
 void fibril_start(fibril_t *fibril)
 {
-	futex_lock(&fibril_futex);
 	assert(!fibril->is_running);
 	fibril->is_running = true;
 
-	if (!link_in_use(&fibril->all_link))
-		list_append(&fibril->all_link, &fibril_list);
-
-	_ready_list_push(fibril);
+	fibril_setup(fibril);
 
-	futex_unlock(&fibril_futex);
+	_ready_list_push(fibril, true);
 }
 
 /** Start a fibril that has not been running yet. (obsolete) */
@@ -778,6 +1275,8 @@ void fibril_yield(void)
 	fibril_t *f = _ready_list_pop_nonblocking(false);
 	if (f)
 		_fibril_switch_to(SWITCH_FROM_YIELD, f, false);
+	else
+		fibril_ipc_flush();
 }
 
 static void _runner_fn(void *arg)
@@ -799,7 +1298,9 @@ int fibril_test_spawn_runners(int n)
 
 	if (!multithreaded) {
 		_ready_debug_check();
-		if (futex_initialize(&ready_semaphore, ready_st_count) != EOK)
+		if (futex_initialize(&ready_semaphore,
+		    atomic_load_explicit(&ready_st_count,
+		    memory_order_relaxed)) != EOK)
 			abort();
 		multithreaded = true;
 	}
@@ -869,6 +1370,9 @@ void __fibrils_init(void)
 		abort();
 	if (futex_initialize(&ipc_lists_futex, 1) != EOK)
 		abort();
+	if (futex_initialize(&ready_shared.futex, 1) != EOK)
+		abort();
+	list_initialize(&ready_shared.list);
 
 	/*
 	 * We allow a fixed, small amount of parallelism for IPC reads, but
@@ -889,6 +1393,7 @@ void __fibrils_fini(void)
 {
 	futex_destroy(&fibril_futex);
 	futex_destroy(&ipc_lists_futex);
+	futex_destroy(&ready_shared.futex);
 }
 
 void fibril_usleep(usec_t timeout)
@@ -73,6 +73,7 @@ void __thread_main(uspace_arg_t *uarg)
 	 * free(uarg);
 	 */
 
+	fibril_ipc_flush();
 	fibril_teardown(fibril);
 	thread_exit(0);
 }
@@ -177,6 +178,8 @@ thread_id_t thread_get_id(void)
  */
 void thread_usleep(usec_t usec)
 {
+	/* Do not hold back the IPC deferred by this thread while sleeping. */
+	fibril_ipc_flush();
 	(void) __SYSCALL1(SYS_THREAD_USLEEP, usec);
 }
 
@@ -888,9 +888,10 @@ errno_t vfs_read_short(int file, aoff64_t pos, void *buf, size_t nbyte,
 
 	async_exch_t *exch = vfs_exchange_begin();
 
+	/* The file system server may loan the pages of its buffer. */
 	req = async_send_3(exch, VFS_IN_READ, file, LOWER32(pos),
 	    UPPER32(pos), &answer);
-	rc = async_data_read_start(exch, (void *) buf, nbyte);
+	rc = async_data_read_start_loan(exch, (void *) buf, nbyte);
 
 	vfs_exchange_end(exch);
 
@@ -1352,9 +1353,10 @@ errno_t vfs_write_short(int file, aoff64_t pos, const void *buf, size_t nbyte,
 
 	async_exch_t *exch = vfs_exchange_begin();
 
+	/* Large page-aligned buffers are loaned to the file system server. */
 	req = async_send_3(exch, VFS_IN_WRITE, file, LOWER32(pos),
 	    UPPER32(pos), &answer);
-	rc = async_data_write_start(exch, (void *) buf, nbyte);
+	rc = async_data_write_start_loan(exch, buf, nbyte);
 
 	vfs_exchange_end(exch);
 
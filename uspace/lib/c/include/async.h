@@ -101,9 +101,28 @@ typedef enum {
 /** Forward declarations */
 struct async_exch;
 struct async_sess;
+struct async_ring;
 
 typedef struct async_sess async_sess_t;
 typedef struct async_exch async_exch_t;
+typedef struct async_ring async_ring_t;
+
+/** Ring channel request handler
+ *
+ * @param ring Ring channel the request was received through.
+ * @param call Data of the request, to be passed to async_ring_answer().
+ * @param arg  Argument passed to async_ring_accept().
+ *
+ */
+typedef void (*async_ring_handler_t)(async_ring_t *, ipc_call_t *, void *);
+
+/** Ring channel control operations, passed in the first call argument */
+typedef enum {
+	ASYNC_RING_CREATE,
+	ASYNC_RING_SUBMIT,
+	ASYNC_RING_WAIT,
+	ASYNC_RING_DESTROY
+} async_ring_op_t;
 
 extern __noreturn void async_manager(void);
 
@@ -176,6 +195,8 @@ extern errno_t async_answer_4(ipc_call_t *, errno_t, sysarg_t, sysarg_t,
     sysarg_t, sysarg_t);
 extern errno_t async_answer_5(ipc_call_t *, errno_t, sysarg_t, sysarg_t,
     sysarg_t, sysarg_t, sysarg_t);
+extern errno_t async_answer_sync(ipc_call_t *, errno_t, sysarg_t, sysarg_t,
+    sysarg_t, sysarg_t, sysarg_t);
 
 /*
  * Wrappers for forwarding routines.
@@ -333,8 +354,11 @@ extern errno_t async_data_read_forward_4_1(async_exch_t *, sysarg_t, sysarg_t,
 
 extern aid_t async_data_read(async_exch_t *, void *, size_t, ipc_call_t *);
 extern errno_t async_data_read_start(async_exch_t *, void *, size_t);
+extern errno_t async_data_read_start_loan(async_exch_t *, void *, size_t);
 extern bool async_data_read_receive(ipc_call_t *, size_t *);
 extern errno_t async_data_read_finalize(ipc_call_t *, const void *, size_t);
+extern errno_t async_data_read_finalize_loan(ipc_call_t *, const void *,
+    size_t);
 
 extern errno_t async_data_write_forward_0_0(async_exch_t *, sysarg_t);
 extern errno_t async_data_write_forward_1_0(async_exch_t *, sysarg_t, sysarg_t);
@@ -357,6 +381,8 @@ extern errno_t async_data_write_forward_4_1(async_exch_t *, sysarg_t, sysarg_t,
     sysarg_t, sysarg_t, sysarg_t, ipc_call_t *);
 
 extern errno_t async_data_write_start(async_exch_t *, const void *, size_t);
+extern errno_t async_data_write_start_loan(async_exch_t *, const void *,
+    size_t);
 extern bool async_data_write_receive(ipc_call_t *, size_t *);
 extern errno_t async_data_write_finalize(ipc_call_t *, void *, size_t);
 
@@ -380,6 +406,16 @@ extern void async_remote_state_release_exchange(async_exch_t *);
 extern void *async_as_area_create(void *, size_t, unsigned int, async_sess_t *,
     sysarg_t, sysarg_t, sysarg_t);
 
+extern errno_t async_ring_create(async_sess_t *, sysarg_t, size_t,
+    async_ring_t **);
+extern errno_t async_ring_req(async_ring_t *, ipc_call_t *, ipc_call_t *);
+extern errno_t async_ring_accept(ipc_call_t *, async_ring_handler_t, void *,
+    async_ring_t **);
+extern void async_ring_dispatch(async_ring_t *, ipc_call_t *);
+extern errno_t async_ring_answer(async_ring_t *, ipc_call_t *, errno_t,
+    sysarg_t, sysarg_t, sysarg_t, sysarg_t, sysarg_t);
+extern void async_ring_destroy(async_ring_t *);
+
 errno_t async_spawn_notification_handler(void);
 
 #endif
@@ -45,7 +45,14 @@
 #include <abi/proc/task.h>
 #include <abi/cap.h>
 
+extern errno_t ipc_call_async_batch(ipc_batch_call_t *, size_t);
 extern errno_t ipc_wait(ipc_call_t *, sysarg_t, unsigned int);
+extern errno_t ipc_wait_batch(ipc_call_t *, size_t, size_t *, sysarg_t,
+    unsigned int);
+extern errno_t ipc_call_wait(cap_phone_handle_t, const ipc_call_t *, void *,
+    ipc_call_t *, sysarg_t, unsigned int);
+extern errno_t ipc_answer_wait(cap_call_handle_t, const ipc_call_t *,
+    ipc_call_t *, sysarg_t, unsigned int);
 extern void ipc_poke(void);
 
 /*
@@ -0,0 +1,449 @@
+/*
+ * Copyright (c) 2026 agent
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * - Redistributions of source code must retain the above copyright
+ *   notice, this list of conditions and the following disclaimer.
+ * - Redistributions in binary form must reproduce the above copyright
+ *   notice, this list of conditions and the following disclaimer in the
+ *   documentation and/or other materials provided with the distribution.
+ * - The name of the author may not be used to endorse or promote products
+ *   derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+ * NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <async.h>
+#include <errno.h>
+#include <fibril.h>
+#include <fibril_synch.h>
+#include <loc.h>
+#include <mem.h>
+#include <pcut/pcut.h>
+
+PCUT_INIT;
+
+PCUT_TEST_SUITE(async_ring);
+
+#define TEST_RING_METHOD  IPC_FIRST_USER_METHOD
+
+static const char *test_ring_server = "test-ring";
+static const char *test_ring_svc = "test/ring";
+
+/** Server side of the test ring channel */
+typedef struct {
+	fibril_mutex_t lock;
+	fibril_condvar_t cv;
+	async_ring_t *ring;
+	/** Keep the handler blocked until cleared */
+	bool hold;
+	/** Do not answer the requests in the handler */
+	bool defer;
+	/** Answer each request twice */
+	bool overflow;
+	/** Number of requests received */
+	size_t received;
+	/** Number of submission doorbells received */
+	size_t submits;
+	/** Last request received */
+	ipc_call_t call;
+	/** Results of answering the last request */
+	errno_t answer_rc[2];
+	/** Connection has been closed */
+	bool closed;
+} test_ring_srv_t;
+
+/** Client request made from a separate fibril */
+typedef struct {
+	test_ring_srv_t *srv;
+	async_ring_t *ring;
+	sysarg_t arg;
+	bool started;
+	bool done;
+	errno_t rc;
+	ipc_call_t answer;
+} test_ring_req_t;
+
+static void test_ring_handler(async_ring_t *ring, ipc_call_t *call, void *arg)
+{
+	test_ring_srv_t *srv = (test_ring_srv_t *) arg;
+
+	fibril_mutex_lock(&srv->lock);
+	srv->received++;
+	srv->call = *call;
+	fibril_condvar_broadcast(&srv->cv);
+	while (srv->hold)
+		fibril_condvar_wait(&srv->cv, &srv->lock);
+	bool defer = srv->defer;
+	fibril_mutex_unlock(&srv->lock);
+
+	if (defer)
+		return;
+
+	srv->answer_rc[0] = async_ring_answer(ring, call, EOK,
+	    ipc_get_arg1(call) + 1, 0, 0, 0, 0);
+	if (srv->overflow) {
+		srv->answer_rc[1] = async_ring_answer(ring, call, EOK,
+		    ipc_get_arg1(call) + 1, 0, 0, 0, 0);
+	}
+}
+
+static void test_ring_conn(ipc_call_t *icall, void *arg)
+{
+	test_ring_srv_t *srv = (test_ring_srv_t *) arg;
+
+	async_accept_0(icall);
+
+	while (true) {
+		ipc_call_t call;
+		async_get_call(&call);
+
+		if (!ipc_get_imethod(&call)) {
+			async_answer_0(&call, EOK);
+			break;
+		}
+
+		if (ipc_get_imethod(&call) != TEST_RING_METHOD) {
+			async_answer_0(&call, EINVAL);
+			continue;
+		}
+
+		switch (ipc_get_arg1(&call)) {
+		case ASYNC_RING_CREATE:
+			(void) async_ring_accept(&call, test_ring_handler, srv,
+			    &srv->ring);
+			break;
+		case ASYNC_RING_SUBMIT:
+			srv->submits++;
+			async_ring_dispatch(srv->ring, &call);
+			break;
+		default:
+			async_ring_dispatch(srv->ring, &call);
+			break;
+		}
+	}
+
+	if (srv->ring != NULL)
+		async_ring_destroy(srv->ring);
+
+	fibril_mutex_lock(&srv->lock);
+	srv->closed = true;
+	fibril_condvar_broadcast(&srv->cv);
+	fibril_mutex_unlock(&srv->lock);
+}
+
+static errno_t test_ring_req_fibril(void *arg)
+{
+	test_ring_req_t *req = (test_ring_req_t *) arg;
+	ipc_call_t request;
+
+	ipc_set_imethod(&request, 0);
+	ipc_set_arg1(&request, req->arg);
+
+	fibril_mutex_lock(&req->srv->lock);
+	req->started = true;
+	fibril_condvar_broadcast(&req->srv->cv);
+	fibril_mutex_unlock(&req->srv->lock);
+
+	errno_t rc = async_ring_req(req->ring, &request, &req->answer);
+
+	fibril_mutex_lock(&req->srv->lock);
+	req->rc = rc;
+	req->done = true;
+	fibril_condvar_broadcast(&req->srv->cv);
+	fibril_mutex_unlock(&req->srv->lock);
+	return EOK;
+}
+
+/** Start a request in a new fibril and wait until it is being made. */
+static void test_ring_req_start(test_ring_req_t *req)
+{
+	fid_t fid = fibril_create(test_ring_req_fibril, req);
+	PCUT_ASSERT_TRUE(fid != 0);
+	fibril_add_ready(fid);
+
+	fibril_mutex_lock(&req->srv->lock);
+	while (!req->started)
+		fibril_condvar_wait(&req->srv->cv, &req->srv->lock);
+	fibril_mutex_unlock(&req->srv->lock);
+}
+
+static void test_ring_req_wait(test_ring_req_t *req)
+{
+	fibril_mutex_lock(&req->srv->lock);
+	while (!req->done)
+		fibril_condvar_wait(&req->srv->cv, &req->srv->lock);
+	fibril_mutex_unlock(&req->srv->lock);
+}
+
+static void test_ring_srv_init(test_ring_srv_t *srv)
+{
+	memset(srv, 0, sizeof(test_ring_srv_t));
+	fibril_mutex_initialize(&srv->lock);
+	fibril_condvar_initialize(&srv->cv);
+}
+
+/** Wait for the server to see the client hang up. */
+static void test_ring_srv_wait_closed(test_ring_srv_t *srv)
+{
+	fibril_mutex_lock(&srv->lock);
+	while (!srv->closed)
+		fibril_condvar_wait(&srv->cv, &srv->lock);
+	fibril_mutex_unlock(&srv->lock);
+}
+
+static async_sess_t *test_ring_connect(test_ring_srv_t *srv,
+    service_id_t *rsid)
+{
+	errno_t rc;
+
+	async_set_fallback_port_handler(test_ring_conn, srv);
+
+	// FIXME This causes this test to be non-reentrant!
+	rc = loc_server_register(test_ring_server);
+	PCUT_ASSERT_ERRNO_VAL(EOK, rc);
+
+	rc = loc_service_register(test_ring_svc, rsid);
+	PCUT_ASSERT_ERRNO_VAL(EOK, rc);
+
+	async_sess_t *sess = loc_service_connect(*rsid, INTERFACE_ANY, 0);
+	PCUT_ASSERT_NOT_NULL(sess);
+	return sess;
+}
+
+static void test_ring_disconnect(test_ring_srv_t *srv, async_sess_t *sess,
+    service_id_t sid)
+{
+	async_hangup(sess);
+	test_ring_srv_wait_closed(srv);
+
+	errno_t rc = loc_service_unregister(sid);
+	PCUT_ASSERT_ERRNO_VAL(EOK, rc);
+}
+
+/** Ring channel with an invalid number of entries cannot be created */
+PCUT_TEST(create_invalid)
+{
+	async_ring_t *ring;
+	errno_t rc;
+
+	rc = async_ring_create(NULL, TEST_RING_METHOD, 0, &ring);
+	PCUT_ASSERT_ERRNO_VAL(EINVAL, rc);
+
+	rc = async_ring_create(NULL, TEST_RING_METHOD, 3, &ring);
+	PCUT_ASSERT_ERRNO_VAL(EINVAL, rc);
+}
+
+/** Create a ring channel, make a request and get its answer */
+PCUT_TEST(create_req_answer)
+{
+	test_ring_srv_t srv;
+	service_id_t sid;
+	async_ring_t *ring;
+	ipc_call_t request;
+	ipc_call_t answer;
+	errno_t rc;
+
+	test_ring_srv_init(&srv);
+	async_sess_t *sess = test_ring_connect(&srv, &sid);
+
+	rc = async_ring_create(sess, TEST_RING_METHOD, 4, &ring);
+	PCUT_ASSERT_ERRNO_VAL(EOK, rc);
+	PCUT_ASSERT_NOT_NULL(srv.ring);
+
+	for (sysarg_t i = 0; i < 10; i++) {
+		ipc_set_imethod(&request, 0);
+		ipc_set_arg1(&request, 42 + i);
+
+		rc = async_ring_req(ring, &request, &answer);
+		PCUT_ASSERT_ERRNO_VAL(EOK, rc);
+		PCUT_ASSERT_INT_EQUALS(43 + i, ipc_get_arg1(&answer));
+		PCUT_ASSERT_INT_EQUALS(42 + i, ipc_get_arg1(&srv.call));
+		PCUT_ASSERT_ERRNO_VAL(EOK, srv.answer_rc[0]);
+	}
+
+	PCUT_ASSERT_INT_EQUALS(10, srv.received);
+
+	async_ring_destroy(ring);
+	test_ring_disconnect(&srv, sess, sid);
+}
+
+/** The doorbell is rung only when the submission ring becomes non-empty */
+PCUT_TEST(doorbell_on_empty)
+{
+	test_ring_srv_t srv;
+	test_ring_req_t req[3];
+	service_id_t sid;
+	async_ring_t *ring;
+	errno_t rc;
+
+	test_ring_srv_init(&srv);
+	async_sess_t *sess = test_ring_connect(&srv, &sid);
+
+	rc = async_ring_create(sess, TEST_RING_METHOD, 4, &ring);
+	PCUT_ASSERT_ERRNO_VAL(EOK, rc);
+
+	for (size_t i = 0; i < 3; i++) {
+		memset(&req[i], 0, sizeof(test_ring_req_t));
+		req[i].srv = &srv;
+		req[i].ring = ring;
+		req[i].arg = i;
+	}
+
+	/* Keep the server busy with the first request. */
+	srv.hold = true;
+	test_ring_req_start(&req[0]);
+
+	fibril_mutex_lock(&srv.lock);
+	while (srv.received == 0)
+		fibril_condvar_wait(&srv.cv, &srv.lock);
+	fibril_mutex_unlock(&srv.lock);
+
+	/*
+	 * The first of these finds the submission ring empty and rings the
+	 * doorbell, the second one only adds to the ring.
+	 */
+	test_ring_req_start(&req[1]);
+	test_ring_req_start(&req[2]);
+
+	fibril_mutex_lock(&srv.lock);
+	srv.hold = false;
+	fibril_condvar_broadcast(&srv.cv);
+	fibril_mutex_unlock(&srv.lock);
+
+	for (size_t i = 0; i < 3; i++) {
+		test_ring_req_wait(&req[i]);
+		PCUT_ASSERT_ERRNO_VAL(EOK, req[i].rc);
+		PCUT_ASSERT_INT_EQUALS(i + 1, ipc_get_arg1(&req[i].answer));
+	}
+
+	/* All doorbells have been handled once the ring is destroyed. */
+	async_ring_destroy(ring);
+
+	PCUT_ASSERT_INT_EQUALS(3, srv.received);
+	PCUT_ASSERT_INT_EQUALS(2, srv.submits);
+
+	test_ring_disconnect(&srv, sess, sid);
+}
+
+/** Answers do not overflow a full completion ring */
+PCUT_TEST(completion_ring_full)
+{
+	test_ring_srv_t srv;
+	service_id_t sid;
+	async_ring_t *ring;
+	ipc_call_t request;
+	ipc_call_t answer;
+	errno_t rc;
+
+	test_ring_srv_init(&srv);
+	async_sess_t *sess = test_ring_connect(&srv, &sid);
+
+	rc = async_ring_create(sess, TEST_RING_METHOD, 1, &ring);
+	PCUT_ASSERT_ERRNO_VAL(EOK, rc);
+
+	/* The client cannot consume the first answer before the second. */
+	srv.overflow = true;
+
+	ipc_set_imethod(&request, 0);
+	ipc_set_arg1(&request, 1);
+
+	rc = async_ring_req(ring, &request, &answer);
+	PCUT_ASSERT_ERRNO_VAL(EOK, rc);
+	PCUT_ASSERT_INT_EQUALS(2, ipc_get_arg1(&answer));
+	PCUT_ASSERT_ERRNO_VAL(EOK, srv.answer_rc[0]);
+	PCUT_ASSERT_ERRNO_VAL(ENOSPC, srv.answer_rc[1]);
+
+	/* Once consumed, there is room for answers again. */
+	srv.overflow = false;
+
+	rc = async_ring_req(ring, &request, &answer);
+	PCUT_ASSERT_ERRNO_VAL(EOK, rc);
+	PCUT_ASSERT_INT_EQUALS(2, ipc_get_arg1(&answer));
+
+	async_ring_destroy(ring);
+	test_ring_disconnect(&srv, sess, sid);
+}
+
+static errno_t test_ring_destroy_fibril(void *arg)
+{
+	test_ring_req_t *req = (test_ring_req_t *) arg;
+
+	async_ring_destroy(req->ring);
+
+	fibril_mutex_lock(&req->srv->lock);
+	req->done = true;
+	fibril_condvar_broadcast(&req->srv->cv);
+	fibril_mutex_unlock(&req->srv->lock);
+	return EOK;
+}
+
+/** Destroying a ring channel waits for the requests in flight */
+PCUT_TEST(destroy_in_flight)
+{
+	test_ring_srv_t srv;
+	test_ring_req_t req;
+	test_ring_req_t destroy;
+	service_id_t sid;
+	async_ring_t *ring;
+	errno_t rc;
+
+	test_ring_srv_init(&srv);
+	async_sess_t *sess = test_ring_connect(&srv, &sid);
+
+	rc = async_ring_create(sess, TEST_RING_METHOD, 4, &ring);
+	PCUT_ASSERT_ERRNO_VAL(EOK, rc);
+
+	srv.defer = true;
+
+	memset(&req, 0, sizeof(req));
+	req.srv = &srv;
+	req.ring = ring;
+	req.arg = 7;
+	test_ring_req_start(&req);
+
+	fibril_mutex_lock(&srv.lock);
+	while (srv.received == 0)
+		fibril_condvar_wait(&srv.cv, &srv.lock);
+	fibril_mutex_unlock(&srv.lock);
+
+	memset(&destroy, 0, sizeof(destroy));
+	destroy.srv = &srv;
+	destroy.ring = ring;
+
+	fid_t fid = fibril_create(test_ring_destroy_fibril, &destroy);
+	PCUT_ASSERT_TRUE(fid != 0);
+	fibril_add_ready(fid);
+
+	/* Let the destroying fibril run, it must wait for the answer. */
+	fibril_yield();
+
+	PCUT_ASSERT_FALSE(destroy.done);
+	PCUT_ASSERT_FALSE(req.done);
+
+	rc = async_ring_answer(srv.ring, &srv.call, EOK, 8, 0, 0, 0, 0);
+	PCUT_ASSERT_ERRNO_VAL(EOK, rc);
+
+	test_ring_req_wait(&req);
+	PCUT_ASSERT_ERRNO_VAL(EOK, req.rc);
+	PCUT_ASSERT_INT_EQUALS(8, ipc_get_arg1(&req.answer));
+
+	test_ring_req_wait(&destroy);
+
+	test_ring_disconnect(&srv, sess, sid);
+}
+
+PCUT_EXPORT(async_ring);
@@ -0,0 +1,307 @@
+/*
+ * Copyright (c) 2026 agent
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * - Redistributions of source code must retain the above copyright
+ *   notice, this list of conditions and the following disclaimer.
+ * - Redistributions in binary form must reproduce the above copyright
+ *   notice, this list of conditions and the following disclaimer in the
+ *   documentation and/or other materials provided with the distribution.
+ * - The name of the author may not be used to endorse or promote products
+ *   derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+ * NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <async.h>
+#include <errno.h>
+#include <fibril.h>
+#include <fibril_synch.h>
+#include <loc.h>
+#include <mem.h>
+#include <pcut/pcut.h>
+#include "../../generic/private/futex.h"
+#include "../../generic/private/thread.h"
+
+PCUT_INIT;
+
+PCUT_TEST_SUITE(fibril_ipc);
+
+#define TEST_IPC_METHOD  IPC_FIRST_USER_METHOD
+#define TEST_IPC_COUNT   8
+
+static const char *test_ipc_server = "test-fibril-ipc";
+static const char *test_ipc_svc = "test/fibril-ipc";
+
+/** Server side of the test connection */
+typedef struct {
+	fibril_mutex_t lock;
+	fibril_condvar_t cv;
+	/** Collect the requests and answer them in reverse order */
+	bool reverse;
+	/** Futex to up when a request is received, if initialized */
+	futex_t *futex;
+	/** Arguments of the requests, in the order received */
+	sysarg_t args[TEST_IPC_COUNT];
+	ipc_call_t calls[TEST_IPC_COUNT];
+	size_t received;
+	/** Connection has been closed */
+	bool closed;
+} test_ipc_srv_t;
+
+static void test_ipc_request(test_ipc_srv_t *srv, ipc_call_t *call)
+{
+	fibril_mutex_lock(&srv->lock);
+
+	if (srv->received == TEST_IPC_COUNT) {
+		fibril_mutex_unlock(&srv->lock);
+		async_answer_0(call, ELIMIT);
+		return;
+	}
+
+	size_t i = srv->received++;
+	srv->args[i] = ipc_get_arg1(call);
+	srv->calls[i] = *call;
+	fibril_condvar_broadcast(&srv->cv);
+	fibril_mutex_unlock(&srv->lock);
+
+	if (srv->futex != NULL)
+		futex_up(srv->futex);
+
+	if (!srv->reverse) {
+		async_answer_1(call, EOK, ipc_get_arg1(call) + 1);
+		return;
+	}
+
+	if (i + 1 < TEST_IPC_COUNT)
+		return;
+
+	while (true) {
+		async_answer_1(&srv->calls[i], EOK,
+		    ipc_get_arg1(&srv->calls[i]) + 1);
+		if (i == 0)
+			break;
+		i--;
+	}
+}
+
+static void test_ipc_conn(ipc_call_t *icall, void *arg)
+{
+	test_ipc_srv_t *srv = (test_ipc_srv_t *) arg;
+
+	async_accept_0(icall);
+
+	while (true) {
+		ipc_call_t call;
+		async_get_call(&call);
+
+		if (!ipc_get_imethod(&call)) {
+			async_answer_0(&call, EOK);
+			break;
+		}
+
+		if (ipc_get_imethod(&call) != TEST_IPC_METHOD) {
+			async_answer_0(&call, EINVAL);
+			continue;
+		}
+
+		test_ipc_request(srv, &call);
+	}
+
+	fibril_mutex_lock(&srv->lock);
+	srv->closed = true;
+	fibril_condvar_broadcast(&srv->cv);
+	fibril_mutex_unlock(&srv->lock);
+}
+
+static async_sess_t *test_ipc_connect(test_ipc_srv_t *srv,
+    service_id_t *rsid)
+{
+	errno_t rc;
+
+	memset(srv, 0, sizeof(test_ipc_srv_t));
+	fibril_mutex_initialize(&srv->lock);
+	fibril_condvar_initialize(&srv->cv);
+
+	async_set_fallback_port_handler(test_ipc_conn, srv);
+
+	// FIXME This causes this test to be non-reentrant!
+	rc = loc_server_register(test_ipc_server);
+	PCUT_ASSERT_ERRNO_VAL(EOK, rc);
+
+	rc = loc_service_register(test_ipc_svc, rsid);
+	PCUT_ASSERT_ERRNO_VAL(EOK, rc);
+
+	async_sess_t *sess = loc_service_connect(*rsid, INTERFACE_ANY, 0);
+	PCUT_ASSERT_NOT_NULL(sess);
+	return sess;
+}
+
+static void test_ipc_disconnect(test_ipc_srv_t *srv, async_sess_t *sess,
+    service_id_t sid)
+{
+	async_hangup(sess);
+
+	fibril_mutex_lock(&srv->lock);
+	while (!srv->closed)
+		fibril_condvar_wait(&srv->cv, &srv->lock);
+	fibril_mutex_unlock(&srv->lock);
+
+	errno_t rc = loc_service_unregister(sid);
+	PCUT_ASSERT_ERRNO_VAL(EOK, rc);
+}
+
+/** Send the test requests in a row and check their answers. */
+static void test_ipc_send_all(test_ipc_srv_t *srv, async_sess_t *sess)
+{
+	aid_t req[TEST_IPC_COUNT];
+	ipc_call_t answer[TEST_IPC_COUNT];
+
+	async_exch_t *exch = async_exchange_begin(sess);
+	PCUT_ASSERT_NOT_NULL(exch);
+
+	for (size_t i = 0; i < TEST_IPC_COUNT; i++) {
+		req[i] = async_send_1(exch, TEST_IPC_METHOD, i, &answer[i]);
+		PCUT_ASSERT_TRUE(req[i] != 0);
+	}
+
+	async_exchange_end(exch);
+
+	for (size_t i = 0; i < TEST_IPC_COUNT; i++) {
+		errno_t retval;
+		async_wait_for(req[i], &retval);
+		PCUT_ASSERT_ERRNO_VAL(EOK, retval);
+		PCUT_ASSERT_INT_EQUALS(i + 1, ipc_get_arg1(&answer[i]));
+	}
+
+	PCUT_ASSERT_INT_EQUALS(TEST_IPC_COUNT, srv->received);
+	for (size_t i = 0; i < TEST_IPC_COUNT; i++)
+		PCUT_ASSERT_INT_EQUALS(i, srv->args[i]);
+}
+
+/** Deferred requests are made in the order they were sent */
+PCUT_TEST(send_order)
+{
+	test_ipc_srv_t srv;
+	service_id_t sid;
+
+	async_sess_t *sess = test_ipc_connect(&srv, &sid);
+	test_ipc_send_all(&srv, sess);
+	test_ipc_disconnect(&srv, sess, sid);
+}
+
+/** Deferred answers reach the requests they answer in any order */
+PCUT_TEST(answer_order)
+{
+	test_ipc_srv_t srv;
+	service_id_t sid;
+
+	async_sess_t *sess = test_ipc_connect(&srv, &sid);
+	srv.reverse = true;
+	test_ipc_send_all(&srv, sess);
+	test_ipc_disconnect(&srv, sess, sid);
+}
+
+/** Send a request without ending the exchange. */
+static aid_t test_ipc_send_one(async_sess_t *sess, async_exch_t **rexch,
+    ipc_call_t *answer)
+{
+	async_exch_t *exch = async_exchange_begin(sess);
+	PCUT_ASSERT_NOT_NULL(exch);
+
+	aid_t req = async_send_1(exch, TEST_IPC_METHOD, 1, answer);
+	PCUT_ASSERT_TRUE(req != 0);
+
+	*rexch = exch;
+	return req;
+}
+
+static void test_ipc_wait_one(async_exch_t *exch, aid_t req,
+    ipc_call_t *answer)
+{
+	errno_t retval;
+
+	async_exchange_end(exch);
+	async_wait_for(req, &retval);
+	PCUT_ASSERT_ERRNO_VAL(EOK, retval);
+	PCUT_ASSERT_INT_EQUALS(2, ipc_get_arg1(answer));
+}
+
+/** A deferred request is made before the thread sleeps in the kernel */
+PCUT_TEST(flush_on_usleep)
+{
+	test_ipc_srv_t srv;
+	service_id_t sid;
+	async_exch_t *exch;
+	ipc_call_t answer;
+
+	async_sess_t *sess = test_ipc_connect(&srv, &sid);
+
+	/* The request is received by another thread while this one sleeps. */
+	PCUT_ASSERT_INT_EQUALS(1, fibril_test_spawn_runners(1));
+
+	aid_t req = test_ipc_send_one(sess, &exch, &answer);
+
+	for (int i = 0; i < 1000; i++) {
+		fibril_mutex_lock(&srv.lock);
+		size_t received = srv.received;
+		fibril_mutex_unlock(&srv.lock);
+
+		if (received > 0)
+			break;
+
+		thread_usleep(1000);
+	}
+
+	PCUT_ASSERT_INT_EQUALS(1, srv.received);
+
+	test_ipc_wait_one(exch, req, &answer);
+	test_ipc_disconnect(&srv, sess, sid);
+}
+
+/** A deferred request is made before the thread sleeps on a futex */
+PCUT_TEST(flush_on_futex)
+{
+	test_ipc_srv_t srv;
+	service_id_t sid;
+	async_exch_t *exch;
+	ipc_call_t answer;
+	futex_t futex;
+
+	async_sess_t *sess = test_ipc_connect(&srv, &sid);
+
+	PCUT_ASSERT_ERRNO_VAL(EOK, futex_initialize(&futex, 0));
+	srv.futex = &futex;
+
+	PCUT_ASSERT_INT_EQUALS(1, fibril_test_spawn_runners(1));
+
+	aid_t req = test_ipc_send_one(sess, &exch, &answer);
+
+	struct timespec expires;
+	getuptime(&expires);
+	ts_add_diff(&expires, SEC2NSEC(10));
+
+	/* Upped only once the request is received by another thread. */
+	errno_t rc = futex_down_timeout(&futex, &expires);
+	PCUT_ASSERT_ERRNO_VAL(EOK, rc);
+
+	test_ipc_wait_one(exch, req, &answer);
+	test_ipc_disconnect(&srv, sess, sid);
+
+	futex_destroy(&futex);
+}
+
+PCUT_EXPORT(fibril_ipc);
@@ -0,0 +1,245 @@
+/*
+ * Copyright (c) 2026 agent
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * - Redistributions of source code must retain the above copyright
+ *   notice, this list of conditions and the following disclaimer.
+ * - Redistributions in binary form must reproduce the above copyright
+ *   notice, this list of conditions and the following disclaimer in the
+ *   documentation and/or other materials provided with the distribution.
+ * - The name of the author may not be used to endorse or promote products
+ *   derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+ * NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <fibril.h>
+#include <pcut/pcut.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include "../../generic/private/fibril.h"
+#include "../../generic/private/thread.h"
+
+PCUT_INIT;
+
+PCUT_TEST_SUITE(fibril_ready);
+
+/** Number of fibrils queued at once */
+#define TEST_READY_COUNT  8
+
+/** Runs in a row from the next slot of a queue, READY_NEXT_MAX in fibril.c */
+#define TEST_READY_NEXT_MAX  8
+
+/** Sleep period of a thread waiting for another one, in microseconds */
+#define TEST_READY_POLL  100
+
+/** Number of periods after which a thread gives up waiting */
+#define TEST_READY_POLL_MAX  10000
+
+/** Sleep the thread until @a flag is set, without switching fibrils. */
+static bool test_ready_thread_wait(atomic_bool *flag)
+{
+	for (int i = 0; i < TEST_READY_POLL_MAX; i++) {
+		if (atomic_load(flag))
+			return true;
+
+		thread_usleep(TEST_READY_POLL);
+	}
+
+	return atomic_load(flag);
+}
+
+/** Make the current thread own a ready queue. */
+static void test_ready_queue_own(void)
+{
+	/* The main fibril inherits the queue of the helper it is woken by. */
+	fibril_usleep(1000);
+}
+
+/** Fibrils taking turns through the next slot */
+typedef struct {
+	fibril_event_t main;
+	fibril_event_t other;
+	bool stop;
+	int rounds;
+	/** Round in which the queued fibril ran, -1 if it has not */
+	int queued_round;
+} test_ready_next_t;
+
+static errno_t test_ready_next_fibril(void *arg)
+{
+	test_ready_next_t *t = (test_ready_next_t *) arg;
+
+	while (true) {
+		fibril_wait_for(&t->other);
+		if (t->stop)
+			break;
+
+		t->rounds++;
+		fibril_notify(&t->main);
+	}
+
+	fibril_notify(&t->main);
+	return EOK;
+}
+
+static errno_t test_ready_queued_fibril(void *arg)
+{
+	test_ready_next_t *t = (test_ready_next_t *) arg;
+
+	t->queued_round = t->rounds;
+	return EOK;
+}
+
+/** Fibrils woken up in turns do not keep a queued fibril from running */
+PCUT_TEST(next_gives_way)
+{
+	test_ready_next_t t = {
+		.main = FIBRIL_EVENT_INIT,
+		.other = FIBRIL_EVENT_INIT,
+		.queued_round = -1
+	};
+
+	/*
+	 * Other threads would steal the queued fibril, this needs to be
+	 * observed with a single one.
+	 */
+	test_ready_queue_own();
+
+	fid_t queued = fibril_create(test_ready_queued_fibril, &t);
+	PCUT_ASSERT_TRUE(queued != 0);
+	fibril_add_ready(queued);
+
+	fid_t other = fibril_create(test_ready_next_fibril, &t);
+	PCUT_ASSERT_TRUE(other != 0);
+	fibril_add_ready(other);
+
+	while ((t.queued_round < 0) && (t.rounds < 1000)) {
+		fibril_notify(&t.other);
+		fibril_wait_for(&t.main);
+	}
+
+	t.stop = true;
+	fibril_notify(&t.other);
+	fibril_wait_for(&t.main);
+
+	/* The next slot gives way after a few runs in a row. */
+	PCUT_ASSERT_TRUE(t.queued_round >= 0);
+	PCUT_ASSERT_TRUE(t.queued_round <= 2 * TEST_READY_NEXT_MAX);
+}
+
+/** Fibril recording that it has run */
+typedef struct {
+	atomic_bool started;
+	/** Keep the thread busy until set */
+	atomic_bool *release;
+} test_ready_fibril_t;
+
+static errno_t test_ready_fibril(void *arg)
+{
+	test_ready_fibril_t *f = (test_ready_fibril_t *) arg;
+	atomic_bool *release = f->release;
+
+	/* The test may reuse or drop f once it is started. */
+	atomic_store(&f->started, true);
+
+	if (release != NULL)
+		(void) test_ready_thread_wait(release);
+
+	return EOK;
+}
+
+static void test_ready_fibril_start(test_ready_fibril_t *f,
+    atomic_bool *release)
+{
+	atomic_init(&f->started, false);
+	f->release = release;
+
+	fid_t fid = fibril_create(test_ready_fibril, f);
+	PCUT_ASSERT_TRUE(fid != 0);
+	fibril_add_ready(fid);
+}
+
+/** An idle thread steals a fibril and half of the rest of the queue */
+PCUT_TEST(steal_half)
+{
+	/* Outlive the test, the fibrils may still be waiting for release. */
+	static test_ready_fibril_t blocker;
+	static test_ready_fibril_t f[TEST_READY_COUNT];
+	static atomic_bool release_blocker;
+	static atomic_bool release_first;
+
+	atomic_init(&release_blocker, false);
+	atomic_init(&release_first, false);
+
+	test_ready_queue_own();
+	PCUT_ASSERT_INT_EQUALS(1, fibril_test_spawn_runners(1));
+
+	/*
+	 * This thread does not switch fibrils, so the runner steals the
+	 * blocker and is kept busy by it while the queue is filled.
+	 */
+	test_ready_fibril_start(&blocker, &release_blocker);
+	PCUT_ASSERT_TRUE(test_ready_thread_wait(&blocker.started));
+
+	for (int i = 0; i < TEST_READY_COUNT; i++)
+		test_ready_fibril_start(&f[i], i == 0 ? &release_first : NULL);
+
+	/*
+	 * Once free, the runner steals the first fibril queued, which keeps
+	 * it busy again, and half of the rest behind it.
+	 */
+	atomic_store(&release_blocker, true);
+	PCUT_ASSERT_TRUE(test_ready_thread_wait(&f[0].started));
+
+	/* The rest of the queue is left to this thread. */
+	fibril_yield();
+
+	int stolen = 0;
+	for (int i = 1; i < TEST_READY_COUNT; i++) {
+		if (!atomic_load(&f[i].started))
+			stolen++;
+	}
+
+	PCUT_ASSERT_INT_EQUALS((TEST_READY_COUNT - 1) / 2, stolen);
+
+	/* The stolen fibrils run once the runner is free again. */
+	atomic_store(&release_first, true);
+
+	for (int i = 1; i < TEST_READY_COUNT; i++)
+		PCUT_ASSERT_TRUE(test_ready_thread_wait(&f[i].started));
+}
+
+/** A fibril made ready while a thread goes to wait for IPC is not lost */
+PCUT_TEST(push_during_wait)
+{
+	test_ready_queue_own();
+	PCUT_ASSERT_INT_EQUALS(1, fibril_test_spawn_runners(1));
+
+	/*
+	 * This thread does not switch fibrils, so each fibril is run by the
+	 * runner. Some of them are made ready just as the runner, done with
+	 * the previous one, announces that it waits for IPC.
+	 */
+	for (int i = 0; i < 1000; i++) {
+		test_ready_fibril_t f;
+
+		test_ready_fibril_start(&f, NULL);
+		PCUT_ASSERT_TRUE(test_ready_thread_wait(&f.started));
+	}
+}
+
+PCUT_EXPORT(fibril_ready);
@@ -31,10 +31,13 @@
 
 PCUT_INIT;
 
+PCUT_IMPORT(async_ring);
 PCUT_IMPORT(capa);
 PCUT_IMPORT(casting);
 PCUT_IMPORT(circ_buf);
 PCUT_IMPORT(double_to_str);
+PCUT_IMPORT(fibril_ipc);
+PCUT_IMPORT(fibril_ready);
 PCUT_IMPORT(fibril_timer);
 PCUT_IMPORT(getopt);
 PCUT_IMPORT(gsort);
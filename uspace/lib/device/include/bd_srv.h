@@ -65,6 +65,7 @@ struct bd_ops {
 	errno_t (*write_blocks)(bd_srv_t *, aoff64_t, size_t, const void *, size_t);
 	errno_t (*get_block_size)(bd_srv_t *, size_t *);
 	errno_t (*get_num_blocks)(bd_srv_t *, aoff64_t *);
+	errno_t (*print_stats)(bd_srv_t *);
 };
 
 extern void bd_srvs_init(bd_srvs_t *);
@@ -89,7 +89,7 @@ errno_t bd_read_blocks(bd_t *bd, aoff64_t ba, size_t cnt, void *data, size_t siz
 	ipc_call_t answer;
 	aid_t req = async_send_3(exch, BD_READ_BLOCKS, LOWER32(ba),
 	    UPPER32(ba), cnt, &answer);
-	errno_t rc = async_data_read_start(exch, data, size);
+	errno_t rc = async_data_read_start_loan(exch, data, size);
 	async_exchange_end(exch);
 
 	if (rc != EOK) {
@@ -137,7 +137,7 @@ errno_t bd_write_blocks(bd_t *bd, aoff64_t ba, size_t cnt, const void *data,
 	ipc_call_t answer;
 	aid_t req = async_send_3(exch, BD_WRITE_BLOCKS, LOWER32(ba),
 	    UPPER32(ba), cnt, &answer);
-	errno_t rc = async_data_write_start(exch, data, size);
+	errno_t rc = async_data_write_start_loan(exch, data, size);
 	async_exchange_end(exch);
 
 	if (rc != EOK) {
@@ -195,6 +195,22 @@ errno_t bd_get_num_blocks(bd_t *bd, aoff64_t *rnb)
 	return EOK;
 }
 
+/** Ask the block device server to print its usage statistics.
+ *
+ * @param bd Block device
+ *
+ * @return EOK on success, ENOTSUP if the server keeps no statistics
+ */
+errno_t bd_print_stats(bd_t *bd)
+{
+	async_exch_t *exch = async_exchange_begin(bd->sess);
+
+	errno_t rc = async_req_0_0(exch, BD_PRINT_STATS);
+	async_exchange_end(exch);
+
+	return rc;
+}
+
 static void bd_cb_conn(ipc_call_t *icall, void *arg)
 {
 	bd_t *bd = (bd_t *)arg;
@@ -33,6 +33,7 @@
  * @file
  * @brief Block device server stub
  */
+#include <as.h>
 #include <errno.h>
 #include <ipc/bd.h>
 #include <macros.h>
@@ -42,6 +43,39 @@
 
 #include <bd_srv.h>
 
+/** Allocate a buffer for transferring blocks.
+ *
+ * Large buffers get an address space area of their own. Their pages are
+ * loaned to or from the client copy-on-write and destroying the area once
+ * the transfer is over drops them, so that they are never copied on write.
+ *
+ * @param size Size of the buffer.
+ *
+ * @return Buffer or NULL if out of memory.
+ */
+static void *bd_srv_buf_alloc(size_t size)
+{
+	if (size < DATA_XFER_LOAN_MIN)
+		return malloc(size);
+
+	void *buf = as_area_create(AS_AREA_ANY, size, AS_AREA_READ |
+	    AS_AREA_WRITE | AS_AREA_CACHEABLE, AS_AREA_UNPAGED);
+	return (buf != AS_MAP_FAILED) ? buf : NULL;
+}
+
+/** Free a buffer allocated by bd_srv_buf_alloc().
+ *
+ * @param buf  Buffer.
+ * @param size Size of the buffer.
+ */
+static void bd_srv_buf_free(void *buf, size_t size)
+{
+	if (size < DATA_XFER_LOAN_MIN)
+		free(buf);
+	else
+		(void) as_area_destroy(buf);
+}
+
 static void bd_read_blocks_srv(bd_srv_t *srv, ipc_call_t *call)
 {
 	aoff64_t ba;
@@ -59,7 +93,7 @@ static void bd_read_blocks_srv(bd_srv_t *srv, ipc_call_t *call)
 		return;
 	}
 
-	buf = malloc(size);
+	buf = bd_srv_buf_alloc(size);
 	if (buf == NULL) {
 		async_answer_0(&rcall, ENOMEM);
 		async_answer_0(call, ENOMEM);
@@ -69,7 +103,7 @@ static void bd_read_blocks_srv(bd_srv_t *srv, ipc_call_t *call)
 	if (srv->srvs->ops->read_blocks == NULL) {
 		async_answer_0(&rcall, ENOTSUP);
 		async_answer_0(call, ENOTSUP);
-		free(buf);
+		bd_srv_buf_free(buf, size);
 		return;
 	}
 
@@ -77,13 +111,13 @@ static void bd_read_blocks_srv(bd_srv_t *srv, ipc_call_t *call)
 	if (rc != EOK) {
 		async_answer_0(&rcall, ENOMEM);
 		async_answer_0(call, ENOMEM);
-		free(buf);
+		bd_srv_buf_free(buf, size);
 		return;
 	}
 
-	async_data_read_finalize(&rcall, buf, size);
+	async_data_read_finalize_loan(&rcall, buf, size);
 
-	free(buf);
+	bd_srv_buf_free(buf, size);
 	async_answer_0(call, EOK);
 }
 
@@ -159,19 +193,34 @@ static void bd_write_blocks_srv(bd_srv_t *srv, ipc_call_t *call)
 	ba = MERGE_LOUP32(ipc_get_arg1(call), ipc_get_arg2(call));
 	cnt = ipc_get_arg3(call);
 
-	rc = async_data_write_accept(&data, false, 0, 0, 0, &size);
+	ipc_call_t wcall;
+	if (!async_data_write_receive(&wcall, &size)) {
+		async_answer_0(call, EINVAL);
+		return;
+	}
+
+	data = bd_srv_buf_alloc(size);
+	if (data == NULL) {
+		async_answer_0(&wcall, ENOMEM);
+		async_answer_0(call, ENOMEM);
+		return;
+	}
+
+	rc = async_data_write_finalize(&wcall, data, size);
 	if (rc != EOK) {
+		bd_srv_buf_free(data, size);
 		async_answer_0(call, rc);
 		return;
 	}
 
 	if (srv->srvs->ops->write_blocks == NULL) {
+		bd_srv_buf_free(data, size);
 		async_answer_0(call, ENOTSUP);
 		return;
 	}
 
 	rc = srv->srvs->ops->write_blocks(srv, ba, cnt, data, size);
-	free(data);
+	bd_srv_buf_free(data, size);
 	async_answer_0(call, rc);
 }
 
@@ -203,6 +252,19 @@ static void bd_get_num_blocks_srv(bd_srv_t *srv, ipc_call_t *call)
 	async_answer_2(call, rc, LOWER32(num_blocks), UPPER32(num_blocks));
 }
 
+static void bd_print_stats_srv(bd_srv_t *srv, ipc_call_t *call)
+{
+	errno_t rc;
+
+	if (srv->srvs->ops->print_stats == NULL) {
+		async_answer_0(call, ENOTSUP);
+		return;
+	}
+
+	rc = srv->srvs->ops->print_stats(srv);
+	async_answer_0(call, rc);
+}
+
 static bd_srv_t *bd_srv_create(bd_srvs_t *srvs)
 {
 	bd_srv_t *srv;
@@ -273,6 +335,9 @@ errno_t bd_conn(ipc_call_t *icall, bd_srvs_t *srvs)
 		case BD_GET_NUM_BLOCKS:
 			bd_get_num_blocks_srv(srv, &call);
 			break;
+		case BD_PRINT_STATS:
+			bd_print_stats_srv(srv, &call);
+			break;
 		default:
 			async_answer_0(&call, EINVAL);
 		}
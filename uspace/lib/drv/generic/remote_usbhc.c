@@ -392,7 +392,8 @@ static async_transaction_t *async_transaction_create(ipc_call_t *call)
 static errno_t transfer_finished(void *arg, errno_t error, size_t transferred_size)
 {
 	async_transaction_t *trans = arg;
-	const errno_t err = async_answer_1(&trans->call, error, transferred_size);
+	const errno_t err = async_answer_sync(&trans->call, error,
+	    transferred_size, 0, 0, 0, 0);
 	async_transaction_destroy(trans);
 	return err;
 }
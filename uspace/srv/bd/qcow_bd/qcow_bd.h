@@ -52,36 +52,28 @@
 #include <str.h>
 #include <time.h>
 #include <inttypes.h>
+#include "qcow_image.h"
+#include "qcow_map.h"
 
 #define NAME "qcow_bd"
 #define DEFAULT_BLOCK_SIZE 512
-#define QCOW_MAGIC (('Q' << 24) | ('F' << 16) | ('I' << 8) | 0xfb)
-#define QCOW_VERSION 1
-#define QCOW_CRYPT_NONE 0
-#define QCOW_OFLAG_COMPRESSED (1LL << 63)
-#define QCOW_UNALLOCATED_REFERENCE 0
-
-typedef struct __attribute__ ((__packed__)) QCowHeader {
-    uint32_t magic;
-    uint32_t version;
-    uint64_t backing_file_offset;
-    uint32_t backing_file_size;
-    uint32_t mtime;
-    uint64_t size;
-    uint8_t cluster_bits;
-    uint8_t l2_bits;
-    uint16_t unused;
-    uint32_t crypt_method;
-    uint64_t l1_table_offset;
-} QCowHeader;
+#define DEFAULT_CACHE_SIZE 32
+/* Number of granules remembered by the resolved cluster map */
+#define DEFAULT_MAP_SIZE 4096
 
 typedef struct QcowState {
-    uint64_t cluster_size;
 	size_t block_size;
 	aoff64_t num_blocks;
-    uint64_t l2_size;
-    uint64_t l1_size;
-    uint64_t l1_table_offset;
+	/** Maximum number of metadata tables kept in memory per image */
+	size_t cache_size;
+	/** Top image of the backing file chain, the only one written to */
+	qcow_image_t *image;
+	/** Log2 of the smallest cluster size in the chain */
+	unsigned granule_bits;
+	/** Resolved cluster map, only used if the top image has a backing */
+	qcow_map_t map;
+	/** Scratch buffer of one cluster of the top image */
+	uint8_t *cluster_buf;
 } QcowState;
 
 #endif
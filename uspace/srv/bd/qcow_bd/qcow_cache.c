@@ -0,0 +1,600 @@
+/*
+ * Copyright (c) 2026 agent
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * - Redistributions of source code must retain the above copyright
+ *   notice, this list of conditions and the following disclaimer.
+ * - Redistributions in binary form must reproduce the above copyright
+ *   notice, this list of conditions and the following disclaimer in the
+ *   documentation and/or other materials provided with the distribution.
+ * - The name of the author may not be used to endorse or promote products
+ *   derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+ * NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/** @addtogroup qcow_bd
+ * @{
+ */
+
+/**
+ * @file
+ * @brief QCOW metadata table cache
+ *
+ * Keeps a bounded number of L2 tables and refcount blocks in memory, already
+ * converted to host byte order, so that translating a guest offset does not
+ * have to go to the image file. When the cache is full, the least recently
+ * used table is replaced. Modified tables are kept in the cache and only
+ * written to the image when they are evicted or when the cache is flushed.
+ *
+ * The cache may be used by many fibrils at once. Tables are read from the
+ * image without holding the cache lock, so a miss does not hold up hits on
+ * other tables; fibrils asking for a table which is just being read wait
+ * for that read instead of issuing their own. Every table obtained from the
+ * cache is held until it is returned with qcow_cache_put() and a held table
+ * is never recycled. Callers are responsible for serializing modifications
+ * of the table contents.
+ */
+
+#include <adt/hash.h>
+#include <assert.h>
+#include <byteorder.h>
+#include <macros.h>
+#include <mem.h>
+#include <stdlib.h>
+#include <vfs/vfs.h>
+#include "qcow_cache.h"
+
+static size_t qcow_cache_key_hash(const void *key)
+{
+	const uint64_t *offset = key;
+	return hash_mix(*offset);
+}
+
+static size_t qcow_cache_hash(const ht_link_t *item)
+{
+	qcow_cache_entry_t *entry = hash_table_get_inst(item,
+	    qcow_cache_entry_t, hash_link);
+	return hash_mix(entry->offset);
+}
+
+static bool qcow_cache_key_equal(const void *key, const ht_link_t *item)
+{
+	const uint64_t *offset = key;
+	qcow_cache_entry_t *entry = hash_table_get_inst(item,
+	    qcow_cache_entry_t, hash_link);
+	return entry->offset == *offset;
+}
+
+static hash_table_ops_t qcow_cache_ops = {
+	.hash = qcow_cache_hash,
+	.key_hash = qcow_cache_key_hash,
+	.key_equal = qcow_cache_key_equal,
+	.equal = NULL,
+	.remove_callback = NULL
+};
+
+/** Initialize table cache.
+ *
+ * @param cache      Cache to initialize
+ * @param fd         File handle of the image the tables live in
+ * @param capacity   Maximum number of tables kept in memory
+ * @param table_size Size of one table in bytes
+ *
+ * @return EOK on success, ENOMEM if out of memory
+ */
+errno_t qcow_cache_init(qcow_cache_t *cache, int fd, size_t capacity,
+    size_t table_size)
+{
+	fibril_mutex_initialize(&cache->lock);
+	fibril_condvar_initialize(&cache->loaded);
+	cache->fd = fd;
+	cache->table_size = table_size;
+	cache->capacity = max(capacity, 1);
+	cache->count = 0;
+	cache->evicting = 0;
+	cache->stats.hits = 0;
+	cache->stats.misses = 0;
+	cache->stats.evictions = 0;
+	cache->stats.writebacks = 0;
+	list_initialize(&cache->lru);
+
+	cache->wbuf = malloc(table_size);
+	if (cache->wbuf == NULL)
+		return ENOMEM;
+
+	if (!hash_table_create(&cache->hash, cache->capacity, 0,
+	    &qcow_cache_ops)) {
+		free(cache->wbuf);
+		return ENOMEM;
+	}
+
+	return EOK;
+}
+
+/** Free all tables held by the cache.
+ *
+ * Modified tables are not written back, call qcow_cache_flush() first.
+ */
+void qcow_cache_fini(qcow_cache_t *cache)
+{
+	while (!list_empty(&cache->lru)) {
+		qcow_cache_entry_t *entry = list_get_instance(
+		    list_first(&cache->lru), qcow_cache_entry_t, lru_link);
+
+		list_remove(&entry->lru_link);
+		hash_table_remove_item(&cache->hash, &entry->hash_link);
+		free(entry->data);
+		free(entry);
+	}
+
+	cache->count = 0;
+	hash_table_destroy(&cache->hash);
+	free(cache->wbuf);
+}
+
+/** Read a table from the image and convert it to host byte order.
+ *
+ * Called without the cache lock held.
+ */
+static errno_t qcow_cache_load(qcow_cache_t *cache, qcow_cache_entry_t *entry)
+{
+	aoff64_t pos = entry->offset;
+	size_t nread;
+
+	errno_t rc = vfs_read(cache->fd, &pos, entry->data, cache->table_size,
+	    &nread);
+	if (rc != EOK)
+		return EIO;
+
+	if (nread < cache->table_size)
+		return EINVAL;
+
+	if (entry->type == QCOW_TABLE_L2) {
+		size_t n = cache->table_size / sizeof(uint64_t);
+		for (size_t i = 0; i < n; i++)
+			entry->table[i] = uint64_t_be2host(entry->table[i]);
+	} else {
+		size_t n = cache->table_size / sizeof(uint16_t);
+		for (size_t i = 0; i < n; i++)
+			entry->refcounts[i] =
+			    uint16_t_be2host(entry->refcounts[i]);
+	}
+
+	return EOK;
+}
+
+/** Convert a table to big endian.
+ *
+ * @param buf Destination buffer, may be the table itself. Converting the
+ *            table in place twice restores it.
+ */
+static void qcow_cache_encode(qcow_cache_t *cache, qcow_cache_entry_t *entry,
+    void *buf)
+{
+	if (entry->type == QCOW_TABLE_L2) {
+		uint64_t *wbuf = buf;
+		size_t n = cache->table_size / sizeof(uint64_t);
+		for (size_t i = 0; i < n; i++)
+			wbuf[i] = host2uint64_t_be(entry->table[i]);
+	} else {
+		uint16_t *wbuf = buf;
+		size_t n = cache->table_size / sizeof(uint16_t);
+		for (size_t i = 0; i < n; i++)
+			wbuf[i] = host2uint16_t_be(entry->refcounts[i]);
+	}
+}
+
+/** Write a table converted to big endian to the image. */
+static errno_t qcow_cache_write(qcow_cache_t *cache,
+    qcow_cache_entry_t *entry, const void *buf)
+{
+	aoff64_t pos = entry->offset;
+	size_t nwritten;
+
+	errno_t rc = vfs_write(cache->fd, &pos, buf, cache->table_size,
+	    &nwritten);
+	if (rc != EOK || nwritten < cache->table_size)
+		return EIO;
+
+	return EOK;
+}
+
+/** Write a modified table back to the image.
+ *
+ * Called with the cache lock held, which also protects the conversion
+ * buffer.
+ */
+static errno_t qcow_cache_store(qcow_cache_t *cache, qcow_cache_entry_t *entry)
+{
+	qcow_cache_encode(cache, entry, cache->wbuf);
+
+	errno_t rc = qcow_cache_write(cache, entry, cache->wbuf);
+	if (rc != EOK)
+		return rc;
+
+	entry->dirty = false;
+	cache->stats.writebacks++;
+	return EOK;
+}
+
+/** Write back a modified table which nobody holds before it leaves the cache.
+ *
+ * The table is taken off the LRU list, so that it is not picked again, but
+ * stays in the hash table marked as evicting, so that fibrils looking for it
+ * wait for the write instead of reading a stale copy from the image. The
+ * cache lock is dropped while writing, the table is converted in place.
+ *
+ * Called with the cache lock held.
+ *
+ * @return EOK if the table was written and removed from the hash table, its
+ *         data are no longer valid. An error code if the write failed, the
+ *         table is back in the cache and still modified.
+ */
+static errno_t qcow_cache_evict(qcow_cache_t *cache, qcow_cache_entry_t *entry)
+{
+	assert(entry->refs == 0);
+	assert(entry->dirty);
+
+	list_remove(&entry->lru_link);
+	entry->evicting = true;
+	cache->evicting++;
+
+	fibril_mutex_unlock(&cache->lock);
+
+	qcow_cache_encode(cache, entry, entry->data);
+	errno_t rc = qcow_cache_write(cache, entry, entry->data);
+	if (rc != EOK) {
+		/* Back to host byte order */
+		qcow_cache_encode(cache, entry, entry->data);
+	}
+
+	fibril_mutex_lock(&cache->lock);
+
+	entry->evicting = false;
+	cache->evicting--;
+
+	if (rc == EOK) {
+		entry->dirty = false;
+		cache->stats.writebacks++;
+		hash_table_remove_item(&cache->hash, &entry->hash_link);
+	} else {
+		list_append(&entry->lru_link, &cache->lru);
+	}
+
+	fibril_condvar_broadcast(&cache->loaded);
+	return rc;
+}
+
+/** Remove an entry from the cache, it stays allocated. */
+static void qcow_cache_remove(qcow_cache_t *cache, qcow_cache_entry_t *entry)
+{
+	list_remove(&entry->lru_link);
+	hash_table_remove_item(&cache->hash, &entry->hash_link);
+	cache->count--;
+}
+
+/** Free an entry which is no longer in the cache. */
+static void qcow_cache_free_entry(qcow_cache_entry_t *entry)
+{
+	free(entry->data);
+	free(entry);
+}
+
+/** Find a free slot for a new table.
+ *
+ * Allocates a new entry while the cache is below capacity, otherwise
+ * recycles the least recently used table which nobody holds, writing it
+ * back first if needed. If all tables are held, the cache temporarily
+ * grows above its capacity. The returned entry is in neither the hash table
+ * nor the LRU list, but is already counted.
+ *
+ * Writing back a table drops the cache lock, see qcow_cache_evict().
+ */
+static errno_t qcow_cache_alloc_entry(qcow_cache_t *cache,
+    qcow_cache_entry_t **rentry)
+{
+	qcow_cache_entry_t *entry = NULL;
+	errno_t rc;
+
+	if (cache->count >= cache->capacity) {
+		/* Look for the least recently used table nobody holds */
+		link_t *link = list_last(&cache->lru);
+		while (link != NULL) {
+			qcow_cache_entry_t *victim = list_get_instance(link,
+			    qcow_cache_entry_t, lru_link);
+			if (victim->refs == 0) {
+				entry = victim;
+				break;
+			}
+
+			link = list_prev(link, &cache->lru);
+		}
+	}
+
+	if (entry != NULL) {
+		if (entry->dirty) {
+			rc = qcow_cache_evict(cache, entry);
+			if (rc != EOK)
+				return rc;
+		} else {
+			list_remove(&entry->lru_link);
+			hash_table_remove_item(&cache->hash, &entry->hash_link);
+		}
+
+		cache->stats.evictions++;
+	} else {
+		entry = calloc(1, sizeof(qcow_cache_entry_t));
+		if (entry == NULL)
+			return ENOMEM;
+
+		entry->data = malloc(cache->table_size);
+		if (entry->data == NULL) {
+			free(entry);
+			return ENOMEM;
+		}
+
+		link_initialize(&entry->lru_link);
+		cache->count++;
+	}
+
+	entry->dirty = false;
+	entry->loading = false;
+	entry->evicting = false;
+	entry->failed = false;
+	entry->refs = 1;
+	*rentry = entry;
+	return EOK;
+}
+
+/** Insert an entry as the most recently used one. */
+static void qcow_cache_insert(qcow_cache_t *cache, qcow_cache_entry_t *entry,
+    uint64_t offset)
+{
+	entry->offset = offset;
+	hash_table_insert(&cache->hash, &entry->hash_link);
+	list_prepend(&entry->lru_link, &cache->lru);
+}
+
+/** Release a held entry with the cache lock held.
+ *
+ * Writing back a table the cache shrinks by drops the cache lock, see
+ * qcow_cache_evict().
+ */
+static void qcow_cache_put_locked(qcow_cache_t *cache,
+    qcow_cache_entry_t *entry)
+{
+	assert(entry->refs > 0);
+	if (--entry->refs > 0)
+		return;
+
+	if (entry->failed) {
+		qcow_cache_free_entry(entry);
+		return;
+	}
+
+	/* Shrink back once the tables held all at once are released */
+	if (cache->count > cache->capacity) {
+		if (entry->dirty) {
+			if (qcow_cache_evict(cache, entry) != EOK)
+				return;
+
+			cache->count--;
+		} else {
+			qcow_cache_remove(cache, entry);
+		}
+
+		qcow_cache_free_entry(entry);
+		cache->stats.evictions++;
+	}
+}
+
+/** Get a table from the cache, reading it from the image if needed.
+ *
+ * The returned entry is held by the caller and has to be released with
+ * qcow_cache_put().
+ *
+ * @param cache  Table cache
+ * @param offset Offset of the table in the image file
+ * @param type   Kind of the table
+ * @param rentry Place to store pointer to the cache entry
+ *
+ * @return EOK on success or an error code
+ */
+errno_t qcow_cache_get(qcow_cache_t *cache, uint64_t offset,
+    qcow_table_type_t type, qcow_cache_entry_t **rentry)
+{
+	qcow_cache_entry_t *entry;
+	ht_link_t *hlink;
+	errno_t rc;
+
+	fibril_mutex_lock(&cache->lock);
+
+retry:
+	hlink = hash_table_find(&cache->hash, &offset);
+	if (hlink != NULL) {
+		entry = hash_table_get_inst(hlink, qcow_cache_entry_t,
+		    hash_link);
+
+		/* The table is being written back, read it again afterwards */
+		if (entry->evicting) {
+			fibril_condvar_wait(&cache->loaded, &cache->lock);
+			goto retry;
+		}
+
+		if (entry->type != type) {
+			fibril_mutex_unlock(&cache->lock);
+			return EINVAL;
+		}
+
+		/* Move the table to the head of the LRU list */
+		list_remove(&entry->lru_link);
+		list_prepend(&entry->lru_link, &cache->lru);
+
+		entry->refs++;
+		cache->stats.hits++;
+
+		/* Someone else is reading the table, wait for them */
+		while (entry->loading)
+			fibril_condvar_wait(&cache->loaded, &cache->lock);
+
+		if (entry->failed) {
+			qcow_cache_put_locked(cache, entry);
+			fibril_mutex_unlock(&cache->lock);
+			return EIO;
+		}
+
+		fibril_mutex_unlock(&cache->lock);
+		*rentry = entry;
+		return EOK;
+	}
+
+	rc = qcow_cache_alloc_entry(cache, &entry);
+	if (rc != EOK) {
+		fibril_mutex_unlock(&cache->lock);
+		return rc;
+	}
+
+	/* Someone else may have cached the table while the lock was dropped */
+	if (hash_table_find(&cache->hash, &offset) != NULL) {
+		cache->count--;
+		qcow_cache_free_entry(entry);
+		goto retry;
+	}
+
+	cache->stats.misses++;
+
+	entry->type = type;
+	entry->loading = true;
+	qcow_cache_insert(cache, entry, offset);
+
+	fibril_mutex_unlock(&cache->lock);
+	rc = qcow_cache_load(cache, entry);
+	fibril_mutex_lock(&cache->lock);
+
+	entry->loading = false;
+	if (rc != EOK) {
+		/* Waiters see the failure, the last to leave frees the entry */
+		entry->failed = true;
+		qcow_cache_remove(cache, entry);
+	}
+
+	fibril_condvar_broadcast(&cache->loaded);
+
+	if (rc != EOK)
+		qcow_cache_put_locked(cache, entry);
+
+	fibril_mutex_unlock(&cache->lock);
+
+	if (rc == EOK)
+		*rentry = entry;
+	return rc;
+}
+
+/** Add a newly allocated, zero-filled table to the cache.
+ *
+ * The table is not read from the image; it is marked dirty so that it
+ * gets written there on the next flush or eviction. The returned entry is
+ * held by the caller and has to be released with qcow_cache_put().
+ *
+ * @param cache  Table cache
+ * @param offset Offset of the table in the image file
+ * @param type   Kind of the table
+ * @param rentry Place to store pointer to the cache entry
+ *
+ * @return EOK on success or an error code
+ */
+errno_t qcow_cache_get_new(qcow_cache_t *cache, uint64_t offset,
+    qcow_table_type_t type, qcow_cache_entry_t **rentry)
+{
+	qcow_cache_entry_t *entry;
+	errno_t rc;
+
+	fibril_mutex_lock(&cache->lock);
+
+	rc = qcow_cache_alloc_entry(cache, &entry);
+	if (rc != EOK) {
+		fibril_mutex_unlock(&cache->lock);
+		return rc;
+	}
+
+	memset(entry->data, 0, cache->table_size);
+	entry->type = type;
+	entry->dirty = true;
+
+	qcow_cache_insert(cache, entry, offset);
+	fibril_mutex_unlock(&cache->lock);
+
+	*rentry = entry;
+	return EOK;
+}
+
+/** Release a table obtained from qcow_cache_get() or qcow_cache_get_new(). */
+void qcow_cache_put(qcow_cache_t *cache, qcow_cache_entry_t *entry)
+{
+	fibril_mutex_lock(&cache->lock);
+	qcow_cache_put_locked(cache, entry);
+	fibril_mutex_unlock(&cache->lock);
+}
+
+/** Mark a cached table as modified. */
+void qcow_cache_set_dirty(qcow_cache_t *cache, qcow_cache_entry_t *entry)
+{
+	fibril_mutex_lock(&cache->lock);
+	entry->dirty = true;
+	fibril_mutex_unlock(&cache->lock);
+}
+
+/** Write all modified tables back to the image.
+ *
+ * @param cache Table cache
+ *
+ * @return EOK on success or an error code
+ */
+errno_t qcow_cache_flush(qcow_cache_t *cache)
+{
+	errno_t rc = EOK;
+
+	fibril_mutex_lock(&cache->lock);
+
+	/* Tables being evicted are not in the LRU list, wait for them */
+	while (cache->evicting > 0)
+		fibril_condvar_wait(&cache->loaded, &cache->lock);
+
+	list_foreach(cache->lru, lru_link, qcow_cache_entry_t, entry) {
+		if (!entry->dirty)
+			continue;
+
+		rc = qcow_cache_store(cache, entry);
+		if (rc != EOK)
+			break;
+	}
+
+	fibril_mutex_unlock(&cache->lock);
+	return rc;
+}
+
+/** Get a snapshot of the cache usage counters. */
+void qcow_cache_get_stats(qcow_cache_t *cache, qcow_cache_stats_t *stats)
+{
+	fibril_mutex_lock(&cache->lock);
+	*stats = cache->stats;
+	fibril_mutex_unlock(&cache->lock);
+}
+
+/**
+ * @}
+ */
@@ -0,0 +1,139 @@
+/*
+ * Copyright (c) 2026 agent
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * - Redistributions of source code must retain the above copyright
+ *   notice, this list of conditions and the following disclaimer.
+ * - Redistributions in binary form must reproduce the above copyright
+ *   notice, this list of conditions and the following disclaimer in the
+ *   documentation and/or other materials provided with the distribution.
+ * - The name of the author may not be used to endorse or promote products
+ *   derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+ * NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/** @addtogroup qcow_bd
+ * @{
+ */
+/** @file QCOW metadata table cache.
+ */
+
+#ifndef __QCOW_CACHE_H__
+#define __QCOW_CACHE_H__
+
+#include <adt/hash_table.h>
+#include <adt/list.h>
+#include <errno.h>
+#include <fibril_synch.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/** Cache usage counters. */
+typedef struct {
+	/** Number of lookups satisfied from the cache */
+	uint64_t hits;
+	/** Number of lookups that had to read the table from the image */
+	uint64_t misses;
+	/** Number of tables dropped to make room for another one */
+	uint64_t evictions;
+	/** Number of modified tables written back to the image */
+	uint64_t writebacks;
+} qcow_cache_stats_t;
+
+/** Kind of a cached table. */
+typedef enum {
+	/** L2 table, 64-bit entries */
+	QCOW_TABLE_L2,
+	/** QCOW2 refcount block, 16-bit entries */
+	QCOW_TABLE_REFCOUNT
+} qcow_table_type_t;
+
+/** One cached table, decoded to host byte order. */
+typedef struct {
+	/** Link in qcow_cache_t.hash */
+	ht_link_t hash_link;
+	/** Link in qcow_cache_t.lru */
+	link_t lru_link;
+	/** Offset of the table in the image file */
+	uint64_t offset;
+	/** Kind of the table */
+	qcow_table_type_t type;
+	/** Table entries */
+	union {
+		void *data;
+		/** Entries of a QCOW_TABLE_L2 table */
+		uint64_t *table;
+		/** Entries of a QCOW_TABLE_REFCOUNT block */
+		uint16_t *refcounts;
+	};
+	/** Table was modified and needs to be written back */
+	bool dirty;
+	/** Number of users holding the entry, a held entry is never recycled */
+	unsigned refs;
+	/** Table is being read from the image, data are not valid yet */
+	bool loading;
+	/** Table is being written back before it leaves the cache */
+	bool evicting;
+	/** Reading the table failed, the entry is no longer in the cache */
+	bool failed;
+} qcow_cache_entry_t;
+
+/** LRU cache of metadata tables keyed by their offset in the image.
+ *
+ * All tables in one cache have the same size, but may be of different kinds.
+ */
+typedef struct {
+	/** Protects the hash table, the LRU list and the entry states */
+	fibril_mutex_t lock;
+	/** Signalled when an entry has been read or written back */
+	fibril_condvar_t loaded;
+	/** File handle of the image the tables are read from */
+	int fd;
+	/** Size of one table in bytes */
+	size_t table_size;
+	/** Maximum number of cached tables */
+	size_t capacity;
+	/** Number of cached tables, above capacity while all are held */
+	size_t count;
+	/** Number of tables being written back by qcow_cache_evict() */
+	size_t evicting;
+	/** Cached tables by offset */
+	hash_table_t hash;
+	/** Cached tables, most recently used first */
+	list_t lru;
+	/** Buffer for converting a table to big endian on write-back */
+	void *wbuf;
+	/** Usage counters */
+	qcow_cache_stats_t stats;
+} qcow_cache_t;
+
+extern errno_t qcow_cache_init(qcow_cache_t *, int, size_t, size_t);
+extern void qcow_cache_fini(qcow_cache_t *);
+extern errno_t qcow_cache_get(qcow_cache_t *, uint64_t, qcow_table_type_t,
+    qcow_cache_entry_t **);
+extern errno_t qcow_cache_get_new(qcow_cache_t *, uint64_t, qcow_table_type_t,
+    qcow_cache_entry_t **);
+extern void qcow_cache_put(qcow_cache_t *, qcow_cache_entry_t *);
+extern void qcow_cache_set_dirty(qcow_cache_t *, qcow_cache_entry_t *);
+extern errno_t qcow_cache_flush(qcow_cache_t *);
+extern void qcow_cache_get_stats(qcow_cache_t *, qcow_cache_stats_t *);
+
+#endif
+
+/** @}
+ */
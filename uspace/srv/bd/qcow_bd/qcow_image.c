@@ -0,0 +1,1169 @@
+/*
+ * Copyright (c) 2021 Erik Kučák
+ * Copyright (c) 2026 agent
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * - Redistributions of source code must retain the above copyright
+ *   notice, this list of conditions and the following disclaimer.
+ * - Redistributions in binary form must reproduce the above copyright
+ *   notice, this list of conditions and the following disclaimer in the
+ *   documentation and/or other materials provided with the distribution.
+ * - The name of the author may not be used to endorse or promote products
+ *   derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+ * NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/** @addtogroup qcow_bd
+ * @{
+ */
+
+/**
+ * @file
+ * @brief QCOW image layer
+ *
+ * One qcow_image_t represents one file of a backing file chain. It knows how
+ * to translate an offset of the virtual disk to a location in its own file
+ * and how to allocate new clusters there. Clusters which are not allocated
+ * in an image are looked up in its backing image, which is opened
+ * recursively and may be either another qcow image or a raw file.
+ *
+ * Only the top image of a chain is ever modified, backing images are
+ * opened read-only.
+ */
+
+#include <byteorder.h>
+#include <errno.h>
+#include <inflate.h>
+#include <inttypes.h>
+#include <macros.h>
+#include <mem.h>
+#include <stdlib.h>
+#include <str.h>
+#include <str_error.h>
+#include <vfs/vfs.h>
+#include "qcow_image.h"
+
+/* Maximum length of a backing file name as accepted by QEMU */
+#define QCOW_MAX_BACKING_FILE_SIZE 1023
+
+static errno_t qcow_image_open_chain(const char *, bool, size_t, unsigned,
+    qcow_image_t **);
+static errno_t alloc_clusters(qcow_image_t *, uint64_t, uint64_t *);
+
+/** Read from the image file without touching any shared file position.
+ *
+ * @return EOK on success, EIO on an I/O error, EINVAL if the file ends
+ *         before @a len bytes could be read
+ */
+static errno_t read_at(qcow_image_t *image, uint64_t offset, void *buf,
+    size_t len)
+{
+	aoff64_t pos = offset;
+	size_t nread;
+
+	if (vfs_read(image->fd, &pos, buf, len, &nread) != EOK)
+		return EIO;
+
+	if (nread < len)
+		return EINVAL;
+
+	return EOK;
+}
+
+/** Write to the image file without touching any shared file position. */
+static errno_t write_at(qcow_image_t *image, uint64_t offset, const void *buf,
+    size_t len)
+{
+	aoff64_t pos = offset;
+	size_t nwritten;
+
+	if (vfs_write(image->fd, &pos, buf, len, &nwritten) != EOK ||
+	    nwritten < len)
+		return EIO;
+
+	return EOK;
+}
+
+/** Read a table of 64-bit entries from the qcow file.
+ *
+ * The entries are converted to host byte order.
+ *
+ * @param image   Image to read from
+ * @param offset  Offset of the table in the qcow file
+ * @param entries Number of entries in the table
+ * @param rtable  Place to store the newly allocated table
+ */
+static errno_t load_table(qcow_image_t *image, uint64_t offset, size_t entries,
+    uint64_t **rtable)
+{
+	uint64_t *table = calloc(max(entries, 1), sizeof(uint64_t));
+	if (table == NULL)
+		return ENOMEM;
+
+	if (entries > 0 &&
+	    read_at(image, offset, table, entries * sizeof(uint64_t)) != EOK) {
+		free(table);
+		return EIO;
+	}
+
+	for (size_t i = 0; i < entries; i++)
+		table[i] = uint64_t_be2host(table[i]);
+
+	*rtable = table;
+	return EOK;
+}
+
+/** Write a table of 64-bit entries to the qcow file in big endian. */
+static errno_t store_table(qcow_image_t *image, uint64_t offset,
+    const uint64_t *table, size_t entries)
+{
+	uint64_t chunk[64];
+
+	for (size_t i = 0; i < entries; i += ARRAY_SIZE(chunk)) {
+		size_t n = min(entries - i, ARRAY_SIZE(chunk));
+
+		for (size_t j = 0; j < n; j++)
+			chunk[j] = host2uint64_t_be(table[i + j]);
+
+		errno_t rc = write_at(image, offset + i * sizeof(uint64_t),
+		    chunk, n * sizeof(uint64_t));
+		if (rc != EOK)
+			return rc;
+	}
+
+	return EOK;
+}
+
+/** Parse header of a QCOW version 1 image. */
+static errno_t read_qcow_header(qcow_image_t *image)
+{
+	QCowHeader header;
+
+	if (read_at(image, 0, &header, sizeof(header)) != EOK) {
+		fprintf(stderr, "Reading file header failed!\n");
+		return EINVAL;
+	}
+
+	header.backing_file_offset =
+	    uint64_t_be2host(header.backing_file_offset);
+	header.backing_file_size = uint32_t_be2host(header.backing_file_size);
+	header.size = uint64_t_be2host(header.size);
+	header.crypt_method = uint32_t_be2host(header.crypt_method);
+	header.l1_table_offset = uint64_t_be2host(header.l1_table_offset);
+
+	if (header.crypt_method != QCOW_CRYPT_NONE) {
+		fprintf(stderr, "Encryption is not supported!\n");
+		return ENOTSUP;
+	}
+
+	if (header.cluster_bits < 9 || header.cluster_bits > 16 ||
+	    header.l2_bits < 6 || header.l2_bits > 16) {
+		fprintf(stderr, "Invalid cluster or l2 table size!\n");
+		return EINVAL;
+	}
+
+	image->cluster_bits = header.cluster_bits;
+	image->l2_bits = header.l2_bits;
+	image->size = header.size;
+	image->backing_file_offset = header.backing_file_offset;
+	image->backing_file_size = header.backing_file_size;
+	image->l1_table_offset = header.l1_table_offset;
+
+	/* Computing sizes in bytes */
+	image->cluster_size = 1 << image->cluster_bits;
+	image->l2_size = (1 << image->l2_bits) * sizeof(uint64_t);
+
+	/* Computing number of l1 table entries */
+	uint64_t l1_span = image->cluster_size * (1 << image->l2_bits);
+	image->l1_entries = (image->size + l1_span - 1) / l1_span;
+
+	return EOK;
+}
+
+/** Check that the QCOW2 refcount table covers the largest possible file.
+ *
+ * The refcount table is never grown. While the image is open, every cluster
+ * of the virtual disk and every l2 table is allocated at most once, and each
+ * refcount block allocated meanwhile accounts for itself as well.
+ */
+static bool refcount_table_covers(qcow_image_t *image)
+{
+	uint64_t clusters = (image->image_end + image->cluster_size - 1) >>
+	    image->cluster_bits;
+	clusters += (image->size + image->cluster_size - 1) >>
+	    image->cluster_bits;
+	clusters += image->l1_entries;
+
+	/* One refcount block covers itself and entries - 1 other clusters */
+	size_t other = image->refcount_block_entries - 1;
+	clusters += (clusters + other - 1) / other;
+
+	return clusters <= (uint64_t) image->refcount_table_entries *
+	    image->refcount_block_entries;
+}
+
+/** Parse header of a QCOW2 (version 2 or 3) image. */
+static errno_t read_qcow2_header(qcow_image_t *image)
+{
+	QCow2Header header;
+	size_t header_size;
+
+	memset(&header, 0, sizeof(header));
+	if (image->version == QCOW2_VERSION)
+		header_size = offsetof(QCow2Header, incompatible_features);
+	else
+		header_size = sizeof(header);
+
+	if (read_at(image, 0, &header, header_size) != EOK) {
+		fprintf(stderr, "Reading file header failed!\n");
+		return EINVAL;
+	}
+
+	header.backing_file_offset =
+	    uint64_t_be2host(header.backing_file_offset);
+	header.backing_file_size = uint32_t_be2host(header.backing_file_size);
+	header.cluster_bits = uint32_t_be2host(header.cluster_bits);
+	header.size = uint64_t_be2host(header.size);
+	header.crypt_method = uint32_t_be2host(header.crypt_method);
+	header.l1_size = uint32_t_be2host(header.l1_size);
+	header.l1_table_offset = uint64_t_be2host(header.l1_table_offset);
+	header.refcount_table_offset =
+	    uint64_t_be2host(header.refcount_table_offset);
+	header.refcount_table_clusters =
+	    uint32_t_be2host(header.refcount_table_clusters);
+	header.nb_snapshots = uint32_t_be2host(header.nb_snapshots);
+	header.incompatible_features =
+	    uint64_t_be2host(header.incompatible_features);
+	header.refcount_order = uint32_t_be2host(header.refcount_order);
+
+	if (image->version == QCOW2_VERSION)
+		header.refcount_order = QCOW2_REFCOUNT_ORDER;
+
+	if (header.crypt_method != QCOW_CRYPT_NONE) {
+		fprintf(stderr, "Encryption is not supported!\n");
+		return ENOTSUP;
+	}
+
+	if (header.cluster_bits < 9 || header.cluster_bits > 21) {
+		fprintf(stderr, "Invalid cluster size!\n");
+		return EINVAL;
+	}
+
+	if ((header.incompatible_features & ~QCOW3_INCOMPAT_DIRTY) != 0) {
+		fprintf(stderr, "Unsupported incompatible features 0x%" PRIx64
+		    "!\n", header.incompatible_features);
+		return ENOTSUP;
+	}
+
+	/* Refcounts are needed only for writing, so restrict just that */
+	if (!image->read_only &&
+	    (header.incompatible_features & QCOW3_INCOMPAT_DIRTY)) {
+		fprintf(stderr, "Image was not closed cleanly, refcounts may "
+		    "be wrong. Opening read-only.\n");
+		image->read_only = true;
+	}
+
+	if (!image->read_only &&
+	    header.refcount_order != QCOW2_REFCOUNT_ORDER) {
+		fprintf(stderr, "Refcount width of %u bits is not supported "
+		    "for writing. Opening read-only.\n",
+		    1U << header.refcount_order);
+		image->read_only = true;
+	}
+
+	if (!image->read_only && header.nb_snapshots != 0) {
+		fprintf(stderr, "Image has internal snapshots. "
+		    "Opening read-only.\n");
+		image->read_only = true;
+	}
+
+	image->cluster_bits = header.cluster_bits;
+	image->l2_bits = header.cluster_bits - 3;
+	image->size = header.size;
+	image->backing_file_offset = header.backing_file_offset;
+	image->backing_file_size = header.backing_file_size;
+	image->l1_table_offset = header.l1_table_offset;
+	image->l1_entries = header.l1_size;
+
+	/* In QCOW2 both an l2 table and a refcount block fill one cluster */
+	image->cluster_size = 1 << image->cluster_bits;
+	image->l2_size = image->cluster_size;
+
+	image->refcount_table_offset = header.refcount_table_offset;
+	image->refcount_table_entries = header.refcount_table_clusters *
+	    image->cluster_size / sizeof(uint64_t);
+	image->refcount_block_entries = image->cluster_size / sizeof(uint16_t);
+
+	if (!image->read_only && !refcount_table_covers(image)) {
+		fprintf(stderr, "Refcount table is too small for the image to "
+		    "grow. Opening read-only.\n");
+		image->read_only = true;
+	}
+
+	return EOK;
+}
+
+/** Read the file header and fill in the image geometry.
+ *
+ * @param image     Image to read the header of
+ * @param allow_raw Treat a file without the QCOW magic as a raw image
+ *                  instead of failing
+ */
+static errno_t read_header(qcow_image_t *image, bool allow_raw)
+{
+	uint32_t magic_version[2];
+
+	if (read_at(image, 0, magic_version, sizeof(magic_version)) != EOK ||
+	    uint32_t_be2host(magic_version[0]) != QCOW_MAGIC) {
+		if (allow_raw) {
+			/* The whole file is the disk */
+			image->raw = true;
+			image->size = image->image_end;
+			return EOK;
+		}
+
+		fprintf(stderr, "File is not in QCOW format!\n");
+		return ENOTSUP;
+	}
+
+	image->version = uint32_t_be2host(magic_version[1]);
+
+	errno_t rc;
+	switch (image->version) {
+	case QCOW_VERSION:
+		rc = read_qcow_header(image);
+		break;
+	case QCOW2_VERSION:
+	case QCOW3_VERSION:
+		rc = read_qcow2_header(image);
+		break;
+	default:
+		fprintf(stderr, "Version QCOW%" PRIu32 " is not supported!\n",
+		    image->version);
+		return ENOTSUP;
+	}
+
+	if (rc != EOK)
+		return rc;
+
+	image->l1_size = image->l1_entries * sizeof(uint64_t);
+	return EOK;
+}
+
+/** Open the backing image named in the header of @a image.
+ *
+ * A relative backing file name is relative to the directory of the image
+ * which refers to it.
+ *
+ * @param image      Image whose backing image is to be opened
+ * @param fname      File name @a image was opened with
+ * @param cache_size Maximum number of metadata tables kept in memory
+ * @param depth      Position of @a image in the chain
+ */
+static errno_t open_backing(qcow_image_t *image, const char *fname,
+    size_t cache_size, unsigned depth)
+{
+	char *name;
+	char *path;
+	errno_t rc;
+
+	if (image->backing_file_size > QCOW_MAX_BACKING_FILE_SIZE) {
+		fprintf(stderr, "Backing file name is too long!\n");
+		return EINVAL;
+	}
+
+	name = malloc(image->backing_file_size + 1);
+	if (name == NULL)
+		return ENOMEM;
+
+	if (read_at(image, image->backing_file_offset, name,
+	    image->backing_file_size) != EOK) {
+		fprintf(stderr, "Reading backing file name failed!\n");
+		free(name);
+		return EIO;
+	}
+
+	name[image->backing_file_size] = '\0';
+
+	const char *slash = str_rchr(fname, '/');
+	if (name[0] != '/' && slash != NULL) {
+		if (asprintf(&path, "%.*s%s", (int) (slash - fname + 1), fname,
+		    name) < 0) {
+			free(name);
+			return ENOMEM;
+		}
+
+		free(name);
+	} else {
+		path = name;
+	}
+
+	rc = qcow_image_open_chain(path, true, cache_size, depth + 1,
+	    &image->backing);
+	if (rc != EOK)
+		fprintf(stderr, "Opening backing file '%s' failed!\n", path);
+
+	free(path);
+	return rc;
+}
+
+/** Open one image of a chain together with all images below it.
+ *
+ * @param fname      Name of the image file
+ * @param read_only  Open the image for reading only
+ * @param cache_size Maximum number of metadata tables kept in memory
+ * @param depth      Position of the image in the chain, 0 for the top one
+ * @param rimage     Place to store the new image
+ */
+static errno_t qcow_image_open_chain(const char *fname, bool read_only,
+    size_t cache_size, unsigned depth, qcow_image_t **rimage)
+{
+	qcow_image_t *image;
+	errno_t rc;
+
+	if (depth >= QCOW_MAX_CHAIN_DEPTH) {
+		fprintf(stderr, "Backing file chain is too long!\n");
+		return ELIMIT;
+	}
+
+	image = calloc(1, sizeof(qcow_image_t));
+	if (image == NULL)
+		return ENOMEM;
+
+	image->read_only = read_only;
+	fibril_mutex_initialize(&image->zcache_lock);
+
+	/* Try to open file */
+	rc = vfs_lookup_open(fname, WALK_REGULAR,
+	    read_only ? MODE_READ : MODE_READ | MODE_WRITE, &image->fd);
+	if (rc != EOK) {
+		fprintf(stderr, "File opening failed!\n");
+		free(image);
+		return EINVAL;
+	}
+
+	vfs_stat_t stat;
+	rc = vfs_stat(image->fd, &stat);
+	if (rc != EOK) {
+		fprintf(stderr, "Getting file size failed!\n");
+		rc = EIO;
+		goto error;
+	}
+
+	/* New clusters and l2 tables are appended after the current end */
+	image->image_end = stat.size;
+
+	/* Only backing images may be raw */
+	rc = read_header(image, depth > 0);
+	if (rc != EOK)
+		goto error;
+
+	if (image->raw) {
+		*rimage = image;
+		return EOK;
+	}
+
+	rc = load_table(image, image->l1_table_offset, image->l1_entries,
+	    &image->l1_table);
+	if (rc != EOK) {
+		fprintf(stderr, "Reading l1 table failed!\n");
+		goto error;
+	}
+
+	if (image->version != QCOW_VERSION) {
+		rc = load_table(image, image->refcount_table_offset,
+		    image->refcount_table_entries, &image->refcount_table);
+		if (rc != EOK) {
+			fprintf(stderr, "Reading refcount table failed!\n");
+			goto error;
+		}
+	}
+
+	/* Compressed data of one cluster may span up to two clusters */
+	image->zbuf = malloc(2 * image->cluster_size);
+	if (image->zbuf == NULL) {
+		fprintf(stderr, "Allocating buffers failed!\n");
+		rc = ENOMEM;
+		goto error;
+	}
+
+	/* L2 tables and refcount blocks share one cache */
+	rc = qcow_cache_init(&image->cache, image->fd, cache_size,
+	    image->l2_size);
+	if (rc != EOK) {
+		fprintf(stderr, "Initializing metadata cache failed!\n");
+		goto error;
+	}
+
+	if (image->backing_file_offset != 0 && image->backing_file_size != 0) {
+		rc = open_backing(image, fname, cache_size, depth);
+		if (rc != EOK) {
+			qcow_cache_fini(&image->cache);
+			goto error;
+		}
+	}
+
+	*rimage = image;
+	return EOK;
+
+error:
+	free(image->zbuf);
+	free(image->refcount_table);
+	free(image->l1_table);
+	vfs_put(image->fd);
+	free(image);
+	return rc;
+}
+
+/** Open an image together with its chain of backing images.
+ *
+ * @param fname      Name of the image file
+ * @param read_only  Open the image for reading only
+ * @param cache_size Maximum number of metadata tables kept in memory for
+ *                   each image of the chain
+ * @param rimage     Place to store the top image
+ *
+ * @return EOK on success or an error code
+ */
+errno_t qcow_image_open(const char *fname, bool read_only, size_t cache_size,
+    qcow_image_t **rimage)
+{
+	return qcow_image_open_chain(fname, read_only, cache_size, 0, rimage);
+}
+
+/** Close an image and all its backing images.
+ *
+ * Modified metadata are not written back, call qcow_image_flush() first.
+ */
+void qcow_image_close(qcow_image_t *image)
+{
+	if (image->backing != NULL)
+		qcow_image_close(image->backing);
+
+	if (!image->raw) {
+		qcow_cache_fini(&image->cache);
+		for (size_t i = 0; i < QCOW_ZCACHE_SIZE; i++)
+			free(image->zcache[i].data);
+	}
+
+	free(image->zbuf);
+	free(image->refcount_table);
+	free(image->l1_table);
+	vfs_put(image->fd);
+	free(image);
+}
+
+/** Get offset of the l2 table from an l1 table entry. */
+static uint64_t l1_entry_offset(qcow_image_t *image, uint64_t entry)
+{
+	if (image->version == QCOW_VERSION)
+		return entry;
+
+	return entry & QCOW2_OFFSET_MASK;
+}
+
+/** Find the l2 table entry which maps the given offset.
+ *
+ * @param image    Image to look into
+ * @param offset   Offset from the start of the virtual disk
+ * @param allocate Allocate the l2 table if it does not exist yet
+ * @param rentry   Place to store the cached l2 table or NULL if there is none;
+ *                 the table is held and must be released with qcow_cache_put()
+ * @param rindex   Place to store index of the entry within the l2 table
+ */
+static errno_t get_l2_entry(qcow_image_t *image, uint64_t offset, bool allocate,
+    qcow_cache_entry_t **rentry, size_t *rindex)
+{
+	/* Compute l1 table index from the offset  */
+	uint64_t l1_table_index_bit_shift = image->cluster_bits +
+	    image->l2_bits;
+	uint64_t l1_table_index = (offset & 0x7fffffffffffffffULL) >>
+	    l1_table_index_bit_shift;
+
+	if (l1_table_index >= image->l1_entries) {
+		fprintf(stderr, "L1 table index %" PRIu64 " out of range!\n",
+		    l1_table_index);
+		return EINVAL;
+	}
+
+	/* Compute l2 table index from the offset  */
+	uint64_t l2_table_shift = (1 << image->l2_bits) - 1;
+	*rindex = (offset >> image->cluster_bits) & l2_table_shift;
+
+	/* Reading l2 reference from the in-memory l1 table */
+	uint64_t l1_entry = image->l1_table[l1_table_index];
+	uint64_t l2_table_reference = l1_entry_offset(image, l1_entry);
+	errno_t rc;
+
+	if (l2_table_reference == QCOW_UNALLOCATED_REFERENCE) {
+		if (!allocate) {
+			*rentry = NULL;
+			return EOK;
+		}
+
+		/* Append a new empty l2 table, it reaches the file on flush */
+		rc = alloc_clusters(image, image->l2_size, &l2_table_reference);
+		if (rc != EOK)
+			return rc;
+
+		rc = qcow_cache_get_new(&image->cache, l2_table_reference,
+		    QCOW_TABLE_L2, rentry);
+		if (rc != EOK) {
+			fprintf(stderr, "Allocating l2 table failed!\n");
+			return rc;
+		}
+
+		if (image->version != QCOW_VERSION)
+			l2_table_reference |= QCOW2_OFLAG_COPIED;
+
+		image->l1_table[l1_table_index] = l2_table_reference;
+		image->l1_dirty = true;
+		return EOK;
+	}
+
+	if (allocate && image->version != QCOW_VERSION &&
+	    (l1_entry & QCOW2_OFLAG_COPIED) == 0) {
+		fprintf(stderr, "Writing to a shared l2 table is not "
+		    "supported!\n");
+		return ENOTSUP;
+	}
+
+	/* Fetching the l2 table through the cache */
+	rc = qcow_cache_get(&image->cache, l2_table_reference, QCOW_TABLE_L2,
+	    rentry);
+	if (rc != EOK) {
+		fprintf(stderr, "Reading l2 table failed!\n");
+		return rc;
+	}
+
+	return EOK;
+}
+
+/** Decode an l2 table entry.
+ *
+ * @param image    Image the entry belongs to
+ * @param entry    L2 table entry
+ * @param rcluster Place to store offset of the cluster in the qcow file,
+ *                 or the whole entry if the cluster is compressed
+ *
+ * @return Kind of the cluster
+ */
+static qcow_cluster_type_t decode_l2_entry(qcow_image_t *image, uint64_t entry,
+    uint64_t *rcluster)
+{
+	if (image->version == QCOW_VERSION) {
+		*rcluster = entry;
+		if ((entry & QCOW_OFLAG_COMPRESSED) != 0)
+			return QCOW_CLUSTER_COMPRESSED;
+	} else if ((entry & QCOW2_OFLAG_COMPRESSED) != 0) {
+		*rcluster = entry;
+		return QCOW_CLUSTER_COMPRESSED;
+	} else if ((entry & QCOW2_OFLAG_ZERO) != 0) {
+		/* Zero clusters hide the backing file as well */
+		*rcluster = QCOW_UNALLOCATED_REFERENCE;
+		return QCOW_CLUSTER_ZERO;
+	} else {
+		*rcluster = entry & QCOW2_OFFSET_MASK;
+	}
+
+	if (*rcluster == QCOW_UNALLOCATED_REFERENCE)
+		return QCOW_CLUSTER_UNALLOCATED;
+
+	return QCOW_CLUSTER_NORMAL;
+}
+
+/** Decode the l2 table entry of a compressed cluster.
+ *
+ * @param image   Image the entry belongs to
+ * @param entry   L2 table entry
+ * @param roffset Place to store offset of the compressed data in the qcow file
+ * @param rsize   Place to store the upper bound of the compressed data size
+ */
+static void decode_compressed(qcow_image_t *image, uint64_t entry,
+    uint64_t *roffset, size_t *rsize)
+{
+	if (image->version == QCOW_VERSION) {
+		unsigned size_shift = 63 - image->cluster_bits;
+
+		*roffset = entry & ((1ULL << size_shift) - 1);
+		*rsize = (entry >> size_shift) & (image->cluster_size - 1);
+		return;
+	}
+
+	/* QCOW2 stores the size as a number of 512-byte sectors minus one */
+	unsigned size_shift = 62 - (image->cluster_bits - 8);
+	uint64_t sectors = ((entry >> size_shift) &
+	    ((1ULL << (image->cluster_bits - 8)) - 1)) + 1;
+
+	*roffset = entry & ((1ULL << size_shift) - 1);
+	*rsize = sectors * 512 - (*roffset & 511);
+}
+
+/** Find where a single image keeps the data at the given offset.
+ *
+ * @param image   Image to look into
+ * @param pos     Offset from the start of the virtual disk
+ * @param mapping Place to store the location of the data; the offset of
+ *                a normal cluster already includes the position of @a pos
+ *                within the cluster
+ */
+static errno_t qcow_image_lookup(qcow_image_t *image, uint64_t pos,
+    qcow_mapping_t *mapping)
+{
+	qcow_cache_entry_t *l2_entry;
+	size_t l2_table_index;
+	uint64_t cluster_reference;
+
+	mapping->image = image;
+	mapping->offset = QCOW_UNALLOCATED_REFERENCE;
+
+	/* A backing file may be shorter than the images above it */
+	if (pos >= image->size) {
+		mapping->type = QCOW_CLUSTER_ZERO;
+		return EOK;
+	}
+
+	if (image->raw) {
+		mapping->type = QCOW_CLUSTER_NORMAL;
+		mapping->offset = pos;
+		return EOK;
+	}
+
+	errno_t rc = get_l2_entry(image, pos, false, &l2_entry,
+	    &l2_table_index);
+	if (rc != EOK)
+		return rc;
+
+	if (l2_entry == NULL) {
+		mapping->type = QCOW_CLUSTER_UNALLOCATED;
+		return EOK;
+	}
+
+	mapping->type = decode_l2_entry(image, l2_entry->table[l2_table_index],
+	    &cluster_reference);
+	qcow_cache_put(&image->cache, l2_entry);
+
+	if (mapping->type == QCOW_CLUSTER_COMPRESSED)
+		mapping->offset = cluster_reference;
+	else if (mapping->type == QCOW_CLUSTER_NORMAL)
+		mapping->offset = cluster_reference +
+		    (pos & (image->cluster_size - 1));
+
+	return EOK;
+}
+
+/** Find the image of a chain which holds the data at the given offset.
+ *
+ * Unallocated clusters are looked up in the backing images. A cluster
+ * which is not allocated anywhere in the chain reads as zeroes.
+ *
+ * @param image   Top image of the chain
+ * @param pos     Offset from the start of the virtual disk
+ * @param mapping Place to store the location of the data
+ *
+ * @return EOK on success or an error code
+ */
+errno_t qcow_image_resolve(qcow_image_t *image, uint64_t pos,
+    qcow_mapping_t *mapping)
+{
+	while (true) {
+		errno_t rc = qcow_image_lookup(image, pos, mapping);
+		if (rc != EOK)
+			return rc;
+
+		if (mapping->type != QCOW_CLUSTER_UNALLOCATED)
+			return EOK;
+
+		if (image->backing == NULL) {
+			mapping->type = QCOW_CLUSTER_ZERO;
+			return EOK;
+		}
+
+		image = image->backing;
+	}
+}
+
+/** Find the location the data at the given offset can be overwritten at.
+ *
+ * @param image   Image to be written
+ * @param pos     Offset from the start of the virtual disk
+ * @param roffset Place to store offset of the data in the qcow file or
+ *                QCOW_UNALLOCATED_REFERENCE if the cluster has to be
+ *                allocated first using qcow_image_alloc(); that is if it
+ *                does not exist yet, if it is compressed or if it is shared
+ *                (its QCOW2 refcount is above one)
+ *
+ * @return EOK on success or an error code
+ */
+errno_t qcow_image_lookup_write(qcow_image_t *image, uint64_t pos,
+    uint64_t *roffset)
+{
+	qcow_cache_entry_t *l2_entry;
+	size_t l2_table_index;
+	uint64_t cluster_reference;
+
+	*roffset = QCOW_UNALLOCATED_REFERENCE;
+
+	errno_t rc = get_l2_entry(image, pos, false, &l2_entry,
+	    &l2_table_index);
+	if (rc != EOK || l2_entry == NULL)
+		return rc;
+
+	uint64_t entry = l2_entry->table[l2_table_index];
+	qcow_cache_put(&image->cache, l2_entry);
+
+	if (decode_l2_entry(image, entry, &cluster_reference) !=
+	    QCOW_CLUSTER_NORMAL)
+		return EOK;
+
+	if (image->version != QCOW_VERSION && (entry & QCOW2_OFLAG_COPIED) == 0)
+		return EOK;
+
+	*roffset = cluster_reference + (pos & (image->cluster_size - 1));
+	return EOK;
+}
+
+/** Reserve space at the end of the qcow file.
+ *
+ * @param image Image to reserve the space in
+ * @param size  Number of bytes to reserve
+ * @return Cluster-aligned offset of the reserved space
+ */
+static uint64_t reserve_clusters(qcow_image_t *image, uint64_t size)
+{
+	uint64_t offset = (image->image_end + image->cluster_size - 1) &
+	    ~(image->cluster_size - 1);
+
+	image->image_end = offset + size;
+	return offset;
+}
+
+/** Add @a delta to the QCOW2 refcount of the cluster at @a offset.
+ *
+ * A missing refcount block is allocated at the end of the file; it
+ * accounts for its own cluster as well. The refcount table itself is
+ * never grown, writable images are checked to have it large enough by
+ * refcount_table_covers() at open.
+ */
+static errno_t update_refcount(qcow_image_t *image, uint64_t offset, int delta)
+{
+	uint64_t cluster_index = offset >> image->cluster_bits;
+	uint64_t refcount_table_index = cluster_index /
+	    image->refcount_block_entries;
+	size_t refcount_block_index = cluster_index %
+	    image->refcount_block_entries;
+	qcow_cache_entry_t *refcount_block;
+	errno_t rc;
+
+	if (refcount_table_index >= image->refcount_table_entries) {
+		fprintf(stderr, "Refcount table is full!\n");
+		return ENOSPC;
+	}
+
+	uint64_t refcount_block_offset =
+	    image->refcount_table[refcount_table_index] & QCOW2_OFFSET_MASK;
+
+	if (refcount_block_offset == QCOW_UNALLOCATED_REFERENCE) {
+		refcount_block_offset = reserve_clusters(image,
+		    image->cluster_size);
+		rc = qcow_cache_get_new(&image->cache, refcount_block_offset,
+		    QCOW_TABLE_REFCOUNT, &refcount_block);
+		if (rc != EOK)
+			return rc;
+
+		qcow_cache_put(&image->cache, refcount_block);
+
+		image->refcount_table[refcount_table_index] =
+		    refcount_block_offset;
+		image->refcount_table_dirty = true;
+
+		rc = update_refcount(image, refcount_block_offset, 1);
+		if (rc != EOK)
+			return rc;
+	}
+
+	rc = qcow_cache_get(&image->cache, refcount_block_offset,
+	    QCOW_TABLE_REFCOUNT, &refcount_block);
+	if (rc != EOK) {
+		fprintf(stderr, "Reading refcount block failed!\n");
+		return rc;
+	}
+
+	int refcount = refcount_block->refcounts[refcount_block_index] + delta;
+	if (refcount < 0 || refcount > QCOW2_MAX_REFCOUNT) {
+		fprintf(stderr, "Refcount of cluster %" PRIu64 " out of "
+		    "range!\n", cluster_index);
+		qcow_cache_put(&image->cache, refcount_block);
+		return EOVERFLOW;
+	}
+
+	refcount_block->refcounts[refcount_block_index] = refcount;
+	qcow_cache_set_dirty(&image->cache, refcount_block);
+	qcow_cache_put(&image->cache, refcount_block);
+	return EOK;
+}
+
+/** Drop one QCOW2 reference to the clusters holding the given data.
+ *
+ * @param image      Image the clusters belong to
+ * @param offset     Offset of an uncompressed cluster or the l2 table entry
+ *                   of a compressed one
+ * @param compressed Whether the cluster is compressed
+ */
+static errno_t release_cluster(qcow_image_t *image, uint64_t offset,
+    bool compressed)
+{
+	if (!compressed)
+		return update_refcount(image, offset, -1);
+
+	/* Compressed data hold a reference to every cluster they touch */
+	uint64_t data_offset;
+	size_t data_size;
+	decode_compressed(image, offset, &data_offset, &data_size);
+
+	uint64_t cluster_mask = image->cluster_size - 1;
+	uint64_t first = data_offset & ~cluster_mask;
+	uint64_t last = (data_offset + data_size - 1) & ~cluster_mask;
+
+	for (uint64_t c = first; c <= last; c += image->cluster_size) {
+		errno_t rc = update_refcount(image, c, -1);
+		if (rc != EOK)
+			return rc;
+	}
+
+	return EOK;
+}
+
+/** Allocate clusters at the end of the qcow file.
+ *
+ * @param image   Image to allocate the clusters in
+ * @param size    Number of bytes to allocate
+ * @param roffset Place to store cluster-aligned offset of the allocated space
+ */
+static errno_t alloc_clusters(qcow_image_t *image, uint64_t size,
+    uint64_t *roffset)
+{
+	uint64_t offset = reserve_clusters(image, size);
+
+	if (image->version != QCOW_VERSION) {
+		for (uint64_t c = 0; c < size; c += image->cluster_size) {
+			errno_t rc = update_refcount(image, offset + c, 1);
+			if (rc != EOK)
+				return rc;
+		}
+	}
+
+	*roffset = offset;
+	return EOK;
+}
+
+/** Allocate a new cluster for the data at the given offset.
+ *
+ * The l2 table entry is pointed at the new cluster and the reference to
+ * a shared or compressed cluster it replaces is dropped. The contents of
+ * the new cluster are up to the caller.
+ *
+ * @param image    Image to be written
+ * @param pos      Offset from the start of the virtual disk
+ * @param rcluster Place to store offset of the new cluster in the qcow file
+ *
+ * @return EOK on success or an error code
+ */
+errno_t qcow_image_alloc(qcow_image_t *image, uint64_t pos, uint64_t *rcluster)
+{
+	qcow_cache_entry_t *l2_entry;
+	size_t l2_table_index;
+	uint64_t old;
+	uint64_t cluster_reference;
+
+	errno_t rc = get_l2_entry(image, pos, true, &l2_entry, &l2_table_index);
+	if (rc != EOK)
+		return rc;
+
+	qcow_cluster_type_t type = decode_l2_entry(image,
+	    l2_entry->table[l2_table_index], &old);
+
+	rc = alloc_clusters(image, image->cluster_size, &cluster_reference);
+	if (rc != EOK)
+		goto out;
+
+	if (image->version != QCOW_VERSION &&
+	    (type == QCOW_CLUSTER_NORMAL || type == QCOW_CLUSTER_COMPRESSED)) {
+		/* Copy on write, drop our reference to the old cluster */
+		rc = release_cluster(image, old,
+		    type == QCOW_CLUSTER_COMPRESSED);
+		if (rc != EOK)
+			goto out;
+	}
+
+	if (image->version != QCOW_VERSION)
+		l2_entry->table[l2_table_index] = cluster_reference |
+		    QCOW2_OFLAG_COPIED;
+	else
+		l2_entry->table[l2_table_index] = cluster_reference;
+
+	qcow_cache_set_dirty(&image->cache, l2_entry);
+	*rcluster = cluster_reference;
+
+out:
+	qcow_cache_put(&image->cache, l2_entry);
+	return rc;
+}
+
+/** Read data which are contiguous in the image file.
+ *
+ * @param image  Image to read from
+ * @param offset Offset of the data in the image file
+ * @param buf    Destination buffer
+ * @param len    Number of bytes to read
+ */
+errno_t qcow_image_read_data(qcow_image_t *image, uint64_t offset, void *buf,
+    size_t len)
+{
+	return read_at(image, offset, buf, len);
+}
+
+/** Read part of a compressed cluster.
+ *
+ * Clusters are decompressed into a small LRU cache, so that reading
+ * a compressed cluster block by block inflates it only once. Fibrils
+ * reading compressed clusters of one image take turns.
+ *
+ * @param image Image to read from
+ * @param entry L2 table entry of the cluster
+ * @param start Offset of the data within the cluster
+ * @param buf   Destination buffer
+ * @param len   Number of bytes to read
+ */
+errno_t qcow_image_read_compressed(qcow_image_t *image, uint64_t entry,
+    size_t start, void *buf, size_t len)
+{
+	qcow_zcluster_t *zcluster = NULL;
+	uint64_t data_offset;
+	size_t data_size;
+	errno_t rc = EOK;
+
+	decode_compressed(image, entry, &data_offset, &data_size);
+
+	fibril_mutex_lock(&image->zcache_lock);
+
+	for (size_t i = 0; i < QCOW_ZCACHE_SIZE; i++) {
+		if (image->zcache[i].offset == data_offset) {
+			zcluster = &image->zcache[i];
+			break;
+		}
+	}
+
+	if (zcluster != NULL) {
+		image->zcache_stats.hits++;
+	} else {
+		image->zcache_stats.misses++;
+
+		/* Pick an unused or the least recently used entry */
+		zcluster = &image->zcache[0];
+		for (size_t i = 1; i < QCOW_ZCACHE_SIZE; i++) {
+			if (image->zcache[i].last_use < zcluster->last_use)
+				zcluster = &image->zcache[i];
+		}
+
+		if (zcluster->data == NULL) {
+			zcluster->data = malloc(image->cluster_size);
+			if (zcluster->data == NULL) {
+				rc = ENOMEM;
+				goto out;
+			}
+		} else if (zcluster->offset != QCOW_UNALLOCATED_REFERENCE) {
+			image->zcache_stats.evictions++;
+		}
+
+		zcluster->offset = QCOW_UNALLOCATED_REFERENCE;
+
+		/* The size is an upper bound, the data may end with the file */
+		aoff64_t rpos = data_offset;
+		size_t n_rd;
+		if (vfs_read(image->fd, &rpos, image->zbuf, data_size,
+		    &n_rd) != EOK) {
+			rc = EIO;
+			goto out;
+		}
+
+		memset(zcluster->data, 0, image->cluster_size);
+		rc = inflate(image->zbuf, n_rd, zcluster->data,
+		    image->cluster_size);
+		if (rc != EOK) {
+			fprintf(stderr, "Decompressing cluster at %" PRIu64
+			    " failed: %s\n", data_offset, str_error(rc));
+			rc = EIO;
+			goto out;
+		}
+
+		zcluster->offset = data_offset;
+	}
+
+	zcluster->last_use = ++image->zcache_clock;
+	memcpy(buf, zcluster->data + start, len);
+
+out:
+	fibril_mutex_unlock(&image->zcache_lock);
+	return rc;
+}
+
+/** Write data which are contiguous in the image file. */
+errno_t qcow_image_write_data(qcow_image_t *image, uint64_t offset,
+    const void *buf, size_t len)
+{
+	return write_at(image, offset, buf, len);
+}
+
+/** Write cached metadata back to the qcow file.
+ *
+ * L2 tables and refcount blocks go first, so that the l1 and refcount
+ * tables never point to a table which has not reached the file yet.
+ */
+errno_t qcow_image_flush(qcow_image_t *image)
+{
+	errno_t rc = qcow_cache_flush(&image->cache);
+	if (rc != EOK)
+		return rc;
+
+	if (image->refcount_table_dirty) {
+		rc = store_table(image, image->refcount_table_offset,
+		    image->refcount_table, image->refcount_table_entries);
+		if (rc != EOK)
+			return rc;
+
+		image->refcount_table_dirty = false;
+	}
+
+	if (image->l1_dirty) {
+		rc = store_table(image, image->l1_table_offset, image->l1_table,
+		    image->l1_entries);
+		if (rc != EOK)
+			return rc;
+
+		image->l1_dirty = false;
+	}
+
+	if (vfs_sync(image->fd) != EOK)
+		return EIO;
+
+	return EOK;
+}
+
+/**
+ * @}
+ */
@@ -0,0 +1,219 @@
+/*
+ * Copyright (c) 2021 Erik Kučák
+ * Copyright (c) 2026 agent
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * - Redistributions of source code must retain the above copyright
+ *   notice, this list of conditions and the following disclaimer.
+ * - Redistributions in binary form must reproduce the above copyright
+ *   notice, this list of conditions and the following disclaimer in the
+ *   documentation and/or other materials provided with the distribution.
+ * - The name of the author may not be used to endorse or promote products
+ *   derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+ * NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/** @addtogroup qcow_bd
+ * @{
+ */
+/** @file QCOW image layer.
+ */
+
+#ifndef __QCOW_IMAGE_H__
+#define __QCOW_IMAGE_H__
+
+#include <errno.h>
+#include <fibril_synch.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include "qcow_cache.h"
+
+#define QCOW_MAGIC (('Q' << 24) | ('F' << 16) | ('I' << 8) | 0xfb)
+#define QCOW_VERSION 1
+#define QCOW2_VERSION 2
+#define QCOW3_VERSION 3
+#define QCOW_CRYPT_NONE 0
+#define QCOW_OFLAG_COMPRESSED (1ULL << 63)
+#define QCOW_UNALLOCATED_REFERENCE 0
+
+/* QCOW2 l1 and l2 entry flags */
+#define QCOW2_OFLAG_COPIED (1ULL << 63)
+#define QCOW2_OFLAG_COMPRESSED (1ULL << 62)
+#define QCOW2_OFLAG_ZERO (1ULL << 0)
+#define QCOW2_OFFSET_MASK 0x00fffffffffffe00ULL
+
+/* QCOW2 refcounts are 16 bits wide unless a version 3 header says otherwise */
+#define QCOW2_REFCOUNT_ORDER 4
+#define QCOW2_MAX_REFCOUNT 0xffff
+
+/* QCOW3 incompatible feature bits */
+#define QCOW3_INCOMPAT_DIRTY (1ULL << 0)
+
+/* Number of decompressed clusters kept in memory */
+#define QCOW_ZCACHE_SIZE 4
+
+/* Maximum number of images in a backing file chain */
+#define QCOW_MAX_CHAIN_DEPTH 16
+
+typedef struct __attribute__ ((__packed__)) QCowHeader {
+	uint32_t magic;
+	uint32_t version;
+	uint64_t backing_file_offset;
+	uint32_t backing_file_size;
+	uint32_t mtime;
+	uint64_t size;
+	uint8_t cluster_bits;
+	uint8_t l2_bits;
+	uint16_t unused;
+	uint32_t crypt_method;
+	uint64_t l1_table_offset;
+} QCowHeader;
+
+typedef struct __attribute__ ((__packed__)) QCow2Header {
+	uint32_t magic;
+	uint32_t version;
+	uint64_t backing_file_offset;
+	uint32_t backing_file_size;
+	uint32_t cluster_bits;
+	uint64_t size;
+	uint32_t crypt_method;
+	uint32_t l1_size;
+	uint64_t l1_table_offset;
+	uint64_t refcount_table_offset;
+	uint32_t refcount_table_clusters;
+	uint32_t nb_snapshots;
+	uint64_t snapshots_offset;
+	/* Fields below are present only in version 3 */
+	uint64_t incompatible_features;
+	uint64_t compatible_features;
+	uint64_t autoclear_features;
+	uint32_t refcount_order;
+	uint32_t header_length;
+} QCow2Header;
+
+/** Where the data of a cluster are to be found. */
+typedef enum {
+	/** Cluster is not allocated in this image, look into the backing */
+	QCOW_CLUSTER_UNALLOCATED,
+	/** Cluster reads as zeroes */
+	QCOW_CLUSTER_ZERO,
+	/** Cluster is stored uncompressed */
+	QCOW_CLUSTER_NORMAL,
+	/** Cluster is stored compressed */
+	QCOW_CLUSTER_COMPRESSED
+} qcow_cluster_type_t;
+
+struct qcow_image;
+
+/** Location of the data at some offset of the virtual disk. */
+typedef struct {
+	/** Image which holds the data */
+	struct qcow_image *image;
+	/** Kind of the cluster */
+	qcow_cluster_type_t type;
+	/**
+	 * Offset of the data in the image file for QCOW_CLUSTER_NORMAL, l2
+	 * table entry for QCOW_CLUSTER_COMPRESSED, unused otherwise
+	 */
+	uint64_t offset;
+} qcow_mapping_t;
+
+/** Decompressed copy of a compressed cluster. */
+typedef struct {
+	/** Offset of the compressed data in the qcow file, 0 if unused */
+	uint64_t offset;
+	/** Value of qcow_image_t.zcache_clock at the last use */
+	uint64_t last_use;
+	/** Decompressed cluster */
+	uint8_t *data;
+} qcow_zcluster_t;
+
+/** One image of a backing file chain.
+ *
+ * Lookups may run concurrently. Changes of the l1, l2 and refcount tables
+ * must be serialized by the caller and must not run concurrently with
+ * lookups in the same image.
+ */
+typedef struct qcow_image {
+	/** File handle of the image, all I/O is positional */
+	int fd;
+	/** Image is a raw file rather than a qcow image */
+	bool raw;
+	/** QCOW format version of the image */
+	uint32_t version;
+	uint32_t cluster_bits;
+	uint32_t l2_bits;
+	uint64_t cluster_size;
+	/** Size of the virtual disk in bytes */
+	uint64_t size;
+	uint64_t l2_size;
+	uint64_t l1_size;
+	uint64_t l1_table_offset;
+	uint64_t backing_file_offset;
+	uint32_t backing_file_size;
+	/** L1 table in host byte order, loaded at startup */
+	uint64_t *l1_table;
+	/** Number of entries in l1_table */
+	size_t l1_entries;
+	/** L1 table was modified since the last flush */
+	bool l1_dirty;
+	/** QCOW2 refcount table in host byte order, loaded at startup */
+	uint64_t *refcount_table;
+	/** Number of entries in refcount_table */
+	size_t refcount_table_entries;
+	uint64_t refcount_table_offset;
+	/** Refcount table was modified since the last flush */
+	bool refcount_table_dirty;
+	/** Number of refcounts in one refcount block */
+	size_t refcount_block_entries;
+	/** Image cannot be safely modified, writes are refused */
+	bool read_only;
+	/** End of the qcow file, new clusters are allocated from here */
+	uint64_t image_end;
+	/** Cache of recently used l2 tables and refcount blocks */
+	qcow_cache_t cache;
+	/** Protects the decompressed cluster cache */
+	fibril_mutex_t zcache_lock;
+	/** Recently decompressed clusters */
+	qcow_zcluster_t zcache[QCOW_ZCACHE_SIZE];
+	/** Counter ordering zcache entries by their last use */
+	uint64_t zcache_clock;
+	/** Usage counters of the decompressed cluster cache */
+	qcow_cache_stats_t zcache_stats;
+	/** Buffer for compressed cluster data */
+	uint8_t *zbuf;
+	/** Backing image or NULL if there is none */
+	struct qcow_image *backing;
+} qcow_image_t;
+
+extern errno_t qcow_image_open(const char *, bool, size_t, qcow_image_t **);
+extern void qcow_image_close(qcow_image_t *);
+extern errno_t qcow_image_resolve(qcow_image_t *, uint64_t, qcow_mapping_t *);
+extern errno_t qcow_image_lookup_write(qcow_image_t *, uint64_t, uint64_t *);
+extern errno_t qcow_image_alloc(qcow_image_t *, uint64_t, uint64_t *);
+extern errno_t qcow_image_read_data(qcow_image_t *, uint64_t, void *, size_t);
+extern errno_t qcow_image_read_compressed(qcow_image_t *, uint64_t, size_t,
+    void *, size_t);
+extern errno_t qcow_image_write_data(qcow_image_t *, uint64_t, const void *,
+    size_t);
+extern errno_t qcow_image_flush(qcow_image_t *);
+
+#endif
+
+/** @}
+ */
@@ -0,0 +1,255 @@
+/*
+ * Copyright (c) 2026 agent
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * - Redistributions of source code must retain the above copyright
+ *   notice, this list of conditions and the following disclaimer.
+ * - Redistributions in binary form must reproduce the above copyright
+ *   notice, this list of conditions and the following disclaimer in the
+ *   documentation and/or other materials provided with the distribution.
+ * - The name of the author may not be used to endorse or promote products
+ *   derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+ * NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/** @addtogroup qcow_bd
+ * @{
+ */
+
+/**
+ * @file
+ * @brief Resolved cluster map of a backing file chain
+ *
+ * Reading a cluster which is not allocated in the top image means looking
+ * it up in every image down the chain until one has it. The map remembers
+ * the outcome of such lookups, so that a hot region of a deep chain costs
+ * a single hash table lookup instead of one l2 table lookup per layer.
+ *
+ * Backing images are never modified, so an entry only becomes stale when
+ * a cluster of the top image is allocated. The caller has to invalidate
+ * the affected range then.
+ *
+ * The map has a lock of its own. Callers have to make sure that a mapping
+ * which has just been resolved is not inserted after the cluster it
+ * refers to has been reallocated and invalidated.
+ */
+
+#include <adt/hash.h>
+#include <macros.h>
+#include <stdlib.h>
+#include "qcow_map.h"
+
+static size_t qcow_map_key_hash(const void *key)
+{
+	const uint64_t *granule = key;
+	return hash_mix(*granule);
+}
+
+static size_t qcow_map_hash(const ht_link_t *item)
+{
+	qcow_map_entry_t *entry = hash_table_get_inst(item, qcow_map_entry_t,
+	    hash_link);
+	return hash_mix(entry->granule);
+}
+
+static bool qcow_map_key_equal(const void *key, const ht_link_t *item)
+{
+	const uint64_t *granule = key;
+	qcow_map_entry_t *entry = hash_table_get_inst(item, qcow_map_entry_t,
+	    hash_link);
+	return entry->granule == *granule;
+}
+
+static hash_table_ops_t qcow_map_ops = {
+	.hash = qcow_map_hash,
+	.key_hash = qcow_map_key_hash,
+	.key_equal = qcow_map_key_equal,
+	.equal = NULL,
+	.remove_callback = NULL
+};
+
+/** Initialize resolved cluster map.
+ *
+ * @param map          Map to initialize
+ * @param capacity     Maximum number of granules remembered
+ * @param granule_bits Log2 of the granule size
+ *
+ * @return EOK on success, ENOMEM if out of memory
+ */
+errno_t qcow_map_init(qcow_map_t *map, size_t capacity, unsigned granule_bits)
+{
+	fibril_mutex_initialize(&map->lock);
+	map->granule_bits = granule_bits;
+	map->capacity = max(capacity, 1);
+	map->count = 0;
+	map->stats.hits = 0;
+	map->stats.misses = 0;
+	map->stats.evictions = 0;
+	map->stats.writebacks = 0;
+	list_initialize(&map->lru);
+
+	if (!hash_table_create(&map->hash, map->capacity, 0, &qcow_map_ops))
+		return ENOMEM;
+
+	return EOK;
+}
+
+/** Free all entries of the map. */
+void qcow_map_fini(qcow_map_t *map)
+{
+	while (!list_empty(&map->lru)) {
+		qcow_map_entry_t *entry = list_get_instance(
+		    list_first(&map->lru), qcow_map_entry_t, lru_link);
+
+		list_remove(&entry->lru_link);
+		hash_table_remove_item(&map->hash, &entry->hash_link);
+		free(entry);
+	}
+
+	map->count = 0;
+	hash_table_destroy(&map->hash);
+}
+
+/** Look up the location of a granule.
+ *
+ * @param map     Resolved cluster map
+ * @param pos     Granule-aligned offset from the start of the virtual disk
+ * @param mapping Place to store the location of the granule
+ *
+ * @return True if the granule was found
+ */
+bool qcow_map_find(qcow_map_t *map, uint64_t pos, qcow_mapping_t *mapping)
+{
+	uint64_t granule = pos >> map->granule_bits;
+
+	fibril_mutex_lock(&map->lock);
+
+	ht_link_t *hlink = hash_table_find(&map->hash, &granule);
+	if (hlink == NULL) {
+		map->stats.misses++;
+		fibril_mutex_unlock(&map->lock);
+		return false;
+	}
+
+	qcow_map_entry_t *entry = hash_table_get_inst(hlink, qcow_map_entry_t,
+	    hash_link);
+
+	/* Move the entry to the head of the LRU list */
+	list_remove(&entry->lru_link);
+	list_prepend(&entry->lru_link, &map->lru);
+
+	map->stats.hits++;
+	*mapping = entry->mapping;
+	fibril_mutex_unlock(&map->lock);
+	return true;
+}
+
+/** Remember the location of a granule.
+ *
+ * When the map is full, the least recently used entry is replaced.
+ *
+ * @param map     Resolved cluster map
+ * @param pos     Granule-aligned offset from the start of the virtual disk
+ * @param mapping Location of the granule
+ *
+ * @return EOK on success, ENOMEM if out of memory
+ */
+errno_t qcow_map_insert(qcow_map_t *map, uint64_t pos,
+    const qcow_mapping_t *mapping)
+{
+	uint64_t granule = pos >> map->granule_bits;
+	qcow_map_entry_t *entry;
+
+	fibril_mutex_lock(&map->lock);
+
+	/* Another fibril may have resolved the same granule meanwhile */
+	ht_link_t *hlink = hash_table_find(&map->hash, &granule);
+	if (hlink != NULL) {
+		entry = hash_table_get_inst(hlink, qcow_map_entry_t, hash_link);
+		entry->mapping = *mapping;
+		fibril_mutex_unlock(&map->lock);
+		return EOK;
+	}
+
+	if (map->count < map->capacity) {
+		entry = malloc(sizeof(qcow_map_entry_t));
+		if (entry == NULL) {
+			fibril_mutex_unlock(&map->lock);
+			return ENOMEM;
+		}
+
+		link_initialize(&entry->lru_link);
+		map->count++;
+	} else {
+		entry = list_get_instance(list_last(&map->lru),
+		    qcow_map_entry_t, lru_link);
+
+		list_remove(&entry->lru_link);
+		hash_table_remove_item(&map->hash, &entry->hash_link);
+		map->stats.evictions++;
+	}
+
+	entry->granule = granule;
+	entry->mapping = *mapping;
+	hash_table_insert(&map->hash, &entry->hash_link);
+	list_prepend(&entry->lru_link, &map->lru);
+
+	fibril_mutex_unlock(&map->lock);
+	return EOK;
+}
+
+/** Forget the locations of all granules within a range.
+ *
+ * @param map Resolved cluster map
+ * @param pos Granule-aligned offset from the start of the virtual disk
+ * @param len Length of the range in bytes
+ */
+void qcow_map_invalidate(qcow_map_t *map, uint64_t pos, uint64_t len)
+{
+	uint64_t first = pos >> map->granule_bits;
+	uint64_t last = (pos + len - 1) >> map->granule_bits;
+
+	fibril_mutex_lock(&map->lock);
+
+	for (uint64_t granule = first; granule <= last; granule++) {
+		ht_link_t *hlink = hash_table_find(&map->hash, &granule);
+		if (hlink == NULL)
+			continue;
+
+		qcow_map_entry_t *entry = hash_table_get_inst(hlink,
+		    qcow_map_entry_t, hash_link);
+
+		list_remove(&entry->lru_link);
+		hash_table_remove_item(&map->hash, &entry->hash_link);
+		free(entry);
+		map->count--;
+	}
+
+	fibril_mutex_unlock(&map->lock);
+}
+
+/** Get a snapshot of the map usage counters. */
+void qcow_map_get_stats(qcow_map_t *map, qcow_cache_stats_t *stats)
+{
+	fibril_mutex_lock(&map->lock);
+	*stats = map->stats;
+	fibril_mutex_unlock(&map->lock);
+}
+
+/**
+ * @}
+ */
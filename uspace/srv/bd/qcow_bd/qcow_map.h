@@ -0,0 +1,93 @@
+/*
+ * Copyright (c) 2026 agent
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * - Redistributions of source code must retain the above copyright
+ *   notice, this list of conditions and the following disclaimer.
+ * - Redistributions in binary form must reproduce the above copyright
+ *   notice, this list of conditions and the following disclaimer in the
+ *   documentation and/or other materials provided with the distribution.
+ * - The name of the author may not be used to endorse or promote products
+ *   derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+ * NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/** @addtogroup qcow_bd
+ * @{
+ */
+/** @file Resolved cluster map of a backing file chain.
+ */
+
+#ifndef __QCOW_MAP_H__
+#define __QCOW_MAP_H__
+
+#include <adt/hash_table.h>
+#include <adt/list.h>
+#include <errno.h>
+#include <fibril_synch.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include "qcow_cache.h"
+#include "qcow_image.h"
+
+/** Resolved location of one granule of the virtual disk. */
+typedef struct {
+	/** Link in qcow_map_t.hash */
+	ht_link_t hash_link;
+	/** Link in qcow_map_t.lru */
+	link_t lru_link;
+	/** Index of the granule */
+	uint64_t granule;
+	/** Location of the start of the granule */
+	qcow_mapping_t mapping;
+} qcow_map_entry_t;
+
+/** LRU map from virtual disk offsets to the image of a chain holding them.
+ *
+ * The disk is divided into granules of the smallest cluster size found in
+ * the chain, so that a granule always lies within a single cluster of every
+ * image.
+ */
+typedef struct {
+	/** Protects the whole map */
+	fibril_mutex_t lock;
+	/** Log2 of the granule size */
+	unsigned granule_bits;
+	/** Maximum number of entries */
+	size_t capacity;
+	/** Number of current entries */
+	size_t count;
+	/** Entries by granule */
+	hash_table_t hash;
+	/** Entries, most recently used first */
+	list_t lru;
+	/** Usage counters */
+	qcow_cache_stats_t stats;
+} qcow_map_t;
+
+extern errno_t qcow_map_init(qcow_map_t *, size_t, unsigned);
+extern void qcow_map_fini(qcow_map_t *);
+extern bool qcow_map_find(qcow_map_t *, uint64_t, qcow_mapping_t *);
+extern errno_t qcow_map_insert(qcow_map_t *, uint64_t, const qcow_mapping_t *);
+extern void qcow_map_invalidate(qcow_map_t *, uint64_t, uint64_t);
+extern void qcow_map_get_stats(qcow_map_t *, qcow_cache_stats_t *);
+
+#endif
+
+/** @}
+ */
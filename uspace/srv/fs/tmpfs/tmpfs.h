@@ -41,6 +41,14 @@
 #define TMPFS_NODE(node)	((node) ? (tmpfs_node_t *)(node)->data : NULL)
 #define FS_NODE(node)		((node) ? (node)->bp : NULL)
 
+/** Files are stored in chunks of 2^TMPFS_CHUNK_WIDTH bytes. */
+#define TMPFS_CHUNK_WIDTH	12
+#define TMPFS_CHUNK_SIZE	(1 << TMPFS_CHUNK_WIDTH)
+
+/** Each inner node of the data tree has 2^TMPFS_FANOUT_WIDTH slots. */
+#define TMPFS_FANOUT_WIDTH	9
+#define TMPFS_FANOUT		(1 << TMPFS_FANOUT_WIDTH)
+
 typedef enum {
 	TMPFS_NONE,
 	TMPFS_FILE,
@@ -52,8 +60,12 @@ struct tmpfs_node;
 
 typedef struct tmpfs_dentry {
 	link_t link;		/**< Linkage for the list of siblings. */
+	ht_link_t name_link;	/**< Dentries by name hash table link. */
+	ht_link_t pos_link;	/**< Dentries by position hash table link. */
+	struct tmpfs_node *parent;/**< Directory containing the dentry. */
 	struct tmpfs_node *node;/**< Back pointer to TMPFS node. */
 	char *name;		/**< Name of dentry. */
+	aoff64_t pos;		/**< Position of the dentry for readdir. */
 } tmpfs_dentry_t;
 
 typedef struct tmpfs_node {
@@ -64,8 +76,21 @@ typedef struct tmpfs_node {
 	tmpfs_dentry_type_t type;
 	unsigned lnkcnt;	/**< Link count. */
 	size_t size;		/**< File size if type is TMPFS_FILE. */
-	void *data;		/**< File content's if type is TMPFS_FILE. */
+	/**
+	 * Radix tree of the file's content chunks if type is TMPFS_FILE.
+	 * Missing chunks are holes which read as zeroes.
+	 */
+	void *data;
+	unsigned height;	/**< Number of inner levels of the data tree. */
 	list_t cs_list;		/**< Child's siblings list. */
+	/**
+	 * Position to be given to the next dentry linked into the directory.
+	 * Positions only grow, so the siblings list is ordered by them and
+	 * a readdir cursor stays valid no matter what is linked or unlinked.
+	 */
+	aoff64_t next_pos;
+	/** Dentry most recently returned by readdir, where to resume. */
+	tmpfs_dentry_t *readdir_hint;
 } tmpfs_node_t;
 
 extern vfs_out_ops_t tmpfs_ops;
@@ -73,6 +98,9 @@ extern libfs_ops_t tmpfs_libfs_ops;
 
 extern bool tmpfs_init(void);
 
+extern void *tmpfs_data_get(tmpfs_node_t *, aoff64_t, bool);
+extern void tmpfs_data_truncate(tmpfs_node_t *, aoff64_t);
+
 #endif
 
 /**
@@ -0,0 +1,196 @@
+/*
+ * Copyright (c) 2026 agent
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * - Redistributions of source code must retain the above copyright
+ *   notice, this list of conditions and the following disclaimer.
+ * - Redistributions in binary form must reproduce the above copyright
+ *   notice, this list of conditions and the following disclaimer in the
+ *   documentation and/or other materials provided with the distribution.
+ * - The name of the author may not be used to endorse or promote products
+ *   derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+ * NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/** @addtogroup tmpfs
+ * @{
+ */
+
+/**
+ * @file	tmpfs_data.c
+ * @brief	Storage of TMPFS file contents.
+ *
+ * The contents of a file are kept in fixed-size chunks hanging off a radix
+ * tree, much like pages hang off a page table. A tree of height zero is just
+ * a single chunk. Whenever the file grows beyond what the tree can address,
+ * a new root is put on top of the old one. Chunks and inner nodes are only
+ * allocated when written to, so holes in sparse files cost no memory.
+ *
+ * All bytes of an allocated chunk which lie beyond the end of the file are
+ * kept zero, so that growing the file never needs to clear anything.
+ */
+
+#include "tmpfs.h"
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <mem.h>
+
+/** Bit width of the range of offsets covered by a subtree. */
+static unsigned subtree_width(unsigned height)
+{
+	return TMPFS_CHUNK_WIDTH + height * TMPFS_FANOUT_WIDTH;
+}
+
+/** Check whether a tree of the given height can address the offset. */
+static bool tree_covers(unsigned height, aoff64_t pos)
+{
+	unsigned width = subtree_width(height);
+
+	return width >= sizeof(aoff64_t) * 8 || (pos >> width) == 0;
+}
+
+/** Get the slot of an inner node at the given level leading to the offset. */
+static size_t slot_index(unsigned level, aoff64_t pos)
+{
+	return (pos >> subtree_width(level)) & (TMPFS_FANOUT - 1);
+}
+
+static void subtree_free(void *subtree, unsigned height)
+{
+	if (height > 0) {
+		void **slots = subtree;
+
+		for (size_t i = 0; i < TMPFS_FANOUT; i++) {
+			if (slots[i] != NULL)
+				subtree_free(slots[i], height - 1);
+		}
+	}
+
+	free(subtree);
+}
+
+/** Drop everything a subtree holds at or beyond the given size.
+ *
+ * @param subtree Subtree to truncate
+ * @param height  Height of the subtree
+ * @param base    File offset of the first byte covered by the subtree
+ * @param size    New size of the file
+ *
+ * @return The subtree or NULL if it has been freed.
+ */
+static void *subtree_truncate(void *subtree, unsigned height, aoff64_t base,
+    aoff64_t size)
+{
+	if (base >= size) {
+		subtree_free(subtree, height);
+		return NULL;
+	}
+
+	if (height == 0) {
+		size_t end = size - base;
+
+		if (end < TMPFS_CHUNK_SIZE)
+			memset(subtree + end, 0, TMPFS_CHUNK_SIZE - end);
+		return subtree;
+	}
+
+	void **slots = subtree;
+	unsigned width = subtree_width(height - 1);
+
+	/* Children wholly below the new size are not affected. */
+	for (size_t i = (size - base) >> width; i < TMPFS_FANOUT; i++) {
+		if (slots[i] != NULL) {
+			slots[i] = subtree_truncate(slots[i], height - 1,
+			    base + ((aoff64_t) i << width), size);
+		}
+	}
+
+	return subtree;
+}
+
+/** Find the chunk holding a file offset.
+ *
+ * @param nodep File node
+ * @param pos   Offset within the file
+ * @param alloc Allocate the chunk if it does not exist yet
+ *
+ * @return Start of the chunk which contains @a pos or NULL if the offset
+ *         lies in a hole and @a alloc is false, or if there is not enough
+ *         memory.
+ */
+void *tmpfs_data_get(tmpfs_node_t *nodep, aoff64_t pos, bool alloc)
+{
+	if (!tree_covers(nodep->height, pos)) {
+		if (!alloc)
+			return NULL;
+
+		/* Grow the tree by putting new roots on top of it. */
+		while (!tree_covers(nodep->height, pos)) {
+			if (nodep->data != NULL) {
+				void **slots = calloc(TMPFS_FANOUT,
+				    sizeof(void *));
+				if (!slots)
+					return NULL;
+				slots[0] = nodep->data;
+				nodep->data = slots;
+			}
+			nodep->height++;
+		}
+	}
+
+	void **slot = &nodep->data;
+
+	for (unsigned level = nodep->height; level > 0; level--) {
+		if (*slot == NULL) {
+			if (!alloc)
+				return NULL;
+			*slot = calloc(TMPFS_FANOUT, sizeof(void *));
+			if (*slot == NULL)
+				return NULL;
+		}
+
+		slot = &((void **) *slot)[slot_index(level - 1, pos)];
+	}
+
+	if (*slot == NULL && alloc)
+		*slot = calloc(1, TMPFS_CHUNK_SIZE);
+
+	return *slot;
+}
+
+/** Release the contents of a file beyond a given size.
+ *
+ * Truncating to zero frees all memory held by the contents of the file.
+ *
+ * @param nodep File node
+ * @param size  New size of the file
+ */
+void tmpfs_data_truncate(tmpfs_node_t *nodep, aoff64_t size)
+{
+	if (nodep->data != NULL) {
+		nodep->data = subtree_truncate(nodep->data, nodep->height, 0,
+		    size);
+	}
+
+	if (nodep->data == NULL)
+		nodep->height = 0;
+}
+
+/**
+ * @}
+ */
@@ -58,6 +58,9 @@
 /** Global counter for assigning node indices. Shared by all instances. */
 fs_index_t tmpfs_next_index = 1;
 
+/** Contents of holes in sparse files. */
+static const uint8_t tmpfs_zero_chunk[TMPFS_CHUNK_SIZE];
+
 /*
  * Implementation of the libfs interface.
  */
@@ -166,6 +169,14 @@ static bool nodes_key_equal(const void *key_arg, const ht_link_t *item)
 	return key->service_id == node->service_id && key->index == node->index;
 }
 
+/** Hash table of all TMPFS dentries by their directory and name. */
+static hash_table_t dentries_by_name;
+
+/** Hash table of all TMPFS dentries by their directory and position. */
+static hash_table_t dentries_by_pos;
+
+static void tmpfs_dentry_remove(tmpfs_dentry_t *);
+
 static void nodes_remove_callback(ht_link_t *item)
 {
 	tmpfs_node_t *nodep = hash_table_get_inst(item, tmpfs_node_t, nh_link);
@@ -175,13 +186,12 @@ static void nodes_remove_callback(ht_link_t *item)
 		    list_first(&nodep->cs_list), tmpfs_dentry_t, link);
 
 		assert(nodep->type == TMPFS_DIRECTORY);
-		list_remove(&dentryp->link);
-		free(dentryp);
+		tmpfs_dentry_remove(dentryp);
 	}
 
 	if (nodep->data) {
 		assert(nodep->type == TMPFS_FILE);
-		free(nodep->data);
+		tmpfs_data_truncate(nodep, 0);
 	}
 	free(nodep->bp);
 	free(nodep);
@@ -196,6 +206,144 @@ hash_table_ops_t nodes_ops = {
 	.remove_callback = nodes_remove_callback
 };
 
+/*
+ * Implementation of hash table interface for the dentries hash tables.
+ */
+
+typedef struct {
+	tmpfs_node_t *parent;
+	const char *name;
+} dentry_name_key_t;
+
+typedef struct {
+	tmpfs_node_t *parent;
+	aoff64_t pos;
+} dentry_pos_key_t;
+
+static size_t dentry_name_hash(tmpfs_node_t *parent, const char *name)
+{
+	size_t hash = (size_t) parent;
+
+	while (*name != '\0')
+		hash = hash_combine(hash, (uint8_t) *name++);
+
+	return hash;
+}
+
+static size_t dentries_name_key_hash(const void *k)
+{
+	const dentry_name_key_t *key = k;
+	return dentry_name_hash(key->parent, key->name);
+}
+
+static size_t dentries_name_hash(const ht_link_t *item)
+{
+	tmpfs_dentry_t *dentryp = hash_table_get_inst(item, tmpfs_dentry_t,
+	    name_link);
+	return dentry_name_hash(dentryp->parent, dentryp->name);
+}
+
+static bool dentries_name_key_equal(const void *key_arg, const ht_link_t *item)
+{
+	tmpfs_dentry_t *dentryp = hash_table_get_inst(item, tmpfs_dentry_t,
+	    name_link);
+	const dentry_name_key_t *key = key_arg;
+
+	return key->parent == dentryp->parent &&
+	    !str_cmp(key->name, dentryp->name);
+}
+
+/** TMPFS dentries by name hash table operations. */
+static hash_table_ops_t dentries_name_ops = {
+	.hash = dentries_name_hash,
+	.key_hash = dentries_name_key_hash,
+	.key_equal = dentries_name_key_equal,
+	.equal = NULL,
+	.remove_callback = NULL
+};
+
+static size_t dentries_pos_key_hash(const void *k)
+{
+	const dentry_pos_key_t *key = k;
+	return hash_combine((size_t) key->parent, hash_mix64(key->pos));
+}
+
+static size_t dentries_pos_hash(const ht_link_t *item)
+{
+	tmpfs_dentry_t *dentryp = hash_table_get_inst(item, tmpfs_dentry_t,
+	    pos_link);
+	return hash_combine((size_t) dentryp->parent, hash_mix64(dentryp->pos));
+}
+
+static bool dentries_pos_key_equal(const void *key_arg, const ht_link_t *item)
+{
+	tmpfs_dentry_t *dentryp = hash_table_get_inst(item, tmpfs_dentry_t,
+	    pos_link);
+	const dentry_pos_key_t *key = key_arg;
+
+	return key->parent == dentryp->parent && key->pos == dentryp->pos;
+}
+
+/** TMPFS dentries by position hash table operations. */
+static hash_table_ops_t dentries_pos_ops = {
+	.hash = dentries_pos_hash,
+	.key_hash = dentries_pos_key_hash,
+	.key_equal = dentries_pos_key_equal,
+	.equal = NULL,
+	.remove_callback = NULL
+};
+
+/** Unlink a dentry from its directory and free it. */
+static void tmpfs_dentry_remove(tmpfs_dentry_t *dentryp)
+{
+	tmpfs_node_t *parentp = dentryp->parent;
+
+	/* Resume readdir from the preceding dentry. */
+	if (parentp->readdir_hint == dentryp) {
+		link_t *prev = list_prev(&dentryp->link, &parentp->cs_list);
+		parentp->readdir_hint = prev ?
+		    list_get_instance(prev, tmpfs_dentry_t, link) : NULL;
+	}
+
+	hash_table_remove_item(&dentries_by_name, &dentryp->name_link);
+	hash_table_remove_item(&dentries_by_pos, &dentryp->pos_link);
+	list_remove(&dentryp->link);
+	free(dentryp->name);
+	free(dentryp);
+}
+
+/** Find the first dentry of a directory at or after a readdir position. */
+static tmpfs_dentry_t *tmpfs_dentry_at(tmpfs_node_t *parentp, aoff64_t pos)
+{
+	dentry_pos_key_t key = {
+		.parent = parentp,
+		.pos = pos
+	};
+
+	ht_link_t *hlp = hash_table_find(&dentries_by_pos, &key);
+	if (hlp)
+		return hash_table_get_inst(hlp, tmpfs_dentry_t, pos_link);
+
+	/*
+	 * The dentry at pos has been unlinked. Search for the next one,
+	 * starting where the last readdir stopped if that lies before pos.
+	 */
+	tmpfs_dentry_t *hint = parentp->readdir_hint;
+	link_t *lnk = (hint && hint->pos < pos) ?
+	    list_next(&hint->link, &parentp->cs_list) :
+	    list_first(&parentp->cs_list);
+
+	while (lnk) {
+		tmpfs_dentry_t *dentryp = list_get_instance(lnk,
+		    tmpfs_dentry_t, link);
+		if (dentryp->pos >= pos)
+			return dentryp;
+		lnk = list_next(lnk, &parentp->cs_list);
+	}
+
+	return NULL;
+}
+
 static void tmpfs_node_initialize(tmpfs_node_t *nodep)
 {
 	nodep->bp = NULL;
@@ -205,14 +353,19 @@ static void tmpfs_node_initialize(tmpfs_node_t *nodep)
 	nodep->lnkcnt = 0;
 	nodep->size = 0;
 	nodep->data = NULL;
+	nodep->height = 0;
 	list_initialize(&nodep->cs_list);
+	nodep->next_pos = 0;
+	nodep->readdir_hint = NULL;
 }
 
 static void tmpfs_dentry_initialize(tmpfs_dentry_t *dentryp)
 {
 	link_initialize(&dentryp->link);
+	dentryp->parent = NULL;
 	dentryp->name = NULL;
 	dentryp->node = NULL;
+	dentryp->pos = 0;
 }
 
 bool tmpfs_init(void)
@@ -220,6 +373,17 @@ bool tmpfs_init(void)
 	if (!hash_table_create(&nodes, 0, 0, &nodes_ops))
 		return false;
 
+	if (!hash_table_create(&dentries_by_name, 0, 0, &dentries_name_ops)) {
+		hash_table_destroy(&nodes);
+		return false;
+	}
+
+	if (!hash_table_create(&dentries_by_pos, 0, 0, &dentries_pos_ops)) {
+		hash_table_destroy(&dentries_by_name);
+		hash_table_destroy(&nodes);
+		return false;
+	}
+
 	return true;
 }
 
@@ -253,16 +417,20 @@ static void tmpfs_instance_done(service_id_t service_id)
 
 errno_t tmpfs_match(fs_node_t **rfn, fs_node_t *pfn, const char *component)
 {
-	tmpfs_node_t *parentp = TMPFS_NODE(pfn);
+	dentry_name_key_t key = {
+		.parent = TMPFS_NODE(pfn),
+		.name = component
+	};
 
-	list_foreach(parentp->cs_list, link, tmpfs_dentry_t, dentryp) {
-		if (!str_cmp(dentryp->name, component)) {
-			*rfn = FS_NODE(dentryp->node);
-			return EOK;
-		}
+	ht_link_t *hlp = hash_table_find(&dentries_by_name, &key);
+	if (hlp) {
+		tmpfs_dentry_t *dentryp = hash_table_get_inst(hlp,
+		    tmpfs_dentry_t, name_link);
+		*rfn = FS_NODE(dentryp->node);
+	} else {
+		*rfn = NULL;
 	}
 
-	*rfn = NULL;
 	return EOK;
 }
 
@@ -362,10 +530,13 @@ errno_t tmpfs_link_node(fs_node_t *pfn, fs_node_t *cfn, const char *nm)
 	assert(parentp->type == TMPFS_DIRECTORY);
 
 	/* Check for duplicit entries. */
-	list_foreach(parentp->cs_list, link, tmpfs_dentry_t, dp) {
-		if (!str_cmp(dp->name, nm))
-			return EEXIST;
-	}
+	dentry_name_key_t key = {
+		.parent = parentp,
+		.name = nm
+	};
+
+	if (hash_table_find(&dentries_by_name, &key))
+		return EEXIST;
 
 	/* Allocate and initialize the dentry. */
 	dentryp = malloc(sizeof(tmpfs_dentry_t));
@@ -381,9 +552,13 @@ errno_t tmpfs_link_node(fs_node_t *pfn, fs_node_t *cfn, const char *nm)
 		return ENOMEM;
 	}
 	str_cpy(dentryp->name, size + 1, nm);
+	dentryp->parent = parentp;
 	dentryp->node = childp;
+	dentryp->pos = parentp->next_pos++;
 	childp->lnkcnt++;
 	list_append(&dentryp->link, &parentp->cs_list);
+	hash_table_insert(&dentries_by_name, &dentryp->name_link);
+	hash_table_insert(&dentries_by_pos, &dentryp->pos_link);
 
 	return EOK;
 }
@@ -391,29 +566,29 @@ errno_t tmpfs_link_node(fs_node_t *pfn, fs_node_t *cfn, const char *nm)
 errno_t tmpfs_unlink_node(fs_node_t *pfn, fs_node_t *cfn, const char *nm)
 {
 	tmpfs_node_t *parentp = TMPFS_NODE(pfn);
-	tmpfs_node_t *childp = NULL;
+	tmpfs_node_t *childp;
 	tmpfs_dentry_t *dentryp;
 
 	if (!parentp)
 		return EBUSY;
 
-	list_foreach(parentp->cs_list, link, tmpfs_dentry_t, dp) {
-		if (!str_cmp(dp->name, nm)) {
-			dentryp = dp;
-			childp = dentryp->node;
-			assert(FS_NODE(childp) == cfn);
-			break;
-		}
-	}
+	dentry_name_key_t key = {
+		.parent = parentp,
+		.name = nm
+	};
 
-	if (!childp)
+	ht_link_t *hlp = hash_table_find(&dentries_by_name, &key);
+	if (!hlp)
 		return ENOENT;
 
+	dentryp = hash_table_get_inst(hlp, tmpfs_dentry_t, name_link);
+	childp = dentryp->node;
+	assert(FS_NODE(childp) == cfn);
+
 	if ((childp->lnkcnt == 1) && !list_empty(&childp->cs_list))
 		return ENOTEMPTY;
 
-	list_remove(&dentryp->link);
-	free(dentryp);
+	tmpfs_dentry_remove(dentryp);
 	childp->lnkcnt--;
 
 	return EOK;
@@ -462,6 +637,86 @@ static errno_t tmpfs_unmounted(service_id_t service_id)
 	return EOK;
 }
 
+/** Allocate a zero-filled buffer for a transfer spanning several chunks.
+ *
+ * Large buffers get an address space area of their own, so that they are
+ * page-aligned and IPC can loan or move their pages instead of copying.
+ */
+static void *tmpfs_xfer_alloc(size_t size)
+{
+	if (size < DATA_XFER_LOAN_MIN)
+		return calloc(1, size);
+
+	void *buf = as_area_create(AS_AREA_ANY, size,
+	    AS_AREA_READ | AS_AREA_WRITE | AS_AREA_CACHEABLE, AS_AREA_UNPAGED);
+	return buf != AS_MAP_FAILED ? buf : NULL;
+}
+
+/** Free a buffer allocated by tmpfs_xfer_alloc(). */
+static void tmpfs_xfer_free(void *buf, size_t size)
+{
+	if (size < DATA_XFER_LOAN_MIN)
+		free(buf);
+	else
+		as_area_destroy(buf);
+}
+
+/** Answer a read of file contents spanning several chunks.
+ *
+ * The chunks are gathered into a contiguous buffer whose pages are loaned
+ * to the client if it is large enough. Holes are left zero-filled.
+ */
+static errno_t tmpfs_read_gather(ipc_call_t *call, tmpfs_node_t *nodep,
+    aoff64_t pos, size_t size)
+{
+	uint8_t *buf = tmpfs_xfer_alloc(size);
+	if (buf == NULL) {
+		async_answer_0(call, ENOMEM);
+		return ENOMEM;
+	}
+
+	for (size_t done = 0; done < size; ) {
+		size_t offset = (pos + done) % TMPFS_CHUNK_SIZE;
+		size_t n = min(size - done, TMPFS_CHUNK_SIZE - offset);
+
+		const uint8_t *chunk = tmpfs_data_get(nodep, pos + done,
+		    false);
+		if (chunk != NULL)
+			memcpy(buf + done, chunk + offset, n);
+
+		done += n;
+	}
+
+	/* The loaned pages are copied on write, the area can go right away */
+	errno_t rc = async_data_read_finalize_loan(call, buf, size);
+	tmpfs_xfer_free(buf, size);
+	return rc;
+}
+
+/** Store data received in a contiguous buffer into the chunks of a file.
+ *
+ * @return Number of bytes stored, less than @a size if memory ran out.
+ */
+static size_t tmpfs_write_scatter(tmpfs_node_t *nodep, aoff64_t pos,
+    const uint8_t *buf, size_t size)
+{
+	size_t done = 0;
+
+	while (done < size) {
+		size_t offset = (pos + done) % TMPFS_CHUNK_SIZE;
+		size_t n = min(size - done, TMPFS_CHUNK_SIZE - offset);
+
+		uint8_t *chunk = tmpfs_data_get(nodep, pos + done, true);
+		if (chunk == NULL)
+			break;
+
+		memcpy(chunk + offset, buf + done, n);
+		done += n;
+	}
+
+	return done;
+}
+
 static errno_t tmpfs_read(service_id_t service_id, fs_index_t index, aoff64_t pos,
     size_t *rbytes)
 {
@@ -491,32 +746,46 @@ static errno_t tmpfs_read(service_id_t service_id, fs_index_t index, aoff64_t po
 
 	size_t bytes;
 	if (nodep->type == TMPFS_FILE) {
-		bytes = min(nodep->size - pos, size);
-		(void) async_data_read_finalize(&call, nodep->data + pos,
-		    bytes);
+		size_t offset = pos % TMPFS_CHUNK_SIZE;
+		bytes = pos < nodep->size ? nodep->size - pos : 0;
+		bytes = min(bytes, size);
+
+		if (offset + bytes > TMPFS_CHUNK_SIZE) {
+			errno_t rc = tmpfs_read_gather(&call, nodep, pos,
+			    bytes);
+			if (rc != EOK)
+				return rc;
+		} else {
+			/* Data within a single chunk are sent from it */
+			const uint8_t *chunk = tmpfs_data_get(nodep, pos,
+			    false);
+			if (chunk == NULL)
+				chunk = tmpfs_zero_chunk;
+
+			(void) async_data_read_finalize(&call, chunk + offset,
+			    bytes);
+		}
 	} else {
 		tmpfs_dentry_t *dentryp;
-		link_t *lnk;
 
 		assert(nodep->type == TMPFS_DIRECTORY);
 
 		/*
-		 * Yes, we really use O(n) algorithm here.
-		 * If it bothers someone, it could be fixed by introducing a
-		 * hash table.
+		 * The position is a cursor into the directory, advancing it
+		 * by the number of bytes read moves it past the returned
+		 * dentry.
 		 */
-		lnk = list_nth(&nodep->cs_list, pos);
-
-		if (lnk == NULL) {
+		dentryp = tmpfs_dentry_at(nodep, pos);
+		if (dentryp == NULL) {
 			async_answer_0(&call, ENOENT);
 			return ENOENT;
 		}
 
-		dentryp = list_get_instance(lnk, tmpfs_dentry_t, link);
+		nodep->readdir_hint = dentryp;
 
 		(void) async_data_read_finalize(&call, dentryp->name,
 		    str_size(dentryp->name) + 1);
-		bytes = 1;
+		bytes = dentryp->pos - pos + 1;
 	}
 
 	*rbytes = bytes;
@@ -552,34 +821,46 @@ tmpfs_write(service_id_t service_id, fs_index_t index, aoff64_t pos,
 		return EINVAL;
 	}
 
-	/*
-	 * Check whether the file needs to grow.
-	 */
-	if (pos + size <= nodep->size) {
-		/* The file size is not changing. */
-		(void) async_data_write_finalize(&call, nodep->data + pos,
-		    size);
-		goto out;
-	}
-	size_t delta = (pos + size) - nodep->size;
-	/*
-	 * At this point, we are deliberately extremely straightforward and
-	 * simply realloc the contents of the file on every write that grows the
-	 * file. In the end, the situation might not be as bad as it may look:
-	 * our heap allocator can save us and just grow the block whenever
-	 * possible.
-	 */
-	void *newdata = realloc(nodep->data, nodep->size + delta);
-	if (!newdata) {
-		async_answer_0(&call, ENOMEM);
+	size_t offset = pos % TMPFS_CHUNK_SIZE;
+
+	if (pos + size > SIZE_MAX) {
+		async_answer_0(&call, EFBIG);
 		size = 0;
 		goto out;
 	}
-	/* Clear any newly allocated memory in order to emulate gaps. */
-	memset(newdata + nodep->size, 0, delta);
-	nodep->size += delta;
-	nodep->data = newdata;
-	(void) async_data_write_finalize(&call, nodep->data + pos, size);
+
+	if (offset + size > TMPFS_CHUNK_SIZE) {
+		/*
+		 * Receive data spanning several chunks into a contiguous
+		 * buffer and scatter them from there.
+		 */
+		uint8_t *buf = tmpfs_xfer_alloc(size);
+		if (!buf) {
+			async_answer_0(&call, ENOMEM);
+			size = 0;
+			goto out;
+		}
+
+		size_t stored = 0;
+		if (async_data_write_finalize(&call, buf, size) == EOK)
+			stored = tmpfs_write_scatter(nodep, pos, buf, size);
+
+		tmpfs_xfer_free(buf, size);
+		size = stored;
+	} else {
+		/* Data within a single chunk are received right into it */
+		uint8_t *chunk = tmpfs_data_get(nodep, pos, true);
+		if (!chunk) {
+			async_answer_0(&call, ENOMEM);
+			size = 0;
+			goto out;
+		}
+
+		(void) async_data_write_finalize(&call, chunk + offset, size);
+	}
+
+	if (pos + size > nodep->size)
+		nodep->size = pos + size;
 
 out:
 	*wbytes = size;
@@ -609,17 +890,11 @@ static errno_t tmpfs_truncate(service_id_t service_id, fs_index_t index,
 	if (size > SIZE_MAX)
 		return ENOMEM;
 
-	void *newdata = realloc(nodep->data, size);
-	if (!newdata && size)
-		return ENOMEM;
-
-	if (size > nodep->size) {
-		size_t delta = size - nodep->size;
-		memset(newdata + nodep->size, 0, delta);
-	}
+	/* Growing the file just leaves a hole at its end. */
+	if (size < nodep->size)
+		tmpfs_data_truncate(nodep, size);
 
 	nodep->size = size;
-	nodep->data = newdata;
 	return EOK;
 }
 
@@ -228,6 +228,7 @@ extern errno_t vfs_op_write(int fd, aoff64_t, size_t *out_bytes);
 extern void vfs_register(ipc_call_t *);
 
 extern void vfs_page_in(ipc_call_t *);
+extern void vfs_page_cache_invalidate(vfs_node_t *, aoff64_t, aoff64_t);
 
 typedef struct {
 	void *buffer;
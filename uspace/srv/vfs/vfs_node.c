@@ -124,6 +124,12 @@ void vfs_node_delref(vfs_node_t *node)
 	fibril_mutex_unlock(&nodes_mutex);
 
 	if (free_node) {
+		/*
+		 * The node index may be reused for another file once the node
+		 * is destroyed.
+		 */
+		vfs_page_cache_invalidate(node, 0, UINT64_MAX);
+
 		/*
 		 * VFS_OUT_DESTROY will free up the file's resources if there
 		 * are no more hard links.
@@ -150,6 +156,7 @@ void vfs_node_forget(vfs_node_t *node)
 	fibril_mutex_lock(&nodes_mutex);
 	hash_table_remove_item(&nodes, &node->nh_link);
 	fibril_mutex_unlock(&nodes_mutex);
+	vfs_page_cache_invalidate(node, 0, UINT64_MAX);
 	free(node);
 }
 
@@ -483,6 +483,12 @@ static errno_t vfs_rdwr(int fd, aoff64_t pos, bool read, rdwr_ipc_cb_t ipc_cb,
 	if (file->node->type == VFS_NODE_DIRECTORY)
 		fibril_rwlock_read_unlock(&namespace_rwlock);
 
+	/* Make subsequent page faults see the new contents. */
+	if (!read) {
+		vfs_page_cache_invalidate(file->node, pos, rc == EOK ?
+		    pos + ipc_get_arg1(&answer) : UINT64_MAX);
+	}
+
 	/* Unlock the VFS node. */
 	if (rlock) {
 		fibril_rwlock_read_unlock(&file->node->contents_rwlock);
@@ -629,6 +635,8 @@ errno_t vfs_op_resize(int fd, int64_t size)
 	if (rc == EOK)
 		file->node->size = size;
 
+	vfs_page_cache_invalidate(file->node, size, UINT64_MAX);
+
 	fibril_rwlock_write_unlock(&file->node->contents_rwlock);
 	vfs_file_put(file);
 	return rc;
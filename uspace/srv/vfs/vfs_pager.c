@@ -36,35 +36,366 @@
  */
 
 #include "vfs.h"
+#include <adt/hash.h>
+#include <adt/hash_table.h>
+#include <adt/list.h>
 #include <async.h>
 #include <fibril_synch.h>
 #include <errno.h>
 #include <as.h>
+#include <assert.h>
+#include <stdint.h>
+#include <stdlib.h>
 
-void vfs_page_in(ipc_call_t *req)
-{
-	aoff64_t offset = ipc_get_arg1(req);
-	size_t page_size = ipc_get_arg2(req);
-	int fd = ipc_get_arg3(req);
+/** Maximum number of pages kept in the page cache. */
+#define PAGE_CACHE_SIZE  1024
+
+/** All cached pages of one file. */
+typedef struct {
+	/** Link in page_cache_files */
+	ht_link_t link;
+	/** File the pages belong to */
+	vfs_triplet_t triplet;
+	/** Cached pages of the file, pcache_page_t.file_link */
+	list_t pages;
+} pcache_file_t;
+
+/** One page of file data. */
+typedef struct {
+	/** Link in page_cache_pages */
+	ht_link_t link;
+	/** Link in page_cache_lru */
+	link_t lru_link;
+	/** Link in pcache_file_t.pages */
+	link_t file_link;
+	/** File the page belongs to, NULL if the page is not in the cache */
+	pcache_file_t *file;
+	/** Offset of the page in the file */
+	aoff64_t offset;
+	/** Size of the page */
+	size_t size;
+	/** Address space area holding the data */
 	void *page;
+	/** Number of page-in requests using the page */
+	unsigned refs;
+	/** Page is being read from the file system, data are not valid yet */
+	bool loading;
+	/** Result of reading the page */
 	errno_t rc;
+} pcache_page_t;
+
+typedef struct {
+	vfs_triplet_t triplet;
+	aoff64_t offset;
+	size_t size;
+} pcache_key_t;
+
+/** Protects the page cache. */
+static FIBRIL_MUTEX_INITIALIZE(page_cache_lock);
+
+/** Signalled when a page has been read from the file system. */
+static FIBRIL_CONDVAR_INITIALIZE(page_cache_loaded);
+
+/** Cached files by their triplet. */
+static hash_table_t page_cache_files;
+
+/** Cached pages by their triplet and offset. */
+static hash_table_t page_cache_pages;
+
+/** Cached pages, most recently used first. */
+static LIST_INITIALIZE(page_cache_lru);
+
+/** Number of cached pages. */
+static size_t page_cache_count;
+
+static bool page_cache_initialized;
+
+static size_t triplet_hash(const vfs_triplet_t *tri)
+{
+	size_t hash = hash_combine(tri->fs_handle, tri->index);
+	return hash_combine(hash, tri->service_id);
+}
 
-	page = as_area_create(AS_AREA_ANY, page_size,
+static bool triplet_equal(const vfs_triplet_t *a, const vfs_triplet_t *b)
+{
+	return a->fs_handle == b->fs_handle &&
+	    a->service_id == b->service_id && a->index == b->index;
+}
+
+static size_t files_key_hash(const void *key)
+{
+	return triplet_hash(key);
+}
+
+static size_t files_hash(const ht_link_t *item)
+{
+	pcache_file_t *file = hash_table_get_inst(item, pcache_file_t, link);
+	return triplet_hash(&file->triplet);
+}
+
+static bool files_key_equal(const void *key, const ht_link_t *item)
+{
+	pcache_file_t *file = hash_table_get_inst(item, pcache_file_t, link);
+	return triplet_equal(key, &file->triplet);
+}
+
+static hash_table_ops_t files_ops = {
+	.hash = files_hash,
+	.key_hash = files_key_hash,
+	.key_equal = files_key_equal,
+	.equal = NULL,
+	.remove_callback = NULL
+};
+
+static size_t pages_key_hash(const void *key)
+{
+	const pcache_key_t *pkey = key;
+	return hash_combine(triplet_hash(&pkey->triplet),
+	    hash_mix64(pkey->offset));
+}
+
+static size_t pages_hash(const ht_link_t *item)
+{
+	pcache_page_t *page = hash_table_get_inst(item, pcache_page_t, link);
+	return hash_combine(triplet_hash(&page->file->triplet),
+	    hash_mix64(page->offset));
+}
+
+static bool pages_key_equal(const void *key, const ht_link_t *item)
+{
+	const pcache_key_t *pkey = key;
+	pcache_page_t *page = hash_table_get_inst(item, pcache_page_t, link);
+	return page->offset == pkey->offset && page->size == pkey->size &&
+	    triplet_equal(&pkey->triplet, &page->file->triplet);
+}
+
+static hash_table_ops_t pages_ops = {
+	.hash = pages_hash,
+	.key_hash = pages_key_hash,
+	.key_equal = pages_key_equal,
+	.equal = NULL,
+	.remove_callback = NULL
+};
+
+static bool page_cache_init(void)
+{
+	if (page_cache_initialized)
+		return true;
+
+	if (!hash_table_create(&page_cache_files, 0, 0, &files_ops))
+		return false;
+
+	if (!hash_table_create(&page_cache_pages, PAGE_CACHE_SIZE, 0,
+	    &pages_ops)) {
+		hash_table_destroy(&page_cache_files);
+		return false;
+	}
+
+	page_cache_initialized = true;
+	return true;
+}
+
+static void page_destroy(pcache_page_t *page)
+{
+	assert(page->file == NULL);
+	assert(page->refs == 0);
+
+	if (page->page != NULL)
+		as_area_destroy(page->page);
+	free(page);
+}
+
+/** Remove a page from the cache.
+ *
+ * The page is destroyed once its last user puts it. The file structure is
+ * left in place even if this was its last page.
+ */
+static void page_detach(pcache_page_t *page)
+{
+	assert(fibril_mutex_is_locked(&page_cache_lock));
+	assert(page->file != NULL);
+
+	hash_table_remove_item(&page_cache_pages, &page->link);
+	list_remove(&page->lru_link);
+	list_remove(&page->file_link);
+	page->file = NULL;
+	page_cache_count--;
+
+	if (page->refs == 0)
+		page_destroy(page);
+}
+
+static void file_release_if_empty(pcache_file_t *file)
+{
+	assert(fibril_mutex_is_locked(&page_cache_lock));
+
+	if (list_empty(&file->pages)) {
+		hash_table_remove_item(&page_cache_files, &file->link);
+		free(file);
+	}
+}
+
+/** Drop the least recently used page nobody is using. */
+static void page_cache_evict(void)
+{
+	link_t *link = list_last(&page_cache_lru);
+
+	while (link != NULL) {
+		pcache_page_t *page = list_get_instance(link, pcache_page_t,
+		    lru_link);
+		if (page->refs == 0) {
+			pcache_file_t *file = page->file;
+			page_detach(page);
+			file_release_if_empty(file);
+			return;
+		}
+		link = list_prev(link, &page_cache_lru);
+	}
+}
+
+/** Find a page in the cache or insert a new one to be loaded by the caller.
+ *
+ * @param triplet File the page belongs to or NULL if the page must not be
+ *                cached
+ * @param offset  Offset of the page in the file
+ * @param size    Size of the page
+ * @param rpage   Place to store the held page
+ *
+ * @return True if the page has been found, false if the caller must load it.
+ */
+static bool page_get(vfs_triplet_t *triplet, aoff64_t offset, size_t size,
+    pcache_page_t **rpage)
+{
+	pcache_page_t *page;
+
+	fibril_mutex_lock(&page_cache_lock);
+
+	if (triplet != NULL && page_cache_init()) {
+		pcache_key_t key = {
+			.triplet = *triplet,
+			.offset = offset,
+			.size = size
+		};
+
+		ht_link_t *link = hash_table_find(&page_cache_pages, &key);
+		if (link != NULL) {
+			page = hash_table_get_inst(link, pcache_page_t, link);
+			page->refs++;
+			list_remove(&page->lru_link);
+			list_prepend(&page->lru_link, &page_cache_lru);
+
+			while (page->loading) {
+				fibril_condvar_wait(&page_cache_loaded,
+				    &page_cache_lock);
+			}
+
+			fibril_mutex_unlock(&page_cache_lock);
+			*rpage = page;
+			return true;
+		}
+	} else {
+		triplet = NULL;
+	}
+
+	page = calloc(1, sizeof(pcache_page_t));
+	if (page == NULL) {
+		fibril_mutex_unlock(&page_cache_lock);
+		*rpage = NULL;
+		return false;
+	}
+
+	link_initialize(&page->lru_link);
+	link_initialize(&page->file_link);
+	page->offset = offset;
+	page->size = size;
+	page->refs = 1;
+	page->loading = true;
+
+	if (triplet != NULL) {
+		pcache_file_t *file;
+
+		ht_link_t *link = hash_table_find(&page_cache_files, triplet);
+		if (link != NULL) {
+			file = hash_table_get_inst(link, pcache_file_t, link);
+		} else {
+			file = calloc(1, sizeof(pcache_file_t));
+			if (file != NULL) {
+				file->triplet = *triplet;
+				list_initialize(&file->pages);
+				hash_table_insert(&page_cache_files,
+				    &file->link);
+			}
+		}
+
+		if (file != NULL) {
+			if (page_cache_count >= PAGE_CACHE_SIZE)
+				page_cache_evict();
+
+			page->file = file;
+			list_append(&page->file_link, &file->pages);
+			list_prepend(&page->lru_link, &page_cache_lru);
+			hash_table_insert(&page_cache_pages, &page->link);
+			page_cache_count++;
+		}
+	}
+
+	fibril_mutex_unlock(&page_cache_lock);
+	*rpage = page;
+	return false;
+}
+
+/** Publish the result of loading a page. */
+static void page_loaded(pcache_page_t *page, errno_t rc)
+{
+	fibril_mutex_lock(&page_cache_lock);
+
+	page->rc = rc;
+	page->loading = false;
+
+	/* Let the next request retry */
+	if (rc != EOK && page->file != NULL) {
+		pcache_file_t *file = page->file;
+		page_detach(page);
+		file_release_if_empty(file);
+	}
+
+	fibril_condvar_broadcast(&page_cache_loaded);
+	fibril_mutex_unlock(&page_cache_lock);
+}
+
+static void page_put(pcache_page_t *page)
+{
+	fibril_mutex_lock(&page_cache_lock);
+
+	assert(page->refs > 0);
+	page->refs--;
+
+	if (page->refs == 0 && page->file == NULL)
+		page_destroy(page);
+
+	fibril_mutex_unlock(&page_cache_lock);
+}
+
+/** Read a page of a file from the file system. */
+static errno_t page_load(pcache_page_t *page, int fd)
+{
+	page->page = as_area_create(AS_AREA_ANY, page->size,
 	    AS_AREA_READ | AS_AREA_WRITE | AS_AREA_CACHEABLE,
 	    AS_AREA_UNPAGED);
 
-	if (page == AS_MAP_FAILED) {
-		async_answer_0(req, ENOMEM);
-		return;
+	if (page->page == AS_MAP_FAILED) {
+		page->page = NULL;
+		return ENOMEM;
 	}
 
 	rdwr_io_chunk_t chunk = {
-		.buffer = page,
-		.size = page_size
+		.buffer = page->page,
+		.size = page->size
 	};
 
+	errno_t rc;
 	size_t total = 0;
-	aoff64_t pos = offset;
+	aoff64_t pos = page->offset;
 	do {
 		rc = vfs_rdwr_internal(fd, pos, true, &chunk);
 		if (rc != EOK)
@@ -74,18 +405,103 @@ void vfs_page_in(ipc_call_t *req)
 		total += chunk.size;
 		pos += chunk.size;
 		chunk.buffer += chunk.size;
-		chunk.size = page_size - total;
-	} while (total < page_size);
+		chunk.size = page->size - total;
+	} while (total < page->size);
+
+	return rc;
+}
+
+/** Drop cached pages of a file.
+ *
+ * Must be called whenever the contents of the file change other than through
+ * its mappings, so that subsequent page faults see the new data. Pages
+ * already mapped by tasks are not affected.
+ *
+ * @param node  File whose pages are to be dropped
+ * @param start Start of the changed range
+ * @param end   End of the changed range (exclusive)
+ */
+void vfs_page_cache_invalidate(vfs_node_t *node, aoff64_t start,
+    aoff64_t end)
+{
+	vfs_triplet_t triplet = {
+		.fs_handle = node->fs_handle,
+		.service_id = node->service_id,
+		.index = node->index
+	};
 
-	async_answer_1(req, rc, (sysarg_t) page);
+	fibril_mutex_lock(&page_cache_lock);
+
+	if (!page_cache_initialized) {
+		fibril_mutex_unlock(&page_cache_lock);
+		return;
+	}
+
+	ht_link_t *link = hash_table_find(&page_cache_files, &triplet);
+	if (link != NULL) {
+		pcache_file_t *file = hash_table_get_inst(link, pcache_file_t,
+		    link);
+
+		list_foreach_safe(file->pages, cur, next) {
+			pcache_page_t *page = list_get_instance(cur,
+			    pcache_page_t, file_link);
+			if (page->offset < end &&
+			    page->offset + page->size > start)
+				page_detach(page);
+		}
+
+		file_release_if_empty(file);
+	}
+
+	fibril_mutex_unlock(&page_cache_lock);
+}
+
+/** Handle a page fault in an area backed by a file.
+ *
+ * Pages of regular files are kept in a cache shared by all tasks mapping the
+ * same file, so that they are read from the file system only once. The frame
+ * of a cached page is handed out to every faulting task. The kernel maps it
+ * directly only into read-only areas; writable areas get a private copy, so
+ * writes through a mapping never reach the cache or other tasks.
+ */
+void vfs_page_in(ipc_call_t *req)
+{
+	aoff64_t offset = ipc_get_arg1(req);
+	size_t page_size = ipc_get_arg2(req);
+	int fd = ipc_get_arg3(req);
+	pcache_page_t *page;
+	vfs_triplet_t triplet;
+	bool cacheable;
+	errno_t rc;
+
+	vfs_file_t *file = vfs_file_get(fd);
+	if (file == NULL) {
+		async_answer_0(req, EBADF);
+		return;
+	}
+
+	triplet.fs_handle = file->node->fs_handle;
+	triplet.service_id = file->node->service_id;
+	triplet.index = file->node->index;
+	cacheable = file->open_read && file->node->type == VFS_NODE_FILE;
+	vfs_file_put(file);
+
+	if (page_get(cacheable ? &triplet : NULL, offset, page_size, &page)) {
+		rc = page->rc;
+	} else if (page != NULL) {
+		rc = page_load(page, fd);
+		page_loaded(page, rc);
+	} else {
+		async_answer_0(req, ENOMEM);
+		return;
+	}
 
 	/*
-	 * FIXME:
-	 * This is just for now until we implement proper page cache
-	 * management.  Not keeping the pages around in a cache results in
-	 * inherently non-coherent private mappings.
+	 * The kernel takes its own reference to the frame while processing
+	 * the answer, so the page may be dropped from the cache afterwards.
 	 */
-	as_area_destroy(page);
+	async_answer_1(req, rc, (sysarg_t) page->page);
+	page_put(page);
 }
 
 /**